@@ -158,6 +158,12 @@ static __inline void reboot(void)
 
 extern void cpu_halt(void);
 
+/* No way to wake from a write; routine KMSGs still come with an IPI. */
+static inline void cpu_halt_kmsg(void)
+{
+	cpu_halt();
+}
+
 struct preempt_data;
 static inline void cpu_halt_notif_pending(struct preempt_data *vcpd)
 {
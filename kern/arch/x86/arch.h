@@ -43,6 +43,8 @@ void tlbflush(void);
 void tlb_flush_global(void);
 /* idle.c */
 void cpu_halt(void);
+void cpu_halt_kmsg(void);
+extern bool mwait_kmsgs;
 struct preempt_data;
 void cpu_halt_notif_pending(struct preempt_data *vcpd);
 
@@ -159,6 +159,14 @@ void print_cpuinfo(void)
 		panic("Can't write FS Base from userspace, and no FASTCALL support!");
 		#endif
 	}
+	if (ebx & (1 << 9)) {
+		printk("Enhanced REP MOVSB/STOSB supported\n");
+		cpu_set_feat(CPU_FEAT_X86_ERMS);
+	}
+	if (edx & (1 << 4)) {
+		printk("Fast short REP MOVSB supported\n");
+		cpu_set_feat(CPU_FEAT_X86_FSRM);
+	}
 	cpuid(0x80000001, 0x0, &eax, &ebx, &ecx, &edx);
 	if (edx & (1 << 27)) {
 		printk("RDTSCP supported\n");
@@ -3,8 +3,12 @@
 #include <arch/mmu.h>
 #include <cpu_feat.h>
 #include <arch/uaccess.h>
+#include <atomic.h>
+#include <smp.h>
 
 static unsigned int x86_cstate;
+/* Whether idle cores wake for routine KMSGs via mwait (cpu_halt_kmsg()) */
+bool mwait_kmsgs = TRUE;
 
 /* This atomically enables interrupts and halts.  It returns with IRQs off.
  *
@@ -12,8 +16,7 @@ static unsigned int x86_cstate;
 void cpu_halt(void)
 {
 	if (cpu_has_feat(CPU_FEAT_X86_MWAIT)) {
-		/* TODO: since we're monitoring anyway, x86 could use monitor/mwait for
-		 * KMSGs, instead of relying on IPIs.  (Maybe only for ROUTINE). */
+		/* Nothing writes KERNBASE; we only want mwait's cstate. */
 		asm volatile("monitor" : : "a"(KERNBASE), "c"(0), "d"(0));
 		asm volatile("sti; mwait" : : "c"(0x0), "a"(x86_cstate) : "memory");
 	} else {
@@ -22,6 +25,32 @@ void cpu_halt(void)
 	disable_irq();
 }
 
+/* Like cpu_halt(), but with mwait, routine KMSGs wake us without an IPI.  We
+ * watch pcpui->kmsg_poll, and send_kernel_message() clears it instead of
+ * sending an IPI.  Without mwait, or with mwait_kmsgs off, senders see kmsg_poll == 0
+ * and IPI us, like always.  Returns with IRQs off.
+ *
+ * A sender enqueues, then clears kmsg_poll.  If that happens after the monitor,
+ * the write wakes the mwait.  If it happens before, we see kmsg_poll == 0 and
+ * don't wait.  Messages sent before we set kmsg_poll came with an IPI, which
+ * wakes the mwait once we sti. */
+void cpu_halt_kmsg(void)
+{
+	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+
+	if (!mwait_kmsgs || !cpu_has_feat(CPU_FEAT_X86_MWAIT)) {
+		cpu_halt();
+		return;
+	}
+	atomic_set(&pcpui->kmsg_poll, 1);
+	asm volatile("monitor" : : "a"(&pcpui->kmsg_poll), "c"(0), "d"(0));
+	if (atomic_read(&pcpui->kmsg_poll))
+		asm volatile("sti; mwait" : : "c"(0x0), "a"(x86_cstate) : "memory");
+	disable_irq();
+	/* We might have woken for an IRQ.  Senders IPI us until we halt again. */
+	atomic_set(&pcpui->kmsg_poll, 0);
+}
+
 /* Atomically enables interrupts and halts.  It will wake if notif_pending was
  * set (racy), and if we have mwait, it will wake if notif_pending gets set.
  * It returns with IRQs off. */
@@ -10,8 +10,8 @@
  * mappings.
  * - mapping segments doesn't support having a PTE already present
  * - mtrrs break big machines
- * - jumbo pages are only supported at the VM layer, not PM (a jumbo is 2^9
- * little pages, for example)
+ * - the PM only has PML2 jumbos, as 2^9 little pages that happen to be
+ * contiguous (see pm_fill_jumbo()), and only shared file mappings use them
  * - usermemwalk and freeing might need some help (in higher layers of the
  * kernel). */
 
@@ -397,6 +397,17 @@ pte_t pgdir_walk(pgdir_t pgdir, const void *va, int create)
 	return pml_walk(pgdir_get_kpt(pgdir), (uintptr_t)va, flags);
 }
 
+/* Like pgdir_walk, but stops at the PML2, for a user jumbo PTE.  The PTE might
+ * be unmapped, a jumbo, or point to a PML1 of regular PTEs. */
+pte_t pgdir_walk_jumbo(pgdir_t pgdir, const void *va, int create)
+{
+	int flags = PML2_SHIFT;
+
+	if (create == 1)
+		flags |= PG_WALK_CREATE;
+	return pml_walk(pgdir_get_kpt(pgdir), (uintptr_t)va, flags);
+}
+
 static int pml_perm_walk(kpte_t *pml, const void *va, int pml_shift)
 {
 	kpte_t *kpte;
@@ -498,8 +509,11 @@ void x86_cleanup_bootmem(void)
 }
 
 /* Walks len bytes from start, executing 'callback' on every PTE, passing it a
- * specific VA and whatever arg is passed in.  Note, this cannot handle jumbo
- * pages.
+ * specific VA and whatever arg is passed in.
+ *
+ * User jumbo PTEs (PML2) are passed to the callback once, with the VA of the
+ * start of the jumbo.  The VMR code makes sure jumbos never straddle a VMR
+ * boundary (env_unmap_jumbo()), so walks over whole VMRs see whole jumbos.
  *
  * This is just a clumsy wrapper around the more powerful pml_for_each, which
  * can handle jumbo and intermediate pages. */
@@ -516,8 +530,9 @@ int env_user_mem_walk(struct proc *p, void *start, size_t len,
 	{
 		struct tramp_package *tp = (struct tramp_package*)data;
 		assert(tp->cb);
-		/* memwalk CBs don't know how to handle intermediates or jumbos */
-		if (shift != PML1_SHIFT)
+		/* memwalk CBs don't know how to handle intermediates */
+		if ((shift != PML1_SHIFT) &&
+		    !((shift == PML2_SHIFT) && kpte_is_jumbo(kpte) && (kva < ULIM)))
 			return 0;
 		return tp->cb(tp->p, kpte, (void*)kva, tp->cb_arg);
 	}
@@ -530,6 +545,29 @@ int env_user_mem_walk(struct proc *p, void *start, size_t len,
 	                   trampoline_cb, &local_tp);
 }
 
+/* Removes the user jumbo PTE mapping va, if there is one.  Jumbos only map page
+ * cache pages, which stay in the PM, so they just get faulted back in with
+ * regular PTEs.  Call this before splitting a VMR in the middle of a jumbo. */
+void env_unmap_jumbo(struct proc *p, uintptr_t va)
+{
+	kpte_t *kpte;
+	bool unmapped = FALSE;
+
+	assert(va < ULIM);
+	spin_lock(&p->pte_lock);
+	kpte = pml_walk(pgdir_get_kpt(p->env_pgdir), va, PML2_SHIFT);
+	if (kpte && kpte_is_jumbo(kpte)) {
+		if (pte_is_dirty(kpte))
+			pte_mark_pages_dirty(kpte);
+		pte_clear(kpte);
+		unmapped = TRUE;
+	}
+	spin_unlock(&p->pte_lock);
+	if (unmapped)
+		proc_tlbshootdown(p, ROUNDDOWN(va, PML2_PTE_REACH),
+		                  ROUNDUP(va + 1, PML2_PTE_REACH));
+}
+
 /* Frees (decrefs) all pages of the process's page table, including the page
  * directory.  Does not free the memory that is actually mapped. */
 void env_pagetable_free(struct proc *p)
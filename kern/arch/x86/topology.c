@@ -12,6 +12,7 @@
 #include <arch/arch.h>
 #include <arch/apic.h>
 #include <arch/topology.h>
+#include <numa.h>
 
 struct topology_info cpu_topology_info;
 int *os_coreid_lookup;
@@ -330,6 +331,37 @@ static void build_topology(uint32_t core_bits, uint32_t cpu_bits)
 	update_core_list_with_absolute_ids();
 }
 
+/* Returns our numa_id for the SRAT proximity domain dom, or -1 if no core is in
+ * that domain. */
+static int numa_id_of_domain(int dom)
+{
+	for (int i = 0; i < num_cores; i++) {
+		if (find_numa_domain(core_list[i].apic_id) == dom)
+			return core_list[i].numa_id;
+	}
+	return -1;
+}
+
+/* Tells the memory allocator which node each core is in and which memory is in
+ * each node.  Memory in domains without cores stays in node 0. */
+static void init_numa_memory(void)
+{
+	struct Srat *temp;
+	int node;
+
+	for (int i = 0; i < num_cores; i++)
+		numa_set_core_node(i, core_list[i].numa_id);
+	for (int i = 0; i < srat->nchildren; i++) {
+		temp = srat->children[i]->tbl;
+		if (temp == NULL || temp->type != SRmem || temp->mem.nvram)
+			continue;
+		node = numa_id_of_domain(temp->mem.dom);
+		if (node <= 0)
+			continue;
+		numa_add_node_mem(node, temp->mem.addr, temp->mem.len);
+	}
+}
+
 static void build_flat_topology(void)
 {
 	set_num_cores();
@@ -364,10 +396,13 @@ void topology_init(void)
 	/* BIOSes are not strictly required to put NUMA information
 	 * into the ACPI table. If there is no information the safest
 	 * thing to do is assume it's a non-NUMA system, i.e. flat. */
-	if (cpu_bits && get_num_numa())
+	if (cpu_bits && get_num_numa()) {
 		build_topology(core_bits, cpu_bits);
-	else
+		if (num_numa > 1)
+			init_numa_memory();
+	} else {
 		build_flat_topology();
+	}
 }
 
 void print_cpu_topology()
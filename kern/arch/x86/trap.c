@@ -286,8 +286,9 @@ static bool __handler_kernel_page_fault(struct hw_trapframe *hw_tf,
 	 * properly handle bad addrs and whatnot. */
 	pcpui->__lock_checking_enabled--;
 	/* It is a bug for the kernel to access user memory while holding locks that
-	 * are used by handle_page_fault.  At a minimum, this includes p->vmr_lock
-	 * and memory allocation locks.
+	 * are used by handle_page_fault.  At a minimum, this includes p->pte_lock,
+	 * p->vmr_lock (faults wait out changes to the VMRs), and memory allocation
+	 * locks.
 	 *
 	 * In an effort to reduce the number of locks (both now and in the future),
 	 * the kernel will not attempt to handle faults on file-back VMRs.  We
@@ -15,6 +15,7 @@
 #include <pmap.h>
 #include <smp.h>
 #include <tree_file.h>
+#include <reclaim.h>
 
 struct dev gtfs_devtab;
 
@@ -26,7 +27,15 @@ static char *devname(void)
 struct gtfs {
 	struct tree_filesystem		tfs;
 	struct kref					users;
+	TAILQ_ENTRY(gtfs)			link;
 };
+TAILQ_HEAD(gtfs_tailq, gtfs);
+
+/* All gtfs instances, for the shrinkers.  gtfs_release() removes an instance
+ * before tearing it down, so holding the qlock keeps every gtfs on the list
+ * alive. */
+static qlock_t all_gtfs_lock = QLOCK_INITIALIZER(all_gtfs_lock);
+static struct gtfs_tailq all_gtfs = TAILQ_HEAD_INITIALIZER(all_gtfs);
 
 /* Blob hanging off the fs_file->priv.  The backend chans are only accessed,
  * (changed or used) with the corresponding fs_file qlock held.  That's the
@@ -194,6 +203,9 @@ static void gtfs_release(struct kref *kref)
 {
 	struct gtfs *gtfs = container_of(kref, struct gtfs, users);
 
+	qlock(&all_gtfs_lock);
+	TAILQ_REMOVE(&all_gtfs, gtfs, link);
+	qunlock(&all_gtfs_lock);
 	tfs_frontend_purge(&gtfs->tfs, purge_cb);
 	/* this is the ref from attach */
 	assert(kref_refcnt(&gtfs->tfs.root->kref) == 1);
@@ -347,7 +359,41 @@ static size_t __gtfs_fsf_write(struct fs_file *f, void *ubuf, size_t n,
 	if (!gp->be_write)
 		gp->be_write = cclone_and_open(gp->be_walk, O_WRITE);
 	ret = devtab[gp->be_write->type].write(gp->be_write, ubuf, n, off);
-	gp->be_length = MAX(gp->be_length, n + ret);
+	gp->be_length = MAX(gp->be_length, off + ret);
+	return ret;
+}
+
+/* Caller holds the file's qlock.  Reads into a block from the backend.  For
+ * #mnt, the block points at the 9p reply buffers, so the data doesn't get
+ * copied until it lands in our pages. */
+static struct block *__gtfs_fsf_bread(struct fs_file *f, size_t n, off64_t off)
+{
+	struct gtfs_priv *gp = fsf_to_gtfs_priv(f);
+
+	if (!gp->be_read)
+		gp->be_read = cclone_and_open(gp->be_walk, O_READ);
+	return devtab[gp->be_read->type].bread(gp->be_read, n, off);
+}
+
+/* Caller holds the file's qlock.  Writes b to the backend, consuming it.  #mnt
+ * sends b's data as the 9p payload, without copying it. */
+static size_t __gtfs_fsf_bwrite(struct fs_file *f, struct block *b,
+                                off64_t off)
+{
+	ERRSTACK(1);
+	struct gtfs_priv *gp = fsf_to_gtfs_priv(f);
+	size_t ret;
+
+	if (!gp->be_write) {
+		if (waserror()) {
+			freeb(b);
+			nexterror();
+		}
+		gp->be_write = cclone_and_open(gp->be_walk, O_WRITE);
+		poperror();
+	}
+	ret = devtab[gp->be_write->type].bwrite(gp->be_write, b, off);
+	gp->be_length = MAX(gp->be_length, off + ret);
 	return ret;
 }
 
@@ -558,23 +604,26 @@ struct tree_file_ops gtfs_tf_ops = {
 /* Fills page with its contents from its backing store file.
  *
  * Note the page/offset might be beyond the current file length, based on the
- * current pagemap code. */
+ * current pagemap code, e.g. when a write extends the file.  Anything the
+ * backend has beyond our length is stale (we punch holes when we truncate), so
+ * we just zero those pages without asking. */
 static int gtfs_pm_readpage(struct page_map *pm, struct page *pg)
 {
 	ERRSTACK(1);
 	void *kva = page2kva(pg);
 	off64_t offset = pg->pg_index << PGSHIFT;
-	size_t ret;
+	size_t ret = 0;
 
 	if (waserror()) {
 		poperror();
 		return -get_errno();
 	}
-	/* If offset is beyond the length of the file, the 9p device/server should
+	/* If offset is beyond the backend's length, the 9p device/server should
 	 * return 0.  We'll just init an empty page.  The length on the frontend (in
 	 * the fsf->dir.length) will be adjusted.  The backend will hear about it on
 	 * the next sync. */
-	ret = gtfs_fsf_read(pm->pm_file, kva, PGSIZE, offset);
+	if (offset < fs_file_get_length(pm->pm_file))
+		ret = gtfs_fsf_read(pm->pm_file, kva, PGSIZE, offset);
 	poperror();
 	if (ret < PGSIZE)
 		memset(kva + ret, 0, PGSIZE - ret);
@@ -582,6 +631,45 @@ static int gtfs_pm_readpage(struct page_map *pm, struct page *pg)
 	return 0;
 }
 
+/* readpage for an extent, with one big backend block read.  The data goes
+ * straight from the block into our pages. */
+static int gtfs_pm_readpages(struct page_map *pm, struct page **pages,
+                             unsigned int nr)
+{
+	ERRSTACK(1);
+	struct fs_file *f = pm->pm_file;
+	off64_t offset = pages[0]->pg_index << PGSHIFT;
+	size_t len = fs_file_get_length(f);
+	size_t amt = 0, ret = 0, pg_amt;
+	struct block *b = NULL;
+
+	if (offset < len)
+		amt = MIN(nr << PGSHIFT, ROUNDUP(len - offset, PGSIZE));
+	if (amt) {
+		qlock(&f->qlock);
+		if (waserror()) {
+			qunlock(&f->qlock);
+			poperror();
+			return -get_errno();
+		}
+		b = __gtfs_fsf_bread(f, amt, offset);
+		qunlock(&f->qlock);
+		poperror();
+		ret = MIN(BLEN(b), amt);
+	}
+	for (int i = 0; i < nr; i++) {
+		pg_amt = 0;
+		if (ret > i << PGSHIFT) {
+			pg_amt = MIN(PGSIZE, ret - (i << PGSHIFT));
+			b = bl2mem(page2kva(pages[i]), b, pg_amt);
+		}
+		memset(page2kva(pages[i]) + pg_amt, 0, PGSIZE - pg_amt);
+		atomic_or(&pages[i]->pg_flags, PG_UPTODATE);
+	}
+	freeblist(b);
+	return 0;
+}
+
 /* Meant to take the page from PM and flush to backing store. */
 static int gtfs_pm_writepage(struct page_map *pm, struct page *pg)
 {
@@ -610,6 +698,41 @@ static int gtfs_pm_writepage(struct page_map *pm, struct page *pg)
 	return 0;
 }
 
+/* writepage for an extent, with one big backend block write.  Copying the
+ * pages into the block is the only copy. */
+static int gtfs_pm_writepages(struct page_map *pm, struct page **pages,
+                              unsigned int nr)
+{
+	ERRSTACK(1);
+	struct fs_file *f = pm->pm_file;
+	off64_t offset = pages[0]->pg_index << PGSHIFT;
+	size_t amt, pg_amt;
+	struct block *b;
+
+	qlock(&f->qlock);
+	/* Same as writepage: don't write beyond the length of the file. */
+	if (offset >= fs_file_get_length(f)) {
+		qunlock(&f->qlock);
+		return 0;
+	}
+	amt = MIN(nr << PGSHIFT, fs_file_get_length(f) - offset);
+	b = block_alloc(amt, MEM_WAIT);
+	for (int i = 0; (i < nr) && (i << PGSHIFT < amt); i++) {
+		pg_amt = MIN(PGSIZE, amt - (i << PGSHIFT));
+		memcpy(b->wp, page2kva(pages[i]), pg_amt);
+		b->wp += pg_amt;
+	}
+	if (waserror()) {
+		qunlock(&f->qlock);
+		poperror();
+		return -get_errno();
+	}
+	__gtfs_fsf_bwrite(f, b, offset);
+	qunlock(&f->qlock);
+	poperror();
+	return 0;
+}
+
 /* Caller holds the file's qlock */
 static void __trunc_to(struct fs_file *f, off64_t begin)
 {
@@ -693,6 +816,8 @@ static bool gtfs_fs_can_grow_to(struct fs_file *f, size_t len)
 struct fs_file_ops gtfs_fs_ops = {
 	.readpage = gtfs_pm_readpage,
 	.writepage = gtfs_pm_writepage,
+	.readpages = gtfs_pm_readpages,
+	.writepages = gtfs_pm_writepages,
 	.punch_hole = gtfs_fs_punch_hole,
 	.can_grow_to = gtfs_fs_can_grow_to,
 };
@@ -765,6 +890,9 @@ static struct chan *gtfs_attach(char *arg)
 	tf_kref_get(tfs->root);
 	chan_set_tree_file(frontend, tfs->root);
 	poperror();
+	qlock(&all_gtfs_lock);
+	TAILQ_INSERT_TAIL(&all_gtfs, gtfs, link);
+	qunlock(&all_gtfs_lock);
 	return frontend;
 }
 
@@ -807,6 +935,68 @@ static void gtfs_free_memory(struct gtfs *gtfs)
 	tfs_frontend_for_each(&gtfs->tfs, pressure_dfs_cb);
 }
 
+/* Pages freed by shrink_pm_cb.  Protected by all_gtfs_lock. */
+static size_t gtfs_shrink_nr_pages;
+
+static void shrink_pm_cb(struct tree_file *tf)
+{
+	if (!tree_file_is_dir(tf))
+		gtfs_shrink_nr_pages += pm_free_unused_pages(tf->file.pm);
+}
+
+/* Shrinker: drops clean, unused pages from every file's page cache, writing
+ * back dirty ones first. */
+static size_t gtfs_shrink_pagecache(struct shrinker *s, size_t nr_wanted)
+{
+	struct gtfs *gtfs_i;
+	size_t nr_freed;
+
+	qlock(&all_gtfs_lock);
+	gtfs_shrink_nr_pages = 0;
+	TAILQ_FOREACH(gtfs_i, &all_gtfs, link) {
+		tfs_frontend_for_each(&gtfs_i->tfs, shrink_pm_cb);
+		if (gtfs_shrink_nr_pages >= nr_wanted)
+			break;
+	}
+	nr_freed = gtfs_shrink_nr_pages;
+	qunlock(&all_gtfs_lock);
+	return nr_freed;
+}
+
+/* Shrinker: frees TFs on the LRU lists, which takes their page caches with
+ * them, and the negative entries.  Returns the number of TFs freed. */
+static size_t gtfs_shrink_tf_lru(struct shrinker *s, size_t nr_wanted)
+{
+	struct gtfs *gtfs_i;
+	size_t nr_freed = 0;
+
+	qlock(&all_gtfs_lock);
+	TAILQ_FOREACH(gtfs_i, &all_gtfs, link) {
+		nr_freed += tfs_lru_for_each(&gtfs_i->tfs, lru_prune_cb, nr_wanted);
+		nr_freed += tfs_lru_prune_neg(&gtfs_i->tfs);
+	}
+	qunlock(&all_gtfs_lock);
+	return nr_freed;
+}
+
+/* Order matters: the reclaim ktask calls these in order until it has enough.
+ * Files no one is using go first. */
+static struct shrinker gtfs_tf_lru_shrinker = {
+	.name = "gtfs_tf_lru",
+	.shrink = gtfs_shrink_tf_lru,
+};
+
+static struct shrinker gtfs_pagecache_shrinker = {
+	.name = "gtfs_pagecache",
+	.shrink = gtfs_shrink_pagecache,
+};
+
+static void gtfs_init(void)
+{
+	register_shrinker(&gtfs_tf_lru_shrinker);
+	register_shrinker(&gtfs_pagecache_shrinker);
+}
+
 static void gtfs_sync_tf(struct tree_file *tf)
 {
 	writeback_file(&tf->file);
@@ -847,7 +1037,7 @@ struct dev gtfs_devtab __devtab = {
 	.name = "gtfs",
 
 	.reset = devreset,
-	.init = devinit,
+	.init = gtfs_init,
 	.shutdown = devshutdown,
 	.attach = gtfs_attach,
 	.walk = gtfs_walk,
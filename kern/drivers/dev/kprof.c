@@ -40,18 +40,30 @@ enum {
 	Kprintxqid,
 	Kmpstatqid,
 	Kmpstatrawqid,
+	Kpsessqid,
+	/* Session dirs and their files, see KPQID() */
+	Ksessdirqid,
+	Ksessdataqid,
+	Ksessdroppedqid,
+	Ksesscpuqid,
 };
 
+/* Session qids have the type in the low byte, then the session's slot, then the
+ * cpu.  qid.vers is the session's ID, so that a stale chan doesn't get a newer
+ * session in the same slot. */
+#define KPTYPE(q)				((q).path & 0xff)
+#define KPSLOT(q)				(((q).path >> 8) & 0xff)
+#define KPCPU(q)				((q).path >> 16)
+#define KPQID(type, slot, cpu)	\
+	((type) | ((slot) << 8) | ((uint64_t)(cpu) << 16))
+
 struct trace_printk_buffer {
 	atomic_t in_use;
 	char buffer[TRACE_PRINTK_BUFFER_SIZE];
 };
 
 struct kprof {
-	qlock_t lock;
 	bool mpstat_ipi;
-	bool profiling;
-	bool opened;
 };
 
 struct dev kprofdevtab;
@@ -64,6 +76,7 @@ struct dirtab kproftab[] = {
 	{"kprintx",		{Kprintxqid},		0,	0600},
 	{"mpstat",		{Kmpstatqid},		0,	0600},
 	{"mpstat-raw",	{Kmpstatrawqid},	0,	0600},
+	{"kpsess",		{Kpsessqid,			0, QTDIR}, 0,	DMDIR|0550},
 };
 
 static struct kprof kprof;
@@ -98,74 +111,8 @@ static struct chan *kprof_attach(char *spec)
 	return devattach(devname(), spec);
 }
 
-/* Start collecting samples from perf events into the profiler.
- *
- * This command only runs if the user successfully opened kpctl, which gives
- * them a profiler (the global profiler, for now). */
-static void kprof_start_profiler(void)
-{
-	ERRSTACK(1);
-
-	qlock(&kprof.lock);
-	if (waserror()) {
-		qunlock(&kprof.lock);
-		nexterror();
-	}
-	if (!kprof.profiling) {
-		profiler_start();
-		kprof.profiling = TRUE;
-	}
-	poperror();
-	qunlock(&kprof.lock);
-}
-
-/* Stops collecting samples from perf events.
- *
- * This command only runs if the user successfully opened kpctl, which gives
- * them a profiler (the global profiler, for now). */
-static void kprof_stop_profiler(void)
-{
-	ERRSTACK(1);
-
-	qlock(&kprof.lock);
-	if (waserror()) {
-		qunlock(&kprof.lock);
-		nexterror();
-	}
-	if (kprof.profiling) {
-		profiler_stop();
-		kprof.profiling = FALSE;
-	}
-	poperror();
-	qunlock(&kprof.lock);
-}
-
-/* Makes each core flush its results into the profiler queue.  You can do this
- * while the profiler is still running.  However, this does not hang up the
- * queue, so reads on kpdata will block. */
-static void kprof_flush_profiler(void)
-{
-	ERRSTACK(1);
-
-	qlock(&kprof.lock);
-	if (waserror()) {
-		qunlock(&kprof.lock);
-		nexterror();
-	}
-	if (kprof.profiling)
-		profiler_trace_data_flush();
-	poperror();
-	qunlock(&kprof.lock);
-}
-
 static void kprof_init(void)
 {
-	profiler_init();
-
-	qlock_init(&kprof.lock);
-	kprof.profiling = FALSE;
-	kprof.opened = FALSE;
-
 	for (int i = 0; i < ARRAY_SIZE(kproftab); i++)
 		kproftab[i].length = 0;
 
@@ -183,28 +130,144 @@ static void kprof_shutdown(void)
 {
 }
 
-static struct walkqid *kprof_walk(struct chan *c, struct chan *nc, char **name,
-                                  unsigned int nname)
+/* Makes the dir entry for one of a session's files. */
+static void kprof_sessdir(struct chan *c, struct profiler *prof, int type,
+                          int cpu, struct dir *dp)
 {
-	return devwalk(c, nc, name, nname, kproftab, ARRAY_SIZE(kproftab), devgen);
+	struct qid q;
+	size_t len;
+	char *name = get_cur_genbuf();
+
+	switch (type) {
+	case Ksessdataqid:
+		strlcpy(name, "data", GENBUF_SZ);
+		len = profiler_size(prof);
+		break;
+	case Ksessdroppedqid:
+		strlcpy(name, "dropped", GENBUF_SZ);
+		len = 0;
+		break;
+	default:
+		snprintf(name, GENBUF_SZ, "cpu%d", cpu);
+		len = profiler_cpu_size(prof, cpu);
+		break;
+	}
+	mkqid(&q, KPQID(type, KPSLOT(c->qid), cpu), profiler_id(prof), QTFILE);
+	devdir(c, q, name, len, eve.name, 0400, dp);
 }
 
-static size_t kprof_profdata_size(void)
+/* Gets the session c refers to, or 0 if it is gone. */
+static struct profiler *kprof_qid_session(struct chan *c)
 {
-	return profiler_size();
+	struct profiler *prof = profiler_get_slot(KPSLOT(c->qid));
+
+	if (prof && profiler_id(prof) != c->qid.vers) {
+		profiler_put(prof);
+		prof = NULL;
+	}
+	return prof;
 }
 
-static long kprof_profdata_read(void *dest, long size, int64_t off)
+/* The top level is kproftab.  kpsess has a dir for each session, named by its
+ * ID, with:
+ * - data: the session's records, like kpdata
+ * - dropped: how many traces each core dropped because its ring was full
+ * - cpuN: core N's trace records */
+static int kprof_gen(struct chan *c, char *entry_name, struct dirtab *tab,
+                     int ntab, int s, struct dir *dp)
 {
-	return profiler_read(dest, size);
+	struct profiler *prof;
+	struct qid q;
+	int type = KPTYPE(c->qid);
+
+	switch (type) {
+	case Kpsessqid:
+		if (s == DEVDOTDOT)
+			return devgen(c, entry_name, tab, ntab, s, dp);
+		if (s >= PROFILER_MAX_SESSIONS)
+			return -1;
+		prof = profiler_get_slot(s);
+		if (!prof)
+			return 0;
+		snprintf(get_cur_genbuf(), GENBUF_SZ, "%d", profiler_id(prof));
+		mkqid(&q, KPQID(Ksessdirqid, s, 0), profiler_id(prof), QTDIR);
+		devdir(c, q, get_cur_genbuf(), 0, eve.name, DMDIR | 0550, dp);
+		profiler_put(prof);
+		return 1;
+	case Ksessdirqid:
+		if (s == DEVDOTDOT) {
+			mkqid(&q, Kpsessqid, 0, QTDIR);
+			devdir(c, q, "kpsess", 0, eve.name, DMDIR | 0550, dp);
+			return 1;
+		}
+		if (s >= 2 + num_cores)
+			return -1;
+		prof = kprof_qid_session(c);
+		if (!prof)
+			return -1;
+		if (s == 0)
+			kprof_sessdir(c, prof, Ksessdataqid, 0, dp);
+		else if (s == 1)
+			kprof_sessdir(c, prof, Ksessdroppedqid, 0, dp);
+		else
+			kprof_sessdir(c, prof, Ksesscpuqid, s - 2, dp);
+		profiler_put(prof);
+		return 1;
+	case Ksessdataqid:
+	case Ksessdroppedqid:
+	case Ksesscpuqid:
+		/* Direct gen of the file itself, for devstat() */
+		prof = kprof_qid_session(c);
+		if (!prof)
+			return -1;
+		kprof_sessdir(c, prof, type, KPCPU(c->qid), dp);
+		profiler_put(prof);
+		return 1;
+	default:
+		return devgen(c, entry_name, tab, ntab, s, dp);
+	}
+}
+
+static struct walkqid *kprof_walk(struct chan *c, struct chan *nc, char **name,
+                                  unsigned int nname)
+{
+	return devwalk(c, nc, name, nname, kproftab, ARRAY_SIZE(kproftab),
+	               kprof_gen);
 }
 
 static size_t kprof_stat(struct chan *c, uint8_t *db, size_t n)
 {
-	kproftab[Kprofdataqid].length = kprof_profdata_size();
+	kproftab[Kprofdataqid].length = 0;
+	if (KPTYPE(c->qid) == Kprofdataqid && (c->flag & COPEN))
+		kproftab[Kprofdataqid].length = profiler_size(c->aux);
 	kproftab[Kptraceqid].length = kprof_tracedata_size();
 
-	return devstat(c, db, n, kproftab, ARRAY_SIZE(kproftab), devgen);
+	return devstat(c, db, n, kproftab, ARRAY_SIZE(kproftab), kprof_gen);
+}
+
+/* kpdata is for tools that use one session: it gets the newest session that
+ * current opened. */
+static struct profiler *kprof_own_session(void)
+{
+	struct profiler *prof, *newest = NULL;
+
+	for (int i = 0; i < PROFILER_MAX_SESSIONS; i++) {
+		prof = profiler_get_slot(i);
+		if (!prof)
+			continue;
+		if (profiler_owner(prof) != current->pid ||
+		    (newest && profiler_id(newest) > profiler_id(prof))) {
+			profiler_put(prof);
+			continue;
+		}
+		if (newest)
+			profiler_put(newest);
+		newest = prof;
+	}
+	if (!newest)
+		error(ENOENT, "No profiler for pid %d, open kpctl first",
+		      current->pid);
+	return newest;
 }
 
 static struct chan *kprof_open(struct chan *c, int omode)
@@ -213,20 +276,23 @@ static struct chan *kprof_open(struct chan *c, int omode)
 		if (openmode(omode) != O_READ)
 			error(EPERM, ERROR_FIXME);
 	}
-	switch ((int) c->qid.path) {
+	switch (KPTYPE(c->qid)) {
 	case Kprofctlqid:
-		/* We have one global profiler.  Only one FD may be opened at a time for
-		 * it.  If we ever have separate profilers, we can create the profiler
-		 * here, and every open would get a separate instance. */
-		qlock(&kprof.lock);
-		if (kprof.opened) {
-			qunlock(&kprof.lock);
-			error(EBUSY, "Global profiler is already open");
-		}
-		kprof.opened = TRUE;
-		/* TODO: have a real creation function for a non-global profiler */
-		profiler_setup();
-		qunlock(&kprof.lock);
+		/* Every open of kpctl creates a profiler session, which lasts until
+		 * the chan (and any of the session's files) is closed. */
+		c->aux = profiler_create();
+		break;
+	case Kprofdataqid:
+		c->aux = kprof_own_session();
+		break;
+	case Ksessdataqid:
+	case Ksessdroppedqid:
+	case Ksesscpuqid:
+		if (openmode(omode) != O_READ)
+			error(EPERM, ERROR_FIXME);
+		c->aux = kprof_qid_session(c);
+		if (!c->aux)
+			error(ENOENT, "Profiler session %d is gone", c->qid.vers);
 		break;
 	}
 	c->mode = openmode(omode);
@@ -238,18 +304,35 @@ static struct chan *kprof_open(struct chan *c, int omode)
 static void kprof_close(struct chan *c)
 {
 	if (c->flag & COPEN) {
-		switch ((int) c->qid.path) {
+		switch (KPTYPE(c->qid)) {
 		case Kprofctlqid:
-			kprof_stop_profiler();
-			qlock(&kprof.lock);
-			profiler_cleanup();
-			kprof.opened = FALSE;
-			qunlock(&kprof.lock);
+			profiler_stop(c->aux);
+			/* Fall through */
+		case Kprofdataqid:
+		case Ksessdataqid:
+		case Ksessdroppedqid:
+		case Ksesscpuqid:
+			profiler_put(c->aux);
 			break;
 		}
 	}
 }
 
+static long kprof_dropped_read(struct profiler *prof, void *va, long n,
+                               int64_t off)
+{
+	size_t bufsz = num_cores * 32 + 1;
+	char *buf = kmalloc(bufsz, MEM_WAIT);
+	int len = 0;
+
+	for (int i = 0; i < num_cores; i++)
+		len += snprintf(buf + len, bufsz - len, "%5d: %llu\n", i,
+		                profiler_cpu_dropped(prof, i));
+	n = readstr(off, va, n, buf);
+	kfree(buf);
+	return n;
+}
+
 static long mpstat_read(void *va, long n, int64_t off)
 {
 	size_t bufsz = mpstat_len();
@@ -326,11 +409,25 @@ static size_t kprof_read(struct chan *c, void *va, size_t n, off64_t off)
 	uintptr_t offset = off;
 	uint64_t pc;
 
-	switch ((int) c->qid.path) {
-	case Kprofdirqid:
-		return devdirread(c, va, n, kproftab, ARRAY_SIZE(kproftab), devgen);
+	char id_str[16];
+
+	if (c->qid.type & QTDIR)
+		return devdirread(c, va, n, kproftab, ARRAY_SIZE(kproftab),
+		                  kprof_gen);
+	switch (KPTYPE(c->qid)) {
+	case Kprofctlqid:
+		snprintf(id_str, sizeof(id_str), "%d\n", profiler_id(c->aux));
+		n = readstr(offset, va, n, id_str);
+		break;
 	case Kprofdataqid:
-		n = kprof_profdata_read(va, n, off);
+	case Ksessdataqid:
+		n = profiler_read(c->aux, va, n);
+		break;
+	case Ksessdroppedqid:
+		n = kprof_dropped_read(c->aux, va, n, offset);
+		break;
+	case Ksesscpuqid:
+		n = profiler_read_cpu(c->aux, KPCPU(c->qid), va, n);
 		break;
 	case Kptraceqid:
 		n = kprof_tracedata_read(va, n, off);
@@ -360,18 +457,19 @@ static size_t kprof_write(struct chan *c, void *a, size_t n, off64_t unused)
 		kfree(cb);
 		nexterror();
 	}
-	switch ((int) c->qid.path) {
+	switch (KPTYPE(c->qid)) {
 	case Kprofctlqid:
 		if (cb->nf < 1)
 			error(EFAIL, kprof_control_usage);
-		if (profiler_configure(cb))
+		if (profiler_configure(c->aux, cb))
 			break;
 		if (!strcmp(cb->f[0], "start")) {
-			kprof_start_profiler();
+			profiler_start(c->aux);
 		} else if (!strcmp(cb->f[0], "flush")) {
-			kprof_flush_profiler();
+			/* Traces are readable as soon as they are written.  This is for
+			 * old tools. */
 		} else if (!strcmp(cb->f[0], "stop")) {
-			kprof_stop_profiler();
+			profiler_stop(c->aux);
 		} else {
 			error(EFAIL, kprof_control_usage);
 		}
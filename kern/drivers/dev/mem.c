@@ -13,6 +13,7 @@
 #include <error.h>
 #include <syscall.h>
 #include <sys/queue.h>
+#include <numa.h>
 
 struct dev mem_devtab;
 
@@ -27,6 +28,8 @@ enum {
 	Qslab_stats,
 	Qfree,
 	Qkmemstat,
+	Qnuma,
+	Qmag_stats,
 };
 
 static struct dirtab mem_dir[] = {
@@ -35,6 +38,8 @@ static struct dirtab mem_dir[] = {
 	{"slab_stats", {Qslab_stats, 0, QTFILE}, 0, 0444},
 	{"free", {Qfree, 0, QTFILE}, 0, 0444},
 	{"kmemstat", {Qkmemstat, 0, QTFILE}, 0, 0444},
+	{"numa", {Qnuma, 0, QTFILE}, 0, 0444},
+	{"mag_stats", {Qmag_stats, 0, QTFILE}, 0, 0444},
 };
 
 static struct chan *mem_attach(char *spec)
@@ -262,6 +267,84 @@ static struct sized_alloc *build_free(void)
 	return sza;
 }
 
+/* Per-node memory.  Fallbacks are allocations that wanted the node, but got
+ * memory from another node. */
+static struct sized_alloc *build_numa(void)
+{
+	struct sized_alloc *sza;
+	size_t sofar = 0;
+	size_t amt_total, amt_free;
+
+	sza = sized_kzmalloc(100 + nr_numa_nodes * 150, MEM_WAIT);
+	sofar += snprintf(sza->buf + sofar, sza->size - sofar,
+	                  "%4s %5s %18s %18s %12s\n", "Node", "Cores",
+	                  "Total Memory", "Free Memory", "Fallbacks");
+	for (int i = 0; i < nr_numa_nodes; i++) {
+		amt_total = numa_amt_total(i);
+		amt_free = numa_amt_free(i);
+		sofar += snprintf(sza->buf + sofar, sza->size - sofar,
+		                  "%4d %5d %18llu %18llu %12llu\n", i,
+		                  numa_nr_cores(i), amt_total, amt_free,
+		                  numa_nr_fallbacks(i));
+	}
+	return sza;
+}
+
+/* One line per cache about its magazine layer.  Hit% is the percentage of
+ * allocations that didn't need the depot lock.  WSS is the number of full mags
+ * the depot needed since the last trim. */
+static size_t fetch_mag_line(struct kmem_cache *kc, struct sized_alloc *sza,
+                             size_t sofar)
+{
+	struct kmem_depot *depot = &kc->depot;
+	struct kmem_pcpu_cache *pcc;
+	uint64_t nr_allocs = kc->nr_direct_allocs_ever;
+	uint64_t nr_misses = kc->nr_direct_allocs_ever;
+	unsigned int hit_pct = 100;
+
+	for (int i = 0; i < kmc_nr_pcpu_caches(); i++) {
+		pcc = &kc->pcpu_caches[i];
+		nr_allocs += pcc->nr_allocs_ever;
+	}
+	spin_lock_irqsave(&depot->lock);
+	nr_misses += depot->nr_alloc_trips;
+	if (nr_allocs)
+		hit_pct = 100 - MIN(100, nr_misses * 100 / nr_allocs);
+	sofar += snprintf(sza->buf + sofar, sza->size - sofar,
+	                  "%-30s %7u %5u %5u %5u %12llu %4u%% %10llu %10llu "
+	                  "%10llu %6llu %6llu\n",
+	                  kc->name, depot->magsize, depot->nr_not_empty,
+	                  depot->nr_empty,
+	                  depot->nr_not_empty - depot->min_not_empty, nr_allocs,
+	                  hit_pct, depot->nr_alloc_trips, depot->nr_free_trips,
+	                  depot->nr_contended, depot->nr_grows, depot->nr_shrinks);
+	spin_unlock_irqsave(&depot->lock);
+	return sofar;
+}
+
+static struct sized_alloc *build_mag_stats(void)
+{
+	struct sized_alloc *sza;
+	size_t sofar = 0;
+	size_t alloc_amt = 200;
+	struct kmem_cache *kc_i;
+
+	qlock(&arenas_and_slabs_lock);
+	TAILQ_FOREACH(kc_i, &all_kmem_caches, all_kmc_link)
+		alloc_amt += 150;
+	sza = sized_kzmalloc(alloc_amt, MEM_WAIT);
+	sofar += snprintf(sza->buf + sofar, sza->size - sofar,
+	                  "%-30s %7s %5s %5s %5s %12s %5s %10s %10s %10s %6s "
+	                  "%6s\n",
+	                  "Cache", "Magsize", "Full", "Empty", "WSS", "Allocs",
+	                  "Hit", "DepotAlloc", "DepotFree", "Contended", "Grows",
+	                  "Shrink");
+	TAILQ_FOREACH(kc_i, &all_kmem_caches, all_kmc_link)
+		sofar = fetch_mag_line(kc_i, sza, sofar);
+	qunlock(&arenas_and_slabs_lock);
+	return sza;
+}
+
 #define KMEMSTAT_NAME			30
 #define KMEMSTAT_OBJSIZE		8
 #define KMEMSTAT_TOTAL			15
@@ -390,6 +473,12 @@ static struct chan *mem_open(struct chan *c, int omode)
 	case Qkmemstat:
 		c->synth_buf = build_kmemstat();
 		break;
+	case Qnuma:
+		c->synth_buf = build_numa();
+		break;
+	case Qmag_stats:
+		c->synth_buf = build_mag_stats();
+		break;
 	}
 	c->mode = openmode(omode);
 	c->flag |= COPEN;
@@ -406,6 +495,8 @@ static void mem_close(struct chan *c)
 	case Qslab_stats:
 	case Qfree:
 	case Qkmemstat:
+	case Qnuma:
+	case Qmag_stats:
 		kfree(c->synth_buf);
 		break;
 	}
@@ -423,6 +514,8 @@ static size_t mem_read(struct chan *c, void *ubuf, size_t n, off64_t offset)
 	case Qslab_stats:
 	case Qfree:
 	case Qkmemstat:
+	case Qnuma:
+	case Qmag_stats:
 		sza = c->synth_buf;
 		return readmem(offset, ubuf, n, sza->buf, sza->size);
 	default:
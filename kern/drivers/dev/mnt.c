@@ -57,8 +57,14 @@ static char *devname(void)
  * connection.
  */
 
-#define MAXRPC (IOHDRSZ+8192)
+#define MAXRPC (IOHDRSZ + CONFIG_MNT_IOUNIT)
 #define MAXTAG MAX_U16_POOL_SZ
+#define MNT_MAX_INFLIGHT MAX(CONFIG_MNT_MAX_INFLIGHT, 1)
+
+/* Phases of mountio().  Pipelined I/O sends a batch of RPCs, then waits for
+ * each of them. */
+#define MNTIO_SEND		(1 << 0)
+#define MNTIO_WAIT		(1 << 1)
 
 static __inline int isxdigit(int c)
 {
@@ -81,6 +87,7 @@ struct mntrpc {
 	uint8_t *rpc;				/* I/O Data buffer */
 	unsigned int rpclen;		/* len of buffer */
 	struct block *b;			/* reply blocks */
+	struct block *wb;			/* Twrite payload, instead of request.data */
 	char done;					/* Rpc completed */
 	uint64_t stime;				/* start time for mnt statistics */
 	uint32_t reqlen;			/* request length for mnt statistics */
@@ -117,8 +124,11 @@ struct mntrpc *mntralloc(struct chan *, uint32_t);
 size_t mntrdwr(int unused_int, struct chan *, void *, size_t, off64_t);
 int mntrpcread(struct mnt *, struct mntrpc *);
 void mountio(struct mnt *, struct mntrpc *);
+static void __mountio(struct mnt *, struct mntrpc *, int);
 void mountmux(struct mnt *, struct mntrpc *);
 void mountrpc(struct mnt *, struct mntrpc *);
+static void mntrpc_check(struct mnt *, struct mntrpc *);
+static int mntsendwrite(struct mnt *, struct mntrpc *);
 int rpcattn(void *);
 struct chan *mntchan(void);
 
@@ -260,7 +270,7 @@ long mntversion(struct chan *c, char *version, int msize, int returnlen)
 	m->version = NULL;
 	kstrdup(&m->version, f.version);
 	m->id = mntalloc.id++;
-	m->q = qopen(10 * MAXRPC, 0, NULL, NULL);
+	m->q = qopen(10 * f.msize, 0, NULL, NULL);
 	m->msize = f.msize;
 	spin_unlock(&mntalloc.l);
 
@@ -720,6 +730,173 @@ static size_t mntwrite(struct chan *c, void *buf, size_t n, off64_t off)
 	return mntrdwr(Twrite, c, buf, n, off);
 }
 
+/* Only plain files get pipelined.  Directory reads must start where the last
+ * one ended, and appends could be applied out of order by a multithreaded
+ * server.  Synthetic files (streams, ctl files) often look like plain files,
+ * which is why we also wait for a full first reply before pipelining. */
+static bool mnt_can_pipeline(struct chan *c)
+{
+	return (MNT_MAX_INFLIGHT > 1) &&
+	       !(c->qid.type & (QTDIR | QTAPPEND | QTEXCL | QTAUTH));
+}
+
+/* Sends a Tflush for a sent RPC we don't want anymore.  Returns the flush, to
+ * wait on with mntrpc_flush_wait(), or NULL if there's nothing to wait for.
+ * Errors are not thrown: either way, r is off the mount's queue by the time the
+ * flush is done, and its tag is safe to reuse. */
+static struct mntrpc *mntrpc_flush_send(struct mnt *m, struct mntrpc *r)
+{
+	ERRSTACK(1);
+	struct mntrpc *volatile fr = NULL;
+
+	if (r->done)
+		return NULL;
+	if (waserror()) {
+		/* __mountio() already cleaned up after a flush it sent.  If we never
+		 * got one, stop waiting for r. */
+		if (!fr)
+			mntqrm(m, r);
+		poperror();
+		return NULL;
+	}
+	fr = mntflushalloc(r, m->msize);
+	__mountio(m, fr, MNTIO_SEND);
+	poperror();
+	return fr;
+}
+
+static void mntrpc_flush_wait(struct mnt *m, struct mntrpc *fr)
+{
+	ERRSTACK(1);
+
+	if (!fr)
+		return;
+	/* On error, __mountio() freed the flush and took r off the queue. */
+	if (!waserror())
+		__mountio(m, fr, MNTIO_WAIT);
+	poperror();
+}
+
+/* Flushes rs[0..nr), all of which were sent.  The flushes go out together. */
+static void mntrpc_flush_all(struct mnt *m, struct mntrpc **rs, int nr)
+{
+	struct mntrpc *frs[MNT_MAX_INFLIGHT];
+
+	for (int i = 0; i < nr; i++)
+		frs[i] = mntrpc_flush_send(m, rs[i]);
+	for (int i = 0; i < nr; i++)
+		mntrpc_flush_wait(m, frs[i]);
+}
+
+/* Sends up to max_rpcs RPCs for [off, off + n) of a file, then waits for their
+ * replies in order.  Replies can arrive in any order; mountmux() matches them
+ * to RPCs by tag.  Returns the amount transferred, stopping at the first short
+ * reply, and sets *done if there was one.  The RPCs after a short reply are
+ * flushed: for a file they are past EOF, and we don't want to wait on a server
+ * that blocks them.
+ *
+ * Data comes from or goes to uba, unless the caller has blocks: writes with
+ * wblk send slices of it, starting at wblk_off, and reads with rlist append
+ * the reply blocks to *rlist.  Neither copies the data.
+ *
+ * A short write in the middle of a batch means the later RPCs might have
+ * written beyond it.  That only happens when the server is out of space, and
+ * we report the amount up to the short write, same as the serial code. */
+static size_t mntrdwr_batch(int type, struct mnt *m, struct chan *c, char *uba,
+                            struct block *wblk, uint32_t wblk_off,
+                            struct block **rlist, size_t n, off64_t off,
+                            int max_rpcs, bool *done)
+{
+	ERRSTACK(1);
+	struct mntrpc *rs[MNT_MAX_INFLIGHT];
+	volatile int nr_rs = 0, nr_sent = 0, nr_waited = 0;
+	uint32_t iounit = m->msize - IOHDRSZ;
+	uint32_t nr, nreq;
+	size_t cnt = 0, sofar = 0;
+	struct mntrpc *r;
+
+	max_rpcs = MIN(max_rpcs, MNT_MAX_INFLIGHT);
+	/* mntralloc() can throw, so we need to be ready to free what we have. */
+	if (waserror()) {
+		/* The RPC that threw was already flushed or removed. */
+		mntrpc_flush_all(m, rs + nr_waited, nr_sent - nr_waited);
+		for (int i = 0; i < nr_rs; i++)
+			mntfree(rs[i]);
+		nexterror();
+	}
+	while ((nr_rs < max_rpcs) && (sofar < n)) {
+		r = mntralloc(c, m->msize);
+		rs[nr_rs++] = r;
+		r->request.type = type;
+		r->request.fid = c->fid;
+		r->request.offset = off + sofar;
+		r->request.data = uba + sofar;
+		r->request.count = MIN(n - sofar, iounit);
+		r->reply.tag = 0;
+		r->reply.type = Tmax;
+		if (wblk)
+			r->wb = blist_clone(wblk, 0, r->request.count, wblk_off + sofar);
+		sofar += r->request.count;
+	}
+	for (int i = 0; i < nr_rs; i++) {
+		__mountio(m, rs[i], MNTIO_SEND);
+		nr_sent++;
+	}
+	*done = false;
+	for (int i = 0; i < nr_rs; i++) {
+		nr_waited = i + 1;
+		__mountio(m, rs[i], MNTIO_WAIT);
+		mntrpc_check(m, rs[i]);
+		nreq = rs[i]->request.count;
+		nr = MIN(rs[i]->reply.count, nreq);
+		if (type == Tread) {
+			if (rlist) {
+				/* mntrpcread() hung exactly the reply's data off b. */
+				while (*rlist)
+					rlist = &(*rlist)->next;
+				*rlist = rs[i]->b;
+				rs[i]->b = NULL;
+			} else {
+				rs[i]->b = bl2mem((uint8_t*)rs[i]->request.data, rs[i]->b,
+				                  nr);
+			}
+		}
+		cnt += nr;
+		if (nr != nreq) {
+			mntrpc_flush_all(m, rs + i + 1, nr_rs - i - 1);
+			*done = true;
+			break;
+		}
+	}
+	poperror();
+	for (int i = 0; i < nr_rs; i++)
+		mntfree(rs[i]);
+	return cnt;
+}
+
+/* Runs batches until we've done n or get a short reply.  The first RPC goes
+ * alone; we only pipeline the rest if its reply was full. */
+static size_t mntrdwr_pipelined(int type, struct mnt *m, struct chan *c,
+                                char *uba, struct block *wblk,
+                                struct block **rlist, size_t n, off64_t off)
+{
+	size_t nr, cnt = 0;
+	bool done = false;
+	int max_rpcs = 1;
+
+	while (n && !done) {
+		nr = mntrdwr_batch(type, m, c, uba ? uba + cnt : NULL, wblk, cnt,
+		                   rlist, n, off + cnt, max_rpcs, &done);
+		cnt += nr;
+		n -= nr;
+		if (mnt_can_pipeline(c))
+			max_rpcs = MNT_MAX_INFLIGHT;
+	}
+	return cnt;
+}
+
+/* Large reads and writes of plain files are pipelined, see mnt_can_pipeline().
+ * Everything else goes one RPC at a time. */
 size_t mntrdwr(int type, struct chan *c, void *buf, size_t n, off64_t off)
 {
 	ERRSTACK(1);
@@ -731,6 +908,8 @@ size_t mntrdwr(int type, struct chan *c, void *buf, size_t n, off64_t off)
 	m = mntchk(c);
 	uba = buf;
 	cnt = 0;
+	if (mnt_can_pipeline(c) && (n > m->msize - IOHDRSZ))
+		return mntrdwr_pipelined(type, m, c, uba, NULL, NULL, n, off);
 	for (;;) {
 		r = mntralloc(c, m->msize);
 		if (waserror()) {
@@ -766,16 +945,63 @@ size_t mntrdwr(int type, struct chan *c, void *buf, size_t n, off64_t off)
 	return cnt;
 }
 
-void mountrpc(struct mnt *m, struct mntrpc *r)
+/* Reads return the reply blocks themselves, instead of copying into a buffer.
+ * The block we return points at them with its extra_data. */
+static struct block *mntbread(struct chan *c, size_t n, off64_t off)
 {
-	char *sn, *cn;
-	int t;
-	char *e;
+	ERRSTACK(1);
+	struct mnt *m;
+	struct block *blist = NULL, *ret;
+	size_t cnt;
+
+	if (c->qid.type & QTDIR)
+		return devbread(c, n, off);
+	m = mntchk(c);
+	if (waserror()) {
+		freeblist(blist);
+		nexterror();
+	}
+	cnt = mntrdwr_pipelined(Tread, m, c, NULL, NULL, &blist, n, off);
+	poperror();
+	ret = blist_clone(blist, 0, cnt, 0);
+	freeblist(blist);
+	return ret;
+}
 
+/* Writes send slices of bp as the Twrite payloads, instead of copying it. */
+static size_t mntbwrite(struct chan *c, struct block *bp, off64_t off)
+{
+	ERRSTACK(1);
+	struct mnt *m;
+	size_t n, cnt;
+
+	m = mntchk(c);
+	if (waserror()) {
+		freeb(bp);
+		nexterror();
+	}
+	n = BLEN(bp);
+	cnt = mntrdwr_pipelined(Twrite, m, c, NULL, bp, NULL, n, off);
+	poperror();
+	freeb(bp);
+	return cnt;
+}
+
+void mountrpc(struct mnt *m, struct mntrpc *r)
+{
 	r->reply.tag = 0;
 	r->reply.type = Tmax;	/* can't ever be a valid message type */
 
 	mountio(m, r);
+	mntrpc_check(m, r);
+}
+
+/* Throws if a completed RPC's reply is an error or doesn't match. */
+static void mntrpc_check(struct mnt *m, struct mntrpc *r)
+{
+	char *sn, *cn;
+	int t;
+	char *e;
 
 	t = r->reply.type;
 	switch (t) {
@@ -818,7 +1044,61 @@ static bool kth_proc_is_dying(struct kthread *kth)
 	return kth->proc ? proc_is_dying(kth->proc) : false;
 }
 
+/* Sends a Twrite as a block: the header goes in front of the payload, which
+ * stays where it is.  The payload is either r->wb or a copy of request.data
+ * hung off the block's extra_data.  That's the only copy: the transport's
+ * bwrite takes the block as is, instead of copying an rpc buffer.  Returns the
+ * message length. */
+static int mntsendwrite(struct mnt *m, struct mntrpc *r)
+{
+	struct block *b = r->wb;
+	uint32_t hlen = BIT32SZ + BIT8SZ + BIT16SZ + BIT32SZ + BIT64SZ + BIT32SZ;
+	uint8_t *p;
+	void *buf;
+	int n;
+
+	if (!b) {
+		b = block_alloc(0, MEM_WAIT);
+		if (r->request.count) {
+			buf = kmalloc(r->request.count, MEM_WAIT);
+			memcpy(buf, r->request.data, r->request.count);
+			block_append_extra(b, (uintptr_t)buf, 0, r->request.count,
+			                   MEM_WAIT);
+		}
+	}
+	/* Once we hand it off, the block belongs to the transport, even if there's
+	 * an error. */
+	r->wb = NULL;
+	assert(BLEN(b) == r->request.count);
+	b = padblock(b, hlen);
+	n = hlen + r->request.count;
+	p = b->rp;
+	PBIT32(p, n);
+	p += BIT32SZ;
+	PBIT8(p, Twrite);
+	p += BIT8SZ;
+	PBIT16(p, r->request.tag);
+	p += BIT16SZ;
+	PBIT32(p, r->request.fid);
+	p += BIT32SZ;
+	PBIT64(p, r->request.offset);
+	p += BIT64SZ;
+	PBIT32(p, r->request.count);
+	if (devtab[m->c->type].bwrite(m->c, b, 0) != n)
+		error(EIO, ERROR_FIXME);
+	return n;
+}
+
 void mountio(struct mnt *m, struct mntrpc *r)
+{
+	__mountio(m, r, MNTIO_SEND | MNTIO_WAIT);
+}
+
+/* Sends r and/or waits for its reply, depending on phases.  If an abort
+ * interrupts either phase, we flush r and wait for the flush, after which r is
+ * done with an Rflush reply.  Either way, once the WAIT phase returns, r is
+ * done. */
+static void __mountio(struct mnt *m, struct mntrpc *r, int phases)
 {
 	ERRSTACK(1);
 	int n;
@@ -843,26 +1123,39 @@ void mountio(struct mnt *m, struct mntrpc *r)
 		}
 		/* try again.  this is where you can get the "rpc tags" errstr. */
 		r = mntflushalloc(r, m->msize);
+		/* The flush is a new RPC, which we send and wait for, even if we were
+		 * only sending r. */
+		phases = MNTIO_SEND | MNTIO_WAIT;
 		/* need one for every waserror call (so this plus one outside) */
 		poperror();
 	}
 
-	spin_lock(&m->lock);
-	r->m = m;
-	r->list = m->queue;
-	m->queue = r;
-	spin_unlock(&m->lock);
+	if (phases & MNTIO_SEND) {
+		spin_lock(&m->lock);
+		r->m = m;
+		r->list = m->queue;
+		m->queue = r;
+		spin_unlock(&m->lock);
 
-	/* Transmit a file system rpc */
-	if (m->msize == 0)
-		panic("msize");
-	n = convS2M(&r->request, r->rpc, m->msize);
-	if (n < 0)
-		panic("bad message type in mountio");
-	if (devtab[m->c->type].write(m->c, r->rpc, n, 0) != n)
-		error(EIO, ERROR_FIXME);
-/*	r->stime = fastticks(NULL); */
-	r->reqlen = n;
+		/* Transmit a file system rpc */
+		if (m->msize == 0)
+			panic("msize");
+		if (r->request.type == Twrite) {
+			n = mntsendwrite(m, r);
+		} else {
+			n = convS2M(&r->request, r->rpc, m->msize);
+			if (n < 0)
+				panic("bad message type in mountio");
+			if (devtab[m->c->type].write(m->c, r->rpc, n, 0) != n)
+				error(EIO, ERROR_FIXME);
+		}
+/*		r->stime = fastticks(NULL); */
+		r->reqlen = n;
+	}
+	if (!(phases & MNTIO_WAIT)) {
+		poperror();
+		return;
+	}
 
 	/* Gate readers onto the mount point one at a time */
 	for (;;) {
@@ -1140,6 +1433,7 @@ struct mntrpc *mntralloc(struct chan *c, uint32_t msize)
 	new->done = 0;
 	new->flushed = NULL;
 	new->b = NULL;
+	new->wb = NULL;
 	return new;
 }
 
@@ -1147,6 +1441,8 @@ void mntfree(struct mntrpc *r)
 {
 	if (r->b != NULL)
 		freeblist(r->b);
+	if (r->wb != NULL)
+		freeb(r->wb);
 	spin_lock(&mntalloc.l);
 	if (mntalloc.nrpcfree >= 10) {
 		kfree(r->rpc);
@@ -1242,9 +1538,9 @@ struct dev mntdevtab __devtab = {
 	.create = mntcreate,
 	.close = mntclose,
 	.read = mntread,
-	.bread = devbread,
+	.bread = mntbread,
 	.write = mntwrite,
-	.bwrite = devbwrite,
+	.bwrite = mntbwrite,
 	.remove = mntremove,
 	.wstat = mntwstat,
 	.power = devpower,
@@ -76,6 +76,7 @@ enum {
 	CMstraceme,
 	CMstraceall,
 	CMstrace_drop,
+	CMfaultaround,
 };
 
 enum {
@@ -125,6 +126,7 @@ struct cmdtab proccmd[] = {
 	{CMstraceme, "straceme", 0},
 	{CMstraceall, "straceall", 0},
 	{CMstrace_drop, "strace_drop", 2},
+	{CMfaultaround, "faultaround", 2},
 };
 
 /*
@@ -963,6 +965,9 @@ static size_t procread(struct chan *c, void *va, size_t n, off64_t off)
 				char *s = buf, *e = buf + 4096;
 				int i;
 
+				/* pid, progname, state, ppid, then the strace counts if
+				 * it is traced.  The fault counts go last, so the fields
+				 * before them are where they always were. */
 				s = seprintf(s, e,
 				         "%8d %-*s %-10s %6d", p->pid, PROC_PROGNAME_SZ,
 				         p->progname, procstate2str(p->state),
@@ -971,6 +976,8 @@ static size_t procread(struct chan *c, void *va, size_t n, off64_t off)
 					s = seprintf(s, e, " %d trace users %d traced procs",
 					             kref_refcnt(&p->strace->users),
 					             kref_refcnt(&p->strace->procs));
+				s = seprintf(s, e, " %lu faults %lu faulted around",
+				             p->appx_nr_faults, p->appx_nr_around);
 				proc_decref(p);
 				i = readstr(off, va, n, buf);
 				kfree(buf);
@@ -1393,6 +1400,13 @@ static void procctlreq(struct proc *p, char *va, int n)
 		else
 			error(EINVAL, "strace_drop takes on|off %s", cb->f[1]);
 		break;
+	case CMfaultaround:
+		npc = atoi(cb->f[1]);
+		if ((npc < 1) || (npc > FAULT_AROUND_MAX_PGS) || !IS_PWR2(npc))
+			error(EINVAL, "faultaround takes a power of 2 up to %d, got %s",
+			      FAULT_AROUND_MAX_PGS, cb->f[1]);
+		p->fault_around_pgs = npc;
+		break;
 	}
 	poperror();
 	kfree(cb);
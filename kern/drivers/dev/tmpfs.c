@@ -65,6 +65,7 @@ static void __tmpfs_tf_init(struct tree_file *tf, int dir_type, int dir_dev,
 	fs_file_init_dir(&tf->file, dir_type, dir_dev, user, perm);
 	dir->qid.path = tmpfs_get_qid_path((struct tmpfs*)tf->tfs);
 	dir->qid.vers = 0;
+	tf->file.pm->pm_jumbo_thresh = (size_t)CONFIG_TMPFS_JUMBO_THRESH << 20;
 	/* This is the "+1 for existing" ref.  There is no backing store for the FS,
 	 * such as a disk or 9p, so we can't get rid of a file until it is unlinked
 	 * and decreffed.  Note that KFS doesn't use pruners or anything else. */
@@ -119,6 +120,18 @@ static int tmpfs_pm_readpage(struct page_map *pm, struct page *pg)
 	return 0;
 }
 
+/* Same as readpage, but for an extent, e.g. all the pages of a jumbo. */
+static int tmpfs_pm_readpages(struct page_map *pm, struct page **pages,
+                              unsigned int nr)
+{
+	for (int i = 0; i < nr; i++) {
+		memset(page2kva(pages[i]), 0, PGSIZE);
+		atomic_or(&pages[i]->pg_flags, PG_UPTODATE);
+	}
+	kthread_usleep(1);
+	return 0;
+}
+
 /* Meant to take the page from PM and flush to backing store.  There is no
  * backing store. */
 static int tmpfs_pm_writepage(struct page_map *pm, struct page *pg)
@@ -139,6 +152,7 @@ static bool tmpfs_fs_can_grow_to(struct fs_file *f, size_t len)
 struct fs_file_ops tmpfs_fs_ops = {
 	.readpage = tmpfs_pm_readpage,
 	.writepage = tmpfs_pm_writepage,
+	.readpages = tmpfs_pm_readpages,
 	.punch_hole = tmpfs_fs_punch_hole,
 	.can_grow_to = tmpfs_fs_can_grow_to,
 };
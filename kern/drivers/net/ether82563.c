@@ -619,6 +619,7 @@ struct ctlr {
 	int rdfree;					/* rx descriptors awaiting packets */
 	struct rd *rdba;			/* receive descriptor base address */
 	struct block **rb;			/* receive buffers */
+	struct block_pool *rbpool;	/* recycled receive buffers */
 	unsigned int rdh;			/* receive descriptor head */
 	unsigned int rdt;			/* receive descriptor tail */
 	int rdtr;					/* receive delay timer ring value */
@@ -798,6 +799,8 @@ static long i82563ifstat(struct ether *edev, void *a, long n, uint32_t offset)
 	p = seprintf(p, e, "txcw: %.8ux\n", csr32r(ctlr, Txcw));
 	p = seprintf(p, e, "txdctl: %.8ux\n", csr32r(ctlr, Txdctl));
 	p = seprintf(p, e, "pbs: %dKB\n", ctlr->pbs);
+	if (ctlr->rbpool)
+		p = block_pool_seprint(ctlr->rbpool, p, e);
 	p = seprintf(p, e, "pba: %#.8ux\n", ctlr->pba);
 
 	p = seprintf(p, e, "speeds: 10:%ud 100:%ud 1000:%ud ?:%ud\n",
@@ -1119,7 +1122,7 @@ static void i82563replenish(struct ctlr *ctlr)
 			printd("#l%d: 82563: rx overrun\n", ctlr->edev->ctlrno);
 			break;
 		}
-		bp = block_alloc(ctlr->rbsz + Slop + Rbalign, MEM_ATOMIC);
+		bp = block_pool_alloc(ctlr->rbpool, MEM_ATOMIC);
 		if (bp == NULL) {
 			warn_once("OOM, trying to survive");
 			break;
@@ -1603,6 +1606,10 @@ static void freemem(struct ctlr *ctlr)
 	ctlr->tdba = NULL;
 	kfree(ctlr->rdba);
 	ctlr->rdba = NULL;
+	if (ctlr->rbpool) {
+		block_pool_destroy(ctlr->rbpool);
+		ctlr->rbpool = NULL;
+	}
 }
 
 static void i82563attach(struct ether *edev)
@@ -1642,6 +1649,9 @@ static void i82563attach(struct ether *edev)
 		qunlock(&ctlr->alock);
 		error(ENOMEM, "i82563attach: error allocating rx/tx buffers");
 	}
+	/* Enough for a full ring, plus a ring's worth in flight upstream. */
+	ctlr->rbpool = block_pool_create("rbpool", ctlr->rbsz + Slop + Rbalign,
+	                                 Nrd, 2 * Nrd);
 
 	ctlr->edev = edev;	/* point back to Ether* */
 	ctlr->attached = 1;
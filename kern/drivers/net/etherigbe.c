@@ -514,6 +514,7 @@ struct ctlr {
 	int	rdfree;
 	Rd*	rdba;			/* receive descriptor base address */
 	struct block**	rb;			/* receive buffers */
+	struct block_pool*	rbpool;		/* recycled receive buffers */
 	int	rdh;			/* receive descriptor head */
 	int	rdt;			/* receive descriptor tail */
 	int	rdtr;			/* receive delay timer ring value */
@@ -683,6 +684,8 @@ igbeifstat(struct ether* edev, void* a, long n, uint32_t offset)
 		ctlr->ixsm, ctlr->ipcs, ctlr->tcpcs);
 	l += snprintf(p+l, READSTR-l, "rdtr: %ud\n", ctlr->rdtr);
 	l += snprintf(p+l, READSTR-l, "Ctrlext: %08x\n", csr32r(ctlr, Ctrlext));
+	if(ctlr->rbpool != NULL)
+		l = block_pool_seprint(ctlr->rbpool, p+l, p+READSTR) - p;
 
 	l += snprintf(p+l, READSTR-l, "eeprom:");
 	for(i = 0; i < 0x40; i++){
@@ -1053,7 +1056,7 @@ igbereplenish(struct ctlr* ctlr)
 	while(NEXT_RING(rdt, ctlr->nrd) != ctlr->rdh){
 		rd = &ctlr->rdba[rdt];
 		if(ctlr->rb[rdt] == NULL){
-			bp = block_alloc(Rbsz, MEM_ATOMIC);
+			bp = block_pool_alloc(ctlr->rbpool, MEM_ATOMIC);
 			if(bp == NULL){
 				/* needs to be a safe print for interrupt level */
 				printk("#l%d: igbereplenish: no available buffers\n",
@@ -1226,6 +1229,7 @@ igbeattach(struct ether* edev)
 
 	ctlr->tb = NULL;
 	ctlr->rb = NULL;
+	ctlr->rbpool = NULL;
 	ctlr->alloc = NULL;
 	if(waserror()){
 		kfree(ctlr->tb);
@@ -1234,6 +1238,10 @@ igbeattach(struct ether* edev)
 		ctlr->rb = NULL;
 		kfree(ctlr->alloc);
 		ctlr->alloc = NULL;
+		if(ctlr->rbpool != NULL){
+			block_pool_destroy(ctlr->rbpool);
+			ctlr->rbpool = NULL;
+		}
 		qunlock(&ctlr->alock);
 		nexterror();
 	}
@@ -1254,6 +1262,7 @@ igbeattach(struct ether* edev)
 		printd("igbe: can't allocate ctlr->rb or ctlr->tb\n");
 		error(ENOMEM, ERROR_FIXME);
 	}
+	ctlr->rbpool = block_pool_create("rbpool", Rbsz, ctlr->nrd, 2*ctlr->nrd);
 
 	/* the ktasks should free these names, if they ever exit */
 	name = kmalloc(KNAMELEN, MEM_WAIT);
@@ -760,6 +760,7 @@ struct rtl8169_private {
 	struct poke_tracker			poker;				/* tx concurrency */
 	bool						active;
 	bool						attached;
+	struct block_pool			*rx_bpool;			/* rx copy-break blocks */
 
 	void __iomem *mmio_addr;	/* memory map physical address */
 	struct pci_device *pci_dev;
@@ -7445,7 +7446,11 @@ static struct block *rtl8169_try_rx_copy(void *data, struct rtl8169_private *tp,
 	data = rtl8169_align(data);
 	dma_sync_single_for_cpu(d, addr, pkt_size, DMA_FROM_DEVICE);
 	prefetch(data);
-	bp = block_alloc(pkt_size, MEM_ATOMIC);
+	/* Most packets fit in a pool block; jumbos still get a custom block. */
+	if (pkt_size <= tp->rx_bpool->blk_size)
+		bp = block_pool_alloc(tp->rx_bpool, MEM_ATOMIC);
+	else
+		bp = block_alloc(pkt_size, MEM_ATOMIC);
 	if (bp)
 		memcpy(bp->wp, data, pkt_size);
 	dma_sync_single_for_device(d, addr, pkt_size, DMA_FROM_DEVICE);
@@ -8663,6 +8668,10 @@ static void rtl8169_attach(struct ether *edev)
 	tp->attached = TRUE;
 	spin_unlock(&rtl_9ns_lock);
 
+	/* Room for a max-sized frame plus a VLAN tag.  Our ETHERMAXTU is the
+	 * payload MTU (1500), so the header isn't in it already. */
+	tp->rx_bpool = block_pool_create("rx_bpool", ETHERMAXTU + ETHERHDRSIZE + 4,
+	                                 NUM_RX_DESC, 2 * NUM_RX_DESC);
 	if (rtl_open(edev)) {
 		warn("Unable to attach rtl8169!");
 		return;
@@ -108,6 +108,7 @@ void *arena_xalloc(struct arena *arena, size_t size, size_t align, size_t phase,
                    size_t nocross, void *minaddr, void *maxaddr, int flags);
 void arena_xfree(struct arena *arena, void *addr, size_t size);
 
+size_t arena_reclaim(struct arena *arena);
 size_t arena_amt_free(struct arena *arena);
 size_t arena_amt_total(struct arena *arena);
 
@@ -15,11 +15,23 @@
 #include <syscall.h>
 #include <error.h>
 
-extern struct proc_list arsc_proc_list;
-extern spinlock_t arsc_proc_lock;
+struct arsc_server;
 
-syscall_sring_t* sys_init_arsc(struct proc* p);
-intreg_t syscall_async(struct proc* p, syscall_req_t *syscall);
-void arsc_server(uint32_t srcid, long a0, long a1, long a2);
+#ifdef CONFIG_ARSC_SERVER
 
-static intreg_t process_generic_syscalls(struct proc* p, size_t max);
+void arsc_init(void);
+void arsc_proc_destroy(struct proc *p);
+syscall_sring_t *sys_init_arsc(struct proc *p);
+int sys_arsc_kick(struct proc *p);
+
+#else
+
+static inline void arsc_init(void)
+{
+}
+
+static inline void arsc_proc_destroy(struct proc *p)
+{
+}
+
+#endif /* CONFIG_ARSC_SERVER */
@@ -81,14 +81,57 @@ static inline struct proc *get_prov_proc(uint32_t pcoreid)
 	return all_pcores[pcoreid].prov_proc;
 }
 
-/* TODO: need more thorough CG/LL management.  For now, core0 is the only LL
- * core.  This won't play well with the ghetto shit in schedule_init() if you do
- * anything like 'DEDICATED_MONITOR' or the ARSC server.  All that needs an
- * overhaul. */
+/* The arsc servers get the top CONFIG_ARSC_SERVER_CORES cores, never core 0.
+ * See arsc.c. */
+static inline unsigned int nr_arsc_cores(void)
+{
+#ifdef CONFIG_ARSC_SERVER
+	return MIN(CONFIG_ARSC_SERVER_CORES, num_cores - 1);
+#else
+	return 0;
+#endif
+}
+
+static inline bool is_arsc_core(uint32_t pcoreid)
+{
+	return pcoreid && (pcoreid >= num_cores - nr_arsc_cores());
+}
+
+/* Besides core 0, RCU callbacks run on the CONFIG_RCU_CB_CORES - 1 cores just
+ * below the arsc cores.  We always leave at least one CG core.  See rcu.c. */
+static inline unsigned int nr_rcu_cb_extra_cores(void)
+{
+	int avail = num_cores - 2 - nr_arsc_cores();
+
+	return MIN(CONFIG_RCU_CB_CORES - 1, MAX(avail, 0));
+}
+
+static inline bool is_rcu_cb_core(uint32_t pcoreid)
+{
+	uint32_t top = num_cores - nr_arsc_cores();
+
+	return pcoreid && (pcoreid < top) &&
+	       (pcoreid >= top - nr_rcu_cb_extra_cores());
+}
+
+/* The core running the callback kthread for CB slot 'slot'.  Slot 0 is core 0,
+ * and the rest count down from just below the arsc cores. */
+static inline uint32_t rcu_cb_coreid(unsigned int slot)
+{
+	return slot ? num_cores - nr_arsc_cores() - slot : 0;
+}
+
+/* TODO: need more thorough CG/LL management.  For now, core0, the RCU CB cores,
+ * and the arsc server cores are the only LL cores.  This won't play well with
+ * anything like 'DEDICATED_MONITOR'.  All that needs an overhaul. */
 static inline bool is_ll_core(uint32_t pcoreid)
 {
 	if (pcoreid == 0)
 		return TRUE;
+	if (is_arsc_core(pcoreid))
+		return TRUE;
+	if (is_rcu_cb_core(pcoreid))
+		return TRUE;
 	return FALSE;
 }
 
@@ -99,6 +142,7 @@ static inline uint32_t max_vcores(struct proc *p)
 #ifdef CONFIG_DISABLE_SMT
 	return num_cores >> 1;
 #else
-	return num_cores - 1;	/* reserving core 0 */
+	/* reserving core 0 */
+	return num_cores - 1 - nr_arsc_cores() - nr_rcu_cb_extra_cores();
 #endif /* CONFIG_DISABLE_SMT */
 }
@@ -82,7 +82,10 @@ struct proc {
 	spinlock_t vmr_lock;		/* Protects VMR tree (mem mgmt) */
 	spinlock_t pte_lock;		/* Protects page tables (mem mgmt) */
 	struct vmr_tailq vm_regions;
-	int vmr_history;
+	seq_ctr_t vmr_history;		/* odd while the VMRs are changing */
+	unsigned int fault_around_pgs;	/* power of 2, 1 for none */
+	unsigned long appx_nr_faults;	/* racy counters, for #proc status */
+	unsigned long appx_nr_around;
 
 	// Per process info and data pages
  	procinfo_t *procinfo;       // KVA of per-process shared info table (RO)
@@ -91,6 +94,7 @@ struct proc {
 	// The backring pointers for processing asynchronous system calls from the user
 	// Note this is the actual backring, not a pointer to it somewhere else
 	syscall_back_ring_t syscallbackring;
+	struct arsc_server *arsc_srv;	/* set once, by sys_init_arsc() */
 
 	// The front ring pointers for pushing asynchronous system events out to the user
 	// Note this is the actual frontring, not a pointer to it somewhere else
@@ -134,6 +138,7 @@ void	env_pagetable_free(env_t* e);
 
 typedef int (*mem_walk_callback_t)(env_t* e, pte_t pte, void* va, void* arg);
 int		env_user_mem_walk(env_t* e, void* start, size_t len, mem_walk_callback_t callback, void* arg);
+void	env_unmap_jumbo(env_t *e, uintptr_t va);
 
 static inline void set_traced_proc(struct proc *p, bool traced)
 {
@@ -71,7 +71,7 @@ struct fs_file;
 /* TODO: Once we get rid of the VFS and rework the PM, we can put the PM ops in
  * here properly. */
 struct fs_file_ops {
-	struct page_map_operations;	/* readpage and writepage */
+	struct page_map_operations;	/* readpage(s) and writepage(s) */
 	void (*punch_hole)(struct fs_file *f, off64_t begin, off64_t end);
 	bool (*can_grow_to)(struct fs_file *f, size_t len);
 };
@@ -85,6 +85,13 @@ struct fs_file {
 	struct fs_file_ops			*ops;
 	struct page_map				*pm;
 	void						*priv;
+	/* Readahead state, updated racily.  It's just a heuristic. */
+	unsigned long				ra_next;	/* page after the last access */
+	unsigned long				ra_end;		/* page after the window */
+	unsigned long				ra_size;	/* window size, in pages */
+	/* Bumped when walks through or from this file could change, see
+	 * path_cache_invalidate(). */
+	unsigned long				path_gen;
 
 	/* optional inline storage */
 	char						static_name[KNAMELEN];	/* for dir->name */
@@ -10,13 +10,23 @@
 #include <ros/common.h>
 #include <kref.h>
 
-#define NUM_KMALLOC_CACHES 6
+/* Size classes go up by quarter powers of two: 64, 80, 96, 112, 128, 160, ...,
+ * 14336, 16384.  The smallest class must be at least 64 so that every class is
+ * a multiple of KMALLOC_ALIGNMENT. */
+#define KMALLOC_SMALLEST_SHIFT 6
+#define KMALLOC_LARGEST_SHIFT 14
+#define KMALLOC_CLASS_STEPS 4
+#define NUM_KMALLOC_CACHES \
+	(1 + (KMALLOC_LARGEST_SHIFT - KMALLOC_SMALLEST_SHIFT) * KMALLOC_CLASS_STEPS)
 #define KMALLOC_ALIGNMENT 16
-#define KMALLOC_SMALLEST (sizeof(struct kmalloc_tag) << 1)
-#define KMALLOC_LARGEST KMALLOC_SMALLEST << NUM_KMALLOC_CACHES
+#define KMALLOC_SMALLEST (1UL << KMALLOC_SMALLEST_SHIFT)
+#define KMALLOC_LARGEST (1UL << KMALLOC_LARGEST_SHIFT)
 
 void kmalloc_init(void);
+void kmalloc_init_node(int node);
 void *kmalloc(size_t size, int flags);
+void *kmalloc_node(size_t size, int flags, int node);
+void *kzmalloc_node(size_t size, int flags, int node);
 void *kmalloc_array(size_t nmemb, size_t size, int flags);
 void *kzmalloc(size_t size, int flags);
 void *kmalloc_align(size_t size, int flags, size_t align);
@@ -28,6 +38,9 @@ void kmalloc_incref(void *buf);
 void kfree(void *buf);
 void kmalloc_canary_check(char *str);
 void *debug_canary;
+void *__kmalloc_sized(size_t size, int cache_id, int flags);
+void __kfree_sized(void *buf, size_t size, int cache_id);
+size_t kmalloc_class_size(int cache_id);
 
 #define MEM_ATOMIC				(1 << 1)
 #define MEM_WAIT				(1 << 2)
@@ -61,6 +74,43 @@ struct kmalloc_tag {
 	int flags;
 };
 
+/* Returns the kmalloc cache for an object of ksize bytes, which is past the end
+ * of the caches if it is too big for them.  When ksize is a compile-time
+ * constant, this folds down to a constant. */
+static inline int kmalloc_cache_id(size_t ksize)
+{
+	int order;
+
+	if (ksize <= KMALLOC_SMALLEST)
+		return 0;
+	if (ksize > KMALLOC_LARGEST)
+		return NUM_KMALLOC_CACHES;
+	/* ksize - 1 is in [2^order, 2^(order + 1)), and its next two bits are
+	 * which quarter it is in. */
+	order = LOG2_DOWN(ksize - 1);
+	return (order - KMALLOC_SMALLEST_SHIFT) * KMALLOC_CLASS_STEPS + 1
+	       + (((ksize - 1) >> (order - 2)) & (KMALLOC_CLASS_STEPS - 1));
+}
+
+/* Untagged allocations, for callers that know the size of what they free.
+ * There's no tag, so the buffers can't be kfreed, kreallocd, or refcounted with
+ * kmalloc_incref, and they must be freed with kfree_sized with the same size
+ * they were allocated with.  In exchange, small objects don't pay for the tag,
+ * and constant sizes pick their cache at compile time.
+ *
+ * These can return 0 for MEM_ATOMIC, unlike kmalloc. */
+static inline void *kmalloc_sized(size_t size, int flags)
+{
+	return __kmalloc_sized(size, kmalloc_cache_id(size), flags);
+}
+
+static inline void kfree_sized(void *buf, size_t size)
+{
+	if (!buf)
+		return;
+	__kfree_sized(buf, size, kmalloc_cache_id(size));
+}
+
 /* This is aligned so that the buf is aligned to the usual kmalloc alignment. */
 struct sized_alloc {
 	void						*buf;
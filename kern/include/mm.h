@@ -41,8 +41,9 @@ size_t foc_get_len(struct file_or_chan *foc);
 
 /* Basic structure defining a region of a process's virtual memory.  Note we
  * don't refcnt these.  Either they are in the TAILQ/tree, or they should be
- * freed.  There should be no other references floating around.  We still need
- * to sort out how we share memory and how we'll do private memory with these
+ * freed.  There should be no other references floating around, other than page
+ * faults, which look them up under RCU without the vmr_lock.  We still need to
+ * sort out how we share memory and how we'll do private memory with these
  * VMRs. */
 struct vm_region {
 	TAILQ_ENTRY(vm_region)		vm_link;
@@ -56,6 +57,7 @@ struct vm_region {
 	size_t						vm_foff;
 	bool						vm_ready;	/* racy, for the PM checks */
 	bool						vm_shootdown_needed;
+	struct rcu_head				vm_rcu;
 };
 TAILQ_HEAD(vmr_tailq, vm_region);			/* Declares 'struct vmr_tailq' */
 
@@ -89,6 +91,9 @@ void *do_mmap(struct proc *p, uintptr_t addr, size_t len, int prot, int flags,
               struct file_or_chan *foc, size_t offset);
 int mprotect(struct proc *p, uintptr_t addr, size_t len, int prot);
 int munmap(struct proc *p, uintptr_t addr, size_t len);
+/* Upper bound for a proc's fault_around_pgs, which is at most a PML1 of PTEs.
+ * Faults keep an array of this many pages on the stack. */
+#define FAULT_AROUND_MAX_PGS 64
 int handle_page_fault(struct proc *p, uintptr_t va, int prot);
 int handle_page_fault_nofile(struct proc *p, uintptr_t va, int prot);
 unsigned long populate_va(struct proc *p, uintptr_t va, unsigned long nr_pgs);
@@ -87,6 +87,7 @@ struct conv {
 	uint32_t ttl;				/* max time to live */
 	uint32_t tos;				/* type of service */
 	int ignoreadvice;			/* don't terminate connection on icmp errors */
+	bool reuseport;				/* can share lport with other reuseport convs */
 
 	uint8_t ipversion;
 	uint8_t laddr[IPaddrlen];	/* local IP address */
@@ -218,6 +219,43 @@ struct routerparams {
 	int routerlt;
 };
 
+/*
+ *  receive packet steering, one queue per core per Ipifc
+ */
+enum {
+	RPS_MAP_SZ = 256,			/* flow hash buckets */
+	RPS_QLIMIT_DEFAULT = 1024,	/* max packets waiting for a core */
+};
+
+struct rps_queue {
+	spinlock_t lock;
+	struct block *head;
+	struct block *tail;
+	unsigned int len;
+	bool scheduled;				/* a drain kmsg is pending or running */
+	uint64_t nr_steered;
+	uint64_t nr_processed;
+	uint64_t nr_dropped;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+/* Where RFS is sending a flow right now.  qtail is the flow's last packet on
+ * that core's queue, in terms of the queue's nr_steered. */
+struct rps_flow {
+	uint16_t core;				/* core + 1, 0 for none yet */
+	uint64_t qtail;
+};
+
+struct ip_rps {
+	struct Ipifc *ifc;
+	struct Fs *f;
+	bool enabled;
+	bool rfs;					/* prefer the flow's last reader */
+	unsigned int qlimit;
+	uint16_t map[RPS_MAP_SZ];	/* flow hash -> core */
+	struct rps_queue *queues;	/* one per core */
+	struct rps_flow *flows;		/* RFS's current cores, by flow hash */
+};
+
 struct Ipifc {
 	rwlock_t rwlock;
 
@@ -249,6 +287,7 @@ struct Ipifc {
 	uint8_t recvra6;			/* == 1 => recv router advs on this ifc */
 	struct routerparams rp;		/* router parameters as in RFC 2461, pp.40--43.
 								   used only if node is router */
+	struct ip_rps *rps;			/* receive packet steering, if configured */
 };
 
 /*
@@ -669,7 +708,17 @@ extern int ipoput4(struct Fs *,
 extern int ipoput6(struct Fs *,
 				   struct block *, int unused_int, int, int, struct conv *);
 extern int ipstats(struct Fs *, char *unused_char_p_t, int);
+
+/*
+ *  iprps.c
+ */
+void ip_rps_input(struct Fs *f, struct Ipifc *ifc, struct block *bp);
+void ip_rps_note_flow(struct conv *c);
+void ip_rps_ctl(struct Ipifc *ifc, char **argv, int argc);
+void ip_rfs_ctl(struct Ipifc *ifc, char **argv, int argc);
+int ip_rps_stats(struct Ipifc *ifc, char *buf, int len);
 extern uint16_t ptclbsum(uint8_t * unused_uint8_p_t, int);
+extern uint16_t memcpy_and_csum(void *dst, const void *src, size_t len);
 extern uint16_t ptclcsum(struct block *, int unused_int, int);
 extern void ip_init(struct Fs *);
 extern void update_mtucache(uint8_t * unused_uint8_p_t, uint32_t);
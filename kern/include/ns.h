@@ -410,7 +410,8 @@ enum {
 #define NS_TCPCK_SHIFT 4
 #define NS_PKTCK_SHIFT 5
 #define NS_TSO_SHIFT 6
-#define NS_SHIFT_MAX 6
+#define NS_DATACSUM_SHIFT 7
+#define NS_SHIFT_MAX 7
 
 enum {
 	BFREE = (1 << 1),
@@ -419,6 +420,7 @@ enum {
 	Btcpck = (1 << NS_TCPCK_SHIFT),	/* tcp checksum (rx), needed (tx) */
 	Bpktck = (1 << NS_PKTCK_SHIFT),	/* packet checksum (rx, maybe) */
 	Btso = (1 << NS_TSO_SHIFT),		/* TSO desired (tx) */
+	Bdatacsum = (1 << NS_DATACSUM_SHIFT),	/* data_csum is valid (tx) */
 };
 #define BLOCK_META_FLAGS (Bipck | Budpck | Btcpck | Bpktck | Btso)
 #define BLOCK_TRANS_TX_CSUM (Budpck | Btcpck)
@@ -444,6 +446,7 @@ struct block {
 	uint16_t network_offset;	/* offset from start */
 	uint16_t transport_offset;	/* offset from start */
 	uint16_t tx_csum_offset;	/* offset from tx_offset to store csum */
+	uint16_t data_csum;			/* ptclbsum of the data, from qwrite */
 	/* might want something to track the next free extra_data slot */
 	size_t extra_len;
 	unsigned int nr_extra_bufs;
@@ -453,6 +456,42 @@ struct block {
 #define BHLEN(s) ((s)->wp - (s)->rp)
 #define BALLOC(s) ((s)->lim - (s)->base + (s)->extra_len)
 
+/* Block pools hand out pre-sized blocks and recycle them on freeb(), instead of
+ * going back to kmalloc for every packet.  Each core has its own free list.
+ * A block goes back to the core that allocated it: other cores put it on that
+ * core's remote list, which it takes over when its free list runs dry.  That
+ * way blocks that are consumed elsewhere (e.g. with RPS) still refill the RX
+ * core.  When a list grows past hi_water, we release blocks until it is down
+ * to lo_water.  Pool blocks are still kmalloc buffers, so qio can refcnt
+ * them. */
+struct block_pool_pcpu {
+	spinlock_t					lock;
+	struct block				*free_list;
+	unsigned int				nr_free;
+	uint64_t					nr_allocs;
+	uint64_t					nr_hits;
+	uint64_t					nr_frees;
+	uint64_t					nr_released;
+	/* Written by other cores, so it gets its own cacheline */
+	spinlock_t					remote_lock
+	                            __attribute__((aligned(ARCH_CL_SIZE)));
+	struct block				*remote_list;
+	unsigned int				nr_remote;
+	uint64_t					nr_remote_frees;
+	uint64_t					nr_remote_released;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+struct block_pool {
+	char						name[KNAMELEN];
+	size_t						blk_size;
+	unsigned int				lo_water;
+	unsigned int				hi_water;
+	bool						dying;
+	struct kref					kref;
+	atomic_t					nr_shared;
+	struct block_pool_pcpu		*pcpus;
+};
+
 struct chan {
 	spinlock_t lock;
 	struct kref ref;
@@ -614,6 +653,8 @@ struct mntparam {
 	char *spec;
 };
 
+struct path_cache;
+
 struct pgrp {
 	struct kref ref;			/* also used as a lock when mounting */
 	uint32_t pgrpid;
@@ -621,6 +662,8 @@ struct pgrp {
 	struct rwlock ns;			/* Namespace n read/one write lock */
 	qlock_t nsh;
 	struct mhead *mnthash[MNTHASH];
+	unsigned long mount_gen;	/* bumped on (un)mounts, for the path cache */
+	struct path_cache *path_cache;
 	int progmode;
 	int nodevs;
 	int pin;
@@ -700,8 +743,12 @@ enum {
 	Qcoalesce		= (1 << 3),	/* coalesce empty packets on read */
 	Qkick			= (1 << 4),	/* always call the kick routine after qwrite */
 	Qdropoverflow	= (1 << 5),	/* writes that would block will be dropped */
+	Qcsum			= (1 << 6),	/* checksum data while copying in writes */
 };
 
+/* Batched msg I/O (qread_msgs/qwrite_msgs) puts count[4] before each msg. */
+#define QMSG_BATCH_HDR 4
+
 /* Per-process structs */
 #define NR_OPEN_FILES_DEFAULT 32
 #define NR_FILE_DESC_DEFAULT 32
@@ -777,6 +824,12 @@ int block_append_extra(struct block *b, uintptr_t base, uint32_t off,
                        uint32_t len, int mem_flags);
 void block_copy_metadata(struct block *new_b, struct block *old_b);
 void block_reset_metadata(struct block *b);
+struct block_pool *block_pool_create(const char *name, size_t blk_size,
+                                     unsigned int lo_water,
+                                     unsigned int hi_water);
+void block_pool_destroy(struct block_pool *bpool);
+struct block *block_pool_alloc(struct block_pool *bpool, int mem_flags);
+char *block_pool_seprint(struct block_pool *bpool, char *p, char *e);
 int anyhigher(void);
 int anyready(void);
 void _assert(char *unused_char_p_t);
@@ -923,6 +976,9 @@ struct block *packblock(struct block *);
 struct block *padblock(struct block *, int);
 
 void pgrpcpy(struct pgrp *, struct pgrp *);
+void path_cache_invalidate(struct fs_file *f);
+void path_cache_flush(struct pgrp *pg);
+void path_cache_destroy(struct pgrp *pg);
 
 int progfdprint(struct chan *, int unused_int, int, char *unused_char_p_t,
 				int i);
@@ -954,22 +1010,30 @@ void qhangup(struct queue *, char *unused_char_p_t);
 int qisclosed(struct queue *);
 ssize_t qiwrite(struct queue *, void *, int);
 int qlen(struct queue *);
+int qstate(struct queue *q);
 size_t q_bytes_read(struct queue *q);
 void qdropoverflow(struct queue *, bool);
 void q_toggle_qmsg(struct queue *q, bool onoff);
 void q_toggle_qcoalesce(struct queue *q, bool onoff);
+void q_toggle_qcsum(struct queue *q, bool onoff);
 struct queue *qopen(int unused_int, int, void (*)(void *), void *);
 ssize_t qpass(struct queue *, struct block *);
 ssize_t qpassnolim(struct queue *, struct block *);
 void qputback(struct queue *, struct block *);
 size_t qread(struct queue *q, void *va, size_t len);
 size_t qread_nonblock(struct queue *q, void *va, size_t len);
+size_t qread_msgs(struct queue *q, void *va, size_t len,
+                  unsigned int max_msgs);
+size_t qread_msgs_nonblock(struct queue *q, void *va, size_t len,
+                           unsigned int max_msgs);
 void qreopen(struct queue *);
 void qsetlimit(struct queue *, size_t);
 size_t qgetlimit(struct queue *);
 int qwindow(struct queue *);
 ssize_t qwrite(struct queue *, void *, int);
 ssize_t qwrite_nonblock(struct queue *, void *, int);
+size_t qwrite_msgs(struct queue *q, void *vp, size_t len);
+size_t qwrite_msgs_nonblock(struct queue *q, void *vp, size_t len);
 typedef void (*qio_wake_cb_t)(struct queue *q, void *data, int filter);
 void qio_set_wake_cb(struct queue *q, qio_wake_cb_t func, void *data);
 bool qreadable(struct queue *q);
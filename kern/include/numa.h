@@ -0,0 +1,37 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * NUMA memory nodes.  Each node has its own base arena and kpages arena.  Node
+ * 0 is base_arena / kpages_arena, which exist from pmem_init().  The arch adds
+ * the other nodes' memory once it knows the layout (e.g. from the SRAT). */
+
+#pragma once
+
+#include <ros/common.h>
+#include <arena.h>
+
+#define MAX_NUMA_NODES			8
+
+extern int nr_numa_nodes;
+extern struct arena *base_arenas[MAX_NUMA_NODES];
+extern struct arena *kpages_arenas[MAX_NUMA_NODES];
+
+/* The node of the calling core.  Returns 0 before NUMA is set up. */
+int numa_node(void);
+/* The node that owns kernel address @kva. */
+int numa_node_of_addr(void *kva);
+/* The kpages arena for @node, or kpages_arena if the node has no memory. */
+struct arena *numa_kpages_arena(int node);
+int numa_kpages_node(struct arena *arena);
+
+/* Arch hooks, called once during boot, before the other cores come up. */
+void numa_set_core_node(int coreid, int node);
+void numa_add_node_mem(int node, physaddr_t start, size_t len);
+
+/* Stats */
+int numa_node_of_core(int coreid);
+int numa_nr_cores(int node);
+size_t numa_amt_total(int node);
+size_t numa_amt_free(int node);
+void numa_note_fallback(int node);
+size_t numa_nr_fallbacks(int node);
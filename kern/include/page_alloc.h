@@ -59,19 +59,32 @@ extern page_list_t page_free_list;
 void base_arena_init(struct multiboot_info *mbi);
 
 error_t upage_alloc(struct proc *p, page_t **page, bool zero);
+error_t upage_alloc_node(struct proc *p, page_t **page, bool zero, int node);
 error_t kpage_alloc(page_t **page);
 void *kpage_alloc_addr(void);
 void *kpage_zalloc_addr(void);
 
-/* Direct allocation from the kpages arena (instead of kmalloc).  These will
- * give you PGSIZE quantum. */
+/* Direct allocation from the kpages arenas (instead of kmalloc).  These will
+ * give you PGSIZE quantum, from the caller's NUMA node or from @node. */
 void *kpages_alloc(size_t size, int flags);
+void *kpages_alloc_node(size_t size, int flags, int node);
 void *kpages_zalloc(size_t size, int flags);
 void kpages_free(void *addr, size_t size);
 
 void *get_cont_pages(size_t order, int flags);
 void free_cont_pages(void *buf, size_t order);
 
+/* Jumbo pages are PML2-sized and aligned.  A split jumbo is handed out as
+ * JUMBO_NR_PGS individual pages, each freed with page_decref().  The jumbo goes
+ * back to its arena once all of them are freed. */
+#define JUMBO_PGSIZE		PML2_PTE_REACH
+#define JUMBO_NR_PGS		(JUMBO_PGSIZE >> PGSHIFT)
+
+void jumbo_arena_init(void);
+void *jumbo_page_alloc(size_t nr, int flags);
+void jumbo_page_free(void *buf, size_t nr);
+void *jumbo_page_alloc_split(int flags);
+
 void page_decref(page_t *page);
 
 int page_is_free(size_t ppn);
@@ -79,8 +92,15 @@ void lock_page(struct page *page);
 void unlock_page(struct page *page);
 void print_pageinfo(struct page *page);
 static inline bool page_is_pagemap(struct page *page);
+static inline bool page_is_jumbo_split(struct page *page);
 
 static inline bool page_is_pagemap(struct page *page)
 {
 	return atomic_read(&page->pg_flags) & PG_PAGEMAP ? true : false;
 }
+
+/* Whether page is one of the pages of a split jumbo */
+static inline bool page_is_jumbo_split(struct page *page)
+{
+	return page->pg_private != NULL;
+}
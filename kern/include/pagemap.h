@@ -29,18 +29,25 @@ struct page_map {
 	struct page_map_operations	*pm_op;
 	spinlock_t					pm_lock;		/* for the VMR list */
 	struct vmr_tailq			pm_vmrs;
+	size_t						pm_jumbo_thresh; /* file len, 0 for never */
 };
 
+/* The most pages we'll hand to readpages or writepages at once. */
+#define PM_MAX_EXTENT_PGS		32
+
 /* Operations performed on a page_map.  These are usually FS specific, which
  * get assigned when the inode is created.
- * Will fill these in as they are created/needed/used. */
+ * Will fill these in as they are created/needed/used.
+ *
+ * readpages and writepages are optional.  They take an extent: nr pages with
+ * consecutive pg_index, at most PM_MAX_EXTENT_PGS.  The pages are locked for
+ * readpages, which sets PG_UPTODATE on each page it fills, same as readpage. */
 struct page_map_operations {
 	int (*readpage) (struct page_map *, struct page *);
 	int (*writepage) (struct page_map *, struct page *);
-/*	readpages: read a list of pages
-	writepage: write from a page to its backing store
-	writepages: write a list of pages
-	sync_page: start the IO of already scheduled ops
+	int (*readpages) (struct page_map *, struct page **, unsigned int nr);
+	int (*writepages) (struct page_map *, struct page **, unsigned int nr);
+/*	sync_page: start the IO of already scheduled ops
 	set_page_dirty: mark the given page dirty
 	prepare_write: prepare to write (disk backed pages)
 	commit_write: complete a write (disk backed pages)
@@ -56,12 +63,14 @@ int pm_load_page(struct page_map *pm, unsigned long index, struct page **pp);
 int pm_load_page_nowait(struct page_map *pm, unsigned long index,
                         struct page **pp);
 void pm_put_page(struct page *page);
+void pm_readahead(struct page_map *pm, unsigned long index,
+                  unsigned long nr_pgs);
 void pm_add_vmr(struct page_map *pm, struct vm_region *vmr);
 void pm_remove_vmr(struct page_map *pm, struct vm_region *vmr);
 void pm_remove_or_zero_pages(struct page_map *pm, unsigned long start_idx,
                              unsigned long nr_pgs);
 void pm_writeback_pages(struct page_map *pm);
-void pm_free_unused_pages(struct page_map *pm);
+unsigned long pm_free_unused_pages(struct page_map *pm);
 void pm_destroy(struct page_map *pm);
 void pm_page_asserter(struct page *page, char *str);
 void print_page_map_info(struct page_map *pm);
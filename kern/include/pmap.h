@@ -84,6 +84,7 @@ int	 page_insert(pgdir_t pgdir, struct page *page, void *va,
 			int perm);
 void page_remove(pgdir_t pgdir, void *va);
 page_t* page_lookup(pgdir_t pgdir, void *va, pte_t *pte_store);
+void pte_mark_pages_dirty(pte_t pte);
 error_t	pagetable_remove(pgdir_t pgdir, void *va);
 void	page_decref(page_t *pp);
 
@@ -98,6 +99,7 @@ void map_segment(pgdir_t pgdir, uintptr_t va, size_t size, physaddr_t pa,
                  int perm, int pml_shift);
 int unmap_segment(pgdir_t pgdir, uintptr_t va, size_t size);
 pte_t pgdir_walk(pgdir_t pgdir, const void *va, int create);
+pte_t pgdir_walk_jumbo(pgdir_t pgdir, const void *va, int create);
 int get_va_perms(pgdir_t pgdir, const void *va);
 int arch_pgdir_setup(pgdir_t boot_copy, pgdir_t *new_pd);
 physaddr_t arch_pgdir_get_cr3(pgdir_t pd);
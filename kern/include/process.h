@@ -96,6 +96,7 @@ struct proc *pid2proc(pid_t pid);
 bool proc_controls(struct proc *actor, struct proc *target);
 void proc_incref(struct proc *p, unsigned int val);
 void proc_decref(struct proc *p);
+void __set_proc_current(struct proc *p);
 void proc_run_s(struct proc *p);
 void __proc_run_m(struct proc *p);
 void __proc_startcore(struct proc *p, struct user_context *ctx);
@@ -8,25 +8,33 @@
 #include <stdio.h>
 #include <ros/profiler_records.h>
 
+/* Most profilers (sessions) that can be open at once */
+#define PROFILER_MAX_SESSIONS	8
+
 struct hw_trapframe;
 struct proc;
 struct file_or_chan;
 struct cmdbuf;
+struct profiler;
 
-int profiler_configure(struct cmdbuf *cb);
+int profiler_configure(struct profiler *prof, struct cmdbuf *cb);
 void profiler_append_configure_usage(char *msgbuf, size_t buflen);
-void profiler_init(void);
-void profiler_setup(void);
-void profiler_cleanup(void);
-void profiler_start(void);
-void profiler_stop(void);
+struct profiler *profiler_create(void);
+struct profiler *profiler_get_slot(int slot);
+void profiler_put(struct profiler *prof);
+int profiler_id(struct profiler *prof);
+pid_t profiler_owner(struct profiler *prof);
+void profiler_start(struct profiler *prof);
+void profiler_stop(struct profiler *prof);
 void profiler_push_kernel_backtrace(uintptr_t *pc_list, size_t nr_pcs,
                                     uint64_t info);
 void profiler_push_user_backtrace(uintptr_t *pc_list, size_t nr_pcs,
                                   uint64_t info);
-void profiler_trace_data_flush(void);
-int profiler_size(void);
-int profiler_read(void *va, int n);
+size_t profiler_size(struct profiler *prof);
+size_t profiler_read(struct profiler *prof, void *va, size_t n);
+size_t profiler_cpu_size(struct profiler *prof, int cpu);
+size_t profiler_read_cpu(struct profiler *prof, int cpu, void *va, size_t n);
+uint64_t profiler_cpu_dropped(struct profiler *prof, int cpu);
 void profiler_notify_mmap(struct proc *p, uintptr_t addr, size_t size, int prot,
 						  int flags, struct file_or_chan *foc, size_t offset);
 void profiler_notify_new_process(struct proc *p);
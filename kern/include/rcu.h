@@ -56,6 +56,12 @@ struct rcu_state {
 	/* TODO: make a ktask struct and use a read-only pointer. */
 	struct rendez				gp_ktask_rv;
 	int							gp_ktask_ctl;
+
+	/* synchronize_rcu_expedited() waiters.  While there are any, the GP kthread
+	 * kicks tardy cores once per GP, and wakes exp_rv when a GP completes. */
+	atomic_t					nr_exp_waiters;
+	bool						gp_exp_kicked;
+	struct rendez				exp_rv;
 };
 
 struct rcu_pcpui {
@@ -71,14 +77,18 @@ struct rcu_pcpui {
 	unsigned int				nr_cbs;
 	unsigned long				gp_acked;
 
+	/* Only used on CB cores.  The one for CB slot n runs the callbacks of
+	 * every core whose id is n modulo the number of slots. */
 	struct rendez				mgmt_ktask_rv;
 	int							mgmt_ktask_ctl;
+	char						mgmt_ktask_name[16];
 };
 DECLARE_PERCPU(struct rcu_pcpui, rcu_pcpui);
 
 void rcu_init(void);
 void rcu_report_qs(void);
 void rcu_barrier(void);
+void synchronize_rcu_expedited(void);
 void rcu_force_quiescent_state(void);
 unsigned long get_state_synchronize_rcu(void);
 void cond_synchronize_rcu(unsigned long oldstate);
@@ -0,0 +1,33 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Memory reclaim.  See reclaim.c. */
+
+#pragma once
+
+#include <ros/common.h>
+#include <sys/queue.h>
+
+struct arena;
+
+/* Shrinkers free memory held by caches above the slab and arena layers, such as
+ * the page cache.  shrink() runs in the reclaim ktask, so it can block.
+ * nr_wanted is a hint, in pages.  It returns the number of objects freed, in
+ * whatever units make sense for the shrinker. */
+struct shrinker {
+	const char					*name;
+	size_t (*shrink)(struct shrinker *s, size_t nr_wanted);
+	TAILQ_ENTRY(shrinker)		link;
+	size_t						nr_calls;
+	size_t						nr_freed;
+};
+TAILQ_HEAD(shrinker_tailq, shrinker);
+
+void reclaim_init(void);
+void reclaim_poke(void);
+void reclaim_check_arena(struct arena *arena);
+bool reclaim_direct(void);
+bool reclaim_node_low(int node);
+
+void register_shrinker(struct shrinker *s);
+void unregister_shrinker(struct shrinker *s);
@@ -43,6 +43,7 @@
 #define SYS_vmm_poke_guest			38
 #define SYS_send_event				39
 #define SYS_vmm_ctl					40
+#define SYS_arsc_kick				41
 
 /* FS Syscalls */
 #define SYS_read				100
@@ -12,11 +12,10 @@
 #include <ros/event.h>
 
 typedef struct procdata {
-	/*
+	/* The arsc ring, set up by sys_init_arsc().  The kernel reads it through
+	 * its own mapping of procdata, which can't be unmapped. */
 	syscall_sring_t			syscallring;
 	char					pad1[SYSCALLRINGSIZE - sizeof(syscall_sring_t)];
-	*/
-	syscall_sring_t			*syscallring;
 	sysevent_sring_t		syseventring;
 	char					pad2[SYSEVENTRINGSIZE - sizeof(sysevent_sring_t)];
 	bool					printx_on;
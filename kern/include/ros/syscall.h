@@ -58,6 +58,7 @@ static inline bool syscall_retval_is_error(unsigned int sysc_nr, long retval)
 	case SYS_notify:
 	case SYS_self_notify:
 	case SYS_send_event:
+	case SYS_arsc_kick:
 	case SYS_halt_core:
 	case SYS_pop_ctx:
 	case SYS_vmm_poke_guest:
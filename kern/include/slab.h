@@ -69,8 +69,21 @@ struct kmem_depot {
 	unsigned int				magsize;
 	unsigned int				nr_empty;
 	unsigned int				nr_not_empty;
+	/* Low-water marks of the lists since the last trim.  Those mags weren't
+	 * part of the working set. */
+	unsigned int				min_empty;
+	unsigned int				min_not_empty;
 	unsigned int				busy_count;
 	uint64_t					busy_start;
+	/* Trims in a row without contention, for shrinking magsize */
+	unsigned int				quiet_trims;
+	uint64_t					contended_at_trim;
+	/* Stats */
+	uint64_t					nr_alloc_trips;
+	uint64_t					nr_free_trips;
+	uint64_t					nr_contended;
+	uint64_t					nr_grows;
+	uint64_t					nr_shrinks;
 };
 
 struct kmem_slab;
@@ -139,7 +152,8 @@ void *kmem_cache_alloc(struct kmem_cache *cp, int flags);
 void kmem_cache_free(struct kmem_cache *cp, void *buf);
 /* Back end: internal functions */
 void kmem_cache_init(void);
-void kmem_cache_reap(struct kmem_cache *cp);
+size_t kmem_cache_reap(struct kmem_cache *cp);
+size_t kmem_cache_trim_depot(struct kmem_cache *kc);
 unsigned int kmc_nr_pcpu_caches(void);
 /* Low-level interface for initializing a cache. */
 void __kmem_cache_create(struct kmem_cache *kc, const char *name,
@@ -70,6 +70,13 @@ struct per_cpu_info {
 	struct kernel_msg_list immed_amsgs;
 	spinlock_t routine_amsg_lock;
 	struct kernel_msg_list routine_amsgs;
+	/* Routine KMSGs we sent that woke their target through kmsg_poll. */
+	uint64_t nr_kmsg_poll_wakes;
+	/* Set while we're halted in cpu_halt_kmsg(), watching it.  Whoever clears
+	 * it wakes us, so routine KMSG senders can skip the IPI.  It gets a
+	 * cacheline to itself, so writes to our other fields don't wake us. */
+	atomic_t kmsg_poll __attribute__((aligned(ARCH_CL_SIZE)));
+	uint8_t __kmsg_poll_pad[ARCH_CL_SIZE - sizeof(atomic_t)];
 	/* profiling -- opaque to all but the profiling code. */
 	void *profiling;
 }__attribute__((aligned(ARCH_CL_SIZE)));
@@ -24,6 +24,10 @@ void *memset(void* p, int what, size_t sz);
 int   memcmp(const void* s1, const void* s2, size_t sz);
 void *memcpy(void* dst, const void* src, size_t sz);
 void *memmove(void *dst, const void* src, size_t sz);
+/* Portable versions, which memset and memcpy use when the arch has nothing
+ * better. */
+void *memset_generic(void *p, int what, size_t sz);
+void *memcpy_generic(void *dst, const void *src, size_t sz);
 void *memchr(const void *mem, int chr, int len);
 
 void *memfind(const void *s, int c, size_t len);
@@ -38,6 +42,14 @@ void *sigscan(uint8_t *address, int length, char *signature);
 /* In arch/support64.S */
 void bcopy(const void *src, void *dst, size_t len);
 
+#ifdef CONFIG_X86
+/* In arch/string64.S */
+void *memcpy_erms(void *dst, const void *src, size_t len);
+void *memset_erms(void *dst, int c, size_t len);
+void *memcpy_nt(void *dst, const void *src, size_t len);
+void *memset_nt(void *dst, int c, size_t len);
+#endif
+
 #ifdef CONFIG_RISCV
 #warning Implement bcopy
 #endif
@@ -29,12 +29,19 @@ struct tree_filesystem;
  * - NEG entries are always kref == 0, and are on the LRU list if they are in
  *   the tree.  They are never increffed, only rcu-read.
  */
+/* Bucket locks: bucket_locks[i] covers every bucket whose index starts with
+ * the bits of i, at every size of the table.  Growing the table takes all of
+ * them. */
+#define WC_NR_BUCKET_LOCKS HASH_INIT_SZ
+
 struct walk_cache {
 	spinlock_t					lru_lock;
 	struct list_head			lru;
-	spinlock_t					ht_lock;
+	spinlock_t					ht_lock;	/* serializes growing */
+	seq_ctr_t					ht_seq;		/* odd while growing */
 	struct hash_helper			hh;		/* parts are rcu-read */
 	struct hlist_head			*ht;
+	spinlock_t					bucket_locks[WC_NR_BUCKET_LOCKS];
 	struct hlist_head			static_ht[HASH_INIT_SZ];
 };
 
@@ -280,6 +287,6 @@ void tfs_frontend_purge(struct tree_filesystem *tfs,
 void __tfs_dump(struct tree_filesystem *tfs);
 void __tfs_dump_tf(struct tree_file *tf);
 
-void tfs_lru_for_each(struct tree_filesystem *tfs, bool cb(struct tree_file *),
-                      size_t max_tfs);
-void tfs_lru_prune_neg(struct tree_filesystem *tfs);
+size_t tfs_lru_for_each(struct tree_filesystem *tfs,
+                        bool cb(struct tree_file *), size_t max_tfs);
+size_t tfs_lru_prune_neg(struct tree_filesystem *tfs);
@@ -0,0 +1,13 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Pools of pre-zeroed pages.  See zero_pool.c. */
+
+#pragma once
+
+#include <ros/common.h>
+
+struct page;
+
+void zero_pool_init(void);
+struct page *zero_pool_get(int node);
@@ -21,19 +21,15 @@
  * the base arena using an aligned allocation helper for its afunc.  I think,
  * without a lot of thought, that the fragmentation would be equivalent.
  *
- * In the future, we can set up N base_arenas, one for each NUMA domain, each of
- * which is a source for other NUMA allocators, e.g. kpages_i_arena.  Higher
- * level allocators (kmalloc()) will need to choose a NUMA domain and call into
- * the correct allocator.  Each NUMA base arena is self-sufficient: they have no
- * qcaches and their BTs come from their own free page list.  This just
- * replicates the default memory allocator across each NUMA node, and at some
- * point, some generic allocator software needs to pick which node to pull from.
- * I tried to keep assumptions about a single base_arena to a minimum, but
- * you'll see some places where the arena code needs to find some base arena for
- * its BT allocations.  Also note that the base setup happens before we know
- * about NUMA domains.  The plan is to do a small part of domain 0 during
- * pmem_init(), then once we know the full memory layout, add in the rest of
- * domain 0's memory and bootstrap the other domains.
+ * There are N base arenas, one for each NUMA domain, each of which is a source
+ * for other NUMA allocators, e.g. kpages_i_arena.  Higher level allocators
+ * (kmalloc(), kpages_alloc()) choose a NUMA domain and call into the correct
+ * allocator.  Each NUMA base arena is self-sufficient: they have no qcaches and
+ * their BTs come from their own free page list.  This just replicates the
+ * default memory allocator across each NUMA node; see numa.c.  Note that the
+ * base setup happens before we know about NUMA domains.  pmem_init() puts all
+ * of memory in domain 0 (base_arena), then once we know the layout, the other
+ * domains' free memory is carved out of base_arena into their own arenas.
  *
  * When it comes to importing spans, it's not clear whether or not we should
  * import exactly the current allocation request or to bring in more.  If we
@@ -49,8 +45,13 @@
  *   help us get out of OOM.  So we might block when we're at low-mem, not at 0.
  *   We probably should have a sorted list of desired amounts, and unblockers
  *   poke the CV if the first waiter is likely to succeed.
- * - Reclaim: have a ktask that sleeps on a rendez.  We poke it, even from IRQ
- *   context.  It qlocks arenas_and_slabs_lock, then does the reclaim.
+ *
+ * Reclaim: base arenas poke the reclaim ktask (reclaim.c) when they run low,
+ * even from IRQ context.  It qlocks arenas_and_slabs_lock, then does the
+ * reclaim.  Importing arenas only hang on to free memory in their qcaches, since
+ * a span goes back to the source as soon as it is entirely free.  So to release
+ * spans, arena_reclaim() empties the qcaches.  MEM_WAIT allocations that find a
+ * base arena empty try a direct reclaim before giving up.
  *
  * FAQ:
  * - Does allocating memory from an arena require it to take a btag?  Yes -
@@ -78,6 +79,7 @@
 #include <hash.h>
 #include <slab.h>
 #include <kthread.h>
+#include <reclaim.h>
 
 struct arena_tailq all_arenas = TAILQ_HEAD_INITIALIZER(all_arenas);
 qlock_t arenas_and_slabs_lock = QLOCK_INITIALIZER(arenas_and_slabs_lock);
@@ -97,14 +99,14 @@ static void __arena_asserter(struct arena *arena);
 void print_arena_stats(struct arena *arena, bool verbose);
 
 /* For NUMA situations, where there are multiple base arenas, we'll need a way
- * to find *some* base arena.  Ideally, it'll be in the same NUMA domain as
- * arena. */
+ * to find *some* base arena.  We walk down arena's sources, so that a NUMA
+ * node's arenas get their BTs from the node's base.  Arenas that don't import
+ * from a base (and a NULL arena) get base_arena, which is node 0's. */
 static struct arena *find_my_base(struct arena *arena)
 {
-	/* TODO: could walk down sources until is_base is set.  But barring that,
-	 * we'd still need a way to find a base arena for some other allocator that
-	 * just wants a page.  arena may be NULL, so handle that. */
-	return base_arena;
+	while (arena && !arena->is_base)
+		arena = arena->source;
+	return arena ? arena : base_arena;
 }
 
 static void setup_qcaches(struct arena *arena, size_t quantum,
@@ -598,6 +600,8 @@ static void *alloc_from_arena(struct arena *arena, size_t size, int flags)
 	spin_unlock_irqsave(&arena->lock);
 	if (to_free_addr)
 		base_free(arena, to_free_addr, to_free_sz);
+	if (arena->is_base)
+		reclaim_check_arena(arena);
 	return ret;
 }
 
@@ -681,9 +685,13 @@ static bool get_more_resources(struct arena *arena, size_t size, int flags)
 			return FALSE;
 		}
 	} else {
+		reclaim_poke();
 		/* TODO: allow blocking */
-		if (!(flags & MEM_ATOMIC))
+		if (!(flags & MEM_ATOMIC)) {
+			if (reclaim_direct())
+				return TRUE;
 			panic("OOM!");
+		}
 		return FALSE;
 	}
 	return TRUE;
@@ -947,6 +955,8 @@ static void *xalloc_from_arena(struct arena *arena, size_t size,
 	spin_unlock_irqsave(&arena->lock);
 	if (to_free_addr)
 		base_free(arena, to_free_addr, to_free_sz);
+	if (arena->is_base)
+		reclaim_check_arena(arena);
 	return ret;
 }
 
@@ -1183,6 +1193,20 @@ static void __arena_asserter(struct arena *arena)
 	assert(arena->hh.nr_items == nr_allocs);
 }
 
+/* Empties the arena's qcaches, giving their segments back to the arena.  Any
+ * span that ends up entirely free goes back to our source.  Call this on
+ * importers before their sources.  Returns the number of qcache slabs freed. */
+size_t arena_reclaim(struct arena *arena)
+{
+	size_t nr_freed = 0;
+
+	for (int i = 0; i < arena->qcache_max / arena->quantum; i++) {
+		kmem_cache_trim_depot(&arena->qcaches[i]);
+		nr_freed += kmem_cache_reap(&arena->qcaches[i]);
+	}
+	return nr_freed;
+}
+
 size_t arena_amt_free(struct arena *arena)
 {
 	return arena->amt_total_segs - arena->amt_alloc_segs;
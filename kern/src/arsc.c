@@ -1,124 +1,308 @@
-/* See COPYRIGHT for copyright information. */
+/* See COPYRIGHT for copyright information.
+ *
+ * Asynchronous remote syscalls (arsc).
+ *
+ * A process sets up a ring of syscall requests in its procdata
+ * (sys_init_arsc()) and queues struct syscall pointers on it.  A server ktask
+ * on a dedicated core pulls them off and runs them.  The process never traps,
+ * and its cores keep running its code while the server does the work.
+ *
+ * There is one server per arsc core: the top CONFIG_ARSC_SERVER_CORES cores,
+ * which the ksched won't hand out (is_arsc_core()).  Each process gets one
+ * server, round-robin, when it sets up its ring.
+ *
+ * The ring is only for submission.  The server takes a request, frees its slot
+ * right away (pushes the response), and sends the syscall to its own core as a
+ * routine kmsg.  Each of those runs in its own kthread, so a syscall that blocks
+ * only blocks itself: the core goes on to the next kmsg, and the server keeps
+ * draining the ring.  Completions work like for any other async syscall: the
+ * kernel sets SC_DONE and, if the syscall has SC_UEVENT and an ev_q, sends an
+ * EV_SYSCALL event.  Userspace usually points them all at one UCQ (see
+ * parlib/arc.h).
+ *
+ * When its rings are empty, a server polls for ARSC_POLL_USEC, then arms every
+ * ring's req_event (the ring's notification hold-off) and sleeps on a rendez.
+ * A process that pushes past req_event needs to sys_arsc_kick(), which sends a
+ * kmsg to the server's core to wake it.  While the server is busy, no one kicks.
+ *
+ * Syscalls that need the caller's core or context (yield, fork, exec, etc.)
+ * fail with ENOTSUP.  See run_remote_syscall().
+ *
+ * Counters are in #vars. */
 
 #include <ros/common.h>
 #include <ros/ring_syscall.h>
 #include <arch/types.h>
 #include <arch/arch.h>
-#include <arch/mmu.h>
 #include <error.h>
 
 #include <syscall.h>
 #include <kmalloc.h>
 #include <pmap.h>
 #include <stdio.h>
-#include <hashtable.h>
 #include <smp.h>
 #include <arsc_server.h>
-#include <kref.h>
+#include <corerequest.h>
+#include <kthread.h>
+#include <rendez.h>
+#include <trap.h>
+#include <umem.h>
+#include <mm.h>
+#include <time.h>
+#include <ns.h>
 
+/* Most requests we take from one ring before moving on to the next */
+#define ARSC_BATCH				32
+/* How long an idle server polls its rings before sleeping */
+#define ARSC_POLL_USEC			50
 
+struct arsc_server {
+	qlock_t						qlock;	/* protects procs */
+	struct proc_list			procs;
+	struct rendez				rv;
+	atomic_t					kicked;
+	uint32_t					coreid;
+	char						name[16];
+};
 
-struct proc_list arsc_proc_list = TAILQ_HEAD_INITIALIZER(arsc_proc_list);
-spinlock_t arsc_proc_lock = SPINLOCK_INITIALIZER_IRQSAVE;
+static struct arsc_server arsc_servers[CONFIG_ARSC_SERVER_CORES];
+static unsigned int nr_arsc_servers;
+static atomic_t arsc_next_srv;
 
-intreg_t inline syscall_async(struct proc *p, syscall_req_t *call)
+uint64_t arsc_nr_syscalls;
+uint64_t arsc_nr_sleeps;
+uint64_t arsc_nr_kicks;
+
+DEVVARS_ENTRY(arsc_nr_syscalls, "ug");
+DEVVARS_ENTRY(arsc_nr_sleeps, "ug");
+DEVVARS_ENTRY(arsc_nr_kicks, "ug");
+
+static void __arsc_wake(uint32_t srcid, long a0, long a1, long a2)
 {
-	struct syscall* sc = call->sc;
-	return syscall(p, sc->num, sc->arg0, sc->arg1,
-	               sc->arg2, sc->arg3, sc->arg4, sc->arg5);
+	struct arsc_server *srv = (struct arsc_server*)a0;
+
+	rendez_wakeup(&srv->rv);
 }
 
-syscall_sring_t* sys_init_arsc(struct proc *p)
+/* Safe to call from any context.  The wakeup goes to the server's core, which
+ * is where its ktask should run. */
+static void arsc_kick(struct arsc_server *srv)
 {
-	kref_get(&p->p_kref, 1);		/* we're storing an external ref here */
-	syscall_sring_t* sring;
-	void * va;
-	// TODO: need to pin this page in the future when swapping happens
-	va = do_mmap(p,MMAP_LOWEST_VA, SYSCALLRINGSIZE, PROT_READ | PROT_WRITE,
-	             MAP_ANONYMOUS | MAP_POPULATE | MAP_PRIVATE, NULL, 0);
-	pte_t pte = pgdir_walk(p->env_pgdir, (void*)va, 0);
-	assert(pte_walk_okay(pte));
-	sring = (syscall_sring_t*) KADDR(pte_get_paddr(pte));
-	/*make sure we are able to allocate the shared ring */
-	assert(sring != NULL);
- 	p->procdata->syscallring = sring;
-	/* Initialize the generic syscall ring buffer */
-	SHARED_RING_INIT(sring);
+	if (atomic_swap(&srv->kicked, 1))
+		return;
+	arsc_nr_kicks++;
+	send_kernel_message(srv->coreid, __arsc_wake, (long)srv, 0, 0,
+	                    KMSG_ROUTINE);
+}
+
+/* Runs one syscall for a0 (a counted ref) on this core, in its own kthread. */
+static void __arsc_run_sysc(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct proc *p = (struct proc*)a0;
+	struct syscall *sysc = (struct syscall*)a1;
+
+	/* Like a syscall trap, p is current with a counted ref, so that we can
+	 * block.  We leave it loaded; the core drops it when it idles. */
+	__set_proc_current(p);
+	proc_decref(p);
+	run_remote_syscall(sysc);
+	arsc_nr_syscalls++;
+}
+
+/* Takes up to ARSC_BATCH requests off p's ring and sends them to our core as
+ * kmsgs.  Returns how many we took. */
+static unsigned int arsc_take_reqs(struct proc *p)
+{
+	syscall_back_ring_t *sysbr = &p->syscallbackring;
+	syscall_req_t *req;
+	unsigned int nr = 0;
+
+	/* The ring is in p's procdata, and sysbr points at the kernel's mapping
+	 * of it.  It's there as long as p is, and we hold a ref.  The struct
+	 * syscall it points to is a user address, which run_remote_syscall()
+	 * handles. */
+	/* RING_HAS_UNCONSUMED_REQUESTS() never says more than the size of the
+	 * ring, regardless of what the user wrote to req_prod. */
+	while (nr < ARSC_BATCH && RING_HAS_UNCONSUMED_REQUESTS(sysbr)) {
+		req = RING_GET_REQUEST(sysbr, sysbr->req_cons++);
+		proc_incref(p, 1);
+		send_kernel_message(core_id(), __arsc_run_sysc, (long)p,
+		                    (long)ACCESS_ONCE(req->sc), 0, KMSG_ROUTINE);
+		req->status = REQ_processing;
+		/* We're done with the slot; userspace can reuse it. */
+		sysbr->rsp_prod_pvt++;
+		nr++;
+	}
+	if (nr)
+		RING_PUSH_RESPONSES(sysbr);
+	return nr;
+}
+
+/* Sets p's req_event, so p kicks us on its next request.  Returns TRUE if
+ * there are requests already. */
+static bool arsc_arm_ring(struct proc *p)
+{
+	syscall_back_ring_t *sysbr = &p->syscallbackring;
+	int work_to_do;
+
+	RING_FINAL_CHECK_FOR_REQUESTS(sysbr, work_to_do);
+	return work_to_do ? TRUE : FALSE;
+}
+
+/* One pass over all of the server's processes.  Drops the ones that are dying.
+ * Returns how many requests we took. */
+static unsigned int arsc_drain(struct arsc_server *srv)
+{
+	struct proc *p, *temp;
+	unsigned int nr = 0;
+
+	qlock(&srv->qlock);
+	TAILQ_FOREACH_SAFE(p, &srv->procs, proc_arsc_link, temp) {
+		if (proc_is_dying(p)) {
+			TAILQ_REMOVE(&srv->procs, p, proc_arsc_link);
+			proc_decref(p);
+			continue;
+		}
+		nr += arsc_take_reqs(p);
+	}
+	qunlock(&srv->qlock);
+	return nr;
+}
+
+/* Arms every ring.  Returns TRUE if any of them had work. */
+static bool arsc_arm_rings(struct arsc_server *srv)
+{
+	struct proc *p;
+	bool work = FALSE;
+
+	qlock(&srv->qlock);
+	TAILQ_FOREACH(p, &srv->procs, proc_arsc_link)
+		work |= arsc_arm_ring(p);
+	qunlock(&srv->qlock);
+	return work;
+}
 
-	BACK_RING_INIT(&p->syscallbackring,
-	               sring,
-	               SYSCALLRINGSIZE);
+static int arsc_was_kicked(void *arg)
+{
+	struct arsc_server *srv = arg;
 
-	spin_lock_irqsave(&arsc_proc_lock);
-	TAILQ_INSERT_TAIL(&arsc_proc_list, p, proc_arsc_link);
-	spin_unlock_irqsave(&arsc_proc_lock);
-	return (syscall_sring_t*)va;
+	return atomic_read(&srv->kicked);
 }
 
-void arsc_server(uint32_t srcid, long a0, long a1, long a2)
+static void arsc_server(void *arg)
 {
-	struct proc *p = NULL;
-	TAILQ_INIT(&arsc_proc_list);
-	while (1) {
-		while (TAILQ_EMPTY(&arsc_proc_list))
-			cpu_relax();
-
-		TAILQ_FOREACH(p, &arsc_proc_list, proc_arsc_link) {
-			/* Probably want to try to process a dying process's syscalls.  If
-			 * not, just move it to an else case */
-			process_generic_syscalls (p, MAX_ASRC_BATCH);
-			if (proc_is_dying(p)) {
-				TAILQ_REMOVE(&arsc_proc_list, p, proc_arsc_link);
-				proc_decref(p);
-				/* Need to break out, so the TAILQ_FOREACH doesn't flip out.
-				 * It's not fair, but we're not dealing with that yet anyway */
-				break;
-			}
+	struct arsc_server *srv = arg;
+	uint64_t idle_start = 0;
+
+	for (;;) {
+		if (arsc_drain(srv)) {
+			idle_start = 0;
+			/* Let the syscalls we just sent ourselves run */
+			kthread_yield();
+			continue;
+		}
+		if (!idle_start)
+			idle_start = read_tsc();
+		if (tsc2usec(read_tsc() - idle_start) < ARSC_POLL_USEC) {
+			/* Anything else for this core, like kthreads restarting from a
+			 * blocked syscall, only runs if we get out of the way. */
+			if (has_routine_kmsg())
+				kthread_yield();
+			else
+				cpu_relax();
+			continue;
+		}
+		/* Clear kicked before arming, so a kick that comes in after we
+		 * checked a ring keeps us awake. */
+		atomic_set(&srv->kicked, 0);
+		if (arsc_arm_rings(srv)) {
+			idle_start = 0;
+			continue;
 		}
+		arsc_nr_sleeps++;
+		rendez_sleep(&srv->rv, arsc_was_kicked, srv);
+		idle_start = 0;
 	}
 }
 
-static intreg_t process_generic_syscalls(struct proc *p, size_t max)
+/* Sets up p's syscall ring in its procdata and assigns p to a server.  Returns
+ * the ring's user address, or 0 on error. */
+syscall_sring_t *sys_init_arsc(struct proc *p)
 {
-	size_t count = 0;
-	syscall_back_ring_t* sysbr = &p->syscallbackring;
-	struct per_cpu_info* pcpui = &per_cpu_info[core_id()];
-	uintptr_t old_proc;
-	// looking at a process not initialized to perform arsc.
-	if (sysbr == NULL)
-		return count;
-	/* Bail out if there is nothing to do */
-	if (!RING_HAS_UNCONSUMED_REQUESTS(sysbr))
+	struct arsc_server *srv;
+	syscall_sring_t *sring;
+
+	if (!nr_arsc_servers) {
+		set_error(ENOSYS, "No arsc servers (only %d cores)", num_cores);
 		return 0;
-	/* Switch to the address space of the process, so we can handle their
-	 * pointers, etc. */
-	old_proc = switch_to(p);
-	// max is the most we'll process.  max = 0 means do as many as possible
-	// TODO: check for initialization of the ring.
-	while (RING_HAS_UNCONSUMED_REQUESTS(sysbr) && ((!max)||(count < max)) ) {
-		// ASSUME: one queue per process
-		count++;
-		//printk("DEBUG PRE: sring->req_prod: %d, sring->rsp_prod: %d\n",
-		//	   sysbr->sring->req_prod, sysbr->sring->rsp_prod);
-		// might want to think about 0-ing this out, if we aren't
-		// going to explicitly fill in all fields
-		syscall_rsp_t rsp;
-		// this assumes we get our answer immediately for the syscall.
-		syscall_req_t* req = RING_GET_REQUEST(sysbr, ++sysbr->req_cons);
-
-		pcpui->cur_kthread->sysc = req->sc;
-		run_local_syscall(req->sc); // TODO: blocking call will block arcs as well.
-
-		// need to keep the slot in the ring buffer if it is blocked
-		(sysbr->rsp_prod_pvt)++;
-		req->status = RES_ready;
-		RING_PUSH_RESPONSES(sysbr);
+	}
+	srv = &arsc_servers[atomic_fetch_and_add(&arsc_next_srv, 1) %
+	                    nr_arsc_servers];
+	spin_lock(&p->proc_lock);
+	if (p->arsc_srv) {
+		spin_unlock(&p->proc_lock);
+		set_error(EBUSY, "Proc %d already has an arsc ring", p->pid);
+		return 0;
+	}
+	p->arsc_srv = srv;
+	spin_unlock(&p->proc_lock);
+	/* The server uses the kernel's mapping of procdata.  The user can't
+	 * unmap procdata, so the server never faults on the ring. */
+	sring = &p->procdata->syscallring;
+	SHARED_RING_INIT(sring);
+	BACK_RING_INIT(&p->syscallbackring, sring, SYSCALLRINGSIZE);
+	proc_incref(p, 1);	/* the server's ref */
+	qlock(&srv->qlock);
+	TAILQ_INSERT_TAIL(&srv->procs, p, proc_arsc_link);
+	qunlock(&srv->qlock);
+	/* The server could be asleep with its other rings armed */
+	arsc_kick(srv);
+	return &((procdata_t*)UDATA)->syscallring;
+}
 
-		//printk("DEBUG POST: sring->req_prod: %d, sring->rsp_prod: %d\n",
-		//	   sysbr->sring->req_prod, sysbr->sring->rsp_prod);
+/* Wakes p's server, for when p's pushes go past req_event. */
+int sys_arsc_kick(struct proc *p)
+{
+	if (!p->arsc_srv) {
+		set_error(EINVAL, "Proc %d has no arsc ring", p->pid);
+		return -1;
 	}
-	/* switch back to whatever context we were in before */
-	switch_back(p, old_proc);
-	return (intreg_t)count;
+	arsc_kick(p->arsc_srv);
+	return 0;
 }
 
+/* Gets p's server to drop its ref, so that a dying p isn't stuck waiting on a
+ * sleeping server. */
+void arsc_proc_destroy(struct proc *p)
+{
+	if (p->arsc_srv)
+		arsc_kick(p->arsc_srv);
+}
+
+static void __arsc_start(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct arsc_server *srv = (struct arsc_server*)a0;
+
+	ktask(srv->name, arsc_server, srv);
+}
+
+void arsc_init(void)
+{
+	struct arsc_server *srv;
+
+	nr_arsc_servers = nr_arsc_cores();
+	for (int i = 0; i < nr_arsc_servers; i++) {
+		srv = &arsc_servers[i];
+		qlock_init(&srv->qlock);
+		TAILQ_INIT(&srv->procs);
+		rendez_init(&srv->rv);
+		atomic_init(&srv->kicked, 0);
+		srv->coreid = num_cores - 1 - i;
+		assert(is_arsc_core(srv->coreid));
+		snprintf(srv->name, sizeof(srv->name), "arsc_%d", srv->coreid);
+		/* ktask() starts the ktask on the calling core */
+		send_kernel_message(srv->coreid, __arsc_start, (long)srv, 0, 0,
+		                    KMSG_ROUTINE);
+		printk("Using core %d for an ARSC server\n", srv->coreid);
+	}
+}
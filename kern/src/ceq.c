@@ -129,6 +129,39 @@ void send_ceq_msg(struct ceq *ceq, struct proc *p, struct event_msg *msg)
 	*ring_slot = msg->ev_type;
 }
 
+/* Sends nr messages, merging the ones for the same event first, so each event
+ * gets one atomic on its coalesce and at most one post to the ring.  The last
+ * message for an event provides its blob. */
+void send_ceq_msgs(struct ceq *ceq, struct proc *p, struct event_msg *msgs,
+                   unsigned int nr)
+{
+	struct event_msg merged;
+	bool seen;
+
+	for (int i = 0; i < nr; i++) {
+		seen = FALSE;
+		for (int j = 0; j < i; j++) {
+			if (msgs[j].ev_type == msgs[i].ev_type) {
+				seen = TRUE;
+				break;
+			}
+		}
+		if (seen)
+			continue;
+		merged = msgs[i];
+		for (int j = i + 1; j < nr; j++) {
+			if (msgs[j].ev_type != merged.ev_type)
+				continue;
+			if (ceq->operation == CEQ_ADD)
+				merged.ev_arg2 += msgs[j].ev_arg2;
+			else
+				merged.ev_arg2 |= msgs[j].ev_arg2;
+			merged.ev_arg3 = msgs[j].ev_arg3;
+		}
+		send_ceq_msg(ceq, p, &merged);
+	}
+}
+
 void ceq_dumper(int pid, struct event_queue *ev_q)
 {
 	struct proc *p;
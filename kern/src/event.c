@@ -95,6 +95,28 @@ static void post_ev_msg(struct proc *p, struct event_mbox *mbox,
 	}
 }
 
+/* Posts nr messages to the mbox, like post_ev_msg().  UCQs reserve their slots
+ * in bulk, and CEQs merge messages for the same event before touching it. */
+static void post_ev_msgs(struct proc *p, struct event_mbox *mbox,
+                         struct event_msg *msgs, unsigned int nr, int ev_flags)
+{
+	assert(p);
+	switch (mbox->type) {
+		case (EV_MBOX_UCQ):
+			send_ucq_msgs(&mbox->ucq, p, msgs, nr);
+			break;
+		case (EV_MBOX_BITMAP):
+			for (int i = 0; i < nr; i++)
+				send_evbitmap_msg(&mbox->evbm, &msgs[i]);
+			break;
+		case (EV_MBOX_CEQ):
+			send_ceq_msgs(&mbox->ceq, p, msgs, nr);
+			break;
+		default:
+			printk("[kernel] Unknown mbox type %d!\n", mbox->type);
+	}
+}
+
 /* Helper: use this when sending a message to a VCPD mbox.  It just posts to the
  * ev_mbox and sets notif pending.  Note this uses a userspace address for the
  * VCPD (though not a user's pointer). */
@@ -361,6 +383,18 @@ static void send_indir(struct proc *p, struct event_queue *ev_q,
  * where the kernel suggests, set EVENT_VCORE_APPRO(priate). */
 void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
                 uint32_t vcoreid)
+{
+	send_events(p, ev_q, msg, 1, vcoreid);
+}
+
+/* Sends nr messages to ev_q, as if by nr calls to send_event(), but we load the
+ * address space once, post the messages to the mbox in one go, and alert the
+ * vcore (INDIR/IPI) and wake the process at most once.  Use this when you have
+ * a pile of events for the same ev_q, e.g. FD taps.
+ *
+ * For EVENT_SPAM_PUBLIC ev_qs, each message is still spammed on its own. */
+void send_events(struct proc *p, struct event_queue *ev_q,
+                 struct event_msg *msgs, unsigned int nr, uint32_t vcoreid)
 {
 	uintptr_t old_proc;
 	struct event_mbox *ev_mbox = 0;
@@ -369,7 +403,9 @@ void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
 	assert(p);
 	if (proc_is_dying(p))
 		return;
-	printd("[kernel] sending msg to proc %p, ev_q %p\n", p, ev_q);
+	if (!nr)
+		return;
+	printd("[kernel] sending %d msgs to proc %p, ev_q %p\n", nr, p, ev_q);
 	if (!ev_q) {
 		warn("[kernel] Null ev_q - kernel code should check before sending!");
 		return;
@@ -395,7 +431,7 @@ void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
 	 * vcoreid parameter. */
 	if (!(ev_q->ev_flags & EVENT_VCORE_APPRO))
 		vcoreid = ev_q->ev_vcore;	/* use the ev_q's vcoreid */
-	/* Note that RR overwrites APPRO */
+	/* Note that RR overwrites APPRO.  A batch counts as one turn. */
 	if (ev_q->ev_flags & EVENT_ROUNDROBIN) {
 		/* Pick a vcore, round-robin style.  Assuming ev_vcore was the previous
 		 * one used.  Note that round-robin overrides the passed-in vcoreid.
@@ -413,7 +449,8 @@ void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
 	 * we'll prefer to send it to whatever vcoreid we determined at this point
 	 * (via APPRO or whatever). */
 	if (ev_q->ev_flags & EVENT_SPAM_PUBLIC) {
-		spam_public_msg(p, msg, vcoreid, ev_q->ev_flags);
+		for (int i = 0; i < nr; i++)
+			spam_public_msg(p, &msgs[i], vcoreid, ev_q->ev_flags);
 		goto wakeup;
 	}
 	/* We aren't spamming and we know the default vcore, and now we need to
@@ -437,10 +474,13 @@ void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
 		printk("[kernel] Illegal addr for ev_mbox\n");
 		goto out;
 	}
-	post_ev_msg(p, ev_mbox, msg, ev_q->ev_flags);
+	if (nr == 1)
+		post_ev_msg(p, ev_mbox, msgs, ev_q->ev_flags);
+	else
+		post_ev_msgs(p, ev_mbox, msgs, nr, ev_q->ev_flags);
 	wmb();	/* ensure ev_msg write is before alerting the vcore */
 	/* Prod/alert a vcore with an IPI or INDIR, if desired.  INDIR will also
-	 * call try_notify (IPI) later */
+	 * call try_notify (IPI) later.  One alert covers the whole batch. */
 	if (ev_q->ev_flags & EVENT_INDIR) {
 		send_indir(p, ev_q, vcoreid);
 	} else {
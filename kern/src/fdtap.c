@@ -11,6 +11,9 @@
 #include <syscall.h>
 #include <error.h>
 #include <umem.h>
+#include <percpu.h>
+#include <smp.h>
+#include <process.h>
 
 static void tap_min_release(struct kref *kref)
 {
@@ -141,18 +144,161 @@ int remove_fd_tap(struct proc *p, int fd)
 	}
 }
 
+/* Fired taps don't send their events right away.  They go into a per-core
+ * batch, and a routine kmsg on that core sends the whole batch later, e.g.
+ * after the network stack has gone through its pending packets or after core 0
+ * has run every alarm that went off.  The flush groups events by process and
+ * ev_q, so a busy process gets one address space switch, one bulk post to its
+ * mbox, and one alert per ev_q for a pile of taps, instead of one each.
+ *
+ * Each batched event holds a ref on its process, since the tap could be removed
+ * and the process could exit before we flush.  If the batch is full, we just
+ * send the event now.  Tap events are edge notifications ('this FD became
+ * readable'), so no one cares about their order across ev_qs. */
+#define FDTAP_BATCH_SZ			64
+#define FDTAP_BATCH_EV_Q_SZ		16
+
+struct fdtap_event {
+	struct proc					*proc;
+	struct event_queue			*ev_q;
+	struct event_msg			msg;
+};
+
+struct fdtap_batch {
+	spinlock_t					lock;
+	bool						flush_sent;
+	unsigned int				nr;
+	struct fdtap_event			events[FDTAP_BATCH_SZ];
+};
+
+static DEFINE_PERCPU(struct fdtap_batch, fdtap_batch);
+DEFINE_PERCPU_INIT(fdtap_batch_init);
+
+static void fdtap_batch_init(void)
+{
+	for (int i = 0; i < num_cores; i++) {
+		struct fdtap_batch *fb = _PERCPU_VARPTR(fdtap_batch, i);
+
+		spinlock_init(&fb->lock);
+		fb->flush_sent = FALSE;
+		fb->nr = 0;
+	}
+}
+
+/* Pulls the first event out of fb, along with up to FDTAP_BATCH_EV_Q_SZ - 1
+ * others for the same proc and ev_q.  Returns how many we got.  The caller gets
+ * one proc ref for the lot; we drop the others. */
+static unsigned int fdtap_batch_pop(struct fdtap_batch *fb,
+                                    struct fdtap_event *first,
+                                    struct event_msg *msgs)
+{
+	unsigned int nr = 0, keep = 0;
+	struct fdtap_event *ev;
+
+	spin_lock(&fb->lock);
+	if (!fb->nr) {
+		fb->flush_sent = FALSE;
+		spin_unlock(&fb->lock);
+		return 0;
+	}
+	*first = fb->events[0];
+	for (int i = 0; i < fb->nr; i++) {
+		ev = &fb->events[i];
+		if (nr < FDTAP_BATCH_EV_Q_SZ && ev->proc == first->proc &&
+		    ev->ev_q == first->ev_q) {
+			msgs[nr++] = ev->msg;
+			/* All but the first event's ref get dropped right away; the
+			 * caller's one ref covers the group. */
+			if (i)
+				proc_decref(ev->proc);
+			continue;
+		}
+		fb->events[keep++] = *ev;
+	}
+	fb->nr = keep;
+	spin_unlock(&fb->lock);
+	return nr;
+}
+
+static void __fdtap_flush(uint32_t srcid, long a0, long a1, long a2)
+{
+	ERRSTACK(1);
+	struct fdtap_batch *fb = PERCPU_VARPTR(fdtap_batch);
+	struct fdtap_event first;
+	struct event_msg msgs[FDTAP_BATCH_EV_Q_SZ];
+	unsigned int nr;
+	struct proc *cur_p = NULL;
+	uintptr_t old_proc = 0;
+
+	while ((nr = fdtap_batch_pop(fb, &first, msgs))) {
+		/* Stay in the last group's address space until we're done, so that
+		 * groups for the same process don't switch back and forth.  We keep
+		 * one ref on the process we're in. */
+		if (first.proc != cur_p) {
+			if (!cur_p) {
+				old_proc = switch_to(first.proc);
+			} else {
+				switch_to(first.proc);
+				proc_decref(cur_p);
+			}
+			cur_p = first.proc;
+		} else {
+			proc_decref(first.proc);
+		}
+		if (waserror()) {
+			/* The process owning the tap could trigger a kernel PF, as with
+			 * any send_event() call.  Eventually we'll catch that with
+			 * waserror. */
+			warn("Taps for proc %d threw %s", cur_p->pid, current_errstr());
+		} else {
+			send_events(cur_p, first.ev_q, msgs, nr, 0);
+		}
+		poperror();
+	}
+	if (cur_p) {
+		switch_back(cur_p, old_proc);
+		proc_decref(cur_p);
+	}
+}
+
 /* Fires off tap, with the events of filter having occurred.  Returns -1 on
  * error, though this need a little more thought.
  *
+ * The event is sent later, from a routine kmsg on this core; see above.
+ *
  * Some callers may require this to not block. */
 int fire_tap(struct fd_tap *tap, int filter)
 {
 	ERRSTACK(1);
+	struct fdtap_batch *fb = PERCPU_VARPTR(fdtap_batch);
+	struct fdtap_event *ev;
 	struct event_msg ev_msg = {0};
 	int fire_filt = tap->filter & filter;
+	bool send_flush = FALSE;
 
 	if (!fire_filt)
 		return 0;
+	ev_msg.ev_type = tap->ev_id;	/* e.g. CEQ idx */
+	ev_msg.ev_arg2 = fire_filt;		/* e.g. CEQ coalesce */
+	ev_msg.ev_arg3 = tap->data;		/* e.g. CEQ data */
+	spin_lock(&fb->lock);
+	if (fb->nr < FDTAP_BATCH_SZ) {
+		ev = &fb->events[fb->nr++];
+		proc_incref(tap->proc, 1);
+		ev->proc = tap->proc;
+		ev->ev_q = tap->ev_q;
+		ev->msg = ev_msg;
+		if (!fb->flush_sent) {
+			fb->flush_sent = TRUE;
+			send_flush = TRUE;
+		}
+		spin_unlock(&fb->lock);
+		if (send_flush)
+			send_kernel_message(core_id(), __fdtap_flush, 0, 0, 0,
+			                    KMSG_ROUTINE);
+		return 0;
+	}
+	spin_unlock(&fb->lock);
 	if (waserror()) {
 		/* The process owning the tap could trigger a kernel PF, as with any
 		 * send_event() call.  Eventually we'll catch that with waserror. */
@@ -161,9 +307,6 @@ int fire_tap(struct fd_tap *tap, int filter)
 		poperror();
 		return -1;
 	}
-	ev_msg.ev_type = tap->ev_id;	/* e.g. CEQ idx */
-	ev_msg.ev_arg2 = fire_filt;		/* e.g. CEQ coalesce */
-	ev_msg.ev_arg3 = tap->data;		/* e.g. CEQ data */
 	send_event(tap->proc, tap->ev_q, &ev_msg, 0);
 	poperror();
 	return 0;
@@ -39,6 +39,8 @@
 #include <acpi.h>
 #include <coreboot_tables.h>
 #include <rcu.h>
+#include <reclaim.h>
+#include <zero_pool.h>
 
 #define MAX_BOOT_CMDLINE_SIZE 4096
 
@@ -136,6 +138,7 @@ void kernel_init(multiboot_info_t *mboot_info)
 	num_cores = get_early_num_cores();
 	pmem_init(multiboot_kaddr);
 	kmalloc_init();
+	jumbo_arena_init();
 	vmap_init();
 	hashtable_init();
 	radix_init();
@@ -157,6 +160,8 @@ static void __kernel_init_part_deux(void *arg)
 	time_init();
 	arch_init();
 	rcu_init();
+	reclaim_init();
+	zero_pool_init();
 	enable_irq();
 	run_linker_funcs();
 	/* reset/init devtab after linker funcs 3 and 4.  these run NIC and medium
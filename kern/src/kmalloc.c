@@ -11,6 +11,7 @@
 #include <kmalloc.h>
 #include <stdio.h>
 #include <slab.h>
+#include <numa.h>
 #include <assert.h>
 
 #define kmallocdebug(args...)  //printk(args)
@@ -19,47 +20,87 @@
 static spinlock_t pages_list_lock = SPINLOCK_INITIALIZER;
 static page_list_t pages_list;
 
-struct kmem_cache *kmalloc_caches[NUM_KMALLOC_CACHES];
+/* Node 0's caches are made at boot.  The other nodes' caches pull from their
+ * node's kpages arena, and are made when the node's memory shows up. */
+struct kmem_cache *kmalloc_caches[MAX_NUMA_NODES][NUM_KMALLOC_CACHES];
 
 static void __kfree_release(struct kref *kref);
 
+/* Inverse of kmalloc_cache_id(): the object size of cache_id's cache. */
+size_t kmalloc_class_size(int cache_id)
+{
+	int order, step;
+
+	if (!cache_id)
+		return KMALLOC_SMALLEST;
+	order = (cache_id - 1) / KMALLOC_CLASS_STEPS + KMALLOC_SMALLEST_SHIFT;
+	step = (cache_id - 1) % KMALLOC_CLASS_STEPS;
+	return (1UL << order) + (step + 1) * (1UL << (order - 2));
+}
+
 void kmalloc_init(void)
 {
 	char kc_name[KMC_NAME_SZ];
+	size_t ksize;
 
 	/* we want at least a 16 byte alignment of the tag so that the bufs kmalloc
 	 * returns are 16 byte aligned.  we used to check the actual size == 16,
 	 * since we adjusted the KMALLOC_SMALLEST based on that. */
 	static_assert(ALIGNED(sizeof(struct kmalloc_tag), 16));
+	static_assert(KMALLOC_SMALLEST >= 4 * KMALLOC_ALIGNMENT);
 	/* build caches of common sizes.  this size will later include the tag and
 	 * the actual returned buffer. */
-	size_t ksize = KMALLOC_SMALLEST;
 	for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
+		ksize = kmalloc_class_size(i);
+		assert(kmalloc_cache_id(ksize) == i);
 		snprintf(kc_name, KMC_NAME_SZ, "kmalloc_%d", ksize);
-		kmalloc_caches[i] = kmem_cache_create(kc_name, ksize, KMALLOC_ALIGNMENT,
-		                                      0, NULL, 0, 0, NULL);
-		ksize <<= 1;
+		kmalloc_caches[0][i] = kmem_cache_create(kc_name, ksize,
+		                                         KMALLOC_ALIGNMENT, 0, NULL, 0,
+		                                         0, NULL);
+	}
+}
+
+void kmalloc_init_node(int node)
+{
+	char kc_name[KMC_NAME_SZ];
+	size_t ksize;
+
+	for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
+		ksize = kmalloc_class_size(i);
+		snprintf(kc_name, KMC_NAME_SZ, "kmalloc_n%d_%d", node, ksize);
+		kmalloc_caches[node][i] = kmem_cache_create(kc_name, ksize,
+		                                            KMALLOC_ALIGNMENT, 0,
+		                                            kpages_arenas[node], 0, 0,
+		                                            NULL);
 	}
 }
 
 void *kmalloc(size_t size, int flags)
+{
+	return kmalloc_node(size, flags, numa_node());
+}
+
+/* Allocates from @node's memory, if it has any.  If not, or if the node is out
+ * of memory, you'll get memory from somewhere else. */
+void *kmalloc_node(size_t size, int flags, int node)
 {
 	// reserve space for bookkeeping and preserve alignment
 	size_t ksize = size + sizeof(struct kmalloc_tag);
+	struct kmem_cache *kc;
 	void *buf;
 	int cache_id;
+
+	if ((node < 0) || (node >= MAX_NUMA_NODES))
+		node = 0;
 	// determine cache to pull from
-	if (ksize <= KMALLOC_SMALLEST)
-		cache_id = 0;
-	else
-		cache_id = LOG2_UP(ksize) - LOG2_UP(KMALLOC_SMALLEST);
+	cache_id = kmalloc_cache_id(ksize);
 	// if we don't have a cache to handle it, alloc cont pages
 	if (cache_id >= NUM_KMALLOC_CACHES) {
 		/* The arena allocator will round up too, but we want to know in advance
 		 * so that krealloc can avoid extra allocations. */
 		size_t amt_alloc = ROUNDUP(size + sizeof(struct kmalloc_tag), PGSIZE);
 
-		buf = kpages_alloc(amt_alloc, flags);
+		buf = kpages_alloc_node(amt_alloc, flags, node);
 		if (!buf)
 			panic("Kmalloc failed!  Handle me!");
 		// fill in the kmalloc tag
@@ -71,18 +112,42 @@ void *kmalloc(size_t size, int flags)
 		return buf + sizeof(struct kmalloc_tag);
 	}
 	// else, alloc from the appropriate cache
-	buf = kmem_cache_alloc(kmalloc_caches[cache_id], flags);
+	kc = kmalloc_caches[node][cache_id];
+	if (!kc)
+		kc = kmalloc_caches[0][cache_id];
+	buf = kmem_cache_alloc(kc, flags);
 	if (!buf)
 		panic("Kmalloc failed!  Handle me!");
 	// store a pointer to the buffers kmem_cache in it's bookkeeping space
 	struct kmalloc_tag *tag = buf;
 	tag->flags = KMALLOC_TAG_CACHE;
-	tag->my_cache = kmalloc_caches[cache_id];
+	tag->my_cache = kc;
 	tag->canary = KMALLOC_CANARY;
 	kref_init(&tag->kref, __kfree_release, 1);
 	return buf + sizeof(struct kmalloc_tag);
 }
 
+/* Untagged slab objects don't record their cache, so the free side has to be
+ * able to recompute it.  We can't go by the node the memory is on: a node's
+ * caches can hold memory from other nodes when their arenas fall back.  So both
+ * sides use node 0's caches, picked by size alone.  Page-sized allocations are
+ * still node-local; kpages_free finds their arena by address. */
+void *__kmalloc_sized(size_t size, int cache_id, int flags)
+{
+	if (cache_id >= NUM_KMALLOC_CACHES)
+		return kpages_alloc_node(ROUNDUP(size, PGSIZE), flags, numa_node());
+	return kmem_cache_alloc(kmalloc_caches[0][cache_id], flags);
+}
+
+void __kfree_sized(void *buf, size_t size, int cache_id)
+{
+	if (cache_id >= NUM_KMALLOC_CACHES) {
+		kpages_free(buf, ROUNDUP(size, PGSIZE));
+		return;
+	}
+	kmem_cache_free(kmalloc_caches[0][cache_id], buf);
+}
+
 void *kzmalloc(size_t size, int flags)
 {
 	void *v = kmalloc(size, flags);
@@ -92,6 +157,16 @@ void *kzmalloc(size_t size, int flags)
 	return v;
 }
 
+void *kzmalloc_node(size_t size, int flags, int node)
+{
+	void *v = kmalloc_node(size, flags, node);
+
+	if (!v)
+		return v;
+	memset(v, 0, size);
+	return v;
+}
+
 void *kmalloc_align(size_t size, int flags, size_t align)
 {
 	void *addr, *retaddr;
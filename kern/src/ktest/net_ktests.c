@@ -44,6 +44,37 @@ bool test_ptclbsum(void)
 	return true;
 }
 
+/* Copies and checksums at every src/dst alignment mod 8, for lengths that
+ * cover the unrolled loops and every possible tail. */
+bool test_memcpy_and_csum(void)
+{
+	uint8_t src[300], dst[300];
+	uint16_t csum, expected;
+	int s_off, d_off, len;
+
+	for (int i = 0; i < sizeof(src); i++)
+		src[i] = (i * 7 + 3) & 0xff;
+	for (s_off = 0; s_off < 8; s_off++) {
+		for (d_off = 0; d_off < 8; d_off++) {
+			for (len = 0; len <= sizeof(src) - 8; len++) {
+				memset(dst, 0xaa, sizeof(dst));
+				csum = memcpy_and_csum(dst + d_off, src + s_off, len);
+				expected = simplesum(src + s_off, len);
+				if (csum != expected) {
+					printk("s_off %d d_off %d len %d csum %04x expected %04x\n",
+					       s_off, d_off, len, csum, expected);
+					return false;
+				}
+				KT_ASSERT_M("memcpy_and_csum should copy",
+				            !memcmp(dst + d_off, src + s_off, len));
+				KT_ASSERT_M("memcpy_and_csum should not overrun",
+				            dst[d_off + len] == 0xaa);
+			}
+		}
+	}
+	return true;
+}
+
 #define CSUM_BENCH_BUFSIZE 4000
 
 bool test_simplesum_bench(void)
@@ -80,10 +111,102 @@ bool test_ptclbsum_bench(void)
 	return true;
 }
 
+#define CSUM_GBPS_BUFSIZE (64 * 1024)
+#define CSUM_GBPS_LOOPS 1000
+
+static void report_gbps(const char *what, uint64_t bytes, uint64_t ns)
+{
+	/* bytes / ns = GB/s.  Print hundredths, since we lack %f. */
+	printk("%s: %llu bytes in %llu ns, %llu.%02llu GB/s\n", what, bytes, ns,
+	       bytes / MAX(ns, 1), (bytes * 100 / MAX(ns, 1)) % 100);
+}
+
+/* Reports throughput of the checksum and the fused copy+csum, compared to a
+ * plain copy followed by a checksum. */
+bool test_csum_gbps(void)
+{
+	uint8_t *src, *dst;
+	uint64_t start, bytes;
+	uint16_t csum = 0;
+
+	src = kmalloc(CSUM_GBPS_BUFSIZE, MEM_WAIT);
+	dst = kmalloc(CSUM_GBPS_BUFSIZE, MEM_WAIT);
+	for (int i = 0; i < CSUM_GBPS_BUFSIZE; i++)
+		src[i] = i & 0xff;
+	bytes = (uint64_t)CSUM_GBPS_BUFSIZE * CSUM_GBPS_LOOPS;
+
+	start = nsec();
+	for (int i = 0; i < CSUM_GBPS_LOOPS; i++)
+		csum += ptclbsum(src, CSUM_GBPS_BUFSIZE);
+	report_gbps("ptclbsum", bytes, nsec() - start);
+
+	start = nsec();
+	for (int i = 0; i < CSUM_GBPS_LOOPS; i++) {
+		memcpy(dst, src, CSUM_GBPS_BUFSIZE);
+		csum += ptclbsum(dst, CSUM_GBPS_BUFSIZE);
+	}
+	report_gbps("memcpy, then ptclbsum", bytes, nsec() - start);
+
+	start = nsec();
+	for (int i = 0; i < CSUM_GBPS_LOOPS; i++)
+		csum += memcpy_and_csum(dst, src, CSUM_GBPS_BUFSIZE);
+	report_gbps("memcpy_and_csum", bytes, nsec() - start);
+
+	kfree(src);
+	kfree(dst);
+	return true;
+}
+
+/* Builds a batch of nr msgs, msg i being i + 1 bytes of 'a' + i.  Returns the
+ * batch length. */
+static size_t build_msg_batch(uint8_t *buf, int nr)
+{
+	uint8_t *p = buf;
+
+	for (int i = 0; i < nr; i++) {
+		PBIT32(p, i + 1);
+		p += QMSG_BATCH_HDR;
+		memset(p, 'a' + i, i + 1);
+		p += i + 1;
+	}
+	return p - buf;
+}
+
+bool test_qio_msg_batch(void)
+{
+	struct queue *q;
+	uint8_t in[64], out[64];
+	size_t len, ret;
+
+	q = qopen(1024, Qmsg, 0, 0);
+	len = build_msg_batch(in, 4);
+	ret = qwrite_msgs(q, in, len);
+	KT_ASSERT_M("qwrite_msgs should consume the whole batch", ret == len);
+	KT_ASSERT_M("each batched msg should be its own block", qlen(q) == 10);
+	/* At most two msgs */
+	ret = qread_msgs(q, out, sizeof(out), 2);
+	KT_ASSERT_M("qread_msgs should get the first two msgs",
+	            ret == build_msg_batch(in, 2) && !memcmp(in, out, ret));
+	/* Room for the third msg, but not the fourth */
+	ret = qread_msgs(q, out, QMSG_BATCH_HDR * 2 + 3 + 3, 0);
+	KT_ASSERT_M("qread_msgs should only get msgs that fit",
+	            ret == QMSG_BATCH_HDR + 3 && GBIT32(out) == 3);
+	/* The fourth is too big, and gets truncated */
+	ret = qread_msgs(q, out, QMSG_BATCH_HDR + 2, 0);
+	KT_ASSERT_M("qread_msgs should truncate the first msg",
+	            ret == QMSG_BATCH_HDR + 2 && GBIT32(out) == 2);
+	KT_ASSERT_M("truncated msgs should be dropped", qlen(q) == 0);
+	qfree(q);
+	return true;
+}
+
 static struct ktest ktests[] = {
 	KTEST_REG(ptclbsum,				CONFIG_TEST_ptclbsum),
 	KTEST_REG(simplesum_bench,		CONFIG_TEST_simplesum_bench),
 	KTEST_REG(ptclbsum_bench,		CONFIG_TEST_ptclbsum_bench),
+	KTEST_REG(memcpy_and_csum,		CONFIG_TEST_memcpy_and_csum),
+	KTEST_REG(csum_gbps,			CONFIG_TEST_csum_gbps),
+	KTEST_REG(qio_msg_batch,		CONFIG_TEST_qio_msg_batch),
 };
 
 static int num_ktests = sizeof(ktests) / sizeof(struct ktest);
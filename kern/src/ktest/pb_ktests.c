@@ -48,6 +48,9 @@
 #include <ktest.h>
 #include <smallidpool.h>
 #include <linker_func.h>
+#include <tree_file.h>
+#include <cpu_feat.h>
+#include <profiler.h>
 
 KTEST_SUITE("POSTBOOT")
 
@@ -1622,6 +1625,70 @@ bool test_kmalloc_incref(void)
 	return TRUE;
 }
 
+/* Internal fragmentation of the kmalloc size classes, and the cost of an
+ * alloc/free cycle with and without the tag. */
+bool test_kmalloc_classes(void)
+{
+	#define KMC_TEST_NR_CYCLES 100000
+	size_t tag_sz = sizeof(struct kmalloc_tag);
+	size_t waste_pow2 = 0, waste_tagged = 0, waste_sized = 0, total = 0;
+	size_t ksize, pow2;
+	uint64_t start, t_tagged, t_sized;
+	void *buf;
+	int id;
+
+	for (int i = 0; i < NUM_KMALLOC_CACHES; i++) {
+		KT_ASSERT_M("Class sizes should be aligned",
+		            ALIGNED(kmalloc_class_size(i), KMALLOC_ALIGNMENT));
+		KT_ASSERT_M("Class sizes should map back to their class",
+		            kmalloc_cache_id(kmalloc_class_size(i)) == i);
+		KT_ASSERT_M("One past a class should be in the next class",
+		            kmalloc_cache_id(kmalloc_class_size(i) + 1) == i + 1);
+	}
+	for (size_t size = 1; size <= KMALLOC_LARGEST - tag_sz; size++) {
+		ksize = size + tag_sz;
+		id = kmalloc_cache_id(ksize);
+		KT_ASSERT_M("Classes should fit their objects",
+		            kmalloc_class_size(id) >= ksize);
+		KT_ASSERT_M("Classes should be the smallest that fit",
+		            !id || kmalloc_class_size(id - 1) < ksize);
+		/* The old classes were powers of two, starting at 64 */
+		pow2 = MAX(1UL << LOG2_UP(ksize), KMALLOC_SMALLEST);
+		waste_pow2 += pow2 - size;
+		waste_tagged += kmalloc_class_size(id) - size;
+		waste_sized += kmalloc_class_size(kmalloc_cache_id(size)) - size;
+		total += size;
+	}
+	printk("kmalloc waste for 1..%lu bytes: %lu%% pow2, %lu%% quarter classes, %lu%% untagged\n",
+	       KMALLOC_LARGEST - tag_sz, waste_pow2 * 100 / total,
+	       waste_tagged * 100 / total, waste_sized * 100 / total);
+	KT_ASSERT_M("Quarter classes should waste less than powers of two",
+	            waste_tagged < waste_pow2);
+
+	buf = kmalloc_sized(200, MEM_WAIT);
+	KT_ASSERT_M("Sized bufs should be aligned",
+	            ALIGNED(buf, KMALLOC_ALIGNMENT));
+	memset(buf, 0xaa, 200);
+	kfree_sized(buf, 200);
+	buf = kmalloc_sized(3 * PGSIZE, MEM_WAIT);
+	KT_ASSERT_M("Big sized bufs should be page aligned", PGOFF(buf) == 0);
+	memset(buf, 0xaa, 3 * PGSIZE);
+	kfree_sized(buf, 3 * PGSIZE);
+
+	start = read_tsc();
+	for (int i = 0; i < KMC_TEST_NR_CYCLES; i++)
+		kfree(kmalloc(200, MEM_WAIT));
+	t_tagged = read_tsc() - start;
+	start = read_tsc();
+	for (int i = 0; i < KMC_TEST_NR_CYCLES; i++)
+		kfree_sized(kmalloc_sized(200, MEM_WAIT), 200);
+	t_sized = read_tsc() - start;
+	printk("kmalloc 200 byte alloc/free: %llu nsec tagged, %llu nsec sized\n",
+	       tsc2nsec(t_tagged) / KMC_TEST_NR_CYCLES,
+	       tsc2nsec(t_sized) / KMC_TEST_NR_CYCLES);
+	return true;
+}
+
 /* Some ghetto things:
  * - ASSERT_M only lets you have a string, not a format string.
  * - put doesn't return, so we have a "loud" test for that.  alternatively, we
@@ -2014,6 +2081,389 @@ static bool test_percpu_increment(void)
 	return true;
 }
 
+/* Creates a lot of files in one #tmpfs directory and times walks to them.
+ * Walks should cost about the same with 1K files as with 1M, so long as the
+ * walk cache grows with the directory. */
+#define WC_TEST_NR_FILES			(1024 * 1024)
+#define WC_TEST_NR_SMALL			1024
+#define WC_TEST_NR_WALKS			4096
+
+/* Returns the average walk time in nsec, or 0 if a walk failed. */
+static uint64_t __wc_time_walks(struct dev *tmpfs, struct chan *root,
+                                unsigned int nr_files)
+{
+	char name[32];
+	char *names[1] = {name};
+	struct walkqid *wq;
+	uint64_t start, total = 0;
+	bool found;
+
+	for (int i = 0; i < WC_TEST_NR_WALKS; i++) {
+		snprintf(name, sizeof(name), "f%u", (i * 7919) % nr_files);
+		start = read_tsc();
+		wq = tmpfs->walk(root, NULL, names, 1);
+		total += read_tsc() - start;
+		found = wq && (wq->nqid == 1) && wq->clone;
+		if (wq && wq->clone)
+			cclose(wq->clone);
+		kfree(wq);
+		if (!found)
+			return 0;
+	}
+	return tsc2nsec(total) / WC_TEST_NR_WALKS;
+}
+
+static bool test_walk_cache(void)
+{
+	ERRSTACK(1);
+	struct dev *tmpfs = &devtab[devno("tmpfs", 0)];
+	struct chan *root, *c;
+	struct walk_cache *wc;
+	char name[32];
+	uint64_t small_ns = 0, large_ns, start;
+
+	root = tmpfs->attach(NULL);
+	wc = &chan_to_tree_file(root)->tfs->wc;
+	if (waserror()) {
+		cclose(root);
+		KT_ASSERT_M("error creating files", false);
+	}
+	start = read_tsc();
+	for (unsigned int i = 0; i < WC_TEST_NR_FILES; i++) {
+		snprintf(name, sizeof(name), "f%u", i);
+		c = cclone(root);
+		tmpfs->create(c, name, O_RDWR, 0666, NULL);
+		cclose(c);
+		if (i + 1 == WC_TEST_NR_SMALL) {
+			small_ns = __wc_time_walks(tmpfs, root, WC_TEST_NR_SMALL);
+			KT_ASSERT_M("small walk failed", small_ns);
+		}
+	}
+	printk("walk cache: created %d files in %llu msec\n", WC_TEST_NR_FILES,
+	       tsc2msec(read_tsc() - start));
+	large_ns = __wc_time_walks(tmpfs, root, WC_TEST_NR_FILES);
+	poperror();
+	printk("walk cache: %u lists, %lu items, avg walk %llu nsec at %d files, %llu nsec at %d files\n",
+	       wc->hh.nr_hash_lists, wc->hh.nr_items, small_ns, WC_TEST_NR_SMALL,
+	       large_ns, WC_TEST_NR_FILES);
+	KT_ASSERT_M("large walk failed", large_ns);
+	KT_ASSERT_M("walk cache didn't grow",
+	            wc->hh.nr_items <= HASH_MAX_LOAD_FACTOR(wc->hh.nr_hash_lists));
+	/* This frees the files too. */
+	cclose(root);
+	return true;
+}
+
+#define MCS_TEST_BUF_SZ		(2 * 1024 * 1024 + PGSIZE)
+#define MCS_TEST_MAX_SZ		(2 * 1024 * 1024)
+#define MCS_TEST_BYTES		(32 * 1024 * 1024)
+
+static bool __mcs_check(uint8_t *dst, uint8_t *src, size_t off, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		src[off + i] = i * 7 + off;
+	memset(dst, 0xee, n + 2 * 8);
+	memcpy(dst + off, src + off, n);
+	for (size_t i = 0; i < off; i++)
+		KT_ASSERT_M("memcpy wrote before dst", dst[i] == 0xee);
+	for (size_t i = 0; i < n; i++)
+		KT_ASSERT_M("memcpy got the wrong byte",
+		            dst[off + i] == (uint8_t)(i * 7 + off));
+	KT_ASSERT_M("memcpy wrote past dst", dst[off + n] == 0xee);
+	memset(dst + off, 0x5a, n);
+	for (size_t i = 0; i < n; i++)
+		KT_ASSERT_M("memset got the wrong byte", dst[off + i] == 0x5a);
+	KT_ASSERT_M("memset wrote past dst", dst[off + n] == 0xee);
+	return true;
+}
+
+static uint64_t __mcs_mbps(size_t sz, int loops, uint64_t tsc)
+{
+	return sz * loops * 1000 / MAX(tsc2nsec(tsc), 1);
+}
+
+/* Checks memcpy and memset at every path's boundaries and alignments, then
+ * prints their throughput against the portable versions. */
+static bool test_memcpy_sizes(void)
+{
+	size_t check_szs[] = {0, 1, 7, 8, 9, 63, 64, 127, 128, 129, 4095, 4096,
+	                      1024 * 1024 - 1, 1024 * 1024, MCS_TEST_MAX_SZ};
+	uint8_t *src, *dst;
+	uint64_t start, t_copy, t_copy_gen, t_set, t_set_gen;
+	int loops;
+
+	src = kpages_alloc(MCS_TEST_BUF_SZ, MEM_WAIT);
+	dst = kpages_alloc(MCS_TEST_BUF_SZ, MEM_WAIT);
+	for (int i = 0; i < COUNT_OF(check_szs); i++) {
+		for (size_t off = 0; off < 8; off++) {
+			if (!__mcs_check(dst, src, off, check_szs[i]))
+				return false;
+		}
+	}
+	for (size_t i = 0; i < 4096; i++)
+		src[i] = i * 7;
+	memmove(src + 1, src, 4096);
+	memmove(src, src + 1, 4096);
+	for (size_t i = 0; i < 4096; i++)
+		KT_ASSERT_M("overlapping memmove failed",
+		            src[i] == (uint8_t)(i * 7));
+
+#ifdef CONFIG_X86
+	printk("memcpy/memset MB/s, ERMS %d, FSRM %d\n",
+	       cpu_has_feat(CPU_FEAT_X86_ERMS), cpu_has_feat(CPU_FEAT_X86_FSRM));
+#endif
+	for (size_t sz = 16; sz <= MCS_TEST_MAX_SZ; sz <<= 1) {
+		loops = MAX(MCS_TEST_BYTES / sz, 4);
+		start = read_tsc();
+		for (int i = 0; i < loops; i++)
+			memcpy(dst, src, sz);
+		t_copy = read_tsc() - start;
+		start = read_tsc();
+		for (int i = 0; i < loops; i++)
+			memcpy_generic(dst, src, sz);
+		t_copy_gen = read_tsc() - start;
+		start = read_tsc();
+		for (int i = 0; i < loops; i++)
+			memset(dst, i, sz);
+		t_set = read_tsc() - start;
+		start = read_tsc();
+		for (int i = 0; i < loops; i++)
+			memset_generic(dst, i, sz);
+		t_set_gen = read_tsc() - start;
+		printk("%8lu bytes: memcpy %6llu (generic %6llu), memset %6llu (generic %6llu)\n",
+		       sz, __mcs_mbps(sz, loops, t_copy),
+		       __mcs_mbps(sz, loops, t_copy_gen),
+		       __mcs_mbps(sz, loops, t_set),
+		       __mcs_mbps(sz, loops, t_set_gen));
+	}
+	kpages_free(src, MCS_TEST_BUF_SZ);
+	kpages_free(dst, MCS_TEST_BUF_SZ);
+	return true;
+}
+
+#define RCU_TEST_NR_SYNCS		20
+#define RCU_TEST_NR_CBS			100000
+
+struct rcu_test_cb {
+	struct rcu_head				h;
+	atomic_t					*nr_run;
+};
+
+static struct rcu_test_cb *rcu_test_cbs;
+static atomic_t rcu_test_nr_run;
+
+static void __rcu_test_cb(struct rcu_head *head)
+{
+	struct rcu_test_cb *cb = container_of(head, struct rcu_test_cb, h);
+
+	atomic_inc(cb->nr_run);
+}
+
+/* Each core posts its slice of the CBs, so they're spread over the CB cores */
+static void __rcu_test_post_cbs(struct hw_trapframe *hw_tf, void *data)
+{
+	int per_core = RCU_TEST_NR_CBS / num_cores;
+
+	for (int i = core_id() * per_core; i < (core_id() + 1) * per_core; i++) {
+		rcu_test_cbs[i].nr_run = &rcu_test_nr_run;
+		call_rcu(&rcu_test_cbs[i].h, __rcu_test_cb);
+	}
+}
+
+/* Prints the latency of normal and expedited GPs, and how fast the CB cores
+ * get through a flood of CBs posted from every core. */
+static bool test_rcu_gp_latency(void)
+{
+	handler_wrapper_t *waiter = 0;
+	uint64_t start, t_sync, t_exp, t_cbs;
+	int nr_posted = RCU_TEST_NR_CBS / num_cores * num_cores;
+
+	start = read_tsc();
+	for (int i = 0; i < RCU_TEST_NR_SYNCS; i++)
+		synchronize_rcu();
+	t_sync = read_tsc() - start;
+	start = read_tsc();
+	for (int i = 0; i < RCU_TEST_NR_SYNCS; i++)
+		synchronize_rcu_expedited();
+	t_exp = read_tsc() - start;
+	printk("rcu: avg GP wait %llu usec, %llu usec expedited\n",
+	       tsc2usec(t_sync) / RCU_TEST_NR_SYNCS,
+	       tsc2usec(t_exp) / RCU_TEST_NR_SYNCS);
+
+	rcu_test_cbs = kzmalloc(sizeof(struct rcu_test_cb) * RCU_TEST_NR_CBS,
+	                        MEM_WAIT);
+	atomic_init(&rcu_test_nr_run, 0);
+	start = read_tsc();
+	smp_call_function_all(__rcu_test_post_cbs, NULL, &waiter);
+	smp_call_wait(waiter);
+	rcu_barrier();
+	t_cbs = read_tsc() - start;
+	KT_ASSERT_M("rcu_barrier returned before all CBs ran",
+	            atomic_read(&rcu_test_nr_run) == nr_posted);
+	printk("rcu: %d CBs from %d cores on %d CB cores in %llu usec\n",
+	       nr_posted, num_cores, 1 + nr_rcu_cb_extra_cores(),
+	       tsc2usec(t_cbs));
+	kfree(rcu_test_cbs);
+	return true;
+}
+
+#define PROF_TEST_NR_SAMPLES	1000
+#define PROF_TEST_NR_PCS		16
+#define PROF_TEST_NR_SESSIONS	2
+
+static uint64_t *prof_test_ticks;
+
+static void __prof_test_sample(struct hw_trapframe *hw_tf, void *data)
+{
+	uintptr_t pcs[PROF_TEST_NR_PCS];
+	uint64_t start;
+
+	for (int i = 0; i < PROF_TEST_NR_PCS; i++)
+		pcs[i] = (uintptr_t)__prof_test_sample + i;
+	start = read_tsc();
+	for (int i = 0; i < PROF_TEST_NR_SAMPLES; i++)
+		profiler_push_kernel_backtrace(pcs, PROF_TEST_NR_PCS, i);
+	prof_test_ticks[core_id()] = read_tsc() - start;
+}
+
+/* Checks a trace record from a session's ring, then has every core push samples
+ * to a couple of sessions at once, like a PMU interrupt would. */
+static bool test_profiler_sampling(void)
+{
+	handler_wrapper_t *waiter = 0;
+	struct profiler *sessions[PROF_TEST_NR_SESSIONS];
+	struct proftype_kern_trace64 *rec;
+	uintptr_t pcs[3] = {1, 2, 3};
+	uint8_t buf[128];
+	size_t len, rec_len;
+	uint64_t ticks = 0, nsec_per;
+	int coreid;
+
+	for (int i = 0; i < PROF_TEST_NR_SESSIONS; i++) {
+		sessions[i] = profiler_create();
+		profiler_start(sessions[i]);
+	}
+
+	disable_irq();
+	coreid = core_id();
+	profiler_push_kernel_backtrace(pcs, 3, 0x1234);
+	enable_irq();
+	len = profiler_read_cpu(sessions[0], coreid, buf, sizeof(buf));
+	rec_len = sizeof(*rec) + 3 * sizeof(uint64_t);
+	KT_ASSERT_M("Wrong trace record length", len == 2 + rec_len);
+	KT_ASSERT_M("Wrong envelope", buf[0] == PROFTYPE_KERN_TRACE64 &&
+	            buf[1] == rec_len);
+	rec = (struct proftype_kern_trace64 *)(buf + 2);
+	KT_ASSERT_M("Wrong trace record", rec->info == 0x1234 &&
+	            rec->cpu == coreid && rec->num_traces == 3 &&
+	            rec->trace[0] == 1 && rec->trace[2] == 3);
+	KT_ASSERT_M("Other session didn't get the trace",
+	            profiler_cpu_size(sessions[1], coreid) == len);
+
+	prof_test_ticks = kzmalloc(sizeof(uint64_t) * num_cores, MEM_WAIT);
+	smp_call_function_all(__prof_test_sample, NULL, &waiter);
+	smp_call_wait(waiter);
+	for (int i = 0; i < num_cores; i++) {
+		ticks += prof_test_ticks[i];
+		KT_ASSERT_M("Dropped samples from a mostly empty ring",
+		            !profiler_cpu_dropped(sessions[0], i));
+	}
+	nsec_per = tsc2nsec(ticks) / (num_cores * PROF_TEST_NR_SAMPLES);
+	/* At 10kHz, each nsec per sample is 0.001% of a core */
+	printk("profiler: %llu nsec per sample to %d sessions on %d cores, "
+	       "%llu.%03llu%% of each core at 10kHz\n",
+	       nsec_per, PROF_TEST_NR_SESSIONS, num_cores, nsec_per / 1000,
+	       nsec_per % 1000);
+	kfree(prof_test_ticks);
+
+	/* Fill up this core's ring; the rest get dropped and counted */
+	disable_irq();
+	for (int i = 0; i < 1000000; i++) {
+		if (profiler_cpu_dropped(sessions[0], coreid))
+			break;
+		profiler_push_kernel_backtrace(pcs, 3, i);
+	}
+	enable_irq();
+	KT_ASSERT_M("Full ring didn't count drops",
+	            profiler_cpu_dropped(sessions[0], coreid));
+
+	for (int i = 0; i < PROF_TEST_NR_SESSIONS; i++) {
+		profiler_stop(sessions[i]);
+		profiler_put(sessions[i]);
+	}
+	return true;
+}
+
+#define KMSG_PP_ROUNDS 10000
+
+static void __kmsg_pp_pong(uint32_t srcid, long a0, long a1, long a2)
+{
+	sem_up((struct semaphore*)a0);
+}
+
+static void __kmsg_pp_ping(uint32_t srcid, long a0, long a1, long a2)
+{
+	send_kernel_message(srcid, __kmsg_pp_pong, a0, 0, 0, KMSG_ROUTINE);
+}
+
+/* Senders count their wakes, so this covers both directions. */
+static uint64_t kmsg_pp_wakes(uint32_t dst)
+{
+	return READ_ONCE(per_cpu_info[core_id()].nr_kmsg_poll_wakes) +
+	       READ_ONCE(per_cpu_info[dst].nr_kmsg_poll_wakes);
+}
+
+/* Bounces a routine KMSG off dst KMSG_PP_ROUNDS times.  We block in between, so
+ * both cores are idle when their message arrives.  Prints nsec per round trip,
+ * and how many of the 2 * KMSG_PP_ROUNDS messages skipped the IPI. */
+static void kmsg_pp_run(uint32_t dst, const char *how)
+{
+	struct semaphore sem;
+	uint64_t start, nsec, wakes;
+
+	sem_init(&sem, 0);
+	wakes = kmsg_pp_wakes(dst);
+	start = read_tsc();
+	for (int i = 0; i < KMSG_PP_ROUNDS; i++) {
+		send_kernel_message(dst, __kmsg_pp_ping, (long)&sem, 0, 0,
+		                    KMSG_ROUTINE);
+		sem_down(&sem);
+	}
+	nsec = tsc2nsec(read_tsc() - start) / KMSG_PP_ROUNDS;
+	wakes = kmsg_pp_wakes(dst) - wakes;
+	printk("kmsg ping-pong with core %d (%s): %llu nsec per round trip, ",
+	       dst, how, nsec);
+	printk("%llu of %d msgs without an IPI\n", wakes, 2 * KMSG_PP_ROUNDS);
+}
+
+/* Routine KMSG round trips between idle cores.  On x86 with mwait, runs once
+ * with mwait wakeups and once with IPIs.  Under qemu, the guest only gets mwait
+ * with -overcommit cpu-pm=on. */
+static bool test_kmsg_pingpong(void)
+{
+	uint32_t dst = (core_id() + 1) % num_cores;
+	bool mwait = FALSE;
+
+	if (num_cores < 2) {
+		printk("kmsg_pingpong: needs at least 2 cores, skipping\n");
+		return true;
+	}
+#ifdef CONFIG_X86
+	mwait = cpu_has_feat(CPU_FEAT_X86_MWAIT);
+#endif
+	kmsg_pp_run(dst, mwait ? "mwait" : "IPI, no mwait");
+#ifdef CONFIG_X86
+	if (mwait) {
+		mwait_kmsgs = FALSE;
+		kmsg_pp_run(dst, "IPI");
+		mwait_kmsgs = TRUE;
+	}
+#endif
+	KT_ASSERT_M("Our core is awake, but still watching kmsg_poll",
+	            !atomic_read(&per_cpu_info[core_id()].kmsg_poll));
+	return true;
+}
+
 static struct ktest ktests[] = {
 #ifdef CONFIG_X86
 	KTEST_REG(ipi_sending,        CONFIG_TEST_ipi_sending),
@@ -2044,12 +2494,18 @@ static struct ktest ktests[] = {
 	KTEST_REG(rv,                 CONFIG_TEST_rv),
 	KTEST_REG(alarm,              CONFIG_TEST_alarm),
 	KTEST_REG(kmalloc_incref,     CONFIG_TEST_kmalloc_incref),
+	KTEST_REG(kmalloc_classes,    CONFIG_TEST_kmalloc_classes),
 	KTEST_REG(u16pool,            CONFIG_TEST_u16pool),
 	KTEST_REG(uaccess,            CONFIG_TEST_uaccess),
 	KTEST_REG(sort,               CONFIG_TEST_sort),
 	KTEST_REG(cmdline_parse,      CONFIG_TEST_cmdline_parse),
 	KTEST_REG(percpu_zalloc,      CONFIG_TEST_percpu_zalloc),
 	KTEST_REG(percpu_increment,   CONFIG_TEST_percpu_increment),
+	KTEST_REG(walk_cache,         CONFIG_TEST_walk_cache),
+	KTEST_REG(memcpy_sizes,       CONFIG_TEST_memcpy_sizes),
+	KTEST_REG(rcu_gp_latency,     CONFIG_TEST_rcu_gp_latency),
+	KTEST_REG(profiler_sampling,  CONFIG_TEST_profiler_sampling),
+	KTEST_REG(kmsg_pingpong,      CONFIG_TEST_kmsg_pingpong),
 };
 static int num_ktests = sizeof(ktests) / sizeof(struct ktest);
 linker_func_1(register_pb_ktests)
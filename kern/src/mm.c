@@ -255,55 +255,120 @@ static void vmr_free(struct vm_region *vmr)
 	kmem_cache_free(vmr_kcache, vmr);
 }
 
+static void __vmr_free_rcu(struct rcu_head *head)
+{
+	vmr_free(container_of(head, struct vm_region, vm_rcu));
+}
+
+/* Helper: rounds va up to the next address congruent to foff, modulo align. */
+static uintptr_t vmr_align_va(uintptr_t va, size_t foff, size_t align)
+{
+	return va + ((foff - va) & (align - 1));
+}
+
+/* The VMR list is read under RCU by the page fault handler (see
+ * __hpf_get_vmr()), so writers link and unlink VMRs with these instead of the
+ * plain TAILQ ops.  A VMR must be fully set up, including its own next pointer,
+ * before rcu_assign_pointer() makes it reachable.  Callers hold the vmr_lock.
+ */
+static void vmr_link_head(struct proc *p, struct vm_region *vmr)
+{
+	struct vm_region *first = TAILQ_FIRST(&p->vm_regions);
+
+	TAILQ_NEXT(vmr, vm_link) = first;
+	vmr->vm_link.tqe_prev = &TAILQ_FIRST(&p->vm_regions);
+	if (first)
+		first->vm_link.tqe_prev = &TAILQ_NEXT(vmr, vm_link);
+	else
+		p->vm_regions.tqh_last = &TAILQ_NEXT(vmr, vm_link);
+	rcu_assign_pointer(TAILQ_FIRST(&p->vm_regions), vmr);
+}
+
+static void vmr_link_after(struct proc *p, struct vm_region *prev,
+                           struct vm_region *vmr)
+{
+	struct vm_region *next = TAILQ_NEXT(prev, vm_link);
+
+	TAILQ_NEXT(vmr, vm_link) = next;
+	vmr->vm_link.tqe_prev = &TAILQ_NEXT(prev, vm_link);
+	if (next)
+		next->vm_link.tqe_prev = &TAILQ_NEXT(vmr, vm_link);
+	else
+		p->vm_regions.tqh_last = &TAILQ_NEXT(vmr, vm_link);
+	rcu_assign_pointer(TAILQ_NEXT(prev, vm_link), vmr);
+}
+
+/* vmr keeps its next pointer, so a reader on it still finds the rest of the
+ * list.  Free it after a grace period. */
+static void vmr_unlink(struct proc *p, struct vm_region *vmr)
+{
+	struct vm_region *next = TAILQ_NEXT(vmr, vm_link);
+
+	if (next)
+		next->vm_link.tqe_prev = vmr->vm_link.tqe_prev;
+	else
+		p->vm_regions.tqh_last = vmr->vm_link.tqe_prev;
+	WRITE_ONCE(*vmr->vm_link.tqe_prev, next);
+}
+
 /* The caller will set the prot, flags, file, and offset.  We find a spot for it
  * in p's address space, set proc, base, and end.  Caller holds p's vmr_lock.
  *
+ * We prefer a base that is congruent to the file offset modulo align, e.g. so
+ * that jumbo pages of a file line up with jumbo PTEs.  If there is no such
+ * spot, we settle for any spot.  Pass PGSIZE for no preference.
+ *
  * TODO: take a look at solari's vmem alloc.  And consider keeping these in a
  * tree of some sort for easier lookups. */
 static bool vmr_insert(struct vm_region *vmr, struct proc *p, uintptr_t va,
-                       size_t len)
+                       size_t len, size_t align)
 {
 	struct vm_region *vm_i, *vm_next;
-	uintptr_t gap_end;
+	uintptr_t gap_start, gap_end, aligned_va;
 	bool ret = false;
 
 	assert(!PGOFF(va));
 	assert(!PGOFF(len));
 	assert(__is_user_addr((void*)va, len, UMAPTOP));
+	aligned_va = vmr_align_va(va, vmr->vm_foff, align);
+	if (__is_user_addr((void*)aligned_va, len, UMAPTOP))
+		va = aligned_va;
 	/* Is there room before the first one: */
 	vm_i = TAILQ_FIRST(&p->vm_regions);
 	/* This works for now, but if all we have is BRK_END ones, we'll start
 	 * growing backwards (TODO) */
 	if (!vm_i || (va + len <= vm_i->vm_base)) {
+		vmr->vm_proc = p;
 		vmr->vm_base = va;
-		TAILQ_INSERT_HEAD(&p->vm_regions, vmr, vm_link);
+		vmr->vm_end = va + len;
+		vmr_link_head(p, vmr);
 		ret = true;
 	} else {
 		TAILQ_FOREACH(vm_i, &p->vm_regions, vm_link) {
 			vm_next = TAILQ_NEXT(vm_i, vm_link);
 			gap_end = vm_next ? vm_next->vm_base : UMAPTOP;
+			gap_start = vmr_align_va(vm_i->vm_end, vmr->vm_foff, align);
 			/* skip til we get past the 'hint' va */
 			if (va >= gap_end)
 				continue;
 			/* Find a gap that is big enough */
-			if (gap_end - vm_i->vm_end >= len) {
+			if ((gap_start < gap_end) && (gap_end - gap_start >= len)) {
 				/* if we can put it at va, let's do that.  o/w, put it so it
 				 * fits */
-				if ((gap_end >= va + len) && (va >= vm_i->vm_end))
+				if ((gap_end >= va + len) && (va >= gap_start))
 					vmr->vm_base = va;
 				else
-					vmr->vm_base = vm_i->vm_end;
-				TAILQ_INSERT_AFTER(&p->vm_regions, vm_i, vmr, vm_link);
+					vmr->vm_base = gap_start;
+				vmr->vm_proc = p;
+				vmr->vm_end = vmr->vm_base + len;
+				vmr_link_after(p, vm_i, vmr);
 				ret = true;
 				break;
 			}
 		}
 	}
-	/* Finalize the creation, if we got one */
-	if (ret) {
-		vmr->vm_proc = p;
-		vmr->vm_end = vmr->vm_base + len;
-	}
+	if (!ret && (align > PGSIZE))
+		return vmr_insert(vmr, p, va, len, PGSIZE);
 	if (!ret)
 		warn("Not making a VMR, wanted %p, + %p = %p", va, len, va + len);
 	return ret;
@@ -319,39 +384,45 @@ static struct vm_region *split_vmr(struct vm_region *old_vmr, uintptr_t va)
 	assert(!PGOFF(va));
 	if ((old_vmr->vm_base >= va) || (old_vmr->vm_end <= va))
 		return 0;
+	/* Memwalks over either half can't handle a jumbo PTE that spans both */
+	if (vmr_has_file(old_vmr) && (va & (JUMBO_PGSIZE - 1)))
+		env_unmap_jumbo(old_vmr->vm_proc, va);
 	new_vmr = kmem_cache_alloc(vmr_kcache, 0);
 	assert(new_vmr);
-	TAILQ_INSERT_AFTER(&old_vmr->vm_proc->vm_regions, old_vmr, new_vmr,
-	                   vm_link);
 	new_vmr->vm_proc = old_vmr->vm_proc;
 	new_vmr->vm_base = va;
 	new_vmr->vm_end = old_vmr->vm_end;
-	old_vmr->vm_end = va;
 	new_vmr->vm_prot = old_vmr->vm_prot;
 	new_vmr->vm_flags = old_vmr->vm_flags;
 	if (vmr_has_file(old_vmr)) {
 		foc_incref(old_vmr->__vm_foc);
 		new_vmr->__vm_foc = old_vmr->__vm_foc;
-		new_vmr->vm_foff = old_vmr->vm_foff +
-		                      old_vmr->vm_end - old_vmr->vm_base;
-		pm_add_vmr(vmr_to_pm(old_vmr), new_vmr);
+		new_vmr->vm_foff = old_vmr->vm_foff + va - old_vmr->vm_base;
 	} else {
 		new_vmr->__vm_foc = NULL;
 		new_vmr->vm_foff = 0;
 	}
+	vmr_link_after(old_vmr->vm_proc, old_vmr, new_vmr);
+	old_vmr->vm_end = va;
+	if (vmr_has_file(new_vmr))
+		pm_add_vmr(vmr_to_pm(new_vmr), new_vmr);
 	return new_vmr;
 }
 
 /* Called by the unmapper, just cleans up.  Whoever calls this will need to sort
- * out the page table entries. */
+ * out the page table entries.
+ *
+ * Page faults could still be looking at the VMR, so we free it after a grace
+ * period.  vmr_unlink() leaves its vm_link pointing into the list, so they
+ * won't get lost. */
 static void destroy_vmr(struct vm_region *vmr)
 {
 	if (vmr_has_file(vmr)) {
 		pm_remove_vmr(vmr_to_pm(vmr), vmr);
 		foc_decref(vmr->__vm_foc);
 	}
-	TAILQ_REMOVE(&vmr->vm_proc->vm_regions, vmr, vm_link);
-	vmr_free(vmr);
+	vmr_unlink(vmr->vm_proc, vmr);
+	call_rcu(&vmr->vm_rcu, __vmr_free_rcu);
 }
 
 /* Merges two vm regions.  For now, it will check to make sure they are the
@@ -416,7 +487,8 @@ static int shrink_vmr(struct vm_region *vmr, uintptr_t va)
 }
 
 /* Given a va and a proc (later an mm, possibly), returns the owning vmr, or 0
- * if there is none. */
+ * if there is none.  Hold the vmr_lock, or be in an RCU read section and check
+ * vmr_history, like __hpf_get_vmr(). */
 static struct vm_region *find_vmr(struct proc *p, uintptr_t va)
 {
 	struct vm_region *vmr;
@@ -461,7 +533,7 @@ void unmap_and_destroy_vmrs(struct proc *p)
 	/* this only gets called from __proc_free, so there should be no sync
 	 * concerns.  still, better safe than sorry. */
 	spin_lock(&p->vmr_lock);
-	p->vmr_history++;
+	__seq_start_write(&p->vmr_history);
 	spin_lock(&p->pte_lock);
 	TAILQ_FOREACH(vmr_i, &p->vm_regions, vm_link) {
 		/* note this CB sets the PTE = 0, regardless of if it was P or not */
@@ -473,12 +545,15 @@ void unmap_and_destroy_vmrs(struct proc *p)
 	 * to do this outside the pte lock, since it grabs the pm lock. */
 	TAILQ_FOREACH_SAFE(vmr_i, &p->vm_regions, vm_link, vmr_temp)
 		destroy_vmr(vmr_i);
+	__seq_end_write(&p->vmr_history);
 	spin_unlock(&p->vmr_lock);
 }
 
-/* Helper: copies the contents of pages from p to new p.  For pages that aren't
- * present, once we support swapping or CoW, we can do something more
- * intelligent.  0 on success, -ERROR on failure.  Can't handle jumbos. */
+/* Helper: copies the contents of pages from p to new p.  Page cache pages that
+ * a private file mapping hasn't written to yet aren't copied; new_p maps them
+ * read-only too.  For pages that aren't present, once we support swapping, we
+ * can do something more intelligent.  0 on success, -ERROR on failure.  Can't
+ * handle jumbos. */
 static int copy_pages(struct proc *p, struct proc *new_p, uintptr_t va_start,
                       uintptr_t va_end)
 {
@@ -497,11 +572,21 @@ static int copy_pages(struct proc *p, struct proc *new_p, uintptr_t va_start,
 	int copy_page(struct proc *p, pte_t pte, void *va, void *arg) {
 		struct proc *new_p = (struct proc*)arg;
 		struct page *pp;
+		pte_t new_pte;
+
 		if (pte_is_unmapped(pte))
 			return 0;
 		/* pages could be !P, but right now that's only for file backed VMRs
 		 * undergoing page removal, which isn't the caller of copy_pages. */
 		if (pte_is_mapped(pte)) {
+			/* The PTE holds no ref on PM pages; new_p's VMR is in the PM. */
+			if (page_is_pagemap(pa2page(pte_get_paddr(pte)))) {
+				new_pte = pgdir_walk(new_p->env_pgdir, va, TRUE);
+				if (!pte_walk_okay(new_pte))
+					return -ENOMEM;
+				pte_write(new_pte, pte_get_paddr(pte), pte_get_settings(pte));
+				return 0;
+			}
 			/* TODO: check for jumbos */
 			if (upage_alloc(new_p, &pp, 0))
 				return -ENOMEM;
@@ -580,6 +665,9 @@ int duplicate_vmrs(struct proc *p, struct proc *new_p)
 		vmr->vm_flags = vm_i->vm_flags;
 		vmr->__vm_foc = vm_i->__vm_foc;
 		vmr->vm_foff = vm_i->vm_foff;
+		/* fill_vmr() might map PM pages, which the PM must not remove */
+		vmr->vm_ready = true;
+		vmr->vm_shootdown_needed = false;
 		if (vmr_has_file(vm_i)) {
 			foc_incref(vm_i->__vm_foc);
 			pm_add_vmr(vmr_to_pm(vm_i), vmr);
@@ -711,12 +799,24 @@ out_ref:
  *
  * It's possible that a page has already been mapped here, in which case we'll
  * treat as success.  So when we return 0, *a* page is mapped here, but not
- * necessarily the one you passed in. */
+ * necessarily the one you passed in.
+ *
+ * Callers that hold the vmr_lock pass 0 for vmr_seq.  Page faults don't hold
+ * it, and pass the vmr_history their VMR lookup saw.  If the VMRs changed since
+ * then, we return -EAGAIN.  Checking under the pte_lock is enough: writers bump
+ * vmr_history before they take the pte_lock to fix up PTEs, so either we see
+ * the bump, or they see our PTE. */
 static int map_page_at_addr(struct proc *p, struct page *page, uintptr_t addr,
-                            int prot)
+                            int prot, seq_ctr_t *vmr_seq)
 {
 	pte_t pte;
 	spin_lock(&p->pte_lock);	/* walking and changing PTEs */
+	if (vmr_seq && (READ_ONCE(p->vmr_history) != *vmr_seq)) {
+		spin_unlock(&p->pte_lock);
+		if (!page_is_pagemap(page))
+			page_decref(page);
+		return -EAGAIN;
+	}
 	/* find offending PTE (prob don't read this in).  This might alloc an
 	 * intermediate page table page. */
 	pte = pgdir_walk(p->env_pgdir, (void*)addr, TRUE);
@@ -746,6 +846,63 @@ static int map_page_at_addr(struct proc *p, struct page *page, uintptr_t addr,
 	return 0;
 }
 
+/* Helper, maps the JUMBO_NR_PGS pages of the PM starting at page with a single
+ * jumbo PTE at addr.  This only works if page starts a split jumbo, all of whose
+ * pages are in the PM, up to date, and still within the file.  We hold a PM
+ * ref on page, and we'll get refs on the others while we check them.
+ *
+ * Returns 0 if a jumbo is mapped at addr, including one that someone else
+ * mapped.  On error, the caller can fall back to map_page_at_addr().  vmr_seq
+ * is the same as for map_page_at_addr(). */
+static int map_jumbo_at_addr(struct proc *p, struct page_map *pm,
+                             struct page *page, uintptr_t addr, int prot,
+                             seq_ctr_t *vmr_seq)
+{
+	unsigned long idx = page->pg_index;
+	struct page *pg_i;
+	pte_t pte;
+	int nr_refs, ret;
+
+	if (!page_is_jumbo_split(page) || (addr & (JUMBO_PGSIZE - 1)) ||
+	    (idx & (JUMBO_NR_PGS - 1)) || (page2pa(page) & (JUMBO_PGSIZE - 1)))
+		return -EINVAL;
+	if (idx + JUMBO_NR_PGS > nr_pages(fs_file_get_length(pm->pm_file)))
+		return -ESPIPE;
+	for (nr_refs = 0; nr_refs < JUMBO_NR_PGS; nr_refs++) {
+		if (pm_load_page_nowait(pm, idx + nr_refs, &pg_i))
+			break;
+		if (pg_i != page + nr_refs) {
+			pm_put_page(pg_i);
+			break;
+		}
+	}
+	if (nr_refs != JUMBO_NR_PGS) {
+		ret = -EAGAIN;
+		goto out_put;
+	}
+	spin_lock(&p->pte_lock);
+	if (vmr_seq && (READ_ONCE(p->vmr_history) != *vmr_seq)) {
+		spin_unlock(&p->pte_lock);
+		ret = -EAGAIN;
+		goto out_put;
+	}
+	pte = pgdir_walk_jumbo(p->env_pgdir, (void*)addr, TRUE);
+	if (!pte_walk_okay(pte)) {
+		ret = -ENOMEM;
+	} else if (pte_is_unmapped(pte)) {
+		pte_write(pte, page2pa(page), prot | PTE_PS);
+		ret = 0;
+	} else {
+		/* Either a racing fault mapped the jumbo, or there's a PML1 */
+		ret = pte_is_jumbo(pte) ? 0 : -EEXIST;
+	}
+	spin_unlock(&p->pte_lock);
+out_put:
+	for (int i = 0; i < nr_refs; i++)
+		pm_put_page(page + i);
+	return ret;
+}
+
 /* Helper: copies *pp's contents to a new page, replacing your page pointer.  If
  * this succeeds, you'll have a non-PM page, which matters for how you put it.*/
 static int __copy_and_swap_pmpg(struct proc *p, struct page **pp)
@@ -759,6 +916,87 @@ static int __copy_and_swap_pmpg(struct proc *p, struct page **pp)
 	return 0;
 }
 
+/* Private file mappings map the page cache's pages read-only, until they write
+ * to them.  This returns true if pte is one of those, in a MAP_PRIVATE VMR. */
+static bool pte_is_cow(struct vm_region *vmr, pte_t pte)
+{
+	return vmr_has_file(vmr) && (vmr->vm_flags & MAP_PRIVATE) &&
+	       page_is_pagemap(pa2page(pte_get_paddr(pte)));
+}
+
+/* Helper: the write fault half of copy-on-write.  If addr maps a page cache
+ * page in a private VMR, this replaces it with a private copy, mapped with
+ * pte_prot.  The PTE is all we need: while it's mapped, the VMR keeps the PM
+ * from removing the page.  So this doesn't touch the PM, and kernel faults can
+ * do it too.
+ *
+ * The copy is made without the pte_lock, which is for the whole process.  The
+ * page cache's page can't go anywhere while the VMR maps it, and if anything
+ * changed by the time we install the copy, vmr_history or the PTE tells us and
+ * we toss it.
+ *
+ * Returns 0 if addr maps a private page now, -ENOENT if nothing is mapped there
+ * (the caller should do a regular fault), -ENOMEM, or -EAGAIN like
+ * map_page_at_addr(). */
+static int cow_page_at_addr(struct proc *p, uintptr_t addr, int pte_prot,
+                            bool exec, seq_ctr_t *vmr_seq)
+{
+	struct page *old_page, *new_page;
+	pte_t pte;
+	int ret = 0;
+
+	spin_lock(&p->pte_lock);
+	if (READ_ONCE(p->vmr_history) != *vmr_seq) {
+		ret = -EAGAIN;
+		goto out;
+	}
+	pte = pgdir_walk(p->env_pgdir, (void*)addr, FALSE);
+	if (!pte_walk_okay(pte) || !pte_is_present(pte)) {
+		ret = -ENOENT;
+		goto out;
+	}
+	old_page = pa2page(pte_get_paddr(pte));
+	/* A racing fault already made our copy */
+	if (!page_is_pagemap(old_page))
+		goto out;
+	spin_unlock(&p->pte_lock);
+
+	if (upage_alloc(p, &new_page, FALSE))
+		return -ENOMEM;
+	memcpy(page2kva(new_page), page2kva(old_page), PGSIZE);
+
+	spin_lock(&p->pte_lock);
+	if (READ_ONCE(p->vmr_history) != *vmr_seq) {
+		ret = -EAGAIN;
+		goto out_free;
+	}
+	/* The PML1 could have been freed, so we walk again */
+	pte = pgdir_walk(p->env_pgdir, (void*)addr, FALSE);
+	if (!pte_walk_okay(pte) || !pte_is_present(pte)) {
+		ret = -ENOENT;
+		goto out_free;
+	}
+	/* Someone else made a copy (ret 0), or mapped something else */
+	if (pa2page(pte_get_paddr(pte)) != old_page) {
+		ret = page_is_pagemap(pa2page(pte_get_paddr(pte))) ? -EAGAIN : 0;
+		goto out_free;
+	}
+	if (exec)
+		icache_flush_page((void*)addr, page2kva(new_page));
+	pte_write(pte, page2pa(new_page), pte_prot);
+	spin_unlock(&p->pte_lock);
+	/* Other cores could still be reading the page cache's page */
+	proc_tlbshootdown(p, addr, addr + PGSIZE);
+	return 0;
+out_free:
+	spin_unlock(&p->pte_lock);
+	page_decref(new_page);
+	return ret;
+out:
+	spin_unlock(&p->pte_lock);
+	return ret;
+}
+
 /* Hold the VMR lock when you call this - it'll assume the entire VA range is
  * mappable, which isn't true if there are concurrent changes to the VMRs. */
 static int populate_anon_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
@@ -770,7 +1008,7 @@ static int populate_anon_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
 		if (upage_alloc(p, &page, TRUE))
 			return -ENOMEM;
 		/* could imagine doing a memwalk instead of a for loop */
-		ret = map_page_at_addr(p, page, va + i * PGSIZE, pte_prot);
+		ret = map_page_at_addr(p, page, va + i * PGSIZE, pte_prot, 0);
 		if (ret)
 			return ret;
 	}
@@ -784,7 +1022,7 @@ static int populate_pm_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
 {
 	int ret = 0;
 	unsigned long pm_idx0 = offset >> PGSHIFT;
-	int vmr_history = ACCESS_ONCE(p->vmr_history);
+	seq_ctr_t vmr_history = ACCESS_ONCE(p->vmr_history);
 	struct page *page;
 
 	/* This is a racy check - see the comments in fs_file.c.  Also, we're not
@@ -812,7 +1050,10 @@ static int populate_pm_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
 				break;
 			}
 		}
-		if (flags & MAP_PRIVATE) {
+		/* Writable private mappings will probably write soon, so we copy
+		 * now.  Read-only ones share the PM's page, and would copy on a write
+		 * fault after an mprotect. */
+		if ((flags & MAP_PRIVATE) && (pte_prot == PTE_USER_RW)) {
 			ret = __copy_and_swap_pmpg(p, &page);
 			if (ret) {
 				pm_put_page(page);
@@ -824,8 +1065,15 @@ static int populate_pm_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
 		 * TODO: is this still needed?  andrew put this in a while ago*/
 		if (exec)
 			icache_flush_page(0, page2kva(page));
+		/* Shared pages that start a jumbo might get mapped all at once. */
+		if (!(flags & MAP_PRIVATE) && (i + JUMBO_NR_PGS <= nr_pgs) &&
+		    !map_jumbo_at_addr(p, pm, page, va + i * PGSIZE, pte_prot, 0)) {
+			pm_put_page(page);
+			i += JUMBO_NR_PGS - 1;
+			continue;
+		}
 		/* The page could be either in the PM, or a private, now-anon page. */
-		ret = map_page_at_addr(p, page, va + i * PGSIZE, pte_prot);
+		ret = map_page_at_addr(p, page, va + i * PGSIZE, pte_prot, 0);
 		if (page_is_pagemap(page))
 			pm_put_page(page);
 		if (ret)
@@ -834,6 +1082,17 @@ static int populate_pm_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
 	return ret;
 }
 
+/* Helper: returns the alignment vmr_insert() should aim for.  Shared mappings
+ * of files that use jumbo pages get jumbo-aligned, relative to their offset. */
+static size_t mmap_alignment(struct vm_region *vmr, size_t len, int flags)
+{
+	if ((flags & MAP_FIXED) || !(flags & MAP_SHARED) || !vmr_has_file(vmr))
+		return PGSIZE;
+	if ((len < JUMBO_PGSIZE) || !vmr_to_pm(vmr)->pm_jumbo_thresh)
+		return PGSIZE;
+	return JUMBO_PGSIZE;
+}
+
 void *do_mmap(struct proc *p, uintptr_t addr, size_t len, int prot, int flags,
               struct file_or_chan *file, size_t offset)
 {
@@ -888,14 +1147,15 @@ void *do_mmap(struct proc *p, uintptr_t addr, size_t len, int prot, int flags,
 	}
 	/* read/write vmr lock (will change the tree) */
 	spin_lock(&p->vmr_lock);
-	p->vmr_history++;
+	__seq_start_write(&p->vmr_history);
 	/* Need to make sure nothing is in our way when we want a FIXED location.
 	 * We just need to split on the end points (if they exist), and then remove
 	 * everything in between.  __do_munmap() will do this.  Careful, this means
 	 * an mmap can be an implied munmap() (not my call...). */
 	if (flags & MAP_FIXED)
 		__do_munmap(p, addr, len);
-	if (!vmr_insert(vmr, p, addr, len)) {
+	if (!vmr_insert(vmr, p, addr, len, mmap_alignment(vmr, len, flags))) {
+		__seq_end_write(&p->vmr_history);
 		spin_unlock(&p->vmr_lock);
 		if (vmr_has_file(vmr)) {
 			pm_remove_vmr(vmr_to_pm(vmr), vmr);
@@ -911,6 +1171,8 @@ void *do_mmap(struct proc *p, uintptr_t addr, size_t len, int prot, int flags,
 	vmr->vm_ready = true;
 
 	vmr = merge_me(vmr);		/* attempts to merge with neighbors */
+	/* Populating doesn't change the VMRs, and it might unlock and block. */
+	__seq_end_write(&p->vmr_history);
 
 	if (flags & MAP_POPULATE && prot != PROT_NONE) {
 		int pte_prot = (prot & PROT_WRITE) ? PTE_USER_RW :
@@ -957,8 +1219,9 @@ int mprotect(struct proc *p, uintptr_t addr, size_t len, int prot)
 	}
 	/* read/write lock, will probably change the tree and settings */
 	spin_lock(&p->vmr_lock);
-	p->vmr_history++;
+	__seq_start_write(&p->vmr_history);
 	ret = __do_mprotect(p, addr, len, prot);
+	__seq_end_write(&p->vmr_history);
 	spin_unlock(&p->vmr_lock);
 	return ret;
 }
@@ -993,11 +1256,17 @@ int __do_mprotect(struct proc *p, uintptr_t addr, size_t len, int prot)
 		 * PTE that won't trigger a PF (meaning, present PTEs) to have the new
 		 * prot.  The others will fault on access, and we'll change the PTE
 		 * then.  In the off chance we have a mapped but not present PTE, we
-		 * might as well change it too, since we're already here. */
+		 * might as well change it too, since we're already here.
+		 *
+		 * Page cache pages in private VMRs stay read-only, so that a write
+		 * faults and makes a copy. */
 		for (uintptr_t va = vmr->vm_base; va < vmr->vm_end; va += PGSIZE) {
 			pte = pgdir_walk(p->env_pgdir, (void*)va, 0);
 			if (pte_walk_okay(pte) && pte_is_mapped(pte)) {
-				pte_replace_perm(pte, pte_prot);
+				if (pte_is_cow(vmr, pte) && (pte_prot == PTE_USER_RW))
+					pte_replace_perm(pte, PTE_USER_RO);
+				else
+					pte_replace_perm(pte, pte_prot);
 				shootdown_needed = TRUE;
 			}
 		}
@@ -1039,8 +1308,9 @@ int munmap(struct proc *p, uintptr_t addr, size_t len)
 	}
 	/* read/write: changing the vmrs (trees, properties, and whatnot) */
 	spin_lock(&p->vmr_lock);
-	p->vmr_history++;
+	__seq_start_write(&p->vmr_history);
 	ret = __do_munmap(p, addr, len);
+	__seq_end_write(&p->vmr_history);
 	spin_unlock(&p->vmr_lock);
 	return ret;
 }
@@ -1048,15 +1318,12 @@ int munmap(struct proc *p, uintptr_t addr, size_t len)
 static int __munmap_pte(struct proc *p, pte_t pte, void *va, void *arg)
 {
 	bool *shootdown_needed = (bool*)arg;
-	struct page *page;
 
 	/* could put in some checks here for !P and also !0 */
 	if (!pte_is_present(pte))	/* unmapped (== 0) *ptes are also not PTE_P */
 		return 0;
-	if (pte_is_dirty(pte)) {
-		page = pa2page(pte_get_paddr(pte));
-		atomic_or(&page->pg_flags, PG_DIRTY);
-	}
+	if (pte_is_dirty(pte))
+		pte_mark_pages_dirty(pte);
 	pte_clear_present(pte);
 	*shootdown_needed = TRUE;
 	return 0;
@@ -1189,7 +1456,141 @@ static int __hpf_load_page(struct proc *p, struct page_map *pm,
 	return 0;
 }
 
+/* Helper: tries to map the jumbo around va, which a_page is part of, if the
+ * whole jumbo fits in the VMR.  Returns 0 on success. */
+static int __hpf_map_jumbo(struct proc *p, struct vm_region *vmr, uintptr_t va,
+                           struct page *a_page, int pte_prot,
+                           seq_ctr_t *vmr_seq)
+{
+	uintptr_t jumbo_va = ROUNDDOWN(va, JUMBO_PGSIZE);
+	unsigned long pg_off = (va - jumbo_va) >> PGSHIFT;
+
+	if ((jumbo_va < vmr->vm_base) || (jumbo_va + JUMBO_PGSIZE > vmr->vm_end))
+		return -EINVAL;
+	if ((a_page->pg_index & (JUMBO_NR_PGS - 1)) != pg_off)
+		return -EINVAL;
+	return map_jumbo_at_addr(p, vmr_to_pm(vmr), a_page - pg_off, jumbo_va,
+	                         pte_prot, vmr_seq);
+}
+
+/* Helper: finds the VMR holding va without the vmr_lock, and copies it to
+ * vmr_copy.  Returns false if there is no VMR.  On success, *vmr_seq is the
+ * vmr_history the copy is good for, and we hold a ref on the copy's file, if
+ * any, which the caller must put.
+ *
+ * The VMR list is walked under RCU.  destroy_vmr() frees VMRs after a grace
+ * period, and the walk can't get lost: unlinked VMRs still point into the list
+ * and new ones are set up before they are published.  What we read can be torn
+ * by a concurrent writer, so we retry until vmr_history says it wasn't.  We
+ * don't wait for the writer in the read section, which would hold up grace
+ * periods. */
+static bool __hpf_get_vmr(struct proc *p, uintptr_t va,
+                          struct vm_region *vmr_copy, seq_ctr_t *vmr_seq)
+{
+	struct vm_region *vmr;
+	seq_ctr_t seq;
+
+	for (;; cpu_relax()) {
+		rcu_read_lock();
+		seq = READ_ONCE(p->vmr_history);
+		rmb();
+		for (vmr = rcu_dereference(TAILQ_FIRST(&p->vm_regions)); vmr;
+		     vmr = rcu_dereference(TAILQ_NEXT(vmr, vm_link))) {
+			if ((vmr->vm_base <= va) && (vmr->vm_end > va))
+				break;
+		}
+		if (!vmr) {
+			rcu_read_unlock();
+			if (seqctr_retry(seq, READ_ONCE(p->vmr_history)))
+				continue;
+			return false;
+		}
+		*vmr_copy = *vmr;
+		rmb();
+		if (seqctr_retry(seq, READ_ONCE(p->vmr_history))) {
+			rcu_read_unlock();
+			continue;
+		}
+		/* The file is freed after a grace period too.  If its kref is
+		 * already 0, the VMR is being destroyed; try again. */
+		if (vmr_has_file(vmr_copy) &&
+		    !kref_get_not_zero(&vmr_copy->__vm_foc->kref, 1)) {
+			rcu_read_unlock();
+			continue;
+		}
+		rcu_read_unlock();
+		*vmr_seq = seq;
+		return true;
+	}
+}
+
+/* Helper: maps the pages around va that are already in the page cache, from the
+ * naturally aligned group of p->fault_around_pgs pages, within vmr and the
+ * file.  va's page is mapped already, so the group's PML1 exists.  Pages that
+ * someone already mapped are left alone.  Returns how many pages we mapped.
+ *
+ * The PTEs point at the PM's pages, so for private mappings, pte_prot must be
+ * read-only.  vmr_seq is the same as for map_page_at_addr(). */
+static unsigned int fault_around(struct proc *p, struct vm_region *vmr,
+                                 uintptr_t va, int pte_prot, seq_ctr_t *vmr_seq)
+{
+	struct page *pages[FAULT_AROUND_MAX_PGS];
+	unsigned int nr_around = READ_ONCE(p->fault_around_pgs);
+	struct page_map *pm = vmr_to_pm(vmr);
+	uintptr_t start, end;
+	unsigned long idx0, nr_file_pgs;
+	unsigned int nr_pgs, nr_found = 0, nr_mapped = 0;
+	pte_t pte;
+
+	if (nr_around <= 1)
+		return 0;
+	start = ROUNDDOWN(va, nr_around * PGSIZE);
+	end = MIN(start + nr_around * PGSIZE, vmr->vm_end);
+	start = MAX(start, vmr->vm_base);
+	nr_pgs = (end - start) >> PGSHIFT;
+	idx0 = (start - vmr->vm_base + vmr->vm_foff) >> PGSHIFT;
+	/* This is a racy check - see the comments in fs_file.c */
+	nr_file_pgs = nr_pages(fs_file_get_length(pm->pm_file));
+	if (idx0 >= nr_file_pgs)
+		return 0;
+	nr_pgs = MIN(nr_pgs, nr_file_pgs - idx0);
+	for (int i = 0; i < nr_pgs; i++) {
+		pages[i] = NULL;
+		if (start + i * PGSIZE == va)
+			continue;
+		if (!pm_load_page_nowait(pm, idx0 + i, &pages[i]))
+			nr_found++;
+	}
+	if (!nr_found)
+		return 0;
+	spin_lock(&p->pte_lock);
+	if (READ_ONCE(p->vmr_history) == *vmr_seq) {
+		for (int i = 0; i < nr_pgs; i++) {
+			if (!pages[i])
+				continue;
+			pte = pgdir_walk(p->env_pgdir, (void*)(start + i * PGSIZE),
+			                 FALSE);
+			if (!pte_walk_okay(pte) || pte_is_mapped(pte))
+				continue;
+			pte_write(pte, page2pa(pages[i]),
+			          pte_prot | (pte_is_dirty(pte) ? PTE_D : 0));
+			nr_mapped++;
+		}
+	}
+	spin_unlock(&p->pte_lock);
+	/* Like with the faulting page, the VMR keeps the mapped pages in the PM */
+	for (int i = 0; i < nr_pgs; i++) {
+		if (pages[i])
+			pm_put_page(pages[i]);
+	}
+	return nr_mapped;
+}
+
 /* Returns 0 on success, or an appropriate -error code.
+ *
+ * Faults don't take the vmr_lock, so faults on different pages only contend on
+ * the pte_lock, and only while writing the PTE.  Zeroing, copying, and loading
+ * pages all happen in parallel.
  *
  * Notes: if your TLB caches negative results, you'll need to flush the
  * appropriate tlb entry.  Also, you could have a weird race where a present PTE
@@ -1199,29 +1600,40 @@ static int __hpf_load_page(struct proc *p, struct page_map *pm,
  * them. */
 static int __hpf(struct proc *p, uintptr_t va, int prot, bool file_ok)
 {
-	struct vm_region *vmr;
+	struct vm_region vmr_copy, *vmr = &vmr_copy;
 	struct file_or_chan *file;
 	struct page *a_page;
 	unsigned int f_idx;	/* index of the missing page in the file */
+	seq_ctr_t vmr_seq;
+	int pte_prot;
 	int ret = 0;
 	bool first = TRUE;
 	va = ROUNDDOWN(va,PGSIZE);
 
+	p->appx_nr_faults++;
 refault:
-	/* read access to the VMRs TODO: RCU */
-	spin_lock(&p->vmr_lock);
-	/* Check the vmr's protection */
-	vmr = find_vmr(p, va);
-	if (!vmr) {							/* not mapped at all */
+	/* No vmr_lock: we work on a copy of the VMR, and the PTE is only written
+	 * if the VMRs haven't changed since we copied it. */
+	if (!__hpf_get_vmr(p, va, vmr, &vmr_seq)) {	/* not mapped at all */
 		printd("fault: %p not mapped\n", va);
-		ret = -EFAULT;
-		goto out;
+		return -EFAULT;
 	}
+	file = vmr_has_file(vmr) ? vmr->__vm_foc : NULL;
 	if (!(vmr->vm_prot & prot)) {		/* wrong prots for this vmr */
 		ret = -EPERM;
 		goto out;
 	}
-	if (!vmr_has_file(vmr)) {
+	pte_prot = (vmr->vm_prot & PROT_WRITE) ? PTE_USER_RW :
+	           (vmr->vm_prot & (PROT_READ|PROT_EXEC)) ? PTE_USER_RO : 0;
+	/* A write to a private file page that we mapped from the page cache. */
+	if (file && (vmr->vm_flags & MAP_PRIVATE) && (prot & PROT_WRITE)) {
+		ret = cow_page_at_addr(p, va, pte_prot, vmr->vm_prot & PROT_EXEC,
+		                       &vmr_seq);
+		if (ret != -ENOENT)
+			goto out;
+		ret = 0;
+	}
+	if (!file) {
 		/* No file - just want anonymous memory */
 		if (upage_alloc(p, &a_page, TRUE)) {
 			ret = -ENOMEM;
@@ -1232,17 +1644,14 @@ refault:
 			ret = -EACCES;
 			goto out;
 		}
-		file = vmr->__vm_foc;
 		/* If this fails, either something got screwed up with the VMR, or the
 		 * permissions changed after mmap/mprotect.  Either way, I want to know
 		 * (though it's not critical). */
 		if (!check_foc_perms(vmr, file, prot))
 			printk("[kernel] possible issue with VMR prots on file %s!\n",
 			       foc_to_name(file));
-		/* Load the file's page in the page cache.
-		 * TODO: (BLK) Note, we are holding the mem lock!  We need to rewrite
-		 * this stuff so we aren't hold the lock as excessively as we are, and
-		 * such that we can block and resume later. */
+		/* Load the file's page in the page cache.  Our ref on the file keeps
+		 * the PM alive. */
 		assert(!PGOFF(va - vmr->vm_base + vmr->vm_foff));
 		f_idx = (va - vmr->vm_base + vmr->vm_foff) >> PGSHIFT;
 		/* This is a racy check - see the comments in fs_file.c */
@@ -1254,9 +1663,6 @@ refault:
 		if (ret) {
 			if (ret != -EAGAIN)
 				goto out;
-			/* keep the file alive after we unlock */
-			foc_incref(file);
-			spin_unlock(&p->vmr_lock);
 			ret = __hpf_load_page(p, foc_to_pm(file), f_idx, &a_page,
 			                      first);
 			first = FALSE;
@@ -1265,26 +1671,33 @@ refault:
 				return ret;
 			goto refault;
 		}
-		/* If we want a private map, we'll preemptively give you a new page.  We
-		 * used to just care if it was private and writable, but were running
-		 * into issues with libc changing its mapping (map private, then
-		 * mprotect to writable...)  In the future, we want to CoW this anyway,
-		 * so it's not a big deal. */
+		/* Private maps share the page cache's page until they write to it.
+		 * Reads map it read-only, even if the VMR is writable; mprotect keeps
+		 * it that way.  Writes get their own copy. */
 		if ((vmr->vm_flags & MAP_PRIVATE)) {
-			ret = __copy_and_swap_pmpg(p, &a_page);
-			if (ret)
-				goto out_put_pg;
+			if (prot & PROT_WRITE) {
+				ret = __copy_and_swap_pmpg(p, &a_page);
+				if (ret)
+					goto out_put_pg;
+			} else if (pte_prot == PTE_USER_RW) {
+				pte_prot = PTE_USER_RO;
+			}
 		}
 		/* if this is an executable page, we might have to flush the instruction
 		 * cache if our HW requires it. */
 		if (vmr->vm_prot & PROT_EXEC)
 			icache_flush_page((void*)va, page2kva(a_page));
 	}
-	/* update the page table TODO: careful with MAP_PRIVATE etc.  might do this
-	 * separately (file, no file) */
-	int pte_prot = (vmr->vm_prot & PROT_WRITE) ? PTE_USER_RW :
-	               (vmr->vm_prot & (PROT_READ|PROT_EXEC)) ? PTE_USER_RO : 0;
-	ret = map_page_at_addr(p, a_page, va, pte_prot);
+	/* update the page table */
+	if (page_is_pagemap(a_page) && page_is_jumbo_split(a_page) &&
+	    (vmr->vm_flags & MAP_SHARED) &&
+	    !__hpf_map_jumbo(p, vmr, va, a_page, pte_prot, &vmr_seq))
+		goto out_put_pg;
+	ret = map_page_at_addr(p, a_page, va, pte_prot, &vmr_seq);
+	/* Read faults on files map the neighbors too, if they're cached.  For
+	 * private maps, pte_prot is read-only by now. */
+	if (!ret && file && !(prot & PROT_WRITE))
+		p->appx_nr_around += fault_around(p, vmr, va, pte_prot, &vmr_seq);
 	/* fall through, even for errors */
 out_put_pg:
 	/* the VMR's existence in the PM (via the mmap) allows us to have PTE point
@@ -1293,7 +1706,11 @@ out_put_pg:
 	if (page_is_pagemap(a_page))
 		pm_put_page(a_page);
 out:
-	spin_unlock(&p->vmr_lock);
+	if (file)
+		foc_decref(file);
+	/* The VMRs changed since we looked; map_page_at_addr() dropped a_page. */
+	if (ret == -EAGAIN)
+		goto refault;
 	return ret;
 }
 
@@ -70,6 +70,7 @@ enum {
 	Qremote,
 	Qstatus,
 	Qsnoop,
+	Qmdata,
 
 	Logtype = 5,
 	Masktype = (1 << Logtype) - 1,
@@ -200,6 +201,13 @@ static int ip3gen(struct chan *c, int i, struct dir *dp)
 			perm |= qreadable(cv->sq) ? DMREADABLE : 0;
 			return founddevdir(c, q, "snoop", qlen(cv->sq),
 							   cv->owner, perm, dp);
+		case Qmdata:
+			/* batched datagrams only make sense for message queues */
+			if (!(qstate(cv->rq) & Qmsg))
+				return -1;
+			perm = qdata_stat_perm(cv);
+			return founddevdir(c, q, "mdata", qlen(cv->rq),
+							   cv->owner, perm, dp);
 		case Qstatus:
 			p = "status";
 			break;
@@ -324,6 +332,7 @@ ipgen(struct chan *c, char *unused_char_p_t, struct dirtab *d, int unused_int,
 		case Qremote:
 		case Qstatus:
 		case Qsnoop:
+		case Qmdata:
 			return ip3gen(c, TYPE(c->qid), dp);
 	}
 	return -1;
@@ -506,6 +515,7 @@ static struct chan *ipopen(struct chan *c, int omode)
 			mkqid(&c->qid, QID(p->x, cv->x, Qctl), 0, QTFILE);
 			break;
 		case Qdata:
+		case Qmdata:
 		case Qctl:
 		case Qerr:
 			p = f->p[PROTO(c->qid)];
@@ -761,6 +771,7 @@ static void ipclose(struct chan *c)
 				iprouterclose(f);
 			break;
 		case Qdata:
+		case Qmdata:
 		case Qctl:
 		case Qerr:
 		case Qlisten:
@@ -860,10 +871,20 @@ static size_t ipread(struct chan *ch, void *a, size_t n, off64_t off)
 			return rv;
 		case Qdata:
 			c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
+			ip_rps_note_flow(c);
 			if (ch->flag & O_NONBLOCK)
 				return qread_nonblock(c->rq, a, n);
 			else
 				return qread(c->rq, a, n);
+		case Qmdata:
+			/* Batches of datagrams, each preceded by count[4].  The offset is
+			 * the max number of datagrams to return, 0 for as many as fit. */
+			c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
+			ip_rps_note_flow(c);
+			if (ch->flag & O_NONBLOCK)
+				return qread_msgs_nonblock(c->rq, a, n, offset);
+			else
+				return qread_msgs(c->rq, a, n, offset);
 		case Qerr:
 			c = f->p[PROTO(ch->qid)]->conv[CONV(ch->qid)];
 			return qread(c->eq, a, n);
@@ -889,6 +910,7 @@ static struct block *ipbread(struct chan *ch, size_t n, off64_t offset)
 	switch (TYPE(ch->qid)) {
 		case Qdata:
 			c = chan2conv(ch);
+			ip_rps_note_flow(c);
 			if (ch->flag & O_NONBLOCK)
 				return qbread_nonblock(c->rq, n);
 			else
@@ -930,6 +952,12 @@ static void setluniqueport(struct conv *c, int lport)
 			&& xp->rport == c->rport
 			&& ipcmp(xp->raddr, c->raddr) == 0
 			&& ipcmp(xp->laddr, c->laddr) == 0) {
+			/* listeners from the same owner can opt in to sharing a port.
+			 * iphtlook spreads incoming flows across them. */
+			if (xp->state == Announced && xp->reuseport && c->reuseport
+			    && !ipcmp(c->raddr, IPnoaddr)
+			    && !strcmp(xp->owner, c->owner))
+				continue;
 			qunlock(&p->qlock);
 			error(EFAIL, "address in use");
 		}
@@ -1089,6 +1117,18 @@ void Fsstdconnect(struct conv *c, char *argv[], int argc)
 		ipmove(c->raddr, IPv4_loopback);
 }
 
+/*
+ *  "reuseport": let this conv announce a local port that other reuseport
+ *  convs, owned by the same user, have already announced.  Must come before
+ *  the announce or bind.
+ */
+static void reuseportctlmsg(struct conv *c)
+{
+	if (c->lport)
+		error(EISCONN, "reuseport must be set before binding");
+	c->reuseport = TRUE;
+}
+
 /*
  *  initiate connection and sleep till its set up
  */
@@ -1426,6 +1466,15 @@ static size_t ipwrite(struct chan *ch, void *v, size_t n, off64_t off)
 			else
 				qwrite(c->wq, a, n);
 			break;
+		case Qmdata:
+			x = f->p[PROTO(ch->qid)];
+			c = x->conv[CONV(ch->qid)];
+			if (c->lport == 0)
+				autobind(c);
+			if (ch->flag & O_NONBLOCK)
+				return qwrite_msgs_nonblock(c->wq, a, n);
+			else
+				return qwrite_msgs(c->wq, a, n);
 		case Qarp:
 			return arpwrite(f, a, n);
 		case Qiproute:
@@ -1464,6 +1513,8 @@ static size_t ipwrite(struct chan *ch, void *v, size_t n, off64_t off)
 				tosctlmsg(c, cb);
 			else if (strcmp(cb->f[0], "ignoreadvice") == 0)
 				c->ignoreadvice = 1;
+			else if (strcmp(cb->f[0], "reuseport") == 0)
+				reuseportctlmsg(c);
 			else if (strcmp(cb->f[0], "addmulti") == 0) {
 				if (cb->nf < 2)
 					error(EFAIL, "addmulti needs interface address");
@@ -1573,6 +1624,7 @@ int iptapfd(struct chan *chan, struct fd_tap *tap, int cmd)
 
 	switch (TYPE(chan->qid)) {
 		case Qdata:
+		case Qmdata:
 			if (tap->filter & ~DEVIP_LEGAL_DATA_TAPS) {
 				set_errno(ENOSYS);
 				set_errstr("Unsupported #%s data tap %p, must be %p", devname(),
@@ -1783,6 +1835,7 @@ retry:
 	c->lport = 0;
 	c->rport = 0;
 	c->restricted = 0;
+	c->reuseport = FALSE;
 	c->ttl = MAXTTL;
 	c->tos = DFLTTOS;
 	qreopen(c->rq);
@@ -451,7 +451,7 @@ static void etherread4(void *a)
 			freeb(bp);
 		} else {
 			ipifc_trace_block(ifc, bp);
-			ipiput4(er->f, ifc, bp);
+			ip_rps_input(er->f, ifc, bp);
 		}
 		runlock(&ifc->rwlock);
 		poperror();
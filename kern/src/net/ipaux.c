@@ -38,6 +38,7 @@
 #include <smp.h>
 #include <net/ip.h>
 #include <endian.h>
+#include <hash.h>
 
 /*
  *  well known IP addresses
@@ -652,6 +653,46 @@ void iphtrem(struct Ipht *ht, struct conv *c)
 	spin_unlock(&ht->lock);
 }
 
+static bool ipht_listener_match(struct Iphash *h, int match, uint8_t *da,
+                                uint16_t dp)
+{
+	if (h->match != match || h->c->lport != dp)
+		return FALSE;
+	return match == IPmatchport || ipcmp(da, h->c->laddr) == 0;
+}
+
+/* Finds the listener in the chain for da!dp.  Listeners that set "reuseport"
+ * can share a port; flows are spread across the group by their hash, so that
+ * every packet of a connection (the SYN, the ACK that pulls it out of limbo)
+ * goes to the same listener and ends up in its accept queue.
+ *
+ * Called with the ht locked. */
+static struct conv *ipht_pick_listener(struct Iphash *chain, int match,
+                                       uint8_t *sa, uint16_t sp, uint8_t *da,
+                                       uint16_t dp)
+{
+	struct Iphash *h;
+	unsigned int nr = 0, pick;
+
+	for (h = chain; h != NULL; h = h->next) {
+		if (!ipht_listener_match(h, match, da, dp))
+			continue;
+		if (!h->c->reuseport)
+			return h->c;
+		nr++;
+	}
+	if (!nr)
+		return NULL;
+	pick = hash_32(nhgetl(sa + IPaddrlen - 4) ^ hash_32(sp, 32), 32) % nr;
+	for (h = chain; h != NULL; h = h->next) {
+		if (!ipht_listener_match(h, match, da, dp))
+			continue;
+		if (!pick--)
+			return h->c;
+	}
+	return NULL;
+}
+
 /* look for a matching conversation with the following precedence
  *	connected && raddr,rport,laddr,lport
  *	announced && laddr,lport
@@ -682,26 +723,18 @@ struct conv *iphtlook(struct Ipht *ht, uint8_t * sa, uint16_t sp, uint8_t * da,
 
 	/* match local address and port */
 	hv = iphash(IPnoaddr, 0, da, dp);
-	for (h = ht->tab[hv]; h != NULL; h = h->next) {
-		if (h->match != IPmatchpa)
-			continue;
-		c = h->c;
-		if (dp == c->lport && ipcmp(da, c->laddr) == 0) {
-			spin_unlock(&ht->lock);
-			return c;
-		}
+	c = ipht_pick_listener(ht->tab[hv], IPmatchpa, sa, sp, da, dp);
+	if (c) {
+		spin_unlock(&ht->lock);
+		return c;
 	}
 
 	/* match just port */
 	hv = iphash(IPnoaddr, 0, IPnoaddr, dp);
-	for (h = ht->tab[hv]; h != NULL; h = h->next) {
-		if (h->match != IPmatchport)
-			continue;
-		c = h->c;
-		if (dp == c->lport) {
-			spin_unlock(&ht->lock);
-			return c;
-		}
+	c = ipht_pick_listener(ht->tab[hv], IPmatchport, sa, sp, da, dp);
+	if (c) {
+		spin_unlock(&ht->lock);
+		return c;
 	}
 
 	/* match local address */
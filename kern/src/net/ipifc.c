@@ -835,13 +835,26 @@ static void ipifcctl(struct conv *c, char **argv, int argc)
 		ipifcsendra6(ifc, argv, argc);
 	else if (strcmp(argv[0], "recvra6") == 0)
 		ipifcrecvra6(ifc, argv, argc);
+	else if (strcmp(argv[0], "rps") == 0)
+		ip_rps_ctl(ifc, argv, argc);
+	else if (strcmp(argv[0], "rfs") == 0)
+		ip_rfs_ctl(ifc, argv, argc);
 	else
 		error(EINVAL, "unknown command to %s", __func__);
 }
 
 int ipifcstats(struct Proto *ipifc, char *buf, int len)
 {
-	return ipstats(ipifc->f, buf, len);
+	int n;
+
+	n = ipstats(ipifc->f, buf, len);
+	for (int i = 0; i < ipifc->nc && n < len; i++) {
+		if (!ipifc->conv[i])
+			continue;
+		n += ip_rps_stats((struct Ipifc*)ipifc->conv[i]->ptcl, buf + n,
+		                  len - n);
+	}
+	return n;
 }
 
 void ipifcinit(struct Fs *f)
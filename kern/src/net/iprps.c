@@ -0,0 +1,321 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Receive packet steering (RPS) for IP input.
+ *
+ * Without RPS, a medium's reader ktask (e.g. etherread4) carries every packet
+ * through IP, TCP, and UDP on whichever core it runs on.  With RPS, the reader
+ * hashes the packet's flow (addresses and ports) and hands it to a per-core
+ * queue.  The target core drains its queue from a routine kernel message, so
+ * the protocol work for different flows happens in parallel.  Packets in a
+ * flow land on the same core (unless the map changes), so they stay in order.
+ *
+ * The map from flow hash to core is configured per interface with the ipifc
+ * ctl:
+ * 		rps CORE [CORE...]	steer flows across these cores
+ * 		rps off				process packets on the reader's core
+ * 		rfs on|off			prefer the core that last read the flow's conv
+ *
+ * RFS (receive flow steering) uses a global table, indexed by flow hash, of the
+ * core that last read from the conversation.  That's usually where the process
+ * (or the MCP's vcore) that wants the data is running, so its caches are warm.
+ * When the reader moves, we don't move the flow until the old core's queue is
+ * past the flow's last packet (each ifc tracks that in its flows table).
+ * Otherwise the new core could process the flow's packets before the old one
+ * does, and TCP would see them out of order.
+ *
+ * TODO:
+ * - IPv6.  etherread6 still calls ipiput6 directly.
+ * - The queues and RPS struct are never freed, same as ifcs. */
+
+#include <net/ip.h>
+#include <net/tcp.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <error.h>
+#include <hash.h>
+#include <smp.h>
+#include <trap.h>
+
+#define RPS_IP_MF_OFF		0x3fff	/* more frags or frag offset */
+#define RPS_UDPPROTO		17
+#define RPS_FLOW_TBL_BITS	12
+#define RPS_FLOW_TBL_SZ		(1 << RPS_FLOW_TBL_BITS)
+
+/* Core + 1 of the last reader of a flow, 0 for unknown. */
+static uint16_t rps_flow_cores[RPS_FLOW_TBL_SZ];
+/* Set once anyone turns on RFS, so that readers can skip the table. */
+static bool rps_rfs_used;
+
+static uint32_t rps_flow_hash(uint32_t src, uint32_t dst, uint16_t sport,
+                              uint16_t dport)
+{
+	return hash_32(src ^ hash_32(dst ^ (sport << 16 | dport), 32), 32);
+}
+
+/* Hashes an IPv4 packet, with bp->rp at the IP header.  Fragments and
+ * non-TCP/UDP packets only hash the addresses, so that all of a flow's
+ * fragments go to the same core. */
+static uint32_t rps_pkt_hash(struct block *bp)
+{
+	struct Ip4hdr *h = (struct Ip4hdr*)bp->rp;
+	int hl = (h->vihl & 0xF) << 2;
+	uint16_t sport = 0, dport = 0;
+
+	if ((h->proto == IP_TCPPROTO || h->proto == RPS_UDPPROTO) &&
+	    !(nhgets(h->frag) & RPS_IP_MF_OFF) && BHLEN(bp) >= hl + 4) {
+		sport = nhgets(bp->rp + hl);
+		dport = nhgets(bp->rp + hl + 2);
+	}
+	return rps_flow_hash(nhgetl(h->src), nhgetl(h->dst), sport, dport);
+}
+
+/* Called when a process reads from a conv.  Remembers this core as the place
+ * to send the flow's future packets, if RFS is on. */
+void ip_rps_note_flow(struct conv *c)
+{
+	uint32_t hash;
+
+	if (!rps_rfs_used)
+		return;
+	if (!isv4(c->raddr) || !c->rport)
+		return;
+	/* Incoming packets go from the remote to us */
+	hash = rps_flow_hash(nhgetl(c->raddr + IPv4off), nhgetl(c->laddr + IPv4off),
+	                     c->rport, c->lport);
+	hash &= RPS_FLOW_TBL_SZ - 1;
+	if (rps_flow_cores[hash] != core_id() + 1)
+		rps_flow_cores[hash] = core_id() + 1;
+}
+
+/* Returns the core for a packet of the flow.  With RFS, that's the flow's
+ * reader, but only once the flow's core (if any) is done with its queued
+ * packets. */
+static uint32_t rps_pick_core(struct ip_rps *rps, uint32_t hash,
+                              struct rps_flow **flow_p)
+{
+	struct rps_flow *flow;
+	struct rps_queue *q;
+	uint32_t core, want;
+
+	core = rps->map[hash % RPS_MAP_SZ];
+	if (!rps->rfs)
+		return core;
+	flow = &rps->flows[hash & (RPS_FLOW_TBL_SZ - 1)];
+	*flow_p = flow;
+	if (flow->core && flow->core <= num_cores)
+		core = flow->core - 1;
+	want = rps_flow_cores[hash & (RPS_FLOW_TBL_SZ - 1)];
+	if (want && want <= num_cores && want - 1 != core) {
+		q = &rps->queues[core];
+		/* Racy read, but nr_processed only goes up.  Until the old core is
+		 * past our last packet, we stay put. */
+		if (!flow->core ||
+		    (int64_t)(ACCESS_ONCE(q->nr_processed) - flow->qtail) >= 0) {
+			core = want - 1;
+			flow->qtail = 0;
+		}
+	}
+	flow->core = core + 1;
+	return core;
+}
+
+static void rps_process(struct ip_rps *rps, struct rps_queue *q,
+                        struct block *bp)
+{
+	ERRSTACK(1);
+	struct Ipifc *ifc = rps->ifc;
+
+	if (!canrlock(&ifc->rwlock)) {
+		/* The ifc is being changed; drop it like a full queue would */
+		spin_lock_irqsave(&q->lock);
+		q->nr_dropped++;
+		spin_unlock_irqsave(&q->lock);
+		freeb(bp);
+		return;
+	}
+	if (waserror()) {
+		runlock(&ifc->rwlock);
+		poperror();
+		return;
+	}
+	if (ifc->lifc == NULL)
+		freeb(bp);
+	else
+		ipiput4(rps->f, ifc, bp);
+	runlock(&ifc->rwlock);
+	poperror();
+}
+
+/* Routine kmsg, running on the queue's core.  Drains the queue until it is
+ * empty, then tells the producers to kick us again next time. */
+static void __rps_drain(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct ip_rps *rps = (struct ip_rps*)a0;
+	struct rps_queue *q = (struct rps_queue*)a1;
+	struct block *bp, *next;
+
+	for (;;) {
+		spin_lock_irqsave(&q->lock);
+		bp = q->head;
+		q->head = NULL;
+		q->tail = NULL;
+		q->len = 0;
+		if (!bp) {
+			q->scheduled = FALSE;
+			spin_unlock_irqsave(&q->lock);
+			return;
+		}
+		spin_unlock_irqsave(&q->lock);
+		for (; bp; bp = next) {
+			next = bp->next;
+			bp->next = NULL;
+			rps_process(rps, q, bp);
+			q->nr_processed++;
+		}
+	}
+}
+
+/* IPv4 input for a medium's reader.  Hold the ifc rlock.  If RPS is off, or the
+ * flow belongs on this core, we run ipiput4 directly. */
+void ip_rps_input(struct Fs *f, struct Ipifc *ifc, struct block *bp)
+{
+	struct ip_rps *rps = ifc->rps;
+	struct rps_queue *q;
+	struct rps_flow *flow = NULL;
+	uint32_t core;
+	bool kick = FALSE;
+
+	if (!rps || !rps->enabled || BHLEN(bp) < sizeof(struct Ip4hdr)) {
+		ipiput4(f, ifc, bp);
+		return;
+	}
+	core = rps_pick_core(rps, rps_pkt_hash(bp), &flow);
+	if (core == core_id()) {
+		ipiput4(f, ifc, bp);
+		return;
+	}
+	q = &rps->queues[core];
+	spin_lock_irqsave(&q->lock);
+	if (q->len >= rps->qlimit) {
+		q->nr_dropped++;
+		spin_unlock_irqsave(&q->lock);
+		freeb(bp);
+		return;
+	}
+	bp->next = NULL;
+	if (q->tail)
+		q->tail->next = bp;
+	else
+		q->head = bp;
+	q->tail = bp;
+	q->len++;
+	q->nr_steered++;
+	if (flow)
+		flow->qtail = q->nr_steered;
+	if (!q->scheduled) {
+		q->scheduled = TRUE;
+		kick = TRUE;
+	}
+	spin_unlock_irqsave(&q->lock);
+	if (kick)
+		send_kernel_message(core, __rps_drain, (long)rps, (long)q, 0,
+		                    KMSG_ROUTINE);
+}
+
+static struct ip_rps *get_ifc_rps(struct Ipifc *ifc)
+{
+	struct ip_rps *rps;
+
+	if (ifc->rps)
+		return ifc->rps;
+	rps = kzmalloc(sizeof(struct ip_rps), MEM_WAIT);
+	rps->ifc = ifc;
+	rps->f = ifc->conv->p->f;
+	rps->qlimit = RPS_QLIMIT_DEFAULT;
+	rps->queues = kzmalloc_align(sizeof(struct rps_queue) * num_cores,
+	                             MEM_WAIT, ARCH_CL_SIZE);
+	for (int i = 0; i < num_cores; i++)
+		spinlock_init_irqsave(&rps->queues[i].lock);
+	rps->flows = kzmalloc(sizeof(struct rps_flow) * RPS_FLOW_TBL_SZ,
+	                      MEM_WAIT);
+	wmb();	/* init before publishing */
+	ifc->rps = rps;
+	return rps;
+}
+
+/* ipifc ctl: "rps off" or "rps CORE [CORE...]".  Called with the conv qlocked,
+ * which protects ifc->rps's creation. */
+void ip_rps_ctl(struct Ipifc *ifc, char **argv, int argc)
+{
+	struct ip_rps *rps;
+	uint16_t cores[RPS_MAP_SZ];
+	int nr_cores = 0;
+	long core;
+	char *end;
+
+	if (argc < 2)
+		error(EINVAL, "usage: rps off|CORE [CORE...]");
+	if (!strcmp(argv[1], "off")) {
+		if (ifc->rps)
+			ifc->rps->enabled = FALSE;
+		return;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (nr_cores == RPS_MAP_SZ)
+			error(E2BIG, "at most %d rps cores", RPS_MAP_SZ);
+		core = strtol(argv[i], &end, 0);
+		if (*end || core < 0 || core >= num_cores)
+			error(EINVAL, "bad rps core %s", argv[i]);
+		cores[nr_cores++] = core;
+	}
+	rps = get_ifc_rps(ifc);
+	/* Racy with concurrent lookups, which is fine: a few packets go to the
+	 * old core.  They'll be out of order with respect to the new core. */
+	for (int i = 0; i < RPS_MAP_SZ; i++)
+		rps->map[i] = cores[i % nr_cores];
+	rps->enabled = TRUE;
+}
+
+/* ipifc ctl: "rfs on|off". */
+void ip_rfs_ctl(struct Ipifc *ifc, char **argv, int argc)
+{
+	struct ip_rps *rps;
+
+	if (argc != 2)
+		error(EINVAL, "usage: rfs on|off");
+	rps = get_ifc_rps(ifc);
+	if (!strcmp(argv[1], "on")) {
+		rps_rfs_used = TRUE;
+		rps->rfs = TRUE;
+	} else if (!strcmp(argv[1], "off")) {
+		rps->rfs = FALSE;
+	} else {
+		error(EINVAL, "usage: rfs on|off");
+	}
+}
+
+/* Prints the ifc's RPS state and per-core stats into buf.  Returns the amount
+ * printed. */
+int ip_rps_stats(struct Ipifc *ifc, char *buf, int len)
+{
+	struct ip_rps *rps = ifc->rps;
+	struct rps_queue *q;
+	char *p = buf, *e = buf + len;
+
+	if (!rps)
+		return 0;
+	p = seprintf(p, e, "%s rps: %s rfs: %s\n", ifc->dev,
+	             rps->enabled ? "on" : "off", rps->rfs ? "on" : "off");
+	for (int i = 0; i < num_cores; i++) {
+		q = &rps->queues[i];
+		if (!q->nr_steered)
+			continue;
+		p = seprintf(p, e, "\tcore %d: steered %llu processed %llu",
+		             i, q->nr_steered, q->nr_processed);
+		p = seprintf(p, e, " dropped %llu qlen %u\n", q->nr_dropped, q->len);
+	}
+	return p - buf;
+}
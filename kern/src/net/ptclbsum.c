@@ -46,175 +46,125 @@ static uint8_t *aendian = (uint8_t *) & endian;
 
 #ifdef CONFIG_X86
 
-/* $NetBSD: in_cksum.c,v 1.7 1997/09/02 13:18:15 thorpej Exp $ */
-
-/*-
- * Copyright (c) 1988, 1992, 1993
- *	The Regents of the University of California.  All rights reserved.
- * Copyright (c) 1996
- *	Matt Thomas <matt@3am-software.com>
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- * 1. Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- * 2. Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- * 3. All advertising materials mentioning features or use of this software
- *    must display the following acknowledgement:
- *	This product includes software developed by the University of
- *	California, Berkeley and its contributors.
- * 4. Neither the name of the University nor the names of its contributors
- *    may be used to endorse or promote products derived from this software
- *    without specific prior written permission.
- *
- * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
- * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
- * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
- * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
- * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
- * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
- * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
- * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
- * SUCH DAMAGE.
+/* x86 checksums.  The old NetBSD loop summed aligned 32 bit words into a 64 bit
+ * accumulator.  Instead, we sum 64 bit words with add-with-carry, eight at a
+ * time, which is what the CPU is good at.  x86 doesn't care about unaligned
+ * loads, so we never align the buffer.  That means the words are always
+ * relative to the start of the buffer, and we only need to byte swap at the
+ * end (the sum of the little-endian words is the byte swap of the sum of the
+ * big-endian words).
  *
- *	@(#)in_cksum.c	8.1 (Berkeley) 6/10/93
- */
+ * We don't use SSE/AVX: the kernel is built with -mno-sse and does not save the
+ * user's FP state when it enters the kernel.  adc chains run at about a word
+ * per cycle anyway, which is faster than the memory for large buffers. */
 
-/*
- * Checksum routine for Internet Protocol family headers
- *    (Portable Alpha version).
- *
- * This routine is very heavily used in the network
- * code and should be modified for each CPU to be as fast as possible.
- */
+static inline uint64_t csum_add64(uint64_t sum, uint64_t x)
+{
+	asm ("addq %1, %0; adcq $0, %0" : "+r"(sum) : "r"(x));
+	return sum;
+}
 
-#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
-#define REDUCE32							  \
-    {									  \
-	q_util.q = sum;							  \
-	sum = q_util.s[0] + q_util.s[1] + q_util.s[2] + q_util.s[3];	  \
-    }
-#define REDUCE16							  \
-    {									  \
-	q_util.q = sum;							  \
-	l_util.l = q_util.s[0] + q_util.s[1] + q_util.s[2] + q_util.s[3]; \
-	sum = l_util.s[0] + l_util.s[1];				  \
-	ADDCARRY(sum);							  \
-    }
+/* Returns the trailing len (< 8) bytes at buf as a little-endian word. */
+static inline uint64_t csum_tail(const uint8_t *buf, size_t len)
+{
+	uint64_t x = 0;
 
-static const uint32_t in_masks[] = {
-	/*0 bytes*/ /*1 byte*/	/*2 bytes*/ /*3 bytes*/
-	0x00000000, 0x000000FF, 0x0000FFFF, 0x00FFFFFF,	/* offset 0 */
-	0x00000000, 0x0000FF00, 0x00FFFF00, 0xFFFFFF00,	/* offset 1 */
-	0x00000000, 0x00FF0000, 0xFFFF0000, 0xFFFF0000,	/* offset 2 */
-	0x00000000, 0xFF000000, 0xFF000000, 0xFF000000,	/* offset 3 */
-};
+	for (int i = 0; i < len; i++)
+		x |= (uint64_t)buf[i] << (i * 8);
+	return x;
+}
 
-union l_util {
-	uint16_t s[2];
-	uint32_t l;
-};
-union q_util {
-	uint16_t s[4];
-	uint32_t l[2];
-	uint64_t q;
-};
+static inline uint16_t csum_fold(uint64_t sum)
+{
+	uint32_t s32;
+
+	s32 = (uint32_t)sum;
+	s32 += (uint32_t)(sum >> 32);
+	s32 += s32 < (uint32_t)(sum >> 32);
+	s32 = (s32 & 0xffff) + (s32 >> 16);
+	s32 = (s32 & 0xffff) + (s32 >> 16);
+	return be16_to_cpu(s32);
+}
 
-static uint64_t
-in_cksumdata(const void *buf, int len)
+static uint64_t csum_words(const uint8_t *buf, size_t len)
 {
-	const uint32_t *lw = (const uint32_t *) buf;
 	uint64_t sum = 0;
-	uint64_t prefilled;
-	int offset;
-	union q_util q_util;
 
-	if ((3 & (long) lw) == 0 && len == 20) {
-	     sum = (uint64_t) lw[0] + lw[1] + lw[2] + lw[3] + lw[4];
-	     REDUCE32;
-	     return sum;
-	}
-
-	if ((offset = 3 & (long) lw) != 0) {
-		const uint32_t *masks = in_masks + (offset << 2);
-		lw = (uint32_t *) (((long) lw) - offset);
-		sum = *lw++ & masks[len >= 3 ? 3 : len];
-		len -= 4 - offset;
-		if (len <= 0) {
-			REDUCE32;
-			return sum;
-		}
-	}
-#if 0
-	/*
-	 * Force to cache line boundary.
-	 */
-	offset = 32 - (0x1f & (long) lw);
-	if (offset < 32 && len > offset) {
-		len -= offset;
-		if (4 & offset) {
-			sum += (uint64_t) lw[0];
-			lw += 1;
-		}
-		if (8 & offset) {
-			sum += (uint64_t) lw[0] + lw[1];
-			lw += 2;
-		}
-		if (16 & offset) {
-			sum += (uint64_t) lw[0] + lw[1] + lw[2] + lw[3];
-			lw += 4;
-		}
+	while (len >= 64) {
+		asm ("addq 0*8(%[src]), %[sum];"
+		     "adcq 1*8(%[src]), %[sum];"
+		     "adcq 2*8(%[src]), %[sum];"
+		     "adcq 3*8(%[src]), %[sum];"
+		     "adcq 4*8(%[src]), %[sum];"
+		     "adcq 5*8(%[src]), %[sum];"
+		     "adcq 6*8(%[src]), %[sum];"
+		     "adcq 7*8(%[src]), %[sum];"
+		     "adcq $0, %[sum]"
+		     : [sum] "+r"(sum)
+		     : [src] "r"(buf), "m"(*(const uint8_t (*)[64])buf));
+		buf += 64;
+		len -= 64;
 	}
-#endif
-	/*
-	 * access prefilling to start load of next cache line.
-	 * then add current cache line
-	 * save result of prefilling for loop iteration.
-	 */
-	prefilled = lw[0];
-	while ((len -= 32) >= 4) {
-		uint64_t prefilling = lw[8];
-		sum += prefilled + lw[1] + lw[2] + lw[3]
-			+ lw[4] + lw[5] + lw[6] + lw[7];
-		lw += 8;
-		prefilled = prefilling;
-	}
-	if (len >= 0) {
-		sum += prefilled + lw[1] + lw[2] + lw[3]
-			+ lw[4] + lw[5] + lw[6] + lw[7];
-		lw += 8;
-	} else {
-		len += 32;
-	}
-	while ((len -= 16) >= 0) {
-		sum += (uint64_t) lw[0] + lw[1] + lw[2] + lw[3];
-		lw += 4;
-	}
-	len += 16;
-	while ((len -= 4) >= 0) {
-		sum += (uint64_t) *lw++;
+	while (len >= 8) {
+		sum = csum_add64(sum, *(const uint64_t*)buf);
+		buf += 8;
+		len -= 8;
 	}
-	len += 4;
-	if (len > 0)
-		sum += (uint64_t) (in_masks[len] & *lw);
-	REDUCE32;
+	if (len)
+		sum = csum_add64(sum, csum_tail(buf, len));
 	return sum;
 }
-uint16_t ptclbsum(uint8_t * addr, int len)
+
+uint16_t ptclbsum(uint8_t *addr, int len)
+{
+	return csum_fold(csum_words(addr, len));
+}
+
+/* Copies len bytes from src to dst, returning ptclbsum(dst, len).  The data is
+ * in registers for the copy, so the checksum is almost free. */
+uint16_t memcpy_and_csum(void *dst, const void *src, size_t len)
 {
-	uint64_t sum = in_cksumdata(addr, len);
-	union q_util q_util;
-	union l_util l_util;
-	if ((uintptr_t)addr & 1)
-		sum <<= 8;
-	REDUCE16;
-	return cpu_to_be16(sum);
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint64_t sum = 0;
+	uint64_t w0, w1, w2, w3;
+
+	while (len >= 32) {
+		w0 = ((const uint64_t*)s)[0];
+		w1 = ((const uint64_t*)s)[1];
+		w2 = ((const uint64_t*)s)[2];
+		w3 = ((const uint64_t*)s)[3];
+		((uint64_t*)d)[0] = w0;
+		((uint64_t*)d)[1] = w1;
+		((uint64_t*)d)[2] = w2;
+		((uint64_t*)d)[3] = w3;
+		asm ("addq %1, %0;"
+		     "adcq %2, %0;"
+		     "adcq %3, %0;"
+		     "adcq %4, %0;"
+		     "adcq $0, %0"
+		     : "+r"(sum)
+		     : "r"(w0), "r"(w1), "r"(w2), "r"(w3));
+		s += 32;
+		d += 32;
+		len -= 32;
+	}
+	while (len >= 8) {
+		w0 = *(const uint64_t*)s;
+		*(uint64_t*)d = w0;
+		sum = csum_add64(sum, w0);
+		s += 8;
+		d += 8;
+		len -= 8;
+	}
+	if (len) {
+		sum = csum_add64(sum, csum_tail(s, len));
+		for (int i = 0; i < len; i++)
+			d[i] = s[i];
+	}
+	return csum_fold(sum);
 }
+
 #else
 uint16_t ptclbsum(uint8_t * addr, int len)
 {
@@ -282,4 +232,10 @@ uint16_t ptclbsum(uint8_t * addr, int len)
 
 	return losum & 0xffff;
 }
+
+uint16_t memcpy_and_csum(void *dst, const void *src, size_t len)
+{
+	memmove(dst, src, len);
+	return ptclbsum(dst, len);
+}
 #endif
@@ -190,6 +190,8 @@ static void udpcreate(struct conv *c)
 {
 	c->rq = qopen(128 * 1024, Qmsg, 0, 0);
 	c->wq = qbypass(udpkick, c);
+	/* Datagrams are copied in whole, so we can checksum them on the way. */
+	q_toggle_qcsum(c->wq, TRUE);
 }
 
 static void udpclose(struct conv *c)
@@ -215,6 +217,23 @@ static void udpclose(struct conv *c)
 	qunlock(&c->qlock);
 }
 
+/* Returns the UDP checksum for a datagram whose headers start at hdr_off and
+ * are hdr_len bytes, followed by data whose ptclbsum is data_csum.  hdr_len
+ * must be even, so that the data's sum lines up with the header's. */
+static uint16_t udp_csum_with_data(struct block *bp, int hdr_off, int hdr_len,
+                                   uint16_t data_csum)
+{
+	uint32_t sum;
+	uint16_t csum;
+
+	sum = (uint16_t)~ptclcsum(bp, hdr_off, hdr_len);
+	sum += data_csum;
+	sum = (sum & 0xffff) + (sum >> 16);
+	csum = ~sum & 0xffff;
+	/* 0 means "no checksum" */
+	return csum ? csum : 0xffff;
+}
+
 void udpkick(void *x, struct block *bp)
 {
 	struct conv *c = x;
@@ -223,7 +242,7 @@ void udpkick(void *x, struct block *bp)
 	uint16_t rport;
 	uint8_t laddr[IPaddrlen], raddr[IPaddrlen];
 	Udpcb *ucb;
-	int dlen, ptcllen;
+	int dlen, ptcllen, data_csum;
 	Udppriv *upriv;
 	struct Fs *f;
 	int version;
@@ -291,6 +310,12 @@ void udpkick(void *x, struct block *bp)
 	}
 
 	dlen = blocklen(bp);
+	/* The data's checksum is only good if it is exactly what the user wrote,
+	 * and not the address header too. */
+	data_csum = -1;
+	if (!ucb->headers && (bp->flag & Bdatacsum) && !bp->next)
+		data_csum = bp->data_csum;
+	bp->flag &= ~Bdatacsum;
 
 	/* fill in pseudo header and compute checksum */
 	switch (version) {
@@ -326,10 +351,17 @@ void udpkick(void *x, struct block *bp)
 			bp->network_offset = 0;
 			bp->transport_offset = offsetof(Udp4hdr, udpsport);
 			assert(bp->transport_offset == UDP4_IPHDR_SZ);
-			hnputs(uh4->udpcksum,
-				   ~ptclcsum(bp, UDP4_PHDR_OFF, UDP4_PHDR_SZ));
 			bp->tx_csum_offset = uh4->udpcksum - uh4->udpsport;
-			bp->flag |= Budpck;
+			if (data_csum >= 0) {
+				hnputs(uh4->udpcksum,
+				       udp_csum_with_data(bp, UDP4_PHDR_OFF,
+				                          UDP4_PHDR_SZ + UDP_UDPHDR_SZ,
+				                          data_csum));
+			} else {
+				hnputs(uh4->udpcksum,
+				       ~ptclcsum(bp, UDP4_PHDR_OFF, UDP4_PHDR_SZ));
+				bp->flag |= Budpck;
+			}
 			uh4->vihl = IP_VER4;
 			ipoput4(f, bp, 0, c->ttl, c->tos, rc);
 			break;
@@ -363,9 +395,15 @@ void udpkick(void *x, struct block *bp)
 			hnputs(uh6->udplen, ptcllen);
 			uh6->udpcksum[0] = 0;
 			uh6->udpcksum[1] = 0;
-			hnputs(uh6->udpcksum,
-				   ptclcsum(bp, UDP6_PHDR_OFF,
-							dlen + UDP_UDPHDR_SZ + UDP6_PHDR_SZ));
+			if (data_csum >= 0)
+				hnputs(uh6->udpcksum,
+				       udp_csum_with_data(bp, UDP6_PHDR_OFF,
+				                          UDP6_PHDR_SZ + UDP_UDPHDR_SZ,
+				                          data_csum));
+			else
+				hnputs(uh6->udpcksum,
+				       ptclcsum(bp, UDP6_PHDR_OFF,
+				                dlen + UDP_UDPHDR_SZ + UDP6_PHDR_SZ));
 			memset(uh6, 0, 8);
 			bp->network_offset = 0;
 			bp->transport_offset = offsetof(Udp6hdr, udpsport);
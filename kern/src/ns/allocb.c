@@ -46,24 +46,11 @@ enum {
 	BLOCKALIGN = 32,	/* was the old BY2V in inferno, which was 8 */
 };
 
-/*
- *  allocate blocks (round data base address to 64 bit boundary).
- *  if mallocz gives us more than we asked for, leave room at the front
- *  for header.
- */
-struct block *block_alloc(size_t size, int mem_flags)
+/* Sets up a block whose buffer starts at buf, with room for size bytes of data
+ * after the Hdrspc. */
+static void block_init(struct block *b, uint8_t *buf, size_t size)
 {
-	struct block *b;
 	uintptr_t addr;
-	int n;
-
-	/* If Hdrspc is not block aligned it will cause issues. */
-	static_assert(Hdrspc % BLOCKALIGN == 0);
-
-	b = kmalloc(sizeof(struct block) + size + Hdrspc + (BLOCKALIGN - 1),
-				mem_flags);
-	if (b == NULL)
-		return NULL;
 
 	b->next = NULL;
 	b->list = NULL;
@@ -76,8 +63,8 @@ struct block *block_alloc(size_t size, int mem_flags)
 	b->network_offset = 0;
 	b->transport_offset = 0;
 
-	addr = (uintptr_t) b;
-	addr = ROUNDUP(addr + sizeof(struct block), BLOCKALIGN);
+	addr = (uintptr_t) buf;
+	addr = ROUNDUP(addr, BLOCKALIGN);
 	b->base = (uint8_t *) addr;
 	/* TODO: support this */
 	/* interesting. We can ask the allocator, after allocating,
@@ -86,9 +73,7 @@ struct block *block_alloc(size_t size, int mem_flags)
 	 b->lim = ((uint8_t*)b) + msize(b);
 	 * See use of n in commented code below
 	 */
-	b->lim =
-		((uint8_t *) b) + sizeof(struct block) + size + Hdrspc + (BLOCKALIGN -
-																  1);
+	b->lim = buf + size + Hdrspc + (BLOCKALIGN - 1);
 	b->rp = b->base;
 	/* TODO: support this */
 	/* n is supposed to be Hdrspc + rear padding + extra reserved memory, but
@@ -100,13 +85,277 @@ struct block *block_alloc(size_t size, int mem_flags)
 	 */
 	b->rp += Hdrspc;
 	b->wp = b->rp;
-	/* b->base is aligned, rounded up from b
+	/* b->base is aligned, rounded up from buf
 	 * b->lim is the upper bound on our malloc
 	 * b->rp is advanced by some aligned amount, based on how much extra we
 	 * received from kmalloc and the Hdrspc. */
+}
+
+/*
+ *  allocate blocks (round data base address to 64 bit boundary).
+ *  if mallocz gives us more than we asked for, leave room at the front
+ *  for header.
+ */
+struct block *block_alloc(size_t size, int mem_flags)
+{
+	struct block *b;
+
+	/* If Hdrspc is not block aligned it will cause issues. */
+	static_assert(Hdrspc % BLOCKALIGN == 0);
+
+	b = kmalloc(sizeof(struct block) + size + Hdrspc + (BLOCKALIGN - 1),
+				mem_flags);
+	if (b == NULL)
+		return NULL;
+	block_init(b, (uint8_t*)(b + 1), size);
 	return b;
 }
 
+/* Pool blocks know which pool they came from.  The block must be at the start
+ * of the kmalloc buffer, since qio's zero-copy paths kmalloc_incref() it. */
+struct pool_block {
+	struct block				block;
+	struct block_pool			*pool;
+	uint32_t					coreid;		/* allocator, gets it back */
+};
+
+static void block_pool_release(struct kref *kref)
+{
+	struct block_pool *bpool = container_of(kref, struct block_pool, kref);
+
+	kfree(bpool->pcpus);
+	kfree(bpool);
+}
+
+/* Gives a pool block back to kmalloc, for good. */
+static void __pool_block_release(struct block_pool *bpool, struct block *b)
+{
+	kfree(b);
+	kref_put(&bpool->kref);
+}
+
+/* Trims a list that grew past hi_water down to lo_water.  Returns the blocks to
+ * release, which the caller does after unlocking. */
+static struct block *__pool_list_trim(struct block_pool *bpool,
+                                      struct block **list, unsigned int *nr,
+                                      uint64_t *nr_released)
+{
+	struct block *trim = NULL, *b;
+
+	if (*nr <= bpool->hi_water)
+		return NULL;
+	while (*nr > bpool->lo_water) {
+		b = *list;
+		*list = b->next;
+		(*nr)--;
+		(*nr_released)++;
+		b->next = trim;
+		trim = b;
+	}
+	return trim;
+}
+
+static void pool_block_free(struct block *b)
+{
+	struct pool_block *pb = container_of(b, struct pool_block, block);
+	struct block_pool *bpool = pb->pool;
+	struct block_pool_pcpu *pcp;
+	struct block *trim = NULL, *next;
+
+	/* Someone else (e.g. a qclone()d block) still points into this block's
+	 * memory.  We can't recycle it, so let kmalloc free it once they are done.
+	 * The pool will make a new one on demand.  If they were the only other
+	 * holder and dropped their ref since we checked, this kfree() frees it. */
+	if (kmalloc_refcnt(b) > 1) {
+		atomic_inc(&bpool->nr_shared);
+		__pool_block_release(bpool, b);
+		return;
+	}
+	block_init(b, (uint8_t*)(pb + 1), bpool->blk_size);
+	b->free = pool_block_free;
+	pcp = &bpool->pcpus[pb->coreid];
+	if (pb->coreid == core_id()) {
+		spin_lock_irqsave(&pcp->lock);
+		if (bpool->dying) {
+			spin_unlock_irqsave(&pcp->lock);
+			__pool_block_release(bpool, b);
+			return;
+		}
+		pcp->nr_frees++;
+		b->next = pcp->free_list;
+		pcp->free_list = b;
+		pcp->nr_free++;
+		trim = __pool_list_trim(bpool, &pcp->free_list, &pcp->nr_free,
+		                        &pcp->nr_released);
+		spin_unlock_irqsave(&pcp->lock);
+	} else {
+		spin_lock_irqsave(&pcp->remote_lock);
+		if (bpool->dying) {
+			spin_unlock_irqsave(&pcp->remote_lock);
+			__pool_block_release(bpool, b);
+			return;
+		}
+		pcp->nr_remote_frees++;
+		b->next = pcp->remote_list;
+		pcp->remote_list = b;
+		pcp->nr_remote++;
+		/* The owner might not be allocating anymore */
+		trim = __pool_list_trim(bpool, &pcp->remote_list, &pcp->nr_remote,
+		                        &pcp->nr_remote_released);
+		spin_unlock_irqsave(&pcp->remote_lock);
+	}
+	for (b = trim; b; b = next) {
+		next = b->next;
+		__pool_block_release(bpool, b);
+	}
+}
+
+static struct block *__pool_block_new(struct block_pool *bpool, int mem_flags)
+{
+	struct pool_block *pb;
+
+	pb = kmalloc(sizeof(struct pool_block) + bpool->blk_size + Hdrspc +
+	             (BLOCKALIGN - 1), mem_flags);
+	if (!pb)
+		return NULL;
+	pb->pool = bpool;
+	pb->coreid = core_id();
+	block_init(&pb->block, (uint8_t*)(pb + 1), bpool->blk_size);
+	pb->block.free = pool_block_free;
+	kref_get(&bpool->kref, 1);
+	return &pb->block;
+}
+
+/* Creates a pool of blocks, each with room for blk_size bytes of data (plus the
+ * usual Hdrspc).  The calling core's free list starts with lo_water blocks. */
+struct block_pool *block_pool_create(const char *name, size_t blk_size,
+                                     unsigned int lo_water,
+                                     unsigned int hi_water)
+{
+	struct block_pool *bpool;
+	struct block_pool_pcpu *pcp;
+	struct block *b;
+
+	assert(lo_water <= hi_water);
+	bpool = kzmalloc(sizeof(struct block_pool), MEM_WAIT);
+	strlcpy(bpool->name, name, KNAMELEN);
+	bpool->blk_size = blk_size;
+	bpool->lo_water = lo_water;
+	bpool->hi_water = hi_water;
+	bpool->dying = FALSE;
+	kref_init(&bpool->kref, block_pool_release, 1);
+	atomic_init(&bpool->nr_shared, 0);
+	bpool->pcpus = kzmalloc_align(sizeof(struct block_pool_pcpu) * num_cores,
+	                              MEM_WAIT, ARCH_CL_SIZE);
+	for (int i = 0; i < num_cores; i++) {
+		spinlock_init_irqsave(&bpool->pcpus[i].lock);
+		spinlock_init_irqsave(&bpool->pcpus[i].remote_lock);
+	}
+	pcp = &bpool->pcpus[core_id()];
+	for (int i = 0; i < lo_water; i++) {
+		b = __pool_block_new(bpool, MEM_WAIT);
+		spin_lock_irqsave(&pcp->lock);
+		b->next = pcp->free_list;
+		pcp->free_list = b;
+		pcp->nr_free++;
+		spin_unlock_irqsave(&pcp->lock);
+	}
+	return bpool;
+}
+
+/* Releases all of the free blocks.  Blocks that are still out in the wild will
+ * go back to kmalloc when they are freed, and the last one frees the pool.  No
+ * one should call block_pool_alloc() once the pool is destroyed. */
+void block_pool_destroy(struct block_pool *bpool)
+{
+	struct block_pool_pcpu *pcp;
+	struct block *b;
+
+	for (int i = 0; i < num_cores; i++) {
+		pcp = &bpool->pcpus[i];
+		spin_lock_irqsave(&pcp->lock);
+		/* Only needs to be set once, but we need it to be set while we hold
+		 * each pcpu lock, so that frees after we drain don't refill. */
+		bpool->dying = TRUE;
+		while ((b = pcp->free_list)) {
+			pcp->free_list = b->next;
+			pcp->nr_free--;
+			/* Safe to kfree while holding the lock, since the pool is pinned
+			 * by our creation ref. */
+			__pool_block_release(bpool, b);
+		}
+		spin_unlock_irqsave(&pcp->lock);
+		spin_lock_irqsave(&pcp->remote_lock);
+		while ((b = pcp->remote_list)) {
+			pcp->remote_list = b->next;
+			pcp->nr_remote--;
+			__pool_block_release(bpool, b);
+		}
+		spin_unlock_irqsave(&pcp->remote_lock);
+	}
+	kref_put(&bpool->kref);
+}
+
+/* Returns a block with room for bpool->blk_size bytes, which will return to the
+ * pool when it is freed with freeb(). */
+struct block *block_pool_alloc(struct block_pool *bpool, int mem_flags)
+{
+	struct block_pool_pcpu *pcp;
+	struct block *b;
+
+	pcp = &bpool->pcpus[core_id()];
+	spin_lock_irqsave(&pcp->lock);
+	pcp->nr_allocs++;
+	if (!pcp->free_list && pcp->remote_list) {
+		/* Take back everything other cores freed for us.  Lockless peek is
+		 * fine; we'll catch the stragglers next time. */
+		spin_lock_irqsave(&pcp->remote_lock);
+		pcp->free_list = pcp->remote_list;
+		pcp->nr_free = pcp->nr_remote;
+		pcp->remote_list = NULL;
+		pcp->nr_remote = 0;
+		spin_unlock_irqsave(&pcp->remote_lock);
+	}
+	b = pcp->free_list;
+	if (b) {
+		pcp->free_list = b->next;
+		pcp->nr_free--;
+		pcp->nr_hits++;
+	}
+	spin_unlock_irqsave(&pcp->lock);
+	if (b) {
+		b->next = NULL;
+		container_of(b, struct pool_block, block)->coreid = core_id();
+		return b;
+	}
+	return __pool_block_new(bpool, mem_flags);
+}
+
+/* Prints the pool's stats, seprintf-style.  The counters are read racily. */
+char *block_pool_seprint(struct block_pool *bpool, char *p, char *e)
+{
+	struct block_pool_pcpu *pcp;
+	uint64_t allocs = 0, hits = 0, frees = 0, remote = 0, released = 0;
+	unsigned long nr_free = 0;
+
+	for (int i = 0; i < num_cores; i++) {
+		pcp = &bpool->pcpus[i];
+		allocs += pcp->nr_allocs;
+		hits += pcp->nr_hits;
+		frees += pcp->nr_frees + pcp->nr_remote_frees;
+		remote += pcp->nr_remote_frees;
+		released += pcp->nr_released + pcp->nr_remote_released;
+		nr_free += pcp->nr_free + pcp->nr_remote;
+	}
+	p = seprintf(p, e, "%s: blksz %lu water %u/%u free %lu\n", bpool->name,
+	             bpool->blk_size, bpool->lo_water, bpool->hi_water, nr_free);
+	p = seprintf(p, e, "%s: allocs %llu hits %llu recycled %llu released %llu",
+	             bpool->name, allocs, hits, frees, released);
+	p = seprintf(p, e, " remote %llu shared %d\n", remote,
+	             atomic_read(&bpool->nr_shared));
+	return p;
+}
+
 /* Makes sure b has nr_bufs extra_data.  Will grow, but not shrink, an existing
  * extra_data array.  When growing, it'll copy over the old entries.  All new
  * entries will be zeroed.  mem_flags determines if we'll block on kmallocs.
@@ -122,16 +371,12 @@ int block_add_extd(struct block *b, unsigned int nr_bufs, int mem_flags)
 
 	if (old_nr_bufs >= nr_bufs)
 		return 0;
-	if (b->extra_data) {
-		new_bdata = krealloc(b->extra_data, new_amt, mem_flags);
-		if (!new_bdata)
-			return -1;
-		memset(new_bdata + old_amt, 0, new_amt - old_amt);
-	} else {
-		new_bdata = kzmalloc(new_amt, mem_flags);
-		if (!new_bdata)
-			return - 1;
-	}
+	new_bdata = kmalloc_sized(new_amt, mem_flags);
+	if (!new_bdata)
+		return -1;
+	memcpy(new_bdata, b->extra_data, old_amt);
+	memset(new_bdata + old_amt, 0, new_amt - old_amt);
+	kfree_sized(b->extra_data, old_amt);
 	b->extra_data = new_bdata;
 	b->nr_extra_bufs = nr_bufs;
 	return 0;
@@ -208,8 +453,9 @@ void free_block_extra(struct block *b)
 			kfree((void*)ebd->base);
 	}
 	b->extra_len = 0;
+	kfree_sized(b->extra_data,	/* harmless if it is 0 */
+	            sizeof(struct extra_bdata) * b->nr_extra_bufs);
 	b->nr_extra_bufs = 0;
-	kfree(b->extra_data);	/* harmless if it is 0 */
 	b->extra_data = 0;		/* in case the block is reused by a free override */
 }
 
@@ -225,7 +471,8 @@ size_t freeb(struct block *b)
 	free_block_extra(b);
 	/*
 	 * drivers which perform non cache coherent DMA manage their own buffer
-	 * pool of uncached buffers and provide their own free routine.
+	 * pool of uncached buffers and provide their own free routine.  Blocks
+	 * from a block_pool also go back to their pool this way.
 	 */
 	if (b->free) {
 		b->free(b);
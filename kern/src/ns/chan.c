@@ -37,6 +37,8 @@
 #include <pmap.h>
 #include <smp.h>
 #include <syscall.h>
+#include <hash.h>
+#include <tree_file.h>
 
 struct chan *kern_slash;
 
@@ -72,15 +74,20 @@ struct Elemlist {
 	int mustbedir;
 };
 
+struct path_cache_dirs;
+
 struct walk_helper {
 	bool can_mount;
 	bool no_follow;
+	bool uncacheable;	/* set by walk(), see cached_walk() */
 	unsigned int nr_loops;
+	struct path_cache_dirs *dirs;	/* set by cached_walk() */
 };
 #define WALK_MAX_NR_LOOPS 8
 
 static struct chan *walk_symlink(struct chan *symlink, struct walk_helper *wh,
                                  unsigned int nr_names_left);
+static void path_cache_note_dir(struct walk_helper *wh, struct chan *c);
 
 #define SEP(c) ((c) == 0 || (c) == '/')
 void cleancname(struct cname *);
@@ -523,6 +530,7 @@ int cmount(struct chan *new, struct chan *old, int flag, char *spec)
 		f->next = m->mount;
 		m->mount = nm;
 	}
+	__sync_fetch_and_add(&pg->mount_gen, 1);
 
 	wunlock(&m->lock);
 	poperror();
@@ -568,9 +576,12 @@ void cunmount(struct chan *mnt, struct chan *mounted)
 		wunlock(&pg->ns);
 		mountfree(m->mount);
 		m->mount = NULL;
+		__sync_fetch_and_add(&pg->mount_gen, 1);
 		cclose(m->from);
 		wunlock(&m->lock);
 		putmhead(m);
+		/* drop the refs the cache holds on the unmounted device */
+		path_cache_flush(pg);
 		return;
 	}
 
@@ -582,16 +593,19 @@ void cunmount(struct chan *mnt, struct chan *mounted)
 			*p = f->next;
 			f->next = 0;
 			mountfree(f);
+			__sync_fetch_and_add(&pg->mount_gen, 1);
 			if (m->mount == NULL) {
 				*l = m->hash;
 				cclose(m->from);
 				wunlock(&m->lock);
 				wunlock(&pg->ns);
 				putmhead(m);
+				path_cache_flush(pg);
 				return;
 			}
 			wunlock(&m->lock);
 			wunlock(&pg->ns);
+			path_cache_flush(pg);
 			return;
 		}
 		p = &f->next;
@@ -738,6 +752,13 @@ struct chan *undomount(struct chan *c, struct cname *name)
 	return c;
 }
 
+/* Names on tree_file devices only change by unlink, rename, or a chmod of a
+ * directory, all of which invalidate the path cache. */
+static bool dev_has_stable_names(int type)
+{
+	return devtab[type].stat == tree_chan_stat;
+}
+
 /*
  * Either walks all the way or not at all.  No partial results in *cp.
  * *nerror is the number of names to display in an error message.
@@ -801,6 +822,12 @@ int walk(struct chan **cp, char **names, int nnames, struct walk_helper *wh,
 		 * walk_symlink, which should have given us a dotdot. */
 		if ((c->qid.type & QTSYMLINK) && !dotdot)
 			panic("Got a walk from a symlink that wasn't ..!");
+		/* The path cache needs every directory we walk from, so take one
+		 * name at a time. */
+		if (wh->dirs && !wh->uncacheable) {
+			ntry = 1;
+			path_cache_note_dir(wh, c);
+		}
 
 		type = c->type;
 		dev = c->dev;
@@ -821,6 +848,8 @@ int walk(struct chan **cp, char **names, int nnames, struct walk_helper *wh,
 				if (f != NULL) {
 					type = f->to->type;
 					dev = f->to->dev;
+					/* creating in an earlier member would hide this */
+					wh->uncacheable = true;
 				}
 			}
 			if (wq == NULL) {
@@ -834,6 +863,9 @@ int walk(struct chan **cp, char **names, int nnames, struct walk_helper *wh,
 			}
 		}
 
+		if (!dev_has_stable_names(type))
+			wh->uncacheable = true;
+
 		nmh = NULL;
 		if (dotdot) {
 			assert(wq->nqid == 1);
@@ -1048,6 +1080,369 @@ void *memrchr(void *va, int c, long n)
 	return NULL;
 }
 
+/* Path cache.
+ *
+ * walk() goes one element at a time: each step is a device walk, a findmount()
+ * (which rlocks the namespace), and an addelem().  The path cache remembers the
+ * result of a walk() per pgrp, keyed on the starting chan, the path's elements,
+ * no_follow, and the user (tree_file walks check search permission).  A hit
+ * hands out a ref on the chan walk() returned, the same way that a walk of zero
+ * elements hands out the starting chan.  Entries hold refs on both chans, so
+ * comparing the starting chan's pointer is safe.
+ *
+ * We only cache walks that stayed on devices with stable names and that didn't
+ * fall through a union or follow an absolute symlink.  The rest of the world
+ * can change the result in two ways: mounts, which bump the pgrp's mount_gen,
+ * and changes to a directory on the path, which bump that directory's path_gen.
+ * While filling an entry, walk() notes each directory it walked from, along
+ * with its path_gen, up to PATH_CACHE_MAX_DIRS of them.  An entry is valid if the mount_gen and all of those
+ * path_gens match the ones we saw before walking, so a rename in /tmp doesn't
+ * cost a walk of /bin anything.
+ *
+ * Entries also hold refs on the directories, which can pin files that were
+ * unlinked or renamed away.  path_cache_invalidate() pokes the management core
+ * to sweep every pgrp's cache and drop the entries that went stale. */
+#define PATH_CACHE_NR_BITS		8
+#define PATH_CACHE_NR_SLOTS		(1 << PATH_CACHE_NR_BITS)
+#define PATH_CACHE_NR_LOCKS		16
+#define PATH_CACHE_MAX_DIRS		16
+
+struct path_cache_dir {
+	struct chan *c;
+	unsigned long gen;
+};
+
+/* The directories a walk went through, filled in by walk(). */
+struct path_cache_dirs {
+	struct path_cache_dir dirs[PATH_CACHE_MAX_DIRS];
+	unsigned int nr;
+};
+
+struct path_cache_ent {
+	struct chan *from;
+	struct chan *to;
+	char *path;
+	char *user;
+	struct path_cache_dir *dirs;
+	unsigned int nr_dirs;
+	unsigned long hash;
+	unsigned long mount_gen;
+	bool no_follow;
+};
+
+struct path_cache {
+	struct list_head link;		/* on path_caches */
+	spinlock_t locks[PATH_CACHE_NR_LOCKS];
+	struct path_cache_ent ents[PATH_CACHE_NR_SLOTS];
+};
+
+static struct list_head path_caches = LIST_HEAD_INIT(path_caches);
+static qlock_t path_caches_lock = QLOCK_INITIALIZER(path_caches_lock);
+static atomic_t path_cache_sweep_poked;
+
+static spinlock_t *path_cache_lock(struct path_cache *pc, size_t idx)
+{
+	return &pc->locks[idx % PATH_CACHE_NR_LOCKS];
+}
+
+static void path_cache_ent_release(struct path_cache_ent *ent)
+{
+	cclose(ent->from);
+	cclose(ent->to);
+	for (int i = 0; i < ent->nr_dirs; i++)
+		cclose(ent->dirs[i].c);
+	kfree(ent->dirs);
+	kfree(ent->path);
+	kfree(ent->user);
+}
+
+static bool path_cache_dirs_changed(struct path_cache_dir *dirs,
+                                    unsigned int nr_dirs)
+{
+	struct fs_file *f;
+
+	for (int i = 0; i < nr_dirs; i++) {
+		f = &chan_to_tree_file(dirs[i].c)->file;
+		if (dirs[i].gen != READ_ONCE(f->path_gen))
+			return true;
+	}
+	return false;
+}
+
+static bool path_cache_ent_is_stale(struct path_cache_ent *ent,
+                                    struct pgrp *pg)
+{
+	return ent->mount_gen != READ_ONCE(pg->mount_gen) ||
+	       path_cache_dirs_changed(ent->dirs, ent->nr_dirs);
+}
+
+/* Drops pc's entries whose directories changed.  Mount changes flush the pgrp's
+ * cache on their own. */
+static void path_cache_sweep(struct path_cache *pc)
+{
+	struct path_cache_ent *ent;
+	struct path_cache_ent old;
+	spinlock_t *lock;
+
+	for (size_t i = 0; i < PATH_CACHE_NR_SLOTS; i++) {
+		ent = &pc->ents[i];
+		if (!READ_ONCE(ent->to))
+			continue;
+		lock = path_cache_lock(pc, i);
+		spin_lock(lock);
+		if (!ent->to || !path_cache_dirs_changed(ent->dirs, ent->nr_dirs)) {
+			spin_unlock(lock);
+			continue;
+		}
+		old = *ent;
+		memset(ent, 0, sizeof(struct path_cache_ent));
+		spin_unlock(lock);
+		path_cache_ent_release(&old);
+	}
+}
+
+static void __path_cache_sweep(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct path_cache *pc;
+
+	/* Changes after this point will poke us again */
+	atomic_set(&path_cache_sweep_poked, 0);
+	qlock(&path_caches_lock);
+	list_for_each_entry(pc, &path_caches, link)
+		path_cache_sweep(pc);
+	qunlock(&path_caches_lock);
+}
+
+/* Called after a change to f's name or parent, or for a directory, its entries
+ * or search permissions.  Pokes are batched, so a burst of unlinks costs one
+ * sweep. */
+void path_cache_invalidate(struct fs_file *f)
+{
+	__sync_fetch_and_add(&f->path_gen, 1);
+	if (atomic_swap(&path_cache_sweep_poked, 1))
+		return;
+	send_kernel_message(0, __path_cache_sweep, 0, 0, 0, KMSG_ROUTINE);
+}
+
+static struct path_cache *pgrp_path_cache(struct pgrp *pg)
+{
+	struct path_cache *pc = READ_ONCE(pg->path_cache);
+
+	if (pc)
+		return pc;
+	pc = kzmalloc(sizeof(struct path_cache), MEM_WAIT);
+	for (int i = 0; i < PATH_CACHE_NR_LOCKS; i++)
+		spinlock_init(&pc->locks[i]);
+	if (!__sync_bool_compare_and_swap(&pg->path_cache, NULL, pc)) {
+		kfree(pc);
+		return pg->path_cache;
+	}
+	qlock(&path_caches_lock);
+	list_add(&pc->link, &path_caches);
+	qunlock(&path_caches_lock);
+	return pc;
+}
+
+/* Drops every entry, which releases the chans (and whatever those pin, such as
+ * a #gtfs instance).  Concurrent walkers may refill it. */
+void path_cache_flush(struct pgrp *pg)
+{
+	struct path_cache *pc = READ_ONCE(pg->path_cache);
+	struct path_cache_ent old;
+	spinlock_t *lock;
+
+	if (!pc)
+		return;
+	for (size_t i = 0; i < PATH_CACHE_NR_SLOTS; i++) {
+		if (!READ_ONCE(pc->ents[i].to))
+			continue;
+		lock = path_cache_lock(pc, i);
+		spin_lock(lock);
+		old = pc->ents[i];
+		memset(&pc->ents[i], 0, sizeof(struct path_cache_ent));
+		spin_unlock(lock);
+		path_cache_ent_release(&old);
+	}
+}
+
+/* Called when pg is going away, so no one else is walking in it. */
+void path_cache_destroy(struct pgrp *pg)
+{
+	struct path_cache *pc = pg->path_cache;
+
+	if (!pc)
+		return;
+	qlock(&path_caches_lock);
+	list_del(&pc->link);
+	qunlock(&path_caches_lock);
+	path_cache_flush(pg);
+	pg->path_cache = NULL;
+	kfree(pc);
+}
+
+/* Called by walk() before walking from c.  The ref keeps c's tree_file around,
+ * so we can check its path_gen later. */
+static void path_cache_note_dir(struct walk_helper *wh, struct chan *c)
+{
+	struct path_cache_dirs *pcd = wh->dirs;
+	struct path_cache_dir *d;
+
+	if (!dev_has_stable_names(c->type) || pcd->nr == PATH_CACHE_MAX_DIRS) {
+		wh->uncacheable = true;
+		return;
+	}
+	d = &pcd->dirs[pcd->nr++];
+	d->gen = READ_ONCE(chan_to_tree_file(c)->file.path_gen);
+	chan_incref(c);
+	d->c = c;
+}
+
+static void path_cache_dirs_release(struct path_cache_dirs *pcd)
+{
+	for (int i = 0; i < pcd->nr; i++)
+		cclose(pcd->dirs[i].c);
+	pcd->nr = 0;
+}
+
+static bool path_cache_wanted(struct chan *c, Elemlist *e, int amode,
+                              struct walk_helper *wh)
+{
+	if (!current || !wh->can_mount || !e->ARRAY_SIZEs)
+		return false;
+	if (amode != Aaccess && amode != Aopen)
+		return false;
+	return dev_has_stable_names(c->type);
+}
+
+/* Builds the key for the walk from c: the elements joined with '/'. */
+static void path_cache_key_init(struct path_cache_ent *key, struct chan *c,
+                                Elemlist *e, struct walk_helper *wh)
+{
+	size_t len = 0;
+	char *p;
+
+	for (int i = 0; i < e->ARRAY_SIZEs; i++)
+		len += strlen(e->elems[i]) + 1;
+	key->path = kmalloc(len, MEM_WAIT);
+	p = key->path;
+	for (int i = 0; i < e->ARRAY_SIZEs; i++) {
+		len = strlen(e->elems[i]);
+		memcpy(p, e->elems[i], len);
+		p += len;
+		*p++ = '/';
+	}
+	*(p - 1) = '\0';
+
+	key->from = c;
+	key->to = NULL;
+	key->user = current->user.name;
+	key->no_follow = wh->no_follow;
+	/* djb2, like the tree_file walk cache, mixed with the starting chan */
+	key->hash = 5381;
+	for (p = key->path; *p; p++)
+		key->hash = ((key->hash << 5) + key->hash) + *p;
+	key->hash ^= (unsigned long)c ^ key->no_follow;
+	key->mount_gen = READ_ONCE(current->pgrp->mount_gen);
+	key->dirs = NULL;
+	key->nr_dirs = 0;
+}
+
+/* On a hit, replaces *cp with a ref on the cached result, like walk(). */
+static bool path_cache_lookup(struct path_cache *pc, struct path_cache_ent *key,
+                              struct chan **cp)
+{
+	size_t idx = hash_long(key->hash, PATH_CACHE_NR_BITS);
+	struct path_cache_ent *ent = &pc->ents[idx];
+	struct path_cache_ent stale = {0};
+	spinlock_t *lock = path_cache_lock(pc, idx);
+	struct chan *to = NULL;
+
+	spin_lock(lock);
+	if (ent->to) {
+		if (path_cache_ent_is_stale(ent, current->pgrp)) {
+			stale = *ent;
+			memset(ent, 0, sizeof(struct path_cache_ent));
+		} else if (ent->hash == key->hash && ent->from == key->from &&
+		           ent->no_follow == key->no_follow &&
+		           !strcmp(ent->path, key->path) &&
+		           !strcmp(ent->user, key->user)) {
+			to = ent->to;
+			chan_incref(to);
+		}
+	}
+	spin_unlock(lock);
+	path_cache_ent_release(&stale);
+	if (!to)
+		return false;
+	cclose(*cp);
+	*cp = to;
+	return true;
+}
+
+/* Takes the key's from ref and path and pcd's dir refs on success, NULLing them
+ * out. */
+static void path_cache_insert(struct path_cache *pc, struct path_cache_ent *key,
+                              struct chan *to, struct path_cache_dirs *pcd)
+{
+	size_t idx = hash_long(key->hash, PATH_CACHE_NR_BITS);
+	struct path_cache_ent new = *key;
+	struct path_cache_ent old;
+	spinlock_t *lock = path_cache_lock(pc, idx);
+
+	/* Something changed during our walk; we might have seen the old result. */
+	if (key->mount_gen != READ_ONCE(current->pgrp->mount_gen) ||
+	    path_cache_dirs_changed(pcd->dirs, pcd->nr))
+		return;
+	new.to = to;
+	chan_incref(to);
+	new.user = NULL;
+	kstrdup(&new.user, key->user);
+	new.nr_dirs = pcd->nr;
+	new.dirs = kmalloc(sizeof(struct path_cache_dir) * pcd->nr, MEM_WAIT);
+	memcpy(new.dirs, pcd->dirs, sizeof(struct path_cache_dir) * pcd->nr);
+	pcd->nr = 0;
+	key->from = NULL;
+	key->path = NULL;
+	spin_lock(lock);
+	old = pc->ents[idx];
+	pc->ents[idx] = new;
+	spin_unlock(lock);
+	path_cache_ent_release(&old);
+}
+
+/* walk() for __namec_from(), consulting the pgrp's path cache. */
+static int cached_walk(struct chan **cp, Elemlist *e, int amode,
+                       struct walk_helper *wh, int *nerror)
+{
+	struct path_cache *pc;
+	struct path_cache_ent key;
+	struct path_cache_dirs dirs = {.nr = 0};
+	int ret;
+
+	if (!path_cache_wanted(*cp, e, amode, wh))
+		return walk(cp, e->elems, e->ARRAY_SIZEs, wh, nerror);
+	pc = pgrp_path_cache(current->pgrp);
+	path_cache_key_init(&key, *cp, e, wh);
+	if (path_cache_lookup(pc, &key, cp)) {
+		kfree(key.path);
+		if (nerror)
+			*nerror = 0;
+		return 0;
+	}
+	/* walk() closes the starting chan; the cache entry needs its own ref */
+	chan_incref(key.from);
+	wh->uncacheable = false;
+	wh->dirs = &dirs;
+	ret = walk(cp, e->elems, e->ARRAY_SIZEs, wh, nerror);
+	wh->dirs = NULL;
+	if (!ret && !wh->uncacheable && dev_has_stable_names((*cp)->type))
+		path_cache_insert(pc, &key, *cp, &dirs);
+	path_cache_dirs_release(&dirs);
+	cclose(key.from);
+	kfree(key.path);
+	return ret;
+}
+
 /*
  * Turn a name into a channel.
  * &name[0] is known to be a valid address.  It may be a kernel address.
@@ -1135,7 +1530,7 @@ static struct chan *__namec_from(struct chan *c, char *aname, int amode,
 	if (omode & O_NOFOLLOW)
 		wh->no_follow = true;
 
-	if (walk(&c, e.elems, e.ARRAY_SIZEs, wh, &npath) < 0) {
+	if (cached_walk(&c, &e, amode, wh, &npath) < 0) {
 		if (npath < 0 || npath > e.ARRAY_SIZEs) {
 			printd("namec %s walk error npath=%d\n", aname, npath);
 			error(EFAIL, "walk failed");
@@ -1672,6 +2067,8 @@ static struct chan *walk_symlink(struct chan *symlink, struct walk_helper *wh,
 	kfree(dir);
 
 	if (link_name[0] == '/') {
+		/* the path cache doesn't key on current->slash */
+		wh->uncacheable = true;
 		if (current)
 			from = current->slash;
 		else
@@ -469,6 +469,8 @@ size_t devbwrite(struct chan *c, struct block *bp, off64_t offset)
 	ERRSTACK(1);
 	long n;
 
+	/* write() needs the data in one contiguous buffer, not in extra_data. */
+	bp = linearizeblock(bp);
 	if (waserror()) {
 		freeb(bp);
 		nexterror();
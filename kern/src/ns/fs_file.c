@@ -345,6 +345,52 @@ void fs_file_truncate(struct fs_file *f, off64_t to)
 	}
 }
 
+/* Readahead window sizes, in pages */
+#define FSF_RA_MIN				4
+#define FSF_RA_MAX				(4 * PM_MAX_EXTENT_PGS)
+
+/* Called before reading or writing [offset, offset + count).  Any access reads
+ * its own missing pages as one extent, instead of a page at a time.  If the
+ * access continues where the last one left off, we also read ahead of it.
+ * The window doubles each time the access gets within half a window of its
+ * end, up to FSF_RA_MAX.  A non-sequential access resets the window.
+ *
+ * We only read pages below the file's length, and only for PMs that can do
+ * extents.  For others, readahead would just be the same readpages, earlier. */
+static void fs_file_readahead(struct fs_file *f, off64_t offset, size_t count)
+{
+	size_t len = fs_file_get_length(f);
+	unsigned long first, last, nr_file_pgs, start, end;
+	bool seq;
+
+	if (!f->pm->pm_op->readpages)
+		return;
+	if (!count || (offset >= len))
+		return;
+	first = LA2PPN(offset);
+	last = LA2PPN(MIN(offset + count, len) - 1);
+	nr_file_pgs = LA2PPN(len - 1) + 1;
+	/* Small sequential accesses might start in the page the last one ended
+	 * in. */
+	seq = (first == f->ra_next) || (first + 1 == f->ra_next);
+	f->ra_next = last + 1;
+	if (!seq) {
+		f->ra_size = 0;
+		f->ra_end = 0;
+		if (last > first)
+			pm_readahead(f->pm, first, last - first + 1);
+		return;
+	}
+	if (last + f->ra_size / 2 < f->ra_end)
+		return;
+	f->ra_size = f->ra_size ? MIN(f->ra_size * 2, FSF_RA_MAX) : FSF_RA_MIN;
+	start = MAX(first, f->ra_end);
+	end = MIN(MAX(last + 1, start + f->ra_size), nr_file_pgs);
+	f->ra_end = end;
+	if (start < end)
+		pm_readahead(f->pm, start, end - start);
+}
+
 /* Standard read.  We sync with write, in that once the length is set, we'll
  * attempt to read those bytes. */
 size_t fs_file_read(struct fs_file *f, uint8_t *buf, size_t count,
@@ -364,6 +410,7 @@ size_t fs_file_read(struct fs_file *f, uint8_t *buf, size_t count,
 		}
 		nexterror();
 	}
+	fs_file_readahead(f, offset, count);
 	while (buf < buf_end) {
 		/* Check early, so we don't load pages beyond length needlessly.  The
 		 * PM/FSF op might just create zeroed pages when asked. */
@@ -415,6 +462,9 @@ size_t fs_file_write(struct fs_file *f, const uint8_t *buf, size_t count,
 		if (!f->ops->can_grow_to(f, offset + count))
 			error(EINVAL, "can't write file to %lu bytes", offset + count);
 	}
+	/* Writes load the pages they touch, so sequential overwrites benefit from
+	 * readahead too. */
+	fs_file_readahead(f, offset, count);
 	while (buf < buf_end) {
 		pg_off = PGOFF(offset + so_far);
 		pg_idx = LA2PPN(offset + so_far);
@@ -459,6 +509,9 @@ static void wstat_mode(struct fs_file *f, int new_mode)
 	__set_acmtime(f, FSF_CTIME);
 	qunlock(&f->qlock);
 	poperror();
+	/* walks check search permission on directories */
+	if (mode & DMDIR)
+		path_cache_invalidate(f);
 }
 
 size_t fs_file_wstat(struct fs_file *f, uint8_t *m_buf, size_t m_buf_sz)
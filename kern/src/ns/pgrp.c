@@ -47,6 +47,7 @@ void closepgrp(struct pgrp *p)
 {
 	struct mhead **h, **e, *f, *next;
 
+	path_cache_destroy(p);
 	wlock(&p->ns);
 	p->pgrpid = -1;
 
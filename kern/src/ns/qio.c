@@ -701,6 +701,15 @@ static size_t copy_from_first_block(struct queue *q, struct block *to,
 	return copy_amt;
 }
 
+/* Helper: a reader made an unwritable q writable.  Call without the q lock. */
+static void qwake_writers(struct queue *q, int qio_flags)
+{
+	if (q->kick && !(qio_flags & QIO_DONT_KICK))
+		q->kick(q->arg);
+	rendez_wakeup(&q->wr);
+	qwake_cb(q, FDTAP_FILT_WRITABLE);
+}
+
 /* Return codes for __qbread and __try_qbread. */
 enum {
 	QBR_OK,
@@ -801,12 +810,8 @@ out_ok:
 	if (!qwritable(q))
 		was_unwritable = FALSE;
 	spin_unlock_irqsave(&q->lock);
-	if (was_unwritable) {
-		if (q->kick && !(qio_flags & QIO_DONT_KICK))
-			q->kick(q->arg);
-		rendez_wakeup(&q->wr);
-		qwake_cb(q, FDTAP_FILT_WRITABLE);
-	}
+	if (was_unwritable)
+		qwake_writers(q, qio_flags);
 	*real_ret = ret;
 	return QBR_OK;
 }
@@ -1448,6 +1453,85 @@ size_t qread_nonblock(struct queue *q, void *va, size_t len)
 	return read_all_blocks(blist, va, len);
 }
 
+/* Helper for __qread_msgs: waits for a message, then pops it and up to
+ * max_msgs - 1 more, so long as each of the others fits in len along with its
+ * header.  Returns the msgs as a blist, or 0 on EOF. */
+static struct block *__qbread_msgs(struct queue *q, size_t len,
+                                   unsigned int max_msgs, int qio_flags)
+{
+	struct block *ret, *ret_last;
+	bool was_unwritable;
+
+	if (!qwait_and_ilock(q, qio_flags)) {
+		spin_unlock_irqsave(&q->lock);
+		return 0;
+	}
+	/* See __try_qbread for the writer wakeup logic. */
+	was_unwritable = !qwritable(q);
+	ret = pop_first_block(q);
+	len -= MIN(len, BLEN(ret));
+	ret_last = ret;
+	while (q->bfirst && --max_msgs &&
+	       (BLEN(q->bfirst) + QMSG_BATCH_HDR <= len)) {
+		len -= BLEN(q->bfirst) + QMSG_BATCH_HDR;
+		ret_last->next = pop_first_block(q);
+		ret_last = ret_last->next;
+	}
+	if (!qwritable(q))
+		was_unwritable = FALSE;
+	spin_unlock_irqsave(&q->lock);
+	if (was_unwritable)
+		qwake_writers(q, qio_flags);
+	return ret;
+}
+
+/* Batched reads from a Qmsg queue.  Waits for at least one message, then
+ * copies out as many whole messages as fit in len, up to max_msgs (0 for no
+ * limit).  Each message is preceded by its length, count[4] in the usual 9P
+ * byte order.  If the first message is too big, it is truncated, just like
+ * qread.
+ *
+ * Returns the number of bytes copied, including the headers, or 0 on EOF. */
+static size_t __qread_msgs(struct queue *q, void *va, size_t len,
+                           unsigned int max_msgs, int qio_flags)
+{
+	struct block *blist, *next;
+	uint8_t *p = va;
+	size_t amt;
+
+	if (!(q->state & Qmsg))
+		error(EINVAL, "batched read from a non-message queue");
+	if (len <= QMSG_BATCH_HDR)
+		error(EINVAL, "batched read needs more than %d bytes", QMSG_BATCH_HDR);
+	len -= QMSG_BATCH_HDR;
+	blist = __qbread_msgs(q, len, max_msgs ? max_msgs : UINT32_MAX,
+	                       qio_flags);
+	for (; blist; blist = next) {
+		next = blist->next;
+		blist->next = NULL;
+		amt = read_all_blocks(blist, p + QMSG_BATCH_HDR, len);
+		PBIT32(p, amt);
+		p += QMSG_BATCH_HDR + amt;
+		/* only the first message can use up len; the rest were sized to fit,
+		 * including their headers. */
+		len -= MIN(len, amt + QMSG_BATCH_HDR);
+	}
+	return p - (uint8_t*)va;
+}
+
+size_t qread_msgs(struct queue *q, void *va, size_t len,
+                  unsigned int max_msgs)
+{
+	return __qread_msgs(q, va, len, max_msgs, QIO_CAN_ERR_SLEEP);
+}
+
+size_t qread_msgs_nonblock(struct queue *q, void *va, size_t len,
+                           unsigned int max_msgs)
+{
+	return __qread_msgs(q, va, len, max_msgs,
+	                    QIO_CAN_ERR_SLEEP | QIO_NON_BLOCK);
+}
+
 /* This is the rendez wake condition for writers. */
 static int qwriter_should_wake(void *a)
 {
@@ -1589,9 +1673,23 @@ ssize_t qibwrite(struct queue *q, struct block *b)
 	return __qbwrite(q, b, 0);
 }
 
+/* Helper, copies len bytes from @from to @to.  If the queue wants it, the
+ * checksum is computed during the copy and saved in the block. */
+static void build_block_copy(struct block *b, void *to, void *from, size_t len,
+                             bool csum)
+{
+	if (!csum) {
+		memcpy(to, from, len);
+		return;
+	}
+	b->data_csum = memcpy_and_csum(to, from, len);
+	b->flag |= Bdatacsum;
+}
+
 /* Helper, allocs a block and copies [from, from + len) into it.  Returns the
  * block on success, 0 on failure. */
-static struct block *build_block(void *from, size_t len, int mem_flags)
+static struct block *build_block(void *from, size_t len, int mem_flags,
+                                 bool csum)
 {
 	struct block *b;
 	void *ext_buf;
@@ -1612,7 +1710,7 @@ static struct block *build_block(void *from, size_t len, int mem_flags)
 		kfree(b);
 		return 0;
 	}
-	memcpy(ext_buf, from, len);
+	build_block_copy(b, ext_buf, from, len, csum);
 	if (block_add_extd(b, 1, mem_flags)) {
 		kfree(ext_buf);
 		kfree(b);
@@ -1626,7 +1724,7 @@ static struct block *build_block(void *from, size_t len, int mem_flags)
 	b = block_alloc(len, mem_flags);
 	if (!b)
 		return 0;
-	memmove(b->wp, from, len);
+	build_block_copy(b, b->wp, from, len, csum);
 	b->wp += len;
 #endif
 	return b;
@@ -1656,7 +1754,7 @@ static ssize_t __qwrite(struct queue *q, void *vp, size_t len, int mem_flags,
 		/* This is 64K, the max amount per single block.  Still a good value? */
 		if (n > Maxatomic)
 			n = Maxatomic;
-		b = build_block(p + sofar, n, mem_flags);
+		b = build_block(p + sofar, n, mem_flags, q->state & Qcsum);
 		if (!b)
 			break;
 		if (__qbwrite(q, b, qio_flags) < 0)
@@ -1685,6 +1783,54 @@ ssize_t qiwrite(struct queue *q, void *vp, int len)
 	return __qwrite(q, vp, len, MEM_ATOMIC, 0);
 }
 
+/* Batched writes, in the format produced by qread_msgs: each message is
+ * preceded by count[4].  Every message is a separate qwrite, so on a Qmsg or
+ * bypass queue (e.g. UDP's wq), each one is its own datagram.
+ *
+ * Returns the amount of vp consumed.  If some messages went out before an error
+ * (e.g. EAGAIN), this is a partial write, and the rest can be retried. */
+static size_t __qwrite_msgs(struct queue *q, void *vp, size_t len,
+                            int qio_flags)
+{
+	ERRSTACK(1);
+	uint8_t *p = vp, *ep = vp + len;
+	uint8_t *volatile sofar = p;	/* volatile for the waserror */
+	uint32_t msg_len;
+
+	if (waserror()) {
+		if (sofar != vp)
+			goto out_ok;
+		nexterror();
+	}
+	while (ep - p >= QMSG_BATCH_HDR) {
+		msg_len = GBIT32(p);
+		p += QMSG_BATCH_HDR;
+		if (msg_len > ep - p)
+			error(EINVAL, "batched msg of %u bytes, only %d left", msg_len,
+			      ep - p);
+		if (__qwrite(q, p, msg_len, MEM_WAIT, qio_flags) != msg_len)
+			break;
+		p += msg_len;
+		sofar = p;
+	}
+	if (p != ep && sofar == vp)
+		error(EINVAL, "truncated batched msg header");
+out_ok:
+	poperror();
+	return sofar - (uint8_t*)vp;
+}
+
+size_t qwrite_msgs(struct queue *q, void *vp, size_t len)
+{
+	return __qwrite_msgs(q, vp, len, QIO_CAN_ERR_SLEEP | QIO_LIMIT);
+}
+
+size_t qwrite_msgs_nonblock(struct queue *q, void *vp, size_t len)
+{
+	return __qwrite_msgs(q, vp, len, QIO_CAN_ERR_SLEEP | QIO_LIMIT |
+	                                 QIO_NON_BLOCK);
+}
+
 /*
  *  be extremely careful when calling this,
  *  as there is no reference accounting
@@ -1870,6 +2016,17 @@ void q_toggle_qcoalesce(struct queue *q, bool onoff)
 	spin_unlock_irqsave(&q->lock);
 }
 
+/* Qcsum only affects blocks built by future writes. */
+void q_toggle_qcsum(struct queue *q, bool onoff)
+{
+	spin_lock_irqsave(&q->lock);
+	if (onoff)
+		q->state |= Qcsum;
+	else
+		q->state &= ~Qcsum;
+	spin_unlock_irqsave(&q->lock);
+}
+
 /*
  *  flush the output queue
  */
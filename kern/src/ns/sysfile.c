@@ -147,7 +147,7 @@ void fdclose(struct fd_table *fdt, int fd)
 static void set_dot(struct chan *c)
 {
 	c = atomic_swap_ptr((void**)&current->dot, c);
-	synchronize_rcu();
+	synchronize_rcu_expedited();
 	cclose(c);
 }
 
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <error.h>
+#include <hash.h>
 
 /* Adds to the LRU if it was not on it.
  *
@@ -151,10 +152,13 @@ static void wc_init(struct walk_cache *wc)
 	spinlock_init(&wc->lru_lock);
 	INIT_LIST_HEAD(&wc->lru);
 	spinlock_init(&wc->ht_lock);
+	wc->ht_seq = SEQCTR_INITIALIZER;
 	wc->ht = wc->static_ht;
 	hash_init_hh(&wc->hh);
 	for (int i = 0; i < wc->hh.nr_hash_lists; i++)
 		INIT_HLIST_HEAD(&wc->ht[i]);
+	for (int i = 0; i < WC_NR_BUCKET_LOCKS; i++)
+		spinlock_init(&wc->bucket_locks[i]);
 }
 
 static void wc_destroy(struct walk_cache *wc)
@@ -166,17 +170,99 @@ static void wc_destroy(struct walk_cache *wc)
 		kfree(wc->ht);
 }
 
+/* hash_long() takes the top bits of the product, so a bucket's index at one
+ * size is a prefix of its index at any larger size.  That's what lets a single
+ * bucket lock cover a bucket at every size. */
+static spinlock_t *wc_bucket_lock(struct walk_cache *wc, unsigned long hash_val)
+{
+	return &wc->bucket_locks[hash_long(hash_val, HASH_INIT_NR_BITS)];
+}
+
+/* Doubles the hash table, if the hash_helper says we're over the load factor.
+ * Caller can block, but can't hold a bucket lock.
+ *
+ * Readers don't lock.  While we move entries from the old table to the new one,
+ * a reader can miss an entry, either because it looked in the old table or
+ * because it followed a moved entry's link into a different chain.  Readers
+ * that miss check ht_seq and try again.  Readers never get lost: every chain
+ * ends in NULL, in either table. */
+static void wc_maybe_grow(struct walk_cache *wc)
+{
+	struct hlist_head *new_ht, *old_ht;
+	unsigned int new_nr_lists, old_nr_lists;
+	struct tree_file *tf;
+	struct hlist_node *temp;
+	unsigned long hash_val;
+
+	if (!hash_needs_more(&wc->hh))
+		return;
+	spin_lock(&wc->ht_lock);
+	if (!hash_needs_more(&wc->hh)) {
+		spin_unlock(&wc->ht_lock);
+		return;
+	}
+	new_nr_lists = hash_next_nr_lists(&wc->hh);
+	/* Other inserters won't try to grow while we're allocating. */
+	hash_set_load_limit(&wc->hh, SIZE_MAX);
+	spin_unlock(&wc->ht_lock);
+
+	/* We hold no spinlocks here, and our callers can sleep. */
+	new_ht = kmalloc(new_nr_lists * sizeof(struct hlist_head), MEM_WAIT);
+	for (int i = 0; i < new_nr_lists; i++)
+		INIT_HLIST_HEAD(&new_ht[i]);
+
+	for (int i = 0; i < WC_NR_BUCKET_LOCKS; i++)
+		spin_lock(&wc->bucket_locks[i]);
+	__seq_start_write(&wc->ht_seq);
+	old_ht = wc->ht;
+	old_nr_lists = wc->hh.nr_hash_lists;
+	for (int i = 0; i < old_nr_lists; i++) {
+		hlist_for_each_entry_safe(tf, temp, &old_ht[i], hash) {
+			hash_val = hash_string(tree_file_to_name(tf));
+			hlist_del_rcu(&tf->hash);
+			hlist_add_head_rcu(&tf->hash,
+			                   &new_ht[hash_long(hash_val,
+			                                     wc->hh.nr_hash_bits + 1)]);
+		}
+	}
+	/* Readers read nr_hash_bits before ht.  If they see the new size, they'll
+	 * see the new table. */
+	rcu_assign_pointer(wc->ht, new_ht);
+	wmb();
+	spin_lock(&wc->ht_lock);
+	hash_incr_nr_lists(&wc->hh);
+	hash_reset_load_limit(&wc->hh);
+	spin_unlock(&wc->ht_lock);
+	__seq_end_write(&wc->ht_seq);
+	for (int i = WC_NR_BUCKET_LOCKS - 1; i >= 0; i--)
+		spin_unlock(&wc->bucket_locks[i]);
+
+	synchronize_rcu();
+	if (old_ht != wc->static_ht)
+		kfree(old_ht);
+}
+
 /* Looks up the child of parent named 'name' in the walk cache hash table.
- * Caller needs to hold an rcu read lock. */
+ * Caller needs to hold an rcu read lock or the parent's qlock to protect the
+ * child.  We protect the table itself. */
 static struct tree_file *wc_lookup_child(struct tree_file *parent,
                                          const char *name)
 {
 	struct walk_cache *wc = &parent->tfs->wc;
 	unsigned long hash_val = hash_string(name);
-	struct hlist_head *bucket;
+	struct hlist_head *ht, *bucket;
 	struct tree_file *i;
+	unsigned int nr_bits;
+	seq_ctr_t seq;
 
-	bucket = &wc->ht[hash_val % wc->hh.nr_hash_bits];
+	rcu_read_lock();
+retry:
+	seq = READ_ONCE(wc->ht_seq);
+	rmb();
+	nr_bits = READ_ONCE(wc->hh.nr_hash_bits);
+	rmb();
+	ht = rcu_dereference(wc->ht);
+	bucket = &ht[hash_long(hash_val, nr_bits)];
 	hlist_for_each_entry_rcu(i, bucket, hash) {
 		/* Note 'i' is an rcu protected pointer.  That deref is safe.  i->parent
 		 * is also a pointer that in general we want to protect.  In this case,
@@ -187,9 +273,16 @@ static struct tree_file *wc_lookup_child(struct tree_file *parent,
 		/* The file's name should never change while it is in the table, so no
 		 * need for a seq-reader.  Can't assert though, since there are valid
 		 * reasons for other seq lockers. */
-		if (!strcmp(tree_file_to_name(i), name))
+		if (!strcmp(tree_file_to_name(i), name)) {
+			rcu_read_unlock();
 			return i;
+		}
 	}
+	/* A miss during a resize might be a false negative. */
+	rmb();
+	if (seqctr_retry(seq, READ_ONCE(wc->ht_seq)))
+		goto retry;
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -198,28 +291,30 @@ static void wc_insert_child(struct tree_file *parent, struct tree_file *child)
 {
 	struct walk_cache *wc = &parent->tfs->wc;
 	unsigned long hash_val = hash_string(tree_file_to_name(child));
-	struct hlist_head *bucket;
+	spinlock_t *lock = wc_bucket_lock(wc, hash_val);
 
 	assert(child->parent == parent);	/* catch bugs from our callers */
-	/* TODO: consider bucket locks and/or growing the HT.  Prob need a seq_ctr
-	 * in the WC, used on the read side during resizing.  Removal probably would
-	 * need something other than the bucket lock too (confusion about which
-	 * bucket during the op). */
-	spin_lock(&wc->ht_lock);
-	bucket = &wc->ht[hash_val % wc->hh.nr_hash_bits];
-	hlist_add_head_rcu(&child->hash, bucket);
-	spin_unlock(&wc->ht_lock);
+	/* The table can't change while we hold any bucket lock. */
+	spin_lock(lock);
+	hlist_add_head_rcu(&child->hash,
+	                   &wc->ht[hash_long(hash_val, wc->hh.nr_hash_bits)]);
+	spin_unlock(lock);
+	__sync_fetch_and_add(&wc->hh.nr_items, 1);
+	wc_maybe_grow(wc);
 }
 
 /* Caller should hold the parent's qlock */
 static void wc_remove_child(struct tree_file *parent, struct tree_file *child)
 {
 	struct walk_cache *wc = &parent->tfs->wc;
+	unsigned long hash_val = hash_string(tree_file_to_name(child));
+	spinlock_t *lock = wc_bucket_lock(wc, hash_val);
 
 	assert(child->parent == parent);	/* catch bugs from our callers */
-	spin_lock(&wc->ht_lock);
+	spin_lock(lock);
 	hlist_del_rcu(&child->hash);
-	spin_unlock(&wc->ht_lock);
+	spin_unlock(lock);
+	__sync_fetch_and_sub(&wc->hh.nr_items, 1);
 }
 
 /* Helper: returns a refcounted pointer to the potential parent.  May return 0.
@@ -393,6 +488,8 @@ static void __unlink_child(struct tree_file *parent, struct tree_file *child)
 	 * the child back off the list and then free it (after rcu). */
 	parent->tfs->tf_ops.unlink(parent, child);
 	__disconnect_child(parent, child);
+	path_cache_invalidate(&parent->file);
+	path_cache_invalidate(&child->file);
 }
 
 /* Talks to the backend and ensures a tree_file for the child exists, either
@@ -932,6 +1029,10 @@ void tree_file_rename(struct tree_file *tf, struct tree_file *new_parent,
 		if (__mark_disconnected(prev_dst))
 			call_rcu(&prev_dst->rcu, __tf_free_rcu);
 	}
+	/* tf's own gen covers walks of ".." from it */
+	path_cache_invalidate(&old_parent->file);
+	path_cache_invalidate(&new_parent->file);
+	path_cache_invalidate(&tf->file);
 	now = nsec2timespec(epoch_nsec());
 	__set_acmtime_to(&old_parent->file, FSF_CTIME | FSF_MTIME, &now);
 	__set_acmtime_to(&new_parent->file, FSF_CTIME | FSF_MTIME, &now);
@@ -1262,14 +1363,17 @@ void __tfs_dump_tf(struct tree_file *tf)
  *
  * Since we're only on one list at a time ('wc->lru' or 'work'), we can use the
  * lru list_head in the TF.  We know that so long as we hold our kref on a TF,
- * no one will attempt to put it back on the LRU list. */
-void tfs_lru_for_each(struct tree_filesystem *tfs, bool cb(struct tree_file *),
-                      size_t max_tfs)
+ * no one will attempt to put it back on the LRU list.
+ *
+ * Returns the number of TFs freed. */
+size_t tfs_lru_for_each(struct tree_filesystem *tfs,
+                        bool cb(struct tree_file *), size_t max_tfs)
 {
 	struct list_head work = LIST_HEAD_INIT(work);
 	struct walk_cache *wc = &tfs->wc;
 	struct tree_file *tf, *temp, *parent;
 	size_t nr_tfs = 0;
+	size_t nr_freed = 0;
 
 	/* We can have multiple LRU workers in flight, though a given TF will be on
 	 * only one CB list at a time. */
@@ -1354,18 +1458,23 @@ void tfs_lru_for_each(struct tree_filesystem *tfs, bool cb(struct tree_file *),
 		/* We could decref, but instead we can directly free.  We know the ref
 		 * == 1 and it is disconnected.  Directly freeing bypasses call_rcu. */
 		__tf_free(tf);
+		nr_freed++;
 	}
+	return nr_freed;
 }
 
 /* Does a one-cycle 'clock' algorithm to detect use.  On a given pass, we either
  * clear HAS_BEEN_USED xor we remove it.  For negative entries, that bit is used
  * when we look at an entry (use it), compared to positive entries, which is
- * used when we get a reference.  (we never get refs on negatives). */
-void tfs_lru_prune_neg(struct tree_filesystem *tfs)
+ * used when we get a reference.  (we never get refs on negatives).
+ *
+ * Returns the number of TFs freed. */
+size_t tfs_lru_prune_neg(struct tree_filesystem *tfs)
 {
 	struct list_head work = LIST_HEAD_INIT(work);
 	struct walk_cache *wc = &tfs->wc;
 	struct tree_file *tf, *temp, *parent;
+	size_t nr_freed = 0;
 
 	spin_lock(&wc->lru_lock);
 	list_for_each_entry_safe(tf, temp, &wc->lru, lru) {
@@ -1409,5 +1518,7 @@ void tfs_lru_prune_neg(struct tree_filesystem *tfs)
 		assert(kref_refcnt(&tf->kref) == 0);
 		list_del(&tf->lru);
 		__tf_free(tf);
+		nr_freed++;
 	}
+	return nr_freed;
 }
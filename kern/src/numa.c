@@ -0,0 +1,267 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * NUMA memory nodes.
+ *
+ * pmem_init() puts all of memory in base_arena before we know anything about
+ * NUMA.  Once the arch knows the layout, it calls numa_add_node_mem() for each
+ * of the other nodes' memory ranges.  We carve whatever is still free in that
+ * range out of base_arena (with an exact xalloc) and add it to the node's own
+ * base arena.  Each node's base arena is self-sufficient, like base_arena, and
+ * its kpages arena imports from it.
+ *
+ * Anything that was already allocated from a remote range stays with
+ * base_arena; it'll go back there when it is freed.  Since we only carve free
+ * segments, an address in a carved range always belongs to that node's arenas,
+ * and everything else belongs to node 0.  That's how frees find their arena.
+ *
+ * The carved ranges are kept in a small table.  Boot-time fragmentation is low,
+ * so a node's range usually carves into one or two segments.  If we run out of
+ * slots, the rest of the node's memory stays in node 0. */
+
+#include <numa.h>
+#include <arena.h>
+#include <kmalloc.h>
+#include <slab.h>
+#include <pmap.h>
+#include <smp.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define NUMA_MAX_RANGES			64
+#define NUMA_CARVE_BATCH		16
+
+struct numa_range {
+	uintptr_t					start;
+	uintptr_t					end;
+	int							node;
+};
+
+int nr_numa_nodes = 1;
+struct arena *base_arenas[MAX_NUMA_NODES];
+struct arena *kpages_arenas[MAX_NUMA_NODES];
+
+static struct numa_range numa_ranges[NUMA_MAX_RANGES];
+static int nr_numa_ranges;
+static int numa_core_nodes[MAX_NUM_CORES];
+/* Memory carved out of base_arena for the other nodes */
+static size_t numa_amt_carved;
+static size_t numa_fallbacks[MAX_NUMA_NODES];
+
+int numa_node(void)
+{
+	if (nr_numa_nodes == 1)
+		return 0;
+	return numa_core_nodes[core_id_early()];
+}
+
+int numa_node_of_addr(void *kva)
+{
+	uintptr_t addr = (uintptr_t)kva;
+
+	for (int i = 0; i < nr_numa_ranges; i++) {
+		if ((numa_ranges[i].start <= addr) && (addr < numa_ranges[i].end))
+			return numa_ranges[i].node;
+	}
+	return 0;
+}
+
+/* Returns the node whose kpages arena is @arena, or -1. */
+int numa_kpages_node(struct arena *arena)
+{
+	if (!arena)
+		return -1;
+	if (arena == kpages_arena)
+		return 0;
+	for (int i = 1; i < MAX_NUMA_NODES; i++) {
+		if (arena == kpages_arenas[i])
+			return i;
+	}
+	return -1;
+}
+
+struct arena *numa_kpages_arena(int node)
+{
+	if ((node <= 0) || (node >= MAX_NUMA_NODES) || !kpages_arenas[node])
+		return kpages_arena;
+	return kpages_arenas[node];
+}
+
+void numa_set_core_node(int coreid, int node)
+{
+	if ((node < 0) || (node >= MAX_NUMA_NODES)) {
+		warn("Core %d's NUMA node %d is out of range, using 0", coreid, node);
+		node = 0;
+	}
+	numa_core_nodes[coreid] = node;
+	nr_numa_nodes = MAX(nr_numa_nodes, node + 1);
+}
+
+/* Counts an allocation that wanted node, but got memory from another node. */
+void numa_note_fallback(int node)
+{
+	if ((node < 0) || (node >= MAX_NUMA_NODES))
+		return;
+	/* Racy, but it's just a stat, and fallbacks are rare. */
+	numa_fallbacks[node]++;
+}
+
+size_t numa_nr_fallbacks(int node)
+{
+	return numa_fallbacks[node];
+}
+
+/* Records [start, end) as belonging to node, merging with an adjacent range if
+ * possible.  Returns FALSE if the table is full. */
+static bool numa_record_range(int node, uintptr_t start, uintptr_t end)
+{
+	for (int i = 0; i < nr_numa_ranges; i++) {
+		if (numa_ranges[i].node != node)
+			continue;
+		if (numa_ranges[i].end == start) {
+			numa_ranges[i].end = end;
+			return TRUE;
+		}
+		if (numa_ranges[i].start == end) {
+			numa_ranges[i].start = start;
+			return TRUE;
+		}
+	}
+	if (nr_numa_ranges == NUMA_MAX_RANGES)
+		return FALSE;
+	numa_ranges[nr_numa_ranges].start = start;
+	numa_ranges[nr_numa_ranges].end = end;
+	numa_ranges[nr_numa_ranges].node = node;
+	nr_numa_ranges++;
+	return TRUE;
+}
+
+/* Finds up to max free segments of arena that intersect [start, end). */
+static int numa_find_free_segs(struct arena *arena, uintptr_t start,
+                               uintptr_t end, struct numa_range *segs, int max)
+{
+	struct rb_node *rb_i;
+	struct btag *bt_i;
+	uintptr_t s, e;
+	int nr = 0;
+
+	spin_lock_irqsave(&arena->lock);
+	for (rb_i = rb_first(&arena->all_segs); rb_i && (nr < max);
+	     rb_i = rb_next(rb_i)) {
+		bt_i = container_of(rb_i, struct btag, all_link);
+		if (bt_i->status != BTAG_FREE)
+			continue;
+		s = MAX(bt_i->start, start);
+		e = MIN(bt_i->start + bt_i->size, end);
+		if (s >= e)
+			continue;
+		segs[nr].start = s;
+		segs[nr].end = e;
+		nr++;
+	}
+	spin_unlock_irqsave(&arena->lock);
+	return nr;
+}
+
+/* Moves free memory in [start, end) from base_arena to node's base arena.
+ * Returns the amount moved. */
+static size_t numa_carve(int node, uintptr_t start, uintptr_t end)
+{
+	struct numa_range segs[NUMA_CARVE_BATCH];
+	size_t amt = 0, seg_len;
+	void *seg;
+	int nr;
+
+	do {
+		nr = numa_find_free_segs(base_arena, start, end, segs,
+		                         NUMA_CARVE_BATCH);
+		for (int i = 0; i < nr; i++) {
+			seg_len = segs[i].end - segs[i].start;
+			seg = arena_xalloc(base_arena, seg_len, PGSIZE, 0, 0,
+			                   (void*)segs[i].start, (void*)segs[i].end,
+			                   MEM_ATOMIC);
+			if (!seg)
+				return amt;
+			if (!numa_record_range(node, segs[i].start, segs[i].end)) {
+				warn("Out of NUMA ranges, leaving the rest on node 0");
+				arena_xfree(base_arena, seg, seg_len);
+				return amt;
+			}
+			arena_add(base_arenas[node], seg, seg_len, MEM_WAIT);
+			amt += seg_len;
+		}
+	} while (nr == NUMA_CARVE_BATCH);
+	return amt;
+}
+
+/* Sets up the node's kpages arena and kmalloc caches, once the node's base
+ * arena has some memory. */
+static void numa_init_node(int node)
+{
+	char name[ARENA_NAME_SZ];
+	void *pg;
+
+	pg = arena_alloc(base_arenas[node], PGSIZE, MEM_WAIT);
+	snprintf(name, sizeof(name), "kpages_%d", node);
+	kpages_arenas[node] = arena_builder(pg, name, PGSIZE, arena_alloc,
+	                                    arena_free, base_arenas[node],
+	                                    8 * PGSIZE);
+	kmalloc_init_node(node);
+}
+
+void numa_add_node_mem(int node, physaddr_t start, size_t len)
+{
+	char name[ARENA_NAME_SZ];
+	physaddr_t end;
+	size_t amt;
+
+	/* Node 0's memory is already in base_arena. */
+	if ((node <= 0) || (node >= MAX_NUMA_NODES))
+		return;
+	if (start >= max_paddr)
+		return;
+	end = ROUNDDOWN(MIN(start + len, max_paddr), PGSIZE);
+	start = ROUNDUP(start, PGSIZE);
+	if (start >= end)
+		return;
+	if (!base_arenas[node]) {
+		snprintf(name, sizeof(name), "base_%d", node);
+		base_arenas[node] = arena_builder(base_alloc(NULL, PGSIZE, MEM_WAIT),
+		                                  name, PGSIZE, NULL, NULL, NULL, 0);
+	}
+	amt = numa_carve(node, (uintptr_t)KADDR(start), (uintptr_t)KADDR(end));
+	numa_amt_carved += amt;
+	if (amt && !kpages_arenas[node])
+		numa_init_node(node);
+	printk("NUMA node %d: %lu of %lu bytes at %p\n", node, amt, end - start,
+	       start);
+}
+
+/* Node 0's base arena is base_arena, minus what we carved out for others. */
+size_t numa_amt_total(int node)
+{
+	if (!node)
+		return arena_amt_total(base_arena) - numa_amt_carved;
+	return base_arenas[node] ? arena_amt_total(base_arenas[node]) : 0;
+}
+
+size_t numa_amt_free(int node)
+{
+	if (!node)
+		return arena_amt_free(base_arena);
+	return base_arenas[node] ? arena_amt_free(base_arenas[node]) : 0;
+}
+
+int numa_node_of_core(int coreid)
+{
+	return numa_core_nodes[coreid];
+}
+
+int numa_nr_cores(int node)
+{
+	int nr = 0;
+
+	for (int i = 0; i < num_cores; i++)
+		nr += numa_node_of_core(i) == node;
+	return nr;
+}
@@ -9,13 +9,15 @@
 #include <pmap.h>
 #include <kmalloc.h>
 #include <arena.h>
+#include <numa.h>
+#include <zero_pool.h>
 
-/* Helper, allocates a free page. */
-static struct page *get_a_free_page(void)
+/* Helper, allocates a free page from node (or nearby). */
+static struct page *get_a_free_page(int node)
 {
 	void *addr;
 
-	addr = kpages_alloc(PGSIZE, MEM_ATOMIC);
+	addr = kpages_alloc_node(PGSIZE, MEM_ATOMIC, node);
 	if (!addr)
 		return NULL;
 	return kva2page(addr);
@@ -24,7 +26,7 @@ static struct page *get_a_free_page(void)
 /**
  * @brief Allocates a physical page from a pool of unused physical memory.
  *
- * Zeroes the page.
+ * If @zero, the page comes zeroed, from the zero pool when it has one.
  *
  * @param[out] page  set to point to the Page struct
  *                   of the newly allocated page
@@ -34,8 +36,22 @@ static struct page *get_a_free_page(void)
  */
 error_t upage_alloc(struct proc *p, page_t **page, bool zero)
 {
-	struct page *pg = get_a_free_page();
+	return upage_alloc_node(p, page, zero, numa_node());
+}
+
+/* Same as upage_alloc(), but prefers memory from @node. */
+error_t upage_alloc_node(struct proc *p, page_t **page, bool zero, int node)
+{
+	struct page *pg;
 
+	if (zero) {
+		pg = zero_pool_get(node);
+		if (pg) {
+			*page = pg;
+			return 0;
+		}
+	}
+	pg = get_a_free_page(node);
 	if (!pg)
 		return -ENOMEM;
 	*page = pg;
@@ -46,7 +62,7 @@ error_t upage_alloc(struct proc *p, page_t **page, bool zero)
 
 error_t kpage_alloc(page_t **page)
 {
-	struct page *pg = get_a_free_page();
+	struct page *pg = get_a_free_page(numa_node());
 
 	if (!pg)
 		return -ENOMEM;
@@ -58,7 +74,7 @@ error_t kpage_alloc(page_t **page)
  * returns the kernel address (kernbase), or 0 on error. */
 void *kpage_alloc_addr(void)
 {
-	struct page *pg = get_a_free_page();
+	struct page *pg = get_a_free_page(numa_node());
 
 	if (!pg)
 		return 0;
@@ -67,22 +83,52 @@ void *kpage_alloc_addr(void)
 
 void *kpage_zalloc_addr(void)
 {
-	void *retval = kpage_alloc_addr();
+	struct page *pg = zero_pool_get(numa_node());
+	void *retval;
+
+	if (pg)
+		return page2kva(pg);
+	retval = kpage_alloc_addr();
 	if (retval)
 		memset(retval, 0, PGSIZE);
 	return retval;
 }
 
-/* Helper function for allocating from the kpages_arena.  This may be useful
- * later since we might send the caller to a different NUMA domain. */
+/* Helper function for allocating from the kpages arenas.  You get memory from
+ * the calling core's NUMA node, if it has any left. */
 void *kpages_alloc(size_t size, int flags)
 {
-	return arena_alloc(kpages_arena, size, flags);
+	return kpages_alloc_node(size, flags, numa_node());
+}
+
+/* Allocates from @node's kpages arena.  If the node is out of memory, we try
+ * the other nodes before blocking (or failing) on @node. */
+void *kpages_alloc_node(size_t size, int flags, int node)
+{
+	struct arena *local = numa_kpages_arena(node);
+	int atomic_flags = (flags & ~MEM_FLAGS) | MEM_ATOMIC;
+	void *ret;
+
+	if (nr_numa_nodes == 1)
+		return arena_alloc(local, size, flags);
+	ret = arena_alloc(local, size, atomic_flags);
+	if (ret)
+		return ret;
+	for (int i = 0; i < MAX_NUMA_NODES; i++) {
+		if (!kpages_arenas[i] || (kpages_arenas[i] == local))
+			continue;
+		ret = arena_alloc(kpages_arenas[i], size, atomic_flags);
+		if (ret) {
+			numa_note_fallback(node);
+			return ret;
+		}
+	}
+	return arena_alloc(local, size, flags);
 }
 
 void *kpages_zalloc(size_t size, int flags)
 {
-	void *ret = arena_alloc(kpages_arena, size, flags);
+	void *ret = kpages_alloc(size, flags);
 
 	if (!ret)
 		return NULL;
@@ -90,9 +136,10 @@ void *kpages_zalloc(size_t size, int flags)
 	return ret;
 }
 
+/* Memory goes back to the node it came from, regardless of who frees it. */
 void kpages_free(void *addr, size_t size)
 {
-	arena_free(kpages_arena, addr, size);
+	arena_free(numa_kpages_arena(numa_node_of_addr(addr)), addr, size);
 }
 
 /* Returns naturally aligned, contiguous pages of amount PGSIZE << order.  Linux
@@ -109,10 +156,32 @@ void free_cont_pages(void *buf, size_t order)
 	arena_xfree(kpages_arena, buf, PGSIZE << order);
 }
 
+/* Tracks the pages of a split jumbo that haven't been freed yet.  Each of its
+ * pages' pg_private points at it. */
+struct jumbo_split {
+	void						*kva;
+	atomic_t					nr_live;
+};
+
+static void jumbo_split_put_page(struct page *page)
+{
+	struct jumbo_split *js = page->pg_private;
+
+	page->pg_private = NULL;
+	if (atomic_sub_and_test(&js->nr_live, 1)) {
+		jumbo_page_free(js->kva, 1);
+		kfree(js);
+	}
+}
+
 /* Frees the page */
 void page_decref(page_t *page)
 {
 	assert(!page_is_pagemap(page));
+	if (page_is_jumbo_split(page)) {
+		jumbo_split_put_page(page);
+		return;
+	}
 	kpages_free(page2kva(page), PGSIZE);
 }
 
@@ -160,3 +229,26 @@ void jumbo_page_free(void *buf, size_t nr)
 {
 	arena_free(jumbo_pml2_arena, buf, nr * PML2_PTE_REACH);
 }
+
+/* Allocates a jumbo page to be used as JUMBO_NR_PGS separate pages, e.g. by the
+ * page cache.  Returns the KVA of the first page, or NULL.  The pages are freed
+ * individually with page_decref(). */
+void *jumbo_page_alloc_split(int flags)
+{
+	struct jumbo_split *js;
+	void *kva;
+
+	js = kmalloc(sizeof(struct jumbo_split), flags);
+	if (!js)
+		return NULL;
+	kva = jumbo_page_alloc(1, flags);
+	if (!kva) {
+		kfree(js);
+		return NULL;
+	}
+	js->kva = kva;
+	atomic_init(&js->nr_live, JUMBO_NR_PGS);
+	for (int i = 0; i < JUMBO_NR_PGS; i++)
+		kva2page(kva + i * PGSIZE)->pg_private = js;
+	return kva;
+}
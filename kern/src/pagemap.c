@@ -12,6 +12,8 @@
 #include <assert.h>
 #include <stdio.h>
 #include <pagemap.h>
+#include <fs_file.h>
+#include <kmalloc.h>
 #include <rcu.h>
 
 void pm_add_vmr(struct page_map *pm, struct vm_region *vmr)
@@ -96,6 +98,7 @@ void pm_init(struct page_map *pm, struct page_map_operations *op, void *host)
 	qlock_init(&pm->pm_qlock);
 	spinlock_init(&pm->pm_lock);
 	TAILQ_INIT(&pm->pm_vmrs);
+	pm->pm_jumbo_thresh = 0;
 }
 
 /* Looks up the index'th page in the page map, returning a refcnt'd reference
@@ -181,6 +184,9 @@ void pm_put_page(struct page *page)
 	atomic_add((atomic_t*)tree_slot, -(1UL << PM_REFCNT_SHIFT));
 }
 
+static bool pm_wants_jumbo(struct page_map *pm, unsigned long index);
+static void pm_fill_jumbo(struct page_map *pm, unsigned long index);
+
 /* Makes sure the index'th page of the mapped object is loaded in the page cache
  * and returns its location via **pp.
  *
@@ -191,6 +197,10 @@ int pm_load_page(struct page_map *pm, unsigned long index, struct page **pp)
 	int error;
 
 	page = pm_find_page(pm, index);
+	if (!page && pm_wants_jumbo(pm, index)) {
+		pm_fill_jumbo(pm, index);
+		page = pm_find_page(pm, index);
+	}
 	while (!page) {
 		if (kpage_alloc(&page))
 			return -ENOMEM;
@@ -264,6 +274,157 @@ int pm_load_page_nowait(struct page_map *pm, unsigned long index,
 	return 0;
 }
 
+/* Reads a locked extent of pages that readahead put in the PM, then unlocks
+ * them and drops our slot refs.  If the read fails, the pages stay !UPTODATE;
+ * whoever loads them next will try again with readpage. */
+static void pm_read_extent(struct page_map *pm, struct page **pages,
+                           unsigned int nr)
+{
+	if (pm->pm_op->readpages) {
+		pm->pm_op->readpages(pm, pages, nr);
+	} else {
+		for (int i = 0; i < nr; i++)
+			pm->pm_op->readpage(pm, pages[i]);
+	}
+	for (int i = 0; i < nr; i++) {
+		unlock_page(pages[i]);
+		pm_put_page(pages[i]);
+	}
+}
+
+/* Inserts page for index, locked and !UPTODATE, into the PM.  On success, we
+ * hold a slot ref on the page.  On failure, the page is freed. */
+static int __pm_insert_locked_page(struct page_map *pm, unsigned long index,
+                                   struct page *page)
+{
+	int error;
+
+	atomic_set(&page->pg_flags, PG_LOCKED | PG_PAGEMAP);
+	sem_init(&page->pg_sem, 0);
+	error = pm_insert_page(pm, index, page);
+	if (error) {
+		atomic_set(&page->pg_flags, 0);
+		page_decref(page);
+		return error;
+	}
+	return 0;
+}
+
+/* Allocates a page for index and inserts it, locked and !UPTODATE, into the PM.
+ * On success, we hold a slot ref on the page. */
+static int pm_insert_locked_page(struct page_map *pm, unsigned long index,
+                                 struct page **pp)
+{
+	struct page *page;
+	int error;
+
+	if (kpage_alloc(&page))
+		return -ENOMEM;
+	error = __pm_insert_locked_page(pm, index, page);
+	if (error)
+		return error;
+	*pp = page;
+	return 0;
+}
+
+/* Whether index should be loaded as part of a jumbo.  The file must be big
+ * enough, and the jumbo's worth of pages around index must be within the file,
+ * since we never map a jumbo past EOF. */
+static bool pm_wants_jumbo(struct page_map *pm, unsigned long index)
+{
+	size_t len;
+
+	if (!pm->pm_jumbo_thresh)
+		return false;
+	len = fs_file_get_length(pm->pm_file);
+	if (len < pm->pm_jumbo_thresh)
+		return false;
+	return ROUNDUP(index + 1, JUMBO_NR_PGS) <= nr_pages(len);
+}
+
+/* Fills the JUMBO_NR_PGS aligned pages around index with the pages of a split
+ * jumbo, so that they are physically contiguous and can be mapped with a single
+ * jumbo PTE.  This is best effort: if any of the pages are already present, or
+ * we can't get a jumbo right away, we let the caller load a regular page.
+ *
+ * Concurrent loaders of the other pages of the jumbo find them locked and wait
+ * for us.  If we lose a race and some page got inserted in the meantime, we
+ * free our copy of it, and that jumbo will just be mapped with regular PTEs. */
+static void pm_fill_jumbo(struct page_map *pm, unsigned long index)
+{
+	unsigned long first = ROUNDDOWN(index, JUMBO_NR_PGS);
+	struct page *pages[PM_MAX_EXTENT_PGS];
+	struct page *page;
+	unsigned int nr = 0;
+	void *kva;
+
+	for (unsigned long i = first; i < first + JUMBO_NR_PGS; i++) {
+		page = pm_find_page(pm, i);
+		if (page) {
+			pm_put_page(page);
+			return;
+		}
+	}
+	kva = jumbo_page_alloc_split(MEM_ATOMIC);
+	if (!kva)
+		return;
+	for (int i = 0; i < JUMBO_NR_PGS; i++) {
+		page = kva2page(kva + i * PGSIZE);
+		if (__pm_insert_locked_page(pm, first + i, page)) {
+			if (nr)
+				pm_read_extent(pm, pages, nr);
+			nr = 0;
+			continue;
+		}
+		pages[nr++] = page;
+		if (nr == PM_MAX_EXTENT_PGS) {
+			pm_read_extent(pm, pages, nr);
+			nr = 0;
+		}
+	}
+	if (nr)
+		pm_read_extent(pm, pages, nr);
+}
+
+/* Brings [index, index + nr_pgs) into the page cache, best effort.  Pages that
+ * are already present are skipped, and the runs of missing pages between them
+ * are read with as few readpages calls as possible.  This blocks until the
+ * reads are done.
+ *
+ * The new pages are in the PM and locked while they are being read, so
+ * concurrent pm_load_page()s for them wait in lock_page(). */
+void pm_readahead(struct page_map *pm, unsigned long index,
+                  unsigned long nr_pgs)
+{
+	struct page *pages[PM_MAX_EXTENT_PGS];
+	struct page *page;
+	unsigned int nr = 0;
+	int error;
+
+	for (unsigned long i = index; i < index + nr_pgs; i++) {
+		page = pm_find_page(pm, i);
+		if (page) {
+			pm_put_page(page);
+			error = -EEXIST;
+		} else {
+			error = pm_insert_locked_page(pm, i, &page);
+		}
+		if (!error) {
+			pages[nr++] = page;
+			if (nr < PM_MAX_EXTENT_PGS)
+				continue;
+		}
+		if (nr)
+			pm_read_extent(pm, pages, nr);
+		nr = 0;
+		/* EEXIST just breaks up the extent.  Anything else is ENOMEM. */
+		if (error && (error != -EEXIST))
+			return;
+	}
+	if (nr)
+		pm_read_extent(pm, pages, nr);
+}
+
 static bool vmr_has_page_idx(struct vm_region *vmr, unsigned long pg_idx)
 {
 	unsigned long nr_pgs = (vmr->vm_end - vmr->vm_base) >> PGSHIFT;
@@ -366,13 +527,11 @@ void pm_remove_or_zero_pages(struct page_map *pm, unsigned long start_idx,
 static int __pm_mark_and_clear_dirty(struct proc *p, pte_t pte, void *va,
                                      void *arg)
 {
-	struct page *page = pa2page(pte_get_paddr(pte));
 	struct vm_region *vmr = arg;
 
 	if (!pte_is_present(pte) || !pte_is_dirty(pte))
 		return 0;
-	if (!(atomic_read(&page->pg_flags) & PG_DIRTY))
-		atomic_or(&page->pg_flags, PG_DIRTY);
+	pte_mark_pages_dirty(pte);
 	pte_clear_dirty(pte);
 	vmr->vm_shootdown_needed = true;
 	return 0;
@@ -391,9 +550,10 @@ static void mark_and_clear_dirty_ptes(struct page_map *pm)
 	TAILQ_FOREACH(vmr_i, &pm->pm_vmrs, vm_pm_link) {
 		if (!(vmr_i->vm_prot & PROT_WRITE))
 			continue;
-		/* Only care about shared mappings, not private.  Private mappings have
-		 * a reference to the file, but the pages are not in the page cache -
-		 * they hang directly off the PTEs (for now). */
+		/* Only care about shared mappings, not private.  Private mappings can
+		 * map PM pages, but only read-only: the first write faults and CoWs
+		 * the page into an anonymous one (cow_page_at_addr()).  So a private
+		 * PTE for a PM page is never writable or dirty. */
 		if (!(vmr_i->vm_flags & MAP_SHARED))
 			continue;
 		spin_lock(&vmr_i->vm_proc->pte_lock);
@@ -421,31 +581,50 @@ static void shootdown_vmrs(struct page_map *pm)
 	spin_unlock(&pm->pm_lock);
 }
 
+/* An extent of dirty pages waiting to be written back.  We hold the PM qlock
+ * while it's in use, so no one can remove the pages. */
+struct pm_wb_batch {
+	struct page_map				*pm;
+	struct page					*pages[PM_MAX_EXTENT_PGS];
+	unsigned int				nr;
+};
+
 /* Send any queued WBs that haven't been sent yet. */
-static void flush_queued_writebacks(struct page_map *pm)
+static void flush_queued_writebacks(struct pm_wb_batch *wb)
 {
-	/* TODO (WB) */
+	struct page_map *pm = wb->pm;
+
+	if (!wb->nr)
+		return;
+	if (pm->pm_op->writepages) {
+		pm->pm_op->writepages(pm, wb->pages, wb->nr);
+	} else {
+		for (int i = 0; i < wb->nr; i++)
+			pm->pm_op->writepage(pm, wb->pages[i]);
+	}
+	wb->nr = 0;
 }
 
-/* Batches up pages to be written back, preferably as one big op.  If we have a
- * bunch outstanding, we'll send them. */
-static void queue_writeback(struct page_map *pm, struct page *page)
+/* Batches up pages to be written back, preferably as one big op.  Once the
+ * extent is full or the page isn't the next one in the extent, we send it. */
+static void queue_writeback(struct pm_wb_batch *wb, struct page *page)
 {
-	/* TODO (WB): add a bulk op (instead of only writepage()), collect extents,
-	 * and send them to the device.  Probably do something similar for reads. */
-	pm->pm_op->writepage(pm, page);
+	if (wb->nr && ((wb->nr == PM_MAX_EXTENT_PGS) ||
+	               (wb->pages[wb->nr - 1]->pg_index + 1 != page->pg_index)))
+		flush_queued_writebacks(wb);
+	wb->pages[wb->nr++] = page;
 }
 
 static bool __writeback_cb(void **slot, unsigned long tree_idx, void *arg)
 {
-	struct page_map *pm = arg;
+	struct pm_wb_batch *wb = arg;
 	struct page *page = pm_slot_get_page(*slot);
 
 	/* We're qlocked, so all items should have pages. */
 	assert(page);
 	if (atomic_read(&page->pg_flags) & PG_DIRTY) {
 		atomic_and(&page->pg_flags, ~PG_DIRTY);
-		queue_writeback(pm, page);
+		queue_writeback(wb, page);
 	}
 	return false;
 }
@@ -454,11 +633,13 @@ static bool __writeback_cb(void **slot, unsigned long tree_idx, void *arg)
  * not.  All the dirty bits get cleared too, before writing back. */
 void pm_writeback_pages(struct page_map *pm)
 {
+	struct pm_wb_batch wb = {.pm = pm, .nr = 0};
+
 	qlock(&pm->pm_qlock);
 	mark_and_clear_dirty_ptes(pm);
 	shootdown_vmrs(pm);
-	radix_for_each_slot(&pm->pm_tree, __writeback_cb, pm);
-	flush_queued_writebacks(pm);
+	radix_for_each_slot(&pm->pm_tree, __writeback_cb, &wb);
+	flush_queued_writebacks(&wb);
 	qunlock(&pm->pm_qlock);
 }
 
@@ -509,6 +690,7 @@ static bool __flush_unused_cb(void **slot, unsigned long tree_idx, void *arg)
 	/* All clear - the page is unused and (now) clean. */
 	atomic_set(&page->pg_flags, 0);	/* catch bugs */
 	page_decref(page);
+	pm->pm_num_pages--;
 	return true;
 }
 
@@ -516,12 +698,19 @@ static bool __flush_unused_cb(void **slot, unsigned long tree_idx, void *arg)
  * Dirty pages are written back first.
  *
  * We ignore anything mapped in a VMR.  Not bothering with unmapping or
- * shootdowns or anything.  At least for now. */
-void pm_free_unused_pages(struct page_map *pm)
+ * shootdowns or anything.  At least for now.
+ *
+ * Returns the number of pages freed. */
+unsigned long pm_free_unused_pages(struct page_map *pm)
 {
+	unsigned long nr_freed;
+
 	qlock(&pm->pm_qlock);
+	nr_freed = pm->pm_num_pages;
 	radix_for_each_slot(&pm->pm_tree, __flush_unused_cb, pm);
+	nr_freed -= pm->pm_num_pages;
 	qunlock(&pm->pm_qlock);
+	return nr_freed;
 }
 
 static bool __destroy_cb(void **slot, unsigned long tree_idx, void *arg)
@@ -21,6 +21,7 @@
 #include <mm.h>
 #include <multiboot.h>
 #include <arena.h>
+#include <numa.h>
 #include <init.h>
 
 physaddr_t max_pmem = 0;	/* Total amount of physical memory (bytes) */
@@ -52,6 +53,9 @@ static void kpages_arena_init(void)
 	kpages_pg = arena_alloc(base_arena, PGSIZE, MEM_WAIT);
 	kpages_arena = arena_builder(kpages_pg, "kpages", PGSIZE, arena_alloc,
 	                             arena_free, base_arena, 8 * PGSIZE);
+	/* Node 0.  The arch adds the other NUMA nodes once it knows about them. */
+	base_arenas[0] = base_arena;
+	kpages_arenas[0] = kpages_arena;
 }
 
 /**
@@ -243,7 +247,8 @@ int page_insert(pgdir_t pgdir, struct page *page, void *va, int perm)
  * of the pte for this page.  This is used by page_remove
  * but should not be used by other callers.
  *
- * For jumbos, right now this returns the first Page* in the 4MB range
+ * For jumbos, this returns the page within the jumbo that va is in.  Only user
+ * jumbos (JUMBO_PGSIZE) are handled.
  *
  * @param[in]  pgdir     the page directory from which we should do the lookup
  * @param[in]  va        the virtual address of the page we are looking up
@@ -255,11 +260,29 @@ int page_insert(pgdir_t pgdir, struct page *page, void *va, int perm)
 page_t *page_lookup(pgdir_t pgdir, void *va, pte_t *pte_store)
 {
 	pte_t pte = pgdir_walk(pgdir, va, 0);
+	physaddr_t pa;
+
 	if (!pte_walk_okay(pte) || !pte_is_mapped(pte))
 		return 0;
 	if (pte_store)
 		*pte_store = pte;
-	return pa2page(pte_get_paddr(pte));
+	pa = pte_get_paddr(pte);
+	if (pte_is_jumbo(pte))
+		pa += ROUNDDOWN((uintptr_t)va & (JUMBO_PGSIZE - 1), PGSIZE);
+	return pa2page(pa);
+}
+
+/* Marks the pages behind pte as dirty.  A jumbo PTE in a user address space maps
+ * a split jumbo's worth of page cache pages, all of which get marked. */
+void pte_mark_pages_dirty(pte_t pte)
+{
+	struct page *page = pa2page(pte_get_paddr(pte));
+	int nr = pte_is_jumbo(pte) ? JUMBO_NR_PGS : 1;
+
+	for (int i = 0; i < nr; i++, page++) {
+		if (!(atomic_read(&page->pg_flags) & PG_DIRTY))
+			atomic_or(&page->pg_flags, PG_DIRTY);
+	}
 }
 
 /**
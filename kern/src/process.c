@@ -403,7 +403,11 @@ error_t proc_alloc(struct proc **pp, struct proc *parent, int flags)
 	spinlock_init(&p->vmr_lock);
 	spinlock_init(&p->pte_lock);
 	TAILQ_INIT(&p->vm_regions); /* could init this in the slab */
-	p->vmr_history = 0;
+	p->vmr_history = SEQCTR_INITIALIZER;
+	/* Kconfig can only bound it; fault_around() needs the alignment. */
+	static_assert(IS_PWR2(CONFIG_FAULT_AROUND_PGS));
+	p->fault_around_pgs = parent ? parent->fault_around_pgs :
+	                               CONFIG_FAULT_AROUND_PGS;
 	/* Initialize the vcore lists, we'll build the inactive list so that it
 	 * includes all vcores when we initialize procinfo.  Do this before initing
 	 * procinfo. */
@@ -572,7 +576,7 @@ void proc_decref(struct proc *p)
 /* Helper, makes p the 'current' process, dropping the old current/cr3.  This no
  * longer assumes the passed in reference already counted 'current'.  It will
  * incref internally when needed. */
-static void __set_proc_current(struct proc *p)
+void __set_proc_current(struct proc *p)
 {
 	/* We use the pcpui to access 'current' to cut down on the core_id() calls,
 	 * though who know how expensive/painful they are. */
@@ -912,6 +916,8 @@ void proc_destroy(struct proc *p)
 	 * old sleepers). */
 	__proc_set_state(p, PROC_DYING_ABORT);
 	abort_all_sysc(p);
+	/* Get the arsc server, if any, to drop its ref */
+	arsc_proc_destroy(p);
 	/* Tell the ksched about our death, and which cores we freed up */
 	__sched_proc_destroy(p, pc_arr, nr_cores_revoked);
 	/* Tell our parent about our state change (to DYING) */
@@ -6,20 +6,32 @@
  * events.  Examples of events are PMU counter overflows, mmaps, and process
  * creation.
  *
- * Events are collected in a central qio queue.  High-frequency events (e.g.
- * IRQ backtraces()) are collected in per-core buffers, which are flushed to the
- * central queue when they fill up or on command.  Lower-frequency events (e.g.
- * profiler_notify_mmap()) just go straight to the central queue.
+ * A struct profiler is one profiling session.  Kprof creates one for every
+ * open of kpctl, and there can be up to PROFILER_MAX_SESSIONS at once.  Every
+ * event goes to each session that wants it.
  *
- * Currently there is one global profiler.  Kprof is careful to only have one
- * open profiler at a time.  We assert that this is true.  TODO: stop using the
- * global profiler!
+ * High-frequency events (e.g. IRQ backtraces()) are collected in per-core
+ * rings, one per core per session.  A ring is only written by its core, with
+ * IRQs disabled, and readers consume from it without locking out the writer:
+ * it's a single-producer, single-consumer byte ring with free-running head and
+ * tail counters.  When a ring is full, the sample is dropped and counted.
+ * Lower-frequency events (e.g. profiler_notify_mmap()) go to the session's qio
+ * queue, since we won't lose those.
+ *
+ * Readers can get each core's stream of records separately
+ * (profiler_read_cpu()), or the whole session as one stream (profiler_read()),
+ * which takes whole records from the queue and each of the rings.
+ *
+ * The sample paths find sessions under rcu_read_lock(), without a ref.  When
+ * the last ref on a session goes away, we unpublish it and free it after a
+ * grace period.
  *
  * A few other notes:
- * - profiler_control_trace() controls the per-core trace collection.  When it
- *   is disabled, it also flushes the per-core blocks to the central queue.
+ * - profiler_start() and profiler_stop() control the per-core trace
+ *   collection.  The rings are allocated on the first start, so you can size
+ *   them until then.
  * - The collection of mmap and comm samples is independent of trace collection.
- *   Those will occur whenever the profiler is open (refcnt check, for now). */
+ *   Those will occur whenever the session exists. */
 
 #include <ros/common.h>
 #include <ros/mman.h>
@@ -38,7 +50,7 @@
 #include <elf.h>
 #include <ns.h>
 #include <err.h>
-#include <core_set.h>
+#include <rcu.h>
 #include <string.h>
 #include "profiler.h"
 
@@ -46,25 +58,38 @@
 
 #define VBE_MAX_SIZE(t) ((8 * sizeof(t) + 6) / 7)
 
-/* Do not rely on the contents of the PCPU ctx with IRQs enabled. */
-struct profiler_cpu_context {
-	struct block *block;
-	int cpu;
-	int tracing;
-	size_t dropped_data_cnt;
+
+/* One core's samples for one session.  The first cache line is for the core
+ * that writes the ring, the second for the readers. */
+struct profiler_cpu_ring {
+	uint8_t *data;
+	size_t size;		/* power of 2 */
+	uint64_t head;
+	uint64_t dropped;
+
+	uint64_t tail __attribute__((aligned(ARCH_CL_SIZE)));
+	qlock_t qlock;		/* serializes readers */
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+struct profiler {
+	struct kref kref;
+	int id;
+	int slot;
+	pid_t owner;
+	qlock_t qlock;		/* protects start/stop and rings */
+	bool tracing;
+	int next_read_cpu;	/* hint, for fairness in profiler_read() */
+	size_t ring_size;
+	struct profiler_cpu_ring *rings;
+	struct queue *ctl_q;
 };
 
 static int profiler_queue_limit = 64 * 1024 * 1024;
-static size_t profiler_cpu_buffer_size = 65536;
-static qlock_t profiler_mtx = QLOCK_INITIALIZER(profiler_mtx);
-static struct kref profiler_kref;
-static struct profiler_cpu_context *profiler_percpu_ctx;
-static struct queue *profiler_queue;
-
-static inline struct profiler_cpu_context *profiler_get_cpu_ctx(int cpu)
-{
-	return profiler_percpu_ctx + cpu;
-}
+static size_t profiler_cpu_buffer_size = 256 * 1024;
+static spinlock_t profilers_lock = SPINLOCK_INITIALIZER;
+static struct profiler *profilers[PROFILER_MAX_SESSIONS];
+static atomic_t nr_profilers;
+static int profiler_next_id;
 
 static inline char *vb_encode_uint64(char *data, uint64_t n)
 {
@@ -78,127 +103,133 @@ static inline char *vb_encode_uint64(char *data, uint64_t n)
 	return data;
 }
 
-static struct block *profiler_buffer_write(struct profiler_cpu_context *cpu_buf,
-                                           struct block *b)
+static inline size_t profiler_max_envelope_size(void)
 {
-	/* qpass will drop b if the queue is over its limit.  we're willing to lose
-	 * traces, but we won't lose 'control' events, such as MMAP and PID. */
-	if (b) {
-		if (qpass(profiler_queue, b) < 0)
-			cpu_buf->dropped_data_cnt++;
-	}
-	return block_alloc(profiler_cpu_buffer_size, MEM_ATOMIC);
+	return 2 * VBE_MAX_SIZE(uint64_t);
 }
 
-/* Helper, paired with profiler_cpu_buffer_write_commit.  Ensures there is
- * enough room in the pcpu block for our write.  May alloc a new one.
- *
- * IRQs must be disabled before calling, until after write_commit. */
-static char *profiler_cpu_buffer_write_reserve(
-	struct profiler_cpu_context *cpu_buf, size_t size, struct block **pb)
+static void ring_copy_in(struct profiler_cpu_ring *r, uint64_t pos,
+                         const void *src, size_t len)
 {
-	struct block *b = cpu_buf->block;
-
-	if (unlikely((!b) || (b->lim - b->wp) < size)) {
-		cpu_buf->block = b = profiler_buffer_write(cpu_buf, b);
-		if (unlikely(!b))
-			return NULL;
-	}
-	*pb = b;
+	size_t off = pos & (r->size - 1);
+	size_t first = MIN(len, r->size - off);
 
-	return (char *) b->wp;
+	memcpy(r->data + off, src, first);
+	memcpy(r->data, src + first, len - first);
 }
 
-/* Helper, paired with write_reserve.  Finalizes the writing into the block's
- * main body of @size bytes.  IRQs must be disabled until after this is called.
- */
-static inline void profiler_cpu_buffer_write_commit(
-	struct profiler_cpu_context *cpu_buf, struct block *b, size_t size)
+static void ring_copy_out(struct profiler_cpu_ring *r, uint64_t pos,
+                          void *dst, size_t len)
 {
-	b->wp += size;
+	size_t off = pos & (r->size - 1);
+	size_t first = MIN(len, r->size - off);
+
+	memcpy(dst, r->data + off, first);
+	memcpy(dst + first, r->data, len - first);
 }
 
-static inline size_t profiler_max_envelope_size(void)
+static uint8_t ring_byte(struct profiler_cpu_ring *r, uint64_t pos)
 {
-	return 2 * VBE_MAX_SIZE(uint64_t);
+	return r->data[pos & (r->size - 1)];
 }
 
-static void profiler_push_kernel_trace64(struct profiler_cpu_context *cpu_buf,
-                                         const uintptr_t *trace, size_t count,
-                                         uint64_t info)
+/* Returns the length of the record at pos: the envelope (the type and size)
+ * plus the size it says. */
+static size_t ring_record_len(struct profiler_cpu_ring *r, uint64_t pos)
 {
-	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
-	size_t size = sizeof(struct proftype_kern_trace64) +
-		count * sizeof(uint64_t);
-	struct block *b;
-	void *resptr, *ptr;
-
-	assert(!irq_is_enabled());
-	resptr = profiler_cpu_buffer_write_reserve(
-	    cpu_buf, size + profiler_max_envelope_size(), &b);
-	ptr = resptr;
-
-	if (likely(ptr)) {
-		struct proftype_kern_trace64 *record;
+	uint64_t start = pos, size = 0;
+	unsigned int shift = 0;
+	uint8_t b;
 
-		ptr = vb_encode_uint64(ptr, PROFTYPE_KERN_TRACE64);
-		ptr = vb_encode_uint64(ptr, size);
+	while (ring_byte(r, pos++) & 0x80)
+		;
+	do {
+		b = ring_byte(r, pos++);
+		size |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return pos - start + size;
+}
 
-		record = (struct proftype_kern_trace64 *) ptr;
-		ptr += size;
+/* Writes a trace record to r.  Only r's core calls this, with IRQs disabled. */
+static void ring_push_trace64(struct profiler_cpu_ring *r, uint64_t type,
+                              struct proftype_kern_trace64 *record,
+                              const uintptr_t *trace)
+{
+	size_t size = sizeof(*record) + record->num_traces * sizeof(uint64_t);
+	char envelope[2 * VBE_MAX_SIZE(uint64_t)];
+	size_t env_len;
+	uint64_t pos = r->head;
 
-		record->info = info;
-		record->tstamp = nsec();
-		if (is_ktask(pcpui->cur_kthread) || !pcpui->cur_proc)
-			record->pid = -1;
-		else
-			record->pid = pcpui->cur_proc->pid;
-		record->cpu = cpu_buf->cpu;
-		record->num_traces = count;
-		for (size_t i = 0; i < count; i++)
-			record->trace[i] = (uint64_t) trace[i];
-
-		profiler_cpu_buffer_write_commit(cpu_buf, b, ptr - resptr);
+	env_len = vb_encode_uint64(vb_encode_uint64(envelope, type), size) -
+	          envelope;
+	/* The reader moves tail after it is done with the data (rwmb()), so
+	 * anything up to tail + size is ours. */
+	if (pos + env_len + size - ACCESS_ONCE(r->tail) > r->size) {
+		r->dropped++;
+		return;
 	}
-}
-
-static void profiler_push_user_trace64(struct profiler_cpu_context *cpu_buf,
-                                       struct proc *p, const uintptr_t *trace,
-                                       size_t count, uint64_t info)
+	ring_copy_in(r, pos, envelope, env_len);
+	pos += env_len;
+	ring_copy_in(r, pos, record, sizeof(*record));
+	pos += sizeof(*record);
+	ring_copy_in(r, pos, trace, record->num_traces * sizeof(uint64_t));
+	pos += record->num_traces * sizeof(uint64_t);
+	/* The record has to be there before readers see the new head. */
+	wmb();
+	ACCESS_ONCE(r->head) = pos;
+}
+
+/* Pushes a trace to every session that is tracing.  Kernel and user traces have
+ * the same layout. */
+static void profiler_push_trace64(uint64_t type, pid_t pid,
+                                  const uintptr_t *trace, size_t count,
+                                  uint64_t info)
 {
-	size_t size = sizeof(struct proftype_user_trace64) +
-		count * sizeof(uint64_t);
-	struct block *b;
-	void *resptr, *ptr;
+	struct proftype_kern_trace64 record;
+	struct profiler *prof;
 
+	static_assert(sizeof(struct proftype_kern_trace64) ==
+	              sizeof(struct proftype_user_trace64));
+	static_assert(sizeof(uintptr_t) == sizeof(uint64_t));
 	assert(!irq_is_enabled());
-	resptr = profiler_cpu_buffer_write_reserve(
-	    cpu_buf, size + profiler_max_envelope_size(), &b);
-	ptr = resptr;
-
-	if (likely(ptr)) {
-		struct proftype_user_trace64 *record;
-
-		ptr = vb_encode_uint64(ptr, PROFTYPE_USER_TRACE64);
-		ptr = vb_encode_uint64(ptr, size);
-
-		record = (struct proftype_user_trace64 *) ptr;
-		ptr += size;
-
-		record->info = info;
-		record->tstamp = nsec();
-		record->pid = p->pid;
-		record->cpu = cpu_buf->cpu;
-		record->num_traces = count;
-		for (size_t i = 0; i < count; i++)
-			record->trace[i] = (uint64_t) trace[i];
+	if (!atomic_read(&nr_profilers))
+		return;
+	record.info = info;
+	record.tstamp = nsec();
+	record.pid = pid;
+	record.cpu = core_id();
+	record.num_traces = count;
+	rcu_read_lock();
+	for (int i = 0; i < PROFILER_MAX_SESSIONS; i++) {
+		prof = rcu_dereference(profilers[i]);
+		/* tracing is only set after the rings are allocated */
+		if (prof && ACCESS_ONCE(prof->tracing))
+			ring_push_trace64(&prof->rings[record.cpu], type, &record,
+			                  trace);
+	}
+	rcu_read_unlock();
+}
 
-		profiler_cpu_buffer_write_commit(cpu_buf, b, ptr - resptr);
+/* Sends a control record to prof, or to every session if prof is 0. */
+static void profiler_emit(struct profiler *prof, void *rec, size_t len)
+{
+	if (prof) {
+		qiwrite(prof->ctl_q, rec, len);
+		return;
+	}
+	rcu_read_lock();
+	for (int i = 0; i < PROFILER_MAX_SESSIONS; i++) {
+		prof = rcu_dereference(profilers[i]);
+		if (prof)
+			qiwrite(prof->ctl_q, rec, len);
 	}
+	rcu_read_unlock();
 }
 
-static void profiler_push_pid_mmap(struct proc *p, uintptr_t addr, size_t msize,
-                                   size_t offset, const char *path)
+static void profiler_push_pid_mmap(struct profiler *prof, struct proc *p,
+                                   uintptr_t addr, size_t msize, size_t offset,
+                                   const char *path)
 {
 	size_t plen = strlen(path) + 1;
 	size_t size = sizeof(struct proftype_pid_mmap64) + plen;
@@ -221,13 +252,13 @@ static void profiler_push_pid_mmap(struct proc *p, uintptr_t addr, size_t msize,
 		record->offset = offset;
 		memcpy(record->path, path, plen);
 
-		qiwrite(profiler_queue, resptr, (int) (ptr - resptr));
+		profiler_emit(prof, resptr, ptr - resptr);
 
 		kfree(resptr);
 	}
 }
 
-static void profiler_push_new_process(struct proc *p)
+static void profiler_push_new_process(struct profiler *prof, struct proc *p)
 {
 	size_t plen = strlen(p->binary_path) + 1;
 	size_t size = sizeof(struct proftype_new_process) + plen;
@@ -247,25 +278,52 @@ static void profiler_push_new_process(struct proc *p)
 		record->pid = p->pid;
 		memcpy(record->path, p->binary_path, plen);
 
-		qiwrite(profiler_queue, resptr, (int) (ptr - resptr));
+		profiler_emit(prof, resptr, ptr - resptr);
 
 		kfree(resptr);
 	}
 }
 
-static void profiler_emit_current_system_status(void)
+static void __profiler_notify_mmap(struct profiler *prof, struct proc *p,
+                                   uintptr_t addr, size_t size, int prot,
+                                   struct file_or_chan *foc, size_t offset)
 {
-	void enum_proc(struct vm_region *vmr, void *opaque)
-	{
-		struct proc *p = (struct proc *) opaque;
+	if (foc && (prot & PROT_EXEC)) {
+		char path_buf[PROFILER_MAX_PRG_PATH];
+		char *path = foc_abs_path(foc, path_buf, sizeof(path_buf));
 
-		profiler_notify_mmap(p, vmr->vm_base, vmr->vm_end - vmr->vm_base,
-		                     vmr->vm_prot, vmr->vm_flags, vmr->__vm_foc,
-		                     vmr->vm_foff);
+		if (likely(path))
+			profiler_push_pid_mmap(prof, p, addr, size, offset, path);
 	}
+}
+
+static void __profiler_notify_new_process(struct profiler *prof,
+                                          struct proc *p)
+{
+	if (p->binary_path)
+		profiler_push_new_process(prof, p);
+}
+
+struct profiler_enum_arg {
+	struct profiler *prof;
+	struct proc *p;
+};
+
+static void profiler_enum_vmr(struct vm_region *vmr, void *opaque)
+{
+	struct profiler_enum_arg *arg = opaque;
 
+	__profiler_notify_mmap(arg->prof, arg->p, vmr->vm_base,
+	                       vmr->vm_end - vmr->vm_base, vmr->vm_prot,
+	                       vmr->__vm_foc, vmr->vm_foff);
+}
+
+/* Tells a new session about everything that already exists. */
+static void profiler_emit_current_system_status(struct profiler *prof)
+{
 	ERRSTACK(1);
 	struct process_set pset;
+	struct profiler_enum_arg arg = { .prof = prof };
 
 	proc_get_set(&pset);
 	if (waserror()) {
@@ -274,53 +332,39 @@ static void profiler_emit_current_system_status(void)
 	}
 
 	for (size_t i = 0; i < pset.num_processes; i++) {
-		profiler_notify_new_process(pset.procs[i]);
-		enumerate_vmrs(pset.procs[i], enum_proc, pset.procs[i]);
+		__profiler_notify_new_process(prof, pset.procs[i]);
+		arg.p = pset.procs[i];
+		enumerate_vmrs(pset.procs[i], profiler_enum_vmr, &arg);
 	}
 
 	poperror();
 	proc_free_set(&pset);
 }
 
-static void free_cpu_buffers(void)
+static void free_cpu_rings(struct profiler *prof)
 {
-	kfree(profiler_percpu_ctx);
-	profiler_percpu_ctx = NULL;
-
-	if (profiler_queue) {
-		qfree(profiler_queue);
-		profiler_queue = NULL;
-	}
+	if (!prof->rings)
+		return;
+	for (int i = 0; i < num_cores; i++)
+		kfree(prof->rings[i].data);
+	kfree(prof->rings);
+	prof->rings = NULL;
 }
 
-static void alloc_cpu_buffers(void)
+static void alloc_cpu_rings(struct profiler *prof)
 {
-	ERRSTACK(1);
-
-	/* It is very important that we enqueue and dequeue entire records at once.
-	 * If we leave partial records, the entire stream will be corrupt.  Our
-	 * reader does its best to make sure it has room for complete records
-	 * (checks qlen()).
-	 *
-	 * If we ever get corrupt streams, try making this a Qmsg.  Though it
-	 * doesn't help every situation - we have issues with writes greater than
-	 * Maxatomic regardless. */
-	profiler_queue = qopen(profiler_queue_limit, 0, NULL, NULL);
-	if (!profiler_queue)
-		error(ENOMEM, ERROR_FIXME);
-	if (waserror()) {
-		free_cpu_buffers();
-		nexterror();
-	}
-
-	profiler_percpu_ctx =
-	    kzmalloc(sizeof(*profiler_percpu_ctx) * num_cores, MEM_WAIT);
+	struct profiler_cpu_ring *rings;
 
+	rings = kzmalloc_align(sizeof(*rings) * num_cores, MEM_WAIT,
+	                       ARCH_CL_SIZE);
 	for (int i = 0; i < num_cores; i++) {
-		struct profiler_cpu_context *b = &profiler_percpu_ctx[i];
-
-		b->cpu = i;
+		rings[i].data = kmalloc(prof->ring_size, MEM_WAIT);
+		rings[i].size = prof->ring_size;
+		qlock_init(&rings[i].qlock);
 	}
+	/* Readers look at rings without the qlock */
+	wmb();
+	prof->rings = rings;
 }
 
 static long profiler_get_checked_value(const char *value, long k, long minval,
@@ -336,22 +380,31 @@ static long profiler_get_checked_value(const char *value, long k, long minval,
 	return lvalue;
 }
 
-int profiler_configure(struct cmdbuf *cb)
+int profiler_configure(struct profiler *prof, struct cmdbuf *cb)
 {
+	ERRSTACK(1);
+
 	if (!strcmp(cb->f[0], "prof_qlimit")) {
 		if (cb->nf < 2)
 			error(EFAIL, "prof_qlimit KB");
-		if (kref_refcnt(&profiler_kref) > 0)
-			error(EFAIL, "Profiler already running");
-		profiler_queue_limit = (int) profiler_get_checked_value(
-			cb->f[1], 1024, 1024 * 1024, max_pmem / 32);
+		qsetlimit(prof->ctl_q, profiler_get_checked_value(
+			cb->f[1], 1024, 1024 * 1024, max_pmem / 32));
 		return 1;
 	}
 	if (!strcmp(cb->f[0], "prof_cpubufsz")) {
 		if (cb->nf < 2)
 			error(EFAIL, "prof_cpubufsz KB");
-		profiler_cpu_buffer_size = (size_t) profiler_get_checked_value(
-			cb->f[1], 1024, 16 * 1024, 1024 * 1024);
+		qlock(&prof->qlock);
+		if (waserror()) {
+			qunlock(&prof->qlock);
+			nexterror();
+		}
+		if (prof->rings)
+			error(EBUSY, "Profiler was already started");
+		prof->ring_size = ROUNDUPPWR2(profiler_get_checked_value(
+			cb->f[1], 1024, 16 * 1024, 64 * 1024 * 1024));
+		poperror();
+		qunlock(&prof->qlock);
 		return 1;
 	}
 
@@ -373,183 +426,250 @@ void profiler_append_configure_usage(char *msgbuf, size_t buflen)
 
 static void profiler_release(struct kref *kref)
 {
-	bool got_reference = FALSE;
-
-	assert(kref == &profiler_kref);
-	qlock(&profiler_mtx);
-	/* Make sure we did not race with profiler_setup(), that got the
-	 * profiler_mtx lock just before us, and re-initialized the profiler
-	 * for a new user.
-	 * If we race here from another profiler_release() (user did a
-	 * profiler_setup() immediately followed by a profiler_cleanup()) we are
-	 * fine because free_cpu_buffers() can be called multiple times.
-	 */
-	if (!kref_get_not_zero(kref, 1))
-		free_cpu_buffers();
-	else
-		got_reference = TRUE;
-	qunlock(&profiler_mtx);
-	/* We cannot call kref_put() within the profiler_kref lock, as such call
-	 * might trigger anohter call to profiler_release().
-	 */
-	if (got_reference)
-		kref_put(kref);
-}
+	struct profiler *prof = container_of(kref, struct profiler, kref);
 
-void profiler_init(void)
-{
-	assert(kref_refcnt(&profiler_kref) == 0);
-	kref_init(&profiler_kref, profiler_release, 0);
+	spin_lock(&profilers_lock);
+	RCU_INIT_POINTER(profilers[prof->slot], NULL);
+	atomic_dec(&nr_profilers);
+	spin_unlock(&profilers_lock);
+	/* The sample paths could still be using prof and its rings. */
+	synchronize_rcu();
+	free_cpu_rings(prof);
+	qfree(prof->ctl_q);
+	kfree(prof);
 }
 
-void profiler_setup(void)
+/* Creates a session, owned by current, and returns a ref to it.  It collects
+ * mmap and process records right away, but no traces until profiler_start().
+ * Throws if there are too many sessions. */
+struct profiler *profiler_create(void)
 {
 	ERRSTACK(1);
+	struct profiler *prof;
+	int slot;
+
+	prof = kzmalloc(sizeof(struct profiler), MEM_WAIT);
+	kref_init(&prof->kref, profiler_release, 1);
+	qlock_init(&prof->qlock);
+	prof->owner = current ? current->pid : 0;
+	prof->ring_size = profiler_cpu_buffer_size;
+	/* It is very important that we enqueue and dequeue entire records at once.
+	 * If we leave partial records, the entire stream will be corrupt.  Our
+	 * reader does its best to make sure it has room for complete records
+	 * (checks qlen()).
+	 *
+	 * If we ever get corrupt streams, try making this a Qmsg.  Though it
+	 * doesn't help every situation - we have issues with writes greater than
+	 * Maxatomic regardless. */
+	prof->ctl_q = qopen(profiler_queue_limit, 0, NULL, NULL);
+	if (!prof->ctl_q) {
+		kfree(prof);
+		error(ENOMEM, "Unable to allocate a profiler queue");
+	}
+	spin_lock(&profilers_lock);
+	for (slot = 0; slot < PROFILER_MAX_SESSIONS; slot++) {
+		if (!profilers[slot])
+			break;
+	}
+	if (slot == PROFILER_MAX_SESSIONS) {
+		spin_unlock(&profilers_lock);
+		qfree(prof->ctl_q);
+		kfree(prof);
+		error(EBUSY, "Already have %d profilers", PROFILER_MAX_SESSIONS);
+	}
+	prof->slot = slot;
+	prof->id = profiler_next_id++;
+	rcu_assign_pointer(profilers[slot], prof);
+	atomic_inc(&nr_profilers);
+	spin_unlock(&profilers_lock);
 
-	qlock(&profiler_mtx);
 	if (waserror()) {
-		qunlock(&profiler_mtx);
+		profiler_put(prof);
 		nexterror();
 	}
-	assert(!profiler_queue);
-	alloc_cpu_buffers();
-
-	/* Do this only when everything is initialized (as last init operation).
-	 */
-	__kref_get(&profiler_kref, 1);
-
-	profiler_emit_current_system_status();
-
+	profiler_emit_current_system_status(prof);
 	poperror();
-	qunlock(&profiler_mtx);
+	return prof;
 }
 
-void profiler_cleanup(void)
+/* Returns a ref to the session in slot, or 0. */
+struct profiler *profiler_get_slot(int slot)
 {
-	kref_put(&profiler_kref);
+	struct profiler *prof;
+
+	if (slot < 0 || slot >= PROFILER_MAX_SESSIONS)
+		return NULL;
+	spin_lock(&profilers_lock);
+	prof = profilers[slot];
+	if (prof && !kref_get_not_zero(&prof->kref, 1))
+		prof = NULL;
+	spin_unlock(&profilers_lock);
+	return prof;
 }
 
-static void profiler_cpu_flush(struct profiler_cpu_context *cpu_buf)
+void profiler_put(struct profiler *prof)
 {
-	int8_t irq_state = 0;
-
-	disable_irqsave(&irq_state);
-	if (cpu_buf->block && profiler_queue) {
-		qibwrite(profiler_queue, cpu_buf->block);
+	kref_put(&prof->kref);
+}
 
-		cpu_buf->block = NULL;
-	}
-	enable_irqsave(&irq_state);
+int profiler_id(struct profiler *prof)
+{
+	return prof->id;
 }
 
-static void profiler_core_trace_enable(void *opaque)
+pid_t profiler_owner(struct profiler *prof)
 {
-	struct profiler_cpu_context *cpu_buf = profiler_get_cpu_ctx(core_id());
+	return prof->owner;
+}
 
-	cpu_buf->tracing = (int) (opaque != NULL);
-	if (!cpu_buf->tracing)
-		profiler_cpu_flush(cpu_buf);
+void profiler_start(struct profiler *prof)
+{
+	qlock(&prof->qlock);
+	if (!prof->rings)
+		alloc_cpu_rings(prof);
+	qreopen(prof->ctl_q);
+	/* The sample paths use the rings once they see tracing */
+	wmb();
+	prof->tracing = TRUE;
+	qunlock(&prof->qlock);
 }
 
-static void profiler_control_trace(int onoff)
+/* Stops collecting traces.  What's in the rings stays there for the readers.
+ * Hangs up the queue, so readers get EOF once they drain everything. */
+void profiler_stop(struct profiler *prof)
 {
-	struct core_set cset;
+	qlock(&prof->qlock);
+	prof->tracing = FALSE;
+	qhangup(prof->ctl_q, 0);
+	qunlock(&prof->qlock);
+}
 
-	error_assert(EINVAL, profiler_percpu_ctx);
+void profiler_push_kernel_backtrace(uintptr_t *pc_list, size_t nr_pcs,
+                                    uint64_t info)
+{
+	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+	pid_t pid;
 
-	core_set_init(&cset);
-	core_set_fill_available(&cset);
-	smp_do_in_cores(&cset, profiler_core_trace_enable,
-	                (void *) (uintptr_t) onoff);
+	if (is_ktask(pcpui->cur_kthread) || !pcpui->cur_proc)
+		pid = -1;
+	else
+		pid = pcpui->cur_proc->pid;
+	profiler_push_trace64(PROFTYPE_KERN_TRACE64, pid, pc_list, nr_pcs, info);
 }
 
-void profiler_start(void)
+void profiler_push_user_backtrace(uintptr_t *pc_list, size_t nr_pcs,
+                                  uint64_t info)
 {
-	assert(profiler_queue);
-	profiler_control_trace(1);
-	qreopen(profiler_queue);
+	profiler_push_trace64(PROFTYPE_USER_TRACE64, current->pid, pc_list, nr_pcs,
+	                      info);
 }
 
-void profiler_stop(void)
+static size_t ring_len(struct profiler_cpu_ring *r)
 {
-	assert(profiler_queue);
-	profiler_control_trace(0);
-	qhangup(profiler_queue, 0);
+	return ACCESS_ONCE(r->head) - ACCESS_ONCE(r->tail);
 }
 
-static void profiler_core_flush(void *opaque)
+/* Copies up to n bytes out of r and consumes them.  With whole_records, it only
+ * copies complete records. */
+static size_t ring_read(struct profiler_cpu_ring *r, void *va, size_t n,
+                        bool whole_records)
 {
-	struct profiler_cpu_context *cpu_buf = profiler_get_cpu_ctx(core_id());
+	ERRSTACK(1);
+	uint64_t head, tail;
+	size_t amt, rec_len;
 
-	profiler_cpu_flush(cpu_buf);
+	qlock(&r->qlock);
+	if (waserror()) {
+		qunlock(&r->qlock);
+		nexterror();
+	}
+	tail = r->tail;
+	head = ACCESS_ONCE(r->head);
+	/* Pairs with the writer's wmb(): the data up to head is there. */
+	rmb();
+	if (whole_records) {
+		for (amt = 0; tail + amt < head; amt += rec_len) {
+			rec_len = ring_record_len(r, tail + amt);
+			if (amt + rec_len > n)
+				break;
+		}
+	} else {
+		amt = MIN(n, head - tail);
+	}
+	ring_copy_out(r, tail, va, amt);
+	/* We're done with the data before the writer can reuse it. */
+	rwmb();
+	ACCESS_ONCE(r->tail) = tail + amt;
+	poperror();
+	qunlock(&r->qlock);
+	return amt;
 }
 
-void profiler_trace_data_flush(void)
+/* Bytes ready to read from the whole session, counting partial records. */
+size_t profiler_size(struct profiler *prof)
 {
-	struct core_set cset;
+	size_t size = qlen(prof->ctl_q);
 
-	error_assert(EINVAL, profiler_percpu_ctx);
-
-	core_set_init(&cset);
-	core_set_fill_available(&cset);
-	smp_do_in_cores(&cset, profiler_core_flush, NULL);
+	if (prof->rings) {
+		for (int i = 0; i < num_cores; i++)
+			size += ring_len(&prof->rings[i]);
+	}
+	return size;
 }
 
-void profiler_push_kernel_backtrace(uintptr_t *pc_list, size_t nr_pcs,
-                                    uint64_t info)
+/* Reads whole records from the session: control records first, then traces
+ * from each core's ring.  If there's nothing, it blocks until there is a
+ * control record or until the session stops (EOF). */
+size_t profiler_read(struct profiler *prof, void *va, size_t n)
 {
-	if (kref_get_not_zero(&profiler_kref, 1)) {
-		struct profiler_cpu_context *cpu_buf = profiler_get_cpu_ctx(core_id());
+	size_t len = 0;
+	bool had_traces = FALSE;
+	int cpu;
 
-		if (profiler_percpu_ctx && cpu_buf->tracing)
-			profiler_push_kernel_trace64(cpu_buf, pc_list, nr_pcs, info);
-		kref_put(&profiler_kref);
+	if (qlen(prof->ctl_q))
+		return qread(prof->ctl_q, va, n);
+	if (prof->rings) {
+		cpu = prof->next_read_cpu;
+		for (int i = 0; i < num_cores; i++, cpu = (cpu + 1) % num_cores) {
+			if (!ring_len(&prof->rings[cpu]))
+				continue;
+			had_traces = TRUE;
+			len += ring_read(&prof->rings[cpu], va + len, n - len, TRUE);
+		}
+		prof->next_read_cpu = cpu;
+		if (len)
+			return len;
+		if (had_traces)
+			error(EINVAL, "Read of %lu bytes is smaller than a record", n);
 	}
+	return qread(prof->ctl_q, va, n);
 }
 
-void profiler_push_user_backtrace(uintptr_t *pc_list, size_t nr_pcs,
-                                  uint64_t info)
+size_t profiler_cpu_size(struct profiler *prof, int cpu)
 {
-	if (kref_get_not_zero(&profiler_kref, 1)) {
-		struct proc *p = current;
-		struct profiler_cpu_context *cpu_buf = profiler_get_cpu_ctx(core_id());
-
-		if (profiler_percpu_ctx && cpu_buf->tracing)
-			profiler_push_user_trace64(cpu_buf, p, pc_list, nr_pcs, info);
-		kref_put(&profiler_kref);
-	}
+	return prof->rings ? ring_len(&prof->rings[cpu]) : 0;
 }
 
-int profiler_size(void)
+/* Reads cpu's stream of trace records.  Records can span reads. */
+size_t profiler_read_cpu(struct profiler *prof, int cpu, void *va, size_t n)
 {
-	return profiler_queue ? qlen(profiler_queue) : 0;
+	return prof->rings ? ring_read(&prof->rings[cpu], va, n, FALSE) : 0;
 }
 
-int profiler_read(void *va, int n)
+uint64_t profiler_cpu_dropped(struct profiler *prof, int cpu)
 {
-	return profiler_queue ? qread(profiler_queue, va, n) : 0;
+	return prof->rings ? ACCESS_ONCE(prof->rings[cpu].dropped) : 0;
 }
 
 void profiler_notify_mmap(struct proc *p, uintptr_t addr, size_t size, int prot,
                           int flags, struct file_or_chan *foc, size_t offset)
 {
-	if (kref_get_not_zero(&profiler_kref, 1)) {
-		if (foc && (prot & PROT_EXEC) && profiler_percpu_ctx) {
-			char path_buf[PROFILER_MAX_PRG_PATH];
-			char *path = foc_abs_path(foc, path_buf, sizeof(path_buf));
-
-			if (likely(path))
-				profiler_push_pid_mmap(p, addr, size, offset, path);
-		}
-		kref_put(&profiler_kref);
-	}
+	if (atomic_read(&nr_profilers))
+		__profiler_notify_mmap(NULL, p, addr, size, prot, foc, offset);
 }
 
 void profiler_notify_new_process(struct proc *p)
 {
-	if (kref_get_not_zero(&profiler_kref, 1)) {
-		if (profiler_percpu_ctx && p->binary_path)
-			profiler_push_new_process(p);
-		kref_put(&profiler_kref);
-	}
+	if (atomic_read(&nr_profilers))
+		__profiler_notify_new_process(NULL, p);
 }
@@ -61,14 +61,27 @@
  *
  * - We have a kthread for GP management, like Linux.  Callbacks are enqueued
  *   locally (on the core that calls call_rcu), like Linux.  We have a kthread
- *   per management core to process the callbacks, and these threads will handle
- *   the callbacks of *all* cores.  Each core has a specific mgmt kthread that
- *   will run its callbacks.  It is important that a particular core's callbacks
- *   are processed by the same thread - I rely on this to implement rcu_barrier
- *   easily.  In that case, we just need to schedule a CB on every core that has
- *   CBs, and when those N CBs are done, our barrier passed.  This relies on CBs
- *   being processed in order for a given core.  We could do the barrier in
- *   other ways, but it doesn't seem like a big deal.
+ *   per CB core to process the callbacks, and these threads will handle the
+ *   callbacks of *all* cores.  There are CONFIG_RCU_CB_CORES CB slots, and
+ *   core i's callbacks run in slot (i % nr_cb_cores).  Slot 0 is core 0, and
+ *   the others are LL cores that the ksched never gives to MCPs (see
+ *   rcu_cb_coreid()), so CB work doesn't interrupt MCPs.  The kthreads stay on
+ *   their cores, since we wake them with a kmsg to that core.
+ *   It is important that a particular core's callbacks are processed by the
+ *   same thread - I rely on this to implement rcu_barrier easily.  In that
+ *   case, we just need to schedule a CB on every core that has CBs, and when
+ *   those N CBs are done, our barrier passed.  This relies on CBs being
+ *   processed in order for a given core.  We could do the barrier in other
+ *   ways, but it doesn't seem like a big deal.
+ *
+ * - synchronize_rcu_expedited() starts a GP right away and waits for the GP
+ *   itself, not for a CB.  During a GP with expedited waiters, the GP kthread
+ *   sends a routine kmsg to every core that hasn't checked in.  That kmsg
+ *   reports a QS, which is safe, since routine kmsgs never run inside a
+ *   read-side critical section.  We can't report from an IRQ (the IRQ could
+ *   have interrupted a reader), so a core that stays in the kernel still gets
+ *   to finish what it's doing.  But cores that are on their way to userspace
+ *   or to halting check in immediately, instead of at the next tardy check.
  *
  * - I kept around some seq counter and locking stuff in rcu_helper.h.  We might
  *   use that in the future.
@@ -78,6 +91,8 @@
 #include <kthread.h>
 #include <smp.h>
 #include <kmalloc.h>
+#include <stdio.h>
+#include <corerequest.h>
 
 /* How many CBs to queue up before we trigger a GP */
 #define RCU_CB_THRESH 10
@@ -93,6 +108,9 @@ extern int rcu_num_lvls;
 /* Controls whether we skip cores when we expedite, which forces tardy cores. */
 static bool rcu_debug_tardy;
 
+/* Number of CB slots, each with a kthread on core rcu_cb_coreid(slot). */
+static int rcu_nr_cb_cores = 1;
+
 /* Externed in rcu_tree_helper.c */
 struct rcu_state rcu_state;
 
@@ -127,6 +145,41 @@ void synchronize_rcu(void)
 	sem_down(sem);
 }
 
+static int exp_gp_completed(void *arg)
+{
+	unsigned long target = (unsigned long)arg;
+
+	return ULONG_CMP_GE(READ_ONCE(rcu_state.completed), target);
+}
+
+static void wake_gp_ktask(struct rcu_state *rsp, bool force);
+
+/* Like synchronize_rcu(), but it starts a GP right away and prods cores that
+ * are slow to check in.  This is for writers that are on someone's critical
+ * path, e.g. a syscall.  It costs a kmsg to every core that was in the kernel
+ * when the GP started, so don't use it for background work. */
+void synchronize_rcu_expedited(void)
+{
+	struct rcu_state *rsp = &rcu_state;
+	unsigned long target;
+
+	if (in_rcu_cb_ctx(this_pcpui_ptr()))
+		panic("Attempted synchronize_rcu_expedited() from an RCU callback!");
+	if (is_rcu_ktask(current_kthread))
+		panic("Attempted synchronize_rcu_expedited() from an RCU thread!");
+	if (!PERCPU_VAR(rcu_pcpui).booted) {
+		synchronize_rcu();
+		return;
+	}
+	/* The GP kthread needs to see us before it could start our GP. */
+	atomic_inc(&rsp->nr_exp_waiters);
+	/* Same as in __call_rcu_rpi(): gpnum could have been ACKed already. */
+	target = READ_ONCE(rsp->gpnum) + 1;
+	wake_gp_ktask(rsp, true);
+	rendez_sleep(&rsp->exp_rv, exp_gp_completed, (void*)target);
+	atomic_dec(&rsp->nr_exp_waiters);
+}
+
 static inline bool gp_in_progress(struct rcu_state *rsp)
 {
 	unsigned long completed = READ_ONCE(rsp->completed);
@@ -404,6 +457,45 @@ static int root_qsmask_empty(void *arg)
 	return READ_ONCE(rsp->node[0].qsmask) == 0 ? 1 : 0;
 }
 
+static bool gp_wants_exp_kick(struct rcu_state *rsp)
+{
+	return atomic_read(&rsp->nr_exp_waiters) && !rsp->gp_exp_kicked;
+}
+
+/* Wakes the GP kthread during a GP, when the GP is done or when an expedited
+ * waiter showed up. */
+static int gp_should_wake(void *arg)
+{
+	struct rcu_state *rsp = arg;
+
+	return root_qsmask_empty(rsp) || gp_wants_exp_kick(rsp);
+}
+
+static void __rcu_exp_report_qs(uint32_t srcid, long a0, long a1, long a2)
+{
+	rcu_report_qs();
+}
+
+/* Sends a kmsg to every core that hasn't checked in for this GP. */
+static void rcu_exp_kick_tardy_cores(struct rcu_state *rsp)
+{
+	struct rcu_node *rnp;
+	unsigned long qsmask;
+	int i, coreid;
+
+	rcu_for_each_leaf_node(rsp, rnp) {
+		qsmask = READ_ONCE(rnp->qsmask);
+		for_each_set_bit(i, &qsmask, BITS_PER_LONG) {
+			coreid = i + rnp->grplo;
+			/* Fake cores, and we'll check in ourselves when we sleep */
+			if (coreid >= num_cores || coreid == core_id())
+				continue;
+			send_kernel_message(coreid, __rcu_exp_report_qs, 0, 0, 0,
+			                    KMSG_ROUTINE);
+		}
+	}
+}
+
 static void rcu_run_gp(struct rcu_state *rsp)
 {
 	struct rcu_node *rnp;
@@ -416,6 +508,7 @@ static void rcu_run_gp(struct rcu_state *rsp)
 	 * advertise the next GP. */
 	rcu_for_each_node_breadth_first(rsp, rnp)
 		rnp->qsmask = rnp->qsmaskinit;
+	rsp->gp_exp_kicked = false;
 	/* Need the tree set for reporting QSs before advertising the GP */
 	wmb();
 	WRITE_ONCE(rsp->gpnum, rsp->gpnum + 1);
@@ -429,15 +522,24 @@ static void rcu_run_gp(struct rcu_state *rsp)
 	 * a race where a core halted but we didn't see it.  (they report QS, decide
 	 * to halt, pause, we start GP, see they haven't halted, etc.  They could
 	 * report the QS after setting the state, but I didn't want to . */
-	do {
-		rendez_sleep_timeout(&rsp->gp_ktask_rv, root_qsmask_empty, rsp,
+	while (!root_qsmask_empty(rsp)) {
+		/* Expedited waiters could show up at any point in the GP.  One kick
+		 * per GP is enough: a core that got one will check in at its next
+		 * chance, and a second kmsg won't change when that is. */
+		if (gp_wants_exp_kick(rsp)) {
+			rsp->gp_exp_kicked = true;
+			rcu_exp_kick_tardy_cores(rsp);
+		}
+		rendez_sleep_timeout(&rsp->gp_ktask_rv, gp_should_wake, rsp,
 		                     RCU_GP_TARDY_PERIOD);
 		rcu_report_qs_tardy_cores(rsp);
-	} while (!root_qsmask_empty(rsp));
+	}
 	/* Not sure if we need any barriers here.  Once we post 'completed', the CBs
 	 * can start running.  But no one should touch the tree til gpnum is
 	 * incremented. */
 	WRITE_ONCE(rsp->completed, rsp->gpnum);
+	if (atomic_read(&rsp->nr_exp_waiters))
+		rendez_wakeup(&rsp->exp_rv);
 }
 
 static int should_wake_ctl(void *arg)
@@ -447,14 +549,24 @@ static int should_wake_ctl(void *arg)
 	return *ctl != 0 ? 1 : 0;
 }
 
+static void __wake_mgmt_ktask(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct rcu_pcpui *rpi = (struct rcu_pcpui*)a0;
+
+	rendez_wakeup(&rpi->mgmt_ktask_rv);
+}
+
+/* The wakeup happens on the CB core, so that its kthread runs there. */
 static void wake_mgmt_ktasks(struct rcu_state *rsp)
 {
 	struct rcu_pcpui *rpi;
 
-	/* TODO: For each mgmt core */
-	rpi = _PERCPU_VARPTR(rcu_pcpui, 0);
-	rpi->mgmt_ktask_ctl = 1;
-	rendez_wakeup(&rpi->mgmt_ktask_rv);
+	for (int i = 0; i < rcu_nr_cb_cores; i++) {
+		rpi = _PERCPU_VARPTR(rcu_pcpui, rcu_cb_coreid(i));
+		rpi->mgmt_ktask_ctl = 1;
+		send_kernel_message(rpi->coreid, __wake_mgmt_ktask, (long)rpi, 0, 0,
+		                    KMSG_ROUTINE);
+	}
 }
 
 static void rcu_gp_ktask(void *arg)
@@ -534,7 +646,8 @@ static void run_rcu_cbs(struct rcu_state *rsp, int coreid)
 
 static void rcu_mgmt_ktask(void *arg)
 {
-	struct rcu_pcpui *rpi = arg;
+	unsigned int slot = (uintptr_t)arg;
+	struct rcu_pcpui *rpi = _PERCPU_VARPTR(rcu_pcpui, rcu_cb_coreid(slot));
 	struct rcu_state *rsp = rpi->rsp;
 
 	current_kthread->flags |= KTH_IS_RCU_KTASK;
@@ -542,8 +655,7 @@ static void rcu_mgmt_ktask(void *arg)
 		rendez_sleep(&rpi->mgmt_ktask_rv, should_wake_ctl,
 		             &rpi->mgmt_ktask_ctl);
 		rpi->mgmt_ktask_ctl = 0;
-		/* TODO: given the number of mgmt kthreads, we need to assign cores */
-		for_each_core(i)
+		for (int i = slot; i < num_cores; i += rcu_nr_cb_cores)
 			run_rcu_cbs(rsp, i);
 	};
 }
@@ -568,11 +680,9 @@ void rcu_init_pcpui(struct rcu_state *rsp, struct rcu_pcpui *rpi, int coreid)
 	rpi->nr_cbs = 0;
 	rpi->gp_acked = rsp->completed;
 
-	/* TODO: For each mgmt core only */
-	if (coreid == 0) {
-		rendez_init(&rpi->mgmt_ktask_rv);
-		rpi->mgmt_ktask_ctl = 0;
-	}
+	/* We don't know the number of CB cores yet, and it's cheap. */
+	rendez_init(&rpi->mgmt_ktask_rv);
+	rpi->mgmt_ktask_ctl = 0;
 }
 
 /* Initializes the fake cores.  Works with rcu_report_qs_fake_cores() */
@@ -598,9 +708,17 @@ void rcu_init(void)
 	rcu_init_fake_cores(rsp);
 	rcu_dump_rcu_node_tree(rsp);
 
+	atomic_init(&rsp->nr_exp_waiters, 0);
+	rendez_init(&rsp->exp_rv);
 	ktask("rcu_gp", rcu_gp_ktask, rsp);
-	/* TODO: For each mgmt core */
-	ktask("rcu_mgmt_0", rcu_mgmt_ktask, _PERCPU_VARPTR(rcu_pcpui, 0));
+	rcu_nr_cb_cores = 1 + nr_rcu_cb_extra_cores();
+	/* They start here, and move to their CB cores on their first wakeup. */
+	for (int i = 0; i < rcu_nr_cb_cores; i++) {
+		rpi = _PERCPU_VARPTR(rcu_pcpui, rcu_cb_coreid(i));
+		snprintf(rpi->mgmt_ktask_name, sizeof(rpi->mgmt_ktask_name),
+		         "rcu_mgmt_%d", rpi->coreid);
+		ktask(rpi->mgmt_ktask_name, rcu_mgmt_ktask, (void*)(uintptr_t)i);
+	}
 
 	/* If we have a call_rcu before percpu_init, we might be using the spot in
 	 * the actual __percpu .section.  We'd be core 0, so that'd be OK, since all
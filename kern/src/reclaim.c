@@ -0,0 +1,275 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Memory reclaim ktask.
+ *
+ * Base arenas call reclaim_check_arena() after allocations.  Once an arena has
+ * less than 1/RECLAIM_LOW_DIV of its memory free, we poke the ktask.  Pokes can
+ * come from any context, including IRQs and with arena locks held, so all we do
+ * is set a flag and send a routine kmsg to wake the ktask.
+ *
+ * A reclaim pass, in order:
+ * - Trim every slab cache's depot down to its working set and reap the empty
+ *   slabs.  That's usually where most of the free memory is hiding.
+ * - Empty the arenas' qcaches, leaves first, so that free spans of importing
+ *   arenas (e.g. kpages) go back to the base arenas.
+ * - If we're still below 1/RECLAIM_HIGH_DIV free, call the shrinkers in the
+ *   order they registered, then do the slab and arena passes again to collect
+ *   what they freed.
+ *
+ * Even without pressure, the ktask wakes up every RECLAIM_PERIOD_USEC and trims
+ * the depots.  That's the working-set tracking from the magazine paper: a
+ * magazine that sat in the depot for a whole period wasn't needed.
+ *
+ * MEM_WAIT allocations that would otherwise panic for lack of memory call
+ * reclaim_direct(), which does the slab and arena passes synchronously (but not
+ * the shrinkers, which can block for I/O).
+ *
+ * Counters are in #vars. */
+
+#include <reclaim.h>
+#include <arena.h>
+#include <slab.h>
+#include <numa.h>
+#include <kthread.h>
+#include <rendez.h>
+#include <smp.h>
+#include <trap.h>
+#include <ns.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define RECLAIM_LOW_DIV			32
+#define RECLAIM_HIGH_DIV		16
+#define RECLAIM_PERIOD_USEC		(15 * 1000000)
+
+static struct rendez reclaim_rv;
+static atomic_t reclaim_poked;
+static atomic_t reclaim_direct_busy;
+static bool reclaim_ready;
+
+static qlock_t shrinkers_lock = QLOCK_INITIALIZER(shrinkers_lock);
+static struct shrinker_tailq shrinkers = TAILQ_HEAD_INITIALIZER(shrinkers);
+
+uint64_t reclaim_nr_pokes;
+uint64_t reclaim_nr_runs;
+uint64_t reclaim_nr_direct;
+uint64_t reclaim_nr_trims;
+uint64_t reclaim_bytes_freed;
+uint64_t reclaim_mags_freed;
+uint64_t reclaim_slabs_freed;
+uint64_t reclaim_shrinker_freed;
+
+DEVVARS_ENTRY(reclaim_nr_pokes, "ug");
+DEVVARS_ENTRY(reclaim_nr_runs, "ug");
+DEVVARS_ENTRY(reclaim_nr_direct, "ug");
+DEVVARS_ENTRY(reclaim_nr_trims, "ug");
+DEVVARS_ENTRY(reclaim_bytes_freed, "ug");
+DEVVARS_ENTRY(reclaim_mags_freed, "ug");
+DEVVARS_ENTRY(reclaim_slabs_freed, "ug");
+DEVVARS_ENTRY(reclaim_shrinker_freed, "ug");
+
+void register_shrinker(struct shrinker *s)
+{
+	s->nr_calls = 0;
+	s->nr_freed = 0;
+	qlock(&shrinkers_lock);
+	TAILQ_INSERT_TAIL(&shrinkers, s, link);
+	qunlock(&shrinkers_lock);
+}
+
+void unregister_shrinker(struct shrinker *s)
+{
+	qlock(&shrinkers_lock);
+	TAILQ_REMOVE(&shrinkers, s, link);
+	qunlock(&shrinkers_lock);
+}
+
+static size_t reclaim_amt_free(void)
+{
+	size_t amt = 0;
+
+	for (int i = 0; i < nr_numa_nodes; i++)
+		amt += numa_amt_free(i);
+	return amt;
+}
+
+/* Returns TRUE if any node has less than 1/div of its memory free. */
+static bool reclaim_mem_below(int div)
+{
+	for (int i = 0; i < nr_numa_nodes; i++) {
+		if (numa_amt_free(i) < numa_amt_total(i) / div)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Returns TRUE if @node is below the high watermark, i.e. reclaim would be
+ * trying to free memory there.  Callers that hold on to memory optionally (e.g.
+ * the zero pool) can back off. */
+bool reclaim_node_low(int node)
+{
+	return numa_amt_free(node) < numa_amt_total(node) / RECLAIM_HIGH_DIV;
+}
+
+/* Pages we'd need to free to get every node above the high watermark. */
+static size_t reclaim_nr_wanted(void)
+{
+	size_t total, free, amt = 0;
+
+	for (int i = 0; i < nr_numa_nodes; i++) {
+		total = numa_amt_total(i);
+		free = numa_amt_free(i);
+		if (free < total / RECLAIM_HIGH_DIV)
+			amt += total / RECLAIM_HIGH_DIV - free;
+	}
+	return amt >> PGSHIFT;
+}
+
+static void __reclaim_wake(uint32_t srcid, long a0, long a1, long a2)
+{
+	rendez_wakeup(&reclaim_rv);
+}
+
+/* Safe to call from any context. */
+void reclaim_poke(void)
+{
+	if (!reclaim_ready)
+		return;
+	if (atomic_swap(&reclaim_poked, 1))
+		return;
+	reclaim_nr_pokes++;
+	send_kernel_message(core_id(), __reclaim_wake, 0, 0, 0, KMSG_ROUTINE);
+}
+
+/* Called by base arenas after allocating.  Lockless peek at the arena. */
+void reclaim_check_arena(struct arena *arena)
+{
+	if (arena_amt_free(arena) < arena_amt_total(arena) / RECLAIM_LOW_DIV)
+		reclaim_poke();
+}
+
+/* Trims every cache's depot to its working set.  Hold arenas_and_slabs_lock. */
+static void __reclaim_trim_depots(void)
+{
+	struct kmem_cache *kc_i;
+
+	TAILQ_FOREACH(kc_i, &all_kmem_caches, all_kmc_link) {
+		if (kc_i->flags & KMC_QCACHE)
+			continue;
+		reclaim_mags_freed += kmem_cache_trim_depot(kc_i);
+	}
+}
+
+/* The slab and arena passes.  Hold arenas_and_slabs_lock. */
+static void __reclaim_caches(void)
+{
+	struct kmem_cache *kc_i;
+	struct arena *a_i;
+
+	__reclaim_trim_depots();
+	TAILQ_FOREACH(kc_i, &all_kmem_caches, all_kmc_link) {
+		if (kc_i->flags & KMC_QCACHE)
+			continue;
+		reclaim_slabs_freed += kmem_cache_reap(kc_i);
+	}
+	/* Arenas are created after their sources, so going backwards handles
+	 * importers before their sources. */
+	TAILQ_FOREACH_REVERSE(a_i, &all_arenas, arena_tailq, next)
+		reclaim_slabs_freed += arena_reclaim(a_i);
+}
+
+static void reclaim_shrink(void)
+{
+	struct shrinker *s_i;
+	size_t nr_freed;
+
+	qlock(&shrinkers_lock);
+	TAILQ_FOREACH(s_i, &shrinkers, link) {
+		if (!reclaim_mem_below(RECLAIM_HIGH_DIV))
+			break;
+		nr_freed = s_i->shrink(s_i, reclaim_nr_wanted());
+		s_i->nr_calls++;
+		s_i->nr_freed += nr_freed;
+		reclaim_shrinker_freed += nr_freed;
+	}
+	qunlock(&shrinkers_lock);
+}
+
+static void reclaim_run(void)
+{
+	size_t before = reclaim_amt_free();
+	size_t after;
+
+	reclaim_nr_runs++;
+	qlock(&arenas_and_slabs_lock);
+	__reclaim_caches();
+	qunlock(&arenas_and_slabs_lock);
+	if (reclaim_mem_below(RECLAIM_HIGH_DIV)) {
+		reclaim_shrink();
+		qlock(&arenas_and_slabs_lock);
+		__reclaim_caches();
+		qunlock(&arenas_and_slabs_lock);
+	}
+	after = reclaim_amt_free();
+	if (after > before)
+		reclaim_bytes_freed += after - before;
+}
+
+/* Synchronous reclaim, for MEM_WAIT allocations that are out of memory.  Skips
+ * the shrinkers.  Returns TRUE if we freed anything. */
+bool reclaim_direct(void)
+{
+	size_t before, after;
+
+	if (!reclaim_ready)
+		return FALSE;
+	/* Reaping can allocate (e.g. magazines), which can land us back here. */
+	if (atomic_swap(&reclaim_direct_busy, 1))
+		return FALSE;
+	if (!canqlock(&arenas_and_slabs_lock)) {
+		atomic_set(&reclaim_direct_busy, 0);
+		return FALSE;
+	}
+	reclaim_nr_direct++;
+	before = reclaim_amt_free();
+	__reclaim_caches();
+	after = reclaim_amt_free();
+	qunlock(&arenas_and_slabs_lock);
+	atomic_set(&reclaim_direct_busy, 0);
+	if (after <= before)
+		return FALSE;
+	reclaim_bytes_freed += after - before;
+	return TRUE;
+}
+
+static int reclaim_was_poked(void *arg)
+{
+	return atomic_read(&reclaim_poked);
+}
+
+static void reclaim_ktask(void *arg)
+{
+	for (;;) {
+		rendez_sleep_timeout(&reclaim_rv, reclaim_was_poked, NULL,
+		                     RECLAIM_PERIOD_USEC);
+		atomic_set(&reclaim_poked, 0);
+		if (reclaim_mem_below(RECLAIM_LOW_DIV)) {
+			reclaim_run();
+			continue;
+		}
+		reclaim_nr_trims++;
+		qlock(&arenas_and_slabs_lock);
+		__reclaim_trim_depots();
+		qunlock(&arenas_and_slabs_lock);
+	}
+}
+
+void reclaim_init(void)
+{
+	rendez_init(&reclaim_rv);
+	atomic_init(&reclaim_poked, 0);
+	atomic_init(&reclaim_direct_busy, 0);
+	ktask("reclaim", reclaim_ktask, NULL);
+	reclaim_ready = TRUE;
+}
@@ -105,15 +105,8 @@ void schedule_init(void)
 	corealloc_init();
 	spin_unlock(&sched_lock);
 
-#ifdef CONFIG_ARSC_SERVER
-	/* Most likely we'll have a syscall and a process that dedicates itself to
-	 * running this.  Or if it's a kthread, we don't need a core. */
-	#error "Find a way to get a core.  Probably a syscall to run a server."
-	int arsc_coreid = get_any_idle_core();
-	assert(arsc_coreid >= 0);
-	send_kernel_message(arsc_coreid, arsc_server, 0, 0, 0, KMSG_ROUTINE);
-	printk("Using core %d for the ARSC server\n", arsc_coreid);
-#endif /* CONFIG_ARSC_SERVER */
+	/* The arsc cores are never in the idle list (is_ll_core()). */
+	arsc_init();
 }
 
 /* Round-robins on whatever list it's on */
@@ -69,13 +69,16 @@
  *   the depot during free.  Either approach doesn't require someone else to
  *   grab a pcc lock.
  *
+ * - How do magazines leave the depot?  The depot tracks the low-water mark of
+ *   each of its lists.  Those mags were never needed since the last trim, so
+ *   they are not part of the working set.  kmem_cache_trim_depot(), called
+ *   periodically and under pressure by the reclaim ktask, frees them and
+ *   resets the marks.
+ *
  * TODO:
- * - Add reclaim function.
  * - When resizing, do we want to go through the depot and consolidate
  *   magazines?  (probably not a big deal.  maybe we'd deal with it when we
  *   clean up our excess mags.)
- * - Could do some working set tracking.  Like max/min over an interval, with
- *   resetting (in the depot, used for reclaim and maybe aggressive freeing).
  * - Debugging info
  */
 
@@ -86,13 +89,22 @@
 #include <kmalloc.h>
 #include <hash.h>
 #include <arena.h>
+#include <numa.h>
+#include <ns.h>
 
 #define SLAB_POISON ((void*)0xdead1111)
 
 /* Tunables.  I don't know which numbers to pick yet.  Maybe we play with it at
- * runtime.  Though once a mag increases, it'll never decrease. */
+ * runtime.  Magsizes grow when the depot lock sees more than resize_threshold
+ * contended acquisitions in resize_timeout_ns.  They shrink by one after
+ * resize_quiet_trims depot trims in a row without any contention. */
 uint64_t resize_timeout_ns = 1000000000;
 unsigned int resize_threshold = 1;
+unsigned int resize_quiet_trims = 4;
+
+DEVVARS_ENTRY(resize_timeout_ns, "ug");
+DEVVARS_ENTRY(resize_threshold, "uw");
+DEVVARS_ENTRY(resize_quiet_trims, "uw");
 
 /* Protected by the arenas_and_slabs_lock. */
 struct kmem_cache_tailq all_kmem_caches =
@@ -162,6 +174,7 @@ static void lock_depot(struct kmem_depot *depot)
 	 * might then think the burst wasn't big enough. */
 	time = nsec();
 	spin_lock_irqsave(&depot->lock);
+	depot->nr_contended++;
 	/* If there are no not-empty mags, we're probably fighting for the lock not
 	 * because the magazines aren't big enough, but because there aren't enough
 	 * mags in the system yet. */
@@ -174,7 +187,10 @@ static void lock_depot(struct kmem_depot *depot)
 	depot->busy_count++;
 	if (depot->busy_count > resize_threshold) {
 		depot->busy_count = 0;
-		depot->magsize = MIN(KMC_MAG_MAX_SZ, depot->magsize + 1);
+		if (depot->magsize < KMC_MAG_MAX_SZ) {
+			depot->magsize++;
+			depot->nr_grows++;
+		}
 		/* That's all we do - the pccs will eventually notice and up their
 		 * magazine sizes. */
 	}
@@ -193,8 +209,17 @@ static void depot_init(struct kmem_depot *depot)
 	depot->magsize = KMC_MAG_MIN_SZ;
 	depot->nr_not_empty = 0;
 	depot->nr_empty = 0;
+	depot->min_not_empty = 0;
+	depot->min_empty = 0;
 	depot->busy_count = 0;
 	depot->busy_start = 0;
+	depot->quiet_trims = 0;
+	depot->contended_at_trim = 0;
+	depot->nr_alloc_trips = 0;
+	depot->nr_free_trips = 0;
+	depot->nr_contended = 0;
+	depot->nr_grows = 0;
+	depot->nr_shrinks = 0;
 }
 
 static bool mag_is_empty(struct kmem_magazine *mag)
@@ -386,10 +411,38 @@ static void depot_destroy(struct kmem_cache *kc)
 	unlock_depot(depot);
 }
 
+/* Slabs that pull from a kpages arena go through the NUMA-aware kpages
+ * functions.  Caches on the default kpages_arena grow from the growing core's
+ * node; caches on a node's kpages arena grow from that node.  Either way, we
+ * fall back to other nodes instead of panicking, and frees go back to whichever
+ * node the memory came from.  Qcaches *are* their arena's slab layer, so they
+ * must talk to the arena directly. */
+static void *kmem_source_alloc(struct kmem_cache *cp, size_t size)
+{
+	int node;
+
+	if (cp->flags & KMC_QCACHE)
+		return arena_alloc(cp->source, size, MEM_ATOMIC);
+	node = numa_kpages_node(cp->source);
+	if (node == 0)
+		return kpages_alloc(size, MEM_ATOMIC);
+	if (node > 0)
+		return kpages_alloc_node(size, MEM_ATOMIC, node);
+	return arena_alloc(cp->source, size, MEM_ATOMIC);
+}
+
+static void kmem_source_free(struct kmem_cache *cp, void *buf, size_t size)
+{
+	if (!(cp->flags & KMC_QCACHE) && (numa_kpages_node(cp->source) >= 0))
+		kpages_free(buf, size);
+	else
+		arena_free(cp->source, buf, size);
+}
+
 static void kmem_slab_destroy(struct kmem_cache *cp, struct kmem_slab *a_slab)
 {
 	if (!__use_bufctls(cp)) {
-		arena_free(cp->source, ROUNDDOWN(a_slab, PGSIZE), PGSIZE);
+		kmem_source_free(cp, ROUNDDOWN(a_slab, PGSIZE), PGSIZE);
 	} else {
 		struct kmem_bufctl *i, *temp;
 		void *buf_start = (void*)SIZE_MAX;
@@ -401,7 +454,7 @@ static void kmem_slab_destroy(struct kmem_cache *cp, struct kmem_slab *a_slab)
 			 * init the freelist when we reuse the slab. */
 			kmem_cache_free(kmem_bufctl_cache, i);
 		}
-		arena_free(cp->source, buf_start, cp->import_amt);
+		kmem_source_free(cp, buf_start, cp->import_amt);
 		kmem_cache_free(kmem_slab_cache, a_slab);
 	}
 }
@@ -577,10 +630,12 @@ try_alloc:
 	}
 	/* Note the lock ordering: pcc -> depot */
 	lock_depot(depot);
+	depot->nr_alloc_trips++;
 	mag = SLIST_FIRST(&depot->not_empty);
 	if (mag) {
 		SLIST_REMOVE_HEAD(&depot->not_empty, link);
 		depot->nr_not_empty--;
+		depot->min_not_empty = MIN(depot->min_not_empty, depot->nr_not_empty);
 		__return_to_depot(kc, pcc->prev);
 		unlock_depot(depot);
 		pcc->prev = pcc->loaded;
@@ -651,6 +706,7 @@ try_free:
 		goto try_free;
 	}
 	lock_depot(depot);
+	depot->nr_free_trips++;
 	/* Here's where the resize magic happens.  We'll start using it for the next
 	 * magazine. */
 	pcc->magsize = depot->magsize;
@@ -658,6 +714,7 @@ try_free:
 	if (mag) {
 		SLIST_REMOVE_HEAD(&depot->empty, link);
 		depot->nr_empty--;
+		depot->min_empty = MIN(depot->min_empty, depot->nr_empty);
 		__return_to_depot(kc, pcc->prev);
 		unlock_depot(depot);
 		pcc->prev = pcc->loaded;
@@ -703,7 +760,7 @@ static bool kmem_cache_grow(struct kmem_cache *cp)
 		/* Careful, this assumes our source is a PGSIZE-aligned allocator.  We
 		 * could use xalloc to enforce the alignment, but that'll bypass the
 		 * qcaches, which we don't want.  Caller beware. */
-		a_page = arena_alloc(cp->source, PGSIZE, MEM_ATOMIC);
+		a_page = kmem_source_alloc(cp, PGSIZE);
 		if (!a_page)
 			return FALSE;
 		// the slab struct is stored at the end of the page
@@ -728,7 +785,7 @@ static bool kmem_cache_grow(struct kmem_cache *cp)
 		a_slab = kmem_cache_alloc(kmem_slab_cache, 0);
 		if (!a_slab)
 			return FALSE;
-		buf = arena_alloc(cp->source, cp->import_amt, MEM_ATOMIC);
+		buf = kmem_source_alloc(cp, cp->import_amt);
 		if (!buf) {
 			kmem_cache_free(kmem_slab_cache, a_slab);
 			return FALSE;
@@ -751,20 +808,80 @@ static bool kmem_cache_grow(struct kmem_cache *cp)
 	return TRUE;
 }
 
-/* This deallocs every slab from the empty list.  TODO: think a bit more about
- * this.  We can do things like not free all of the empty lists to prevent
- * thrashing.  See 3.4 in the paper. */
-void kmem_cache_reap(struct kmem_cache *cp)
+/* This deallocs every slab from the empty list, returning the number of slabs
+ * freed.  TODO: think a bit more about this.  We can do things like not free
+ * all of the empty lists to prevent thrashing.  See 3.4 in the paper. */
+size_t kmem_cache_reap(struct kmem_cache *cp)
 {
-	struct kmem_slab *a_slab, *next;
+	struct kmem_slab *a_slab;
+	size_t nr_freed = 0;
 
-	// Destroy all empty slabs.  Refer to the notes about the while loop
 	spin_lock_irqsave(&cp->cache_lock);
-	a_slab = TAILQ_FIRST(&cp->empty_slab_list);
-	while (a_slab) {
-		next = TAILQ_NEXT(a_slab, link);
+	while ((a_slab = TAILQ_FIRST(&cp->empty_slab_list))) {
+		TAILQ_REMOVE(&cp->empty_slab_list, a_slab, link);
 		kmem_slab_destroy(cp, a_slab);
-		a_slab = next;
+		nr_freed++;
 	}
 	spin_unlock_irqsave(&cp->cache_lock);
+	return nr_freed;
+}
+
+/* Shrinks the magsize if the depot lock hasn't been contended for a while.
+ * Mags that already have more rounds than the new size are fine; see the FAQ.
+ * Hold the depot lock. */
+static void __depot_maybe_shrink(struct kmem_depot *depot)
+{
+	if (depot->nr_contended != depot->contended_at_trim) {
+		depot->contended_at_trim = depot->nr_contended;
+		depot->quiet_trims = 0;
+		return;
+	}
+	if (++depot->quiet_trims < resize_quiet_trims)
+		return;
+	depot->quiet_trims = 0;
+	if (depot->magsize > KMC_MAG_MIN_SZ) {
+		depot->magsize--;
+		depot->nr_shrinks++;
+	}
+}
+
+/* Frees the depot's magazines that weren't part of its working set since the
+ * last trim: the low-water mark of each list.  Full mags are drained to the
+ * slab layer, so follow this with a reap.  Also shrinks the magsize of caches
+ * whose depot has been quiet.  Returns the number of mags freed. */
+size_t kmem_cache_trim_depot(struct kmem_cache *kc)
+{
+	struct kmem_depot *depot = &kc->depot;
+	struct kmem_mag_slist victims = SLIST_HEAD_INITIALIZER(victims);
+	struct kmem_magazine *mag;
+	unsigned int nr_not_empty, nr_empty;
+	size_t nr_freed = 0;
+
+	spin_lock_irqsave(&depot->lock);
+	nr_not_empty = depot->min_not_empty;
+	nr_empty = depot->min_empty;
+	for (int i = 0; i < nr_not_empty; i++) {
+		mag = SLIST_FIRST(&depot->not_empty);
+		SLIST_REMOVE_HEAD(&depot->not_empty, link);
+		SLIST_INSERT_HEAD(&victims, mag, link);
+	}
+	for (int i = 0; i < nr_empty; i++) {
+		mag = SLIST_FIRST(&depot->empty);
+		SLIST_REMOVE_HEAD(&depot->empty, link);
+		SLIST_INSERT_HEAD(&victims, mag, link);
+	}
+	depot->nr_not_empty -= nr_not_empty;
+	depot->nr_empty -= nr_empty;
+	depot->min_not_empty = depot->nr_not_empty;
+	depot->min_empty = depot->nr_empty;
+	__depot_maybe_shrink(depot);
+	spin_unlock_irqsave(&depot->lock);
+
+	while ((mag = SLIST_FIRST(&victims))) {
+		SLIST_REMOVE_HEAD(&victims, link);
+		drain_mag(kc, mag);
+		kmem_cache_free(kmem_magazine_cache, mag);
+		nr_freed++;
+	}
+	return nr_freed;
 }
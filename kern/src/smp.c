@@ -77,12 +77,13 @@ static void __attribute__((noreturn)) __smp_idle(void *arg)
 		process_routine_kmsg();
 		try_run_proc();
 		cpu_bored();		/* call out to the ksched */
-		/* cpu_halt() atomically turns on interrupts and halts the core.
+		/* cpu_halt_kmsg() atomically turns on interrupts and halts the core.
 		 * Important to do this, since we could have a RKM come in via an
 		 * interrupt right while PRKM is returning, and we wouldn't catch
-		 * it.  When it returns, IRQs are back off. */
+		 * it.  It also wakes for RKMs sent without an IPI.  When it returns,
+		 * IRQs are back off. */
 		__set_cpu_state(pcpui, CPU_STATE_IDLE);
-		cpu_halt();
+		cpu_halt_kmsg();
 		__set_cpu_state(pcpui, CPU_STATE_KERNEL);
 	}
 	assert(0);
@@ -120,6 +121,7 @@ void smp_percpu_init(void)
 	STAILQ_INIT(&per_cpu_info[coreid].immed_amsgs);
 	spinlock_init_irqsave(&per_cpu_info[coreid].routine_amsg_lock);
 	STAILQ_INIT(&per_cpu_info[coreid].routine_amsgs);
+	atomic_init(&per_cpu_info[coreid].kmsg_poll, 0);
 	/* Initialize the per-core timer chain */
 	init_timer_chain(&per_cpu_info[coreid].tchain, set_pcpu_alarm_interrupt);
 	/* Init generic tracing ring */
@@ -1,9 +1,11 @@
-// Basic string routines.  Not hardware optimized, but not shabby.
+// Basic string routines.  Not hardware optimized, but not shabby.  memcpy and
+// memset use the arch's block ops when it has them.
 
 #include <stdio.h>
 #include <string.h>
 #include <ros/memlayout.h>
 #include <assert.h>
+#include <cpu_feat.h>
 
 int
 strlen(const char *s)
@@ -220,7 +222,7 @@ memsetw(long* _v, long c, size_t n)
   } while(0)
 
 void *
-memset(void *v, int c, size_t _n)
+memset_generic(void *v, int c, size_t _n)
 {
 	char *p;
 	size_t n0;
@@ -254,7 +256,7 @@ memset(void *v, int c, size_t _n)
 }
 
 void *
-memcpy(void* dst, const void* src, size_t _n)
+memcpy_generic(void* dst, const void* src, size_t _n)
 {
 	const char* s;
 	char* d;
@@ -291,10 +293,53 @@ memcpy(void* dst, const void* src, size_t _n)
 	return dst;
 }
 
+#ifdef CONFIG_X86
+/* Copies and sets at least this big use non-temporal stores.  They'd blow out
+ * most of the LLC anyway, and it's usually someone else's data they'd evict.
+ * The 2MB clear of a jumbo page is the common case. */
+#define MEM_NT_THRESH			(1024 * 1024)
+/* Without FSRM, rep movsb has a startup cost that loses to the word loops for
+ * short copies. */
+#define MEM_ERMS_MIN			128
+
+static bool use_rep_movsb(size_t n)
+{
+	if (n >= MEM_ERMS_MIN)
+		return cpu_has_feat(CPU_FEAT_X86_ERMS);
+	return cpu_has_feat(CPU_FEAT_X86_FSRM);
+}
+#endif
+
+void *
+memset(void *v, int c, size_t n)
+{
+#ifdef CONFIG_X86
+	if (n >= MEM_NT_THRESH)
+		return memset_nt(v, c, n);
+	if (n >= MEM_ERMS_MIN && cpu_has_feat(CPU_FEAT_X86_ERMS))
+		return memset_erms(v, c, n);
+#endif
+	return memset_generic(v, c, n);
+}
+
+void *
+memcpy(void* dst, const void* src, size_t n)
+{
+#ifdef CONFIG_X86
+	if (n >= MEM_NT_THRESH)
+		return memcpy_nt(dst, src, n);
+	if (use_rep_movsb(n))
+		return memcpy_erms(dst, src, n);
+#endif
+	return memcpy_generic(dst, src, n);
+}
+
 void *
 memmove(void *dst, const void *src, size_t _n)
 {
 #ifdef CONFIG_X86
+	if (dst + _n <= src || src + _n <= dst)
+		return memcpy(dst, src, _n);
 	bcopy(src, dst, _n);
 	return dst;
 #else
@@ -2371,6 +2371,7 @@ const struct sys_table_entry syscall_table[] = {
 	[SYS_halt_core] = {(syscall_t)sys_halt_core, "halt_core"},
 #ifdef CONFIG_ARSC_SERVER
 	[SYS_init_arsc] = {(syscall_t)sys_init_arsc, "init_arsc"},
+	[SYS_arsc_kick] = {(syscall_t)sys_arsc_kick, "arsc_kick"},
 #endif
 	[SYS_change_to_m] = {(syscall_t)sys_change_to_m, "change_to_m"},
 	[SYS_vmm_add_gpcs] = {(syscall_t)sys_vmm_add_gpcs, "vmm_add_gpcs"},
@@ -2466,11 +2467,31 @@ intreg_t syscall(struct proc *p, uintreg_t sc_num, uintreg_t a0, uintreg_t a1,
 	return ret;
 }
 
-/* Execute the syscall on the local core */
-void run_local_syscall(struct syscall *sysc)
+/* Syscalls that work on the calling core or its user context.  A remote
+ * syscall (e.g. from the arsc server) runs on a core the process isn't on, so
+ * these make no sense there. */
+static bool sysc_needs_core(unsigned int sc_num)
+{
+	switch (sc_num) {
+	case SYS_getvcoreid:
+	case SYS_proc_yield:
+	case SYS_change_vcore:
+	case SYS_fork:
+	case SYS_exec:
+	case SYS_halt_core:
+	case SYS_init_arsc:
+	case SYS_change_to_m:
+	case SYS_vc_entry:
+	case SYS_pop_ctx:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void __run_syscall(struct syscall *sysc, bool remote)
 {
 	struct per_cpu_info *pcpui = this_pcpui_ptr();
-	struct proc *p = pcpui->cur_proc;
 	long retval;
 
 	/* In lieu of pinning, we just check the sysc and will PF on the user addr
@@ -2485,6 +2506,11 @@ void run_local_syscall(struct syscall *sysc)
 	systrace_start_trace(pcpui->cur_kthread, sysc);
 	pcpui = this_pcpui_ptr();	/* reload again */
 	alloc_sysc_str(pcpui->cur_kthread);
+	if (remote && sysc_needs_core(sysc->num)) {
+		set_error(ENOTSUP, "Syscall %d can't run remotely", sysc->num);
+		finish_current_sysc(-1);
+		return;
+	}
 	/* syscall() does not return for exec and yield, so put any cleanup in there
 	 * too. */
 	retval = syscall(pcpui->cur_proc, sysc->num, sysc->arg0, sysc->arg1,
@@ -2492,6 +2518,21 @@ void run_local_syscall(struct syscall *sysc)
 	finish_current_sysc(retval);
 }
 
+/* Execute the syscall on the local core */
+void run_local_syscall(struct syscall *sysc)
+{
+	__run_syscall(sysc, FALSE);
+}
+
+/* Execute the syscall for current, from a core that current isn't running on.
+ * Current needs to be loaded with a counted ref, like for a normal syscall, so
+ * that the kthread can block.  Syscalls that need the caller's core or context
+ * fail with ENOTSUP. */
+void run_remote_syscall(struct syscall *sysc)
+{
+	__run_syscall(sysc, TRUE);
+}
+
 /* A process can trap and call this function, which will set up the core to
  * handle all the syscalls.  a.k.a. "sys_debutante(needs, wants)".  If there is
  * at least one, it will run it directly. */
@@ -146,8 +146,20 @@ uint32_t send_kernel_message(uint32_t dst, amr_t pc, long arg0, long arg1,
 	/* since we touched memory the other core will touch (the lock), we don't
 	 * need an wmb_f() */
 	/* if we're sending a routine message locally, we don't want/need an IPI */
-	if ((dst != k_msg->srcid) || (type == KMSG_IMMEDIATE))
+	if ((dst != k_msg->srcid) || (type == KMSG_IMMEDIATE)) {
+		/* An idle core watching kmsg_poll wakes when we clear it (see
+		 * cpu_halt_kmsg()).  Immediate messages still need the IPI, since
+		 * their handlers run from IRQ context.  The read keeps us from
+		 * locking the line of a core that isn't watching. */
+		if ((type == KMSG_ROUTINE) &&
+		    atomic_read(&per_cpu_info[dst].kmsg_poll) &&
+		    atomic_cas(&per_cpu_info[dst].kmsg_poll, 1, 0)) {
+			/* Counted on our core; dst's line is the one we just wrote. */
+			this_pcpui_var(nr_kmsg_poll_wakes)++;
+			return 0;
+		}
 		send_ipi(dst, I_KERNEL_MSG);
+	}
 	return 0;
 }
 
@@ -10,13 +10,42 @@
 #include <mm.h>
 #include <atomic.h>
 
+/* Most slots send_ucq_msgs() reserves with one fetch_and_add.  Every producer
+ * that races past the end of a page bumps the counter, and it only has 12 bits
+ * before it runs into the page address, so we can't grab too many at once. */
+#define UCQ_MAX_BATCH			16
+
+/* Writes msgs into nr consecutive good slots, starting at first_slot, and then
+ * marks them ready.  Returns FALSE on a bad user address. */
+static bool fill_slots(uintptr_t first_slot, struct event_msg *msgs,
+                       unsigned int nr)
+{
+	struct msg_container *my_msg;
+
+	/* Convert slot to actual msg_container.  Note we never actually deref
+	 * first_slot here (o/w we'd need a rw_addr check).  The slots are all on the
+	 * same page. */
+	my_msg = slot2msg(first_slot);
+	/* Make sure our msgs are user RW */
+	if (!is_user_rwaddr(my_msg, nr * sizeof(struct msg_container)))
+		return FALSE;
+	/* Finally write the messages */
+	for (int i = 0; i < nr; i++)
+		my_msg[i].ev_msg = msgs[i];
+	wmb();
+	/* Now that the writes are done, signal to the consumer that they can
+	 * consume our messages (they could have been spinning on them) */
+	for (int i = 0; i < nr; i++)
+		my_msg[i].ready = TRUE;
+	return TRUE;
+}
+
 /* Proc p needs to be current, and you should have checked that ucq is valid
  * memory.  We'll assert it here, to catch any of your bugs.  =) */
 void send_ucq_msg(struct ucq *ucq, struct proc *p, struct event_msg *msg)
 {
 	uintptr_t my_slot = 0;
 	struct ucq_page *new_page, *old_page;
-	struct msg_container *my_msg;
 
 	assert(is_user_rwaddr(ucq, sizeof(struct ucq)));
 	/* So we can try to send ucqs to _Ss before they initialize */
@@ -99,18 +128,8 @@ unlock_lock:
 have_slot:
 	/* Sanity check on our slot. */
 	assert(slot_is_good(my_slot));
-	/* Convert slot to actual msg_container.  Note we never actually deref
-	 * my_slot here (o/w we'd need a rw_addr check). */
-	my_msg = slot2msg(my_slot);
-	/* Make sure our msg is user RW */
-	if (!is_user_rwaddr(my_msg, sizeof(struct msg_container)))
+	if (!fill_slots(my_slot, msg, 1))
 		goto error_addr;
-	/* Finally write the message */
-	my_msg->ev_msg = *msg;
-	wmb();
-	/* Now that the write is done, signal to the consumer that they can consume
-	 * our message (they could have been spinning on it) */
-	my_msg->ready = TRUE;
 	return;
 error_addr_unlock:
 	/* Had a bad addr while holding the lock.  This is a bit more serious */
@@ -127,6 +146,53 @@ error_addr:
 	return;
 }
 
+/* Sends nr messages, in order, as if by nr calls to send_ucq_msg().  We
+ * reserve slots a batch at a time with a single fetch_and_add, and only fall
+ * back to one message at a time when we run off the end of the current page.
+ *
+ * Same rules as send_ucq_msg(): p is current and ucq was checked. */
+void send_ucq_msgs(struct ucq *ucq, struct proc *p, struct event_msg *msgs,
+                   unsigned int nr)
+{
+	uintptr_t my_slot;
+	unsigned int batch, nr_good;
+
+	assert(is_user_rwaddr(ucq, sizeof(struct ucq)));
+	if (!ucq->ucq_ready) {
+		send_ucq_msg(ucq, p, msgs);	/* for the warning */
+		return;
+	}
+	while (nr) {
+		/* send_ucq_msg() handles the overflow and getting a new page */
+		if (ucq->prod_overflow || nr == 1) {
+			send_ucq_msg(ucq, p, msgs);
+			msgs++;
+			nr--;
+			continue;
+		}
+		batch = MIN(nr, UCQ_MAX_BATCH);
+		my_slot = (uintptr_t)atomic_fetch_and_add(&ucq->prod_idx, batch);
+		if (slot_is_good(my_slot))
+			nr_good = MIN(batch, NR_MSG_PER_PAGE - PGOFF(my_slot));
+		else
+			nr_good = 0;
+		if (nr_good < batch) {
+			/* Some or all of our slots were past the end of the page.  Those
+			 * are lost, just like for a single producer.  Warn others to not
+			 * bother with the fetch_and_add. */
+			ucq->prod_overflow = TRUE;
+			if (PGOFF(my_slot) > 3000)
+				warn("Abnormally high counter, there's probably something wrong!");
+		}
+		if (nr_good && !fill_slots(my_slot, msgs, nr_good)) {
+			warn("Invalid user address, not sending a message");
+			return;
+		}
+		msgs += nr_good;
+		nr -= nr_good;
+	}
+}
+
 /* Debugging */
 #include <smp.h>
 #include <pmap.h>
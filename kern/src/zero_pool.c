@@ -0,0 +1,241 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Pools of pre-zeroed pages, one per NUMA node.
+ *
+ * Zeroing a page is most of the cost of a first-touch fault on anonymous
+ * memory.  upage_alloc() and kpage_zalloc_addr() take a page from the calling
+ * core's node's pool if there's one there, and only zero synchronously when the
+ * pool is empty.
+ *
+ * A ktask on the management core refills the pools, a batch at a time, yielding
+ * to other kernel messages between batches.  Allocations poke it once a pool
+ * drops below half full.  It clears pages with non-temporal stores, since no
+ * one will touch them until they're allocated.
+ *
+ * Under memory pressure, we stop refilling once a node falls below reclaim's
+ * high watermark, and the zero pool's shrinker hands the pools back to the
+ * arenas.
+ *
+ * Counters are in #vars.  Hits and misses are counted per core, so faults on
+ * different cores don't share a line, and the ktask adds them up when it runs.
+ * They lag a little. */
+
+#include <zero_pool.h>
+#include <page_alloc.h>
+#include <pmap.h>
+#include <kmalloc.h>
+#include <numa.h>
+#include <reclaim.h>
+#include <kthread.h>
+#include <rendez.h>
+#include <smp.h>
+#include <percpu.h>
+#include <trap.h>
+#include <ns.h>
+#include <string.h>
+#include <assert.h>
+
+#define ZERO_POOL_BATCH			32
+
+struct zero_pool {
+	spinlock_t					lock;
+	page_list_t					pages;
+	size_t						nr_pages;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+struct zero_pool_stats {
+	uint64_t					nr_hits;
+	uint64_t					nr_misses;
+};
+
+static struct zero_pool zero_pools[MAX_NUMA_NODES];
+static DEFINE_PERCPU(struct zero_pool_stats, zero_pool_stats);
+static struct rendez zero_pool_rv;
+static atomic_t zero_pool_poked;
+static bool zero_pool_ready;
+
+uint64_t zero_pool_nr_hits;
+uint64_t zero_pool_nr_misses;
+uint64_t zero_pool_nr_zeroed;
+uint64_t zero_pool_nr_shrunk;
+
+DEVVARS_ENTRY(zero_pool_nr_hits, "ug");
+DEVVARS_ENTRY(zero_pool_nr_misses, "ug");
+DEVVARS_ENTRY(zero_pool_nr_zeroed, "ug");
+DEVVARS_ENTRY(zero_pool_nr_shrunk, "ug");
+
+static void __zero_pool_wake(uint32_t srcid, long a0, long a1, long a2)
+{
+	rendez_wakeup(&zero_pool_rv);
+}
+
+/* Safe to call from any context.  The wakeup goes to the management core, so
+ * the ktask runs there and not on whichever core ran low. */
+static void zero_pool_poke(void)
+{
+	if (atomic_swap(&zero_pool_poked, 1))
+		return;
+	send_kernel_message(0, __zero_pool_wake, 0, 0, 0, KMSG_ROUTINE);
+}
+
+/* Returns a zeroed page from @node's pool, or NULL if it's empty. */
+struct page *zero_pool_get(int node)
+{
+	struct zero_pool *zp = &zero_pools[node];
+	struct page *pg;
+	bool low;
+
+	if (!zero_pool_ready)
+		return NULL;
+	/* Lockless peek: we'll miss occasionally, which is fine. */
+	if (!zp->nr_pages) {
+		PERCPU_VAR(zero_pool_stats).nr_misses++;
+		zero_pool_poke();
+		return NULL;
+	}
+	spin_lock_irqsave(&zp->lock);
+	pg = BSD_LIST_FIRST(&zp->pages);
+	if (pg) {
+		BSD_LIST_REMOVE(pg, pg_link);
+		zp->nr_pages--;
+	}
+	low = zp->nr_pages < CONFIG_ZERO_POOL_PGS / 2;
+	spin_unlock_irqsave(&zp->lock);
+	if (low)
+		zero_pool_poke();
+	if (!pg) {
+		PERCPU_VAR(zero_pool_stats).nr_misses++;
+		return NULL;
+	}
+	PERCPU_VAR(zero_pool_stats).nr_hits++;
+	return pg;
+}
+
+static void zero_pool_clear(void *kva)
+{
+#ifdef CONFIG_X86
+	memset_nt(kva, 0, PGSIZE);
+#else
+	memset(kva, 0, PGSIZE);
+#endif
+}
+
+/* Tops off @node's pool, ZERO_POOL_BATCH pages at a time. */
+static void zero_pool_fill(int node)
+{
+	struct zero_pool *zp = &zero_pools[node];
+	struct page *batch[ZERO_POOL_BATCH];
+	size_t nr_wanted;
+	void *kva;
+	int nr;
+
+	while (zp->nr_pages < CONFIG_ZERO_POOL_PGS) {
+		if (reclaim_node_low(node))
+			return;
+		nr_wanted = MIN(CONFIG_ZERO_POOL_PGS - zp->nr_pages, ZERO_POOL_BATCH);
+		for (nr = 0; nr < nr_wanted; nr++) {
+			kva = kpages_alloc_node(PGSIZE, MEM_ATOMIC, node);
+			if (!kva)
+				break;
+			/* The arena fell back to another node.  Those pages would
+			 * only be remote memory for the faulting core. */
+			if (numa_node_of_addr(kva) != node) {
+				kpages_free(kva, PGSIZE);
+				break;
+			}
+			zero_pool_clear(kva);
+			batch[nr] = kva2page(kva);
+		}
+		spin_lock_irqsave(&zp->lock);
+		for (int i = 0; i < nr; i++)
+			BSD_LIST_INSERT_HEAD(&zp->pages, batch[i], pg_link);
+		zp->nr_pages += nr;
+		spin_unlock_irqsave(&zp->lock);
+		zero_pool_nr_zeroed += nr;
+		if (nr < nr_wanted)
+			return;
+		/* Let the kmsgs that arrived in the meantime run */
+		kthread_yield();
+	}
+}
+
+static int zero_pool_was_poked(void *arg)
+{
+	return atomic_read(&zero_pool_poked);
+}
+
+/* Sums the per-core hit and miss counts into the #vars counters. */
+static void zero_pool_sum_stats(void)
+{
+	struct zero_pool_stats *zps;
+	uint64_t hits = 0, misses = 0;
+
+	for_each_core(i) {
+		zps = _PERCPU_VARPTR(zero_pool_stats, i);
+		hits += READ_ONCE(zps->nr_hits);
+		misses += READ_ONCE(zps->nr_misses);
+	}
+	zero_pool_nr_hits = hits;
+	zero_pool_nr_misses = misses;
+}
+
+static void zero_pool_ktask(void *arg)
+{
+	for (;;) {
+		rendez_sleep(&zero_pool_rv, zero_pool_was_poked, NULL);
+		atomic_set(&zero_pool_poked, 0);
+		zero_pool_sum_stats();
+		for (int i = 0; i < nr_numa_nodes; i++)
+			zero_pool_fill(i);
+	}
+}
+
+/* Gives every pool back to the arenas.  They'll refill once there's memory. */
+static size_t zero_pool_shrink(struct shrinker *s, size_t nr_wanted)
+{
+	struct zero_pool *zp;
+	struct page *pg;
+	size_t nr_freed = 0;
+
+	for (int i = 0; i < nr_numa_nodes; i++) {
+		zp = &zero_pools[i];
+		for (;;) {
+			spin_lock_irqsave(&zp->lock);
+			pg = BSD_LIST_FIRST(&zp->pages);
+			if (pg) {
+				BSD_LIST_REMOVE(pg, pg_link);
+				zp->nr_pages--;
+			}
+			spin_unlock_irqsave(&zp->lock);
+			if (!pg)
+				break;
+			kpages_free(page2kva(pg), PGSIZE);
+			nr_freed++;
+		}
+	}
+	zero_pool_nr_shrunk += nr_freed;
+	return nr_freed;
+}
+
+static struct shrinker zero_pool_shrinker = {
+	.name = "zero_pool",
+	.shrink = zero_pool_shrink,
+};
+
+void zero_pool_init(void)
+{
+	if (!CONFIG_ZERO_POOL_PGS)
+		return;
+	for (int i = 0; i < MAX_NUMA_NODES; i++) {
+		spinlock_init_irqsave(&zero_pools[i].lock);
+		BSD_LIST_INIT(&zero_pools[i].pages);
+		zero_pools[i].nr_pages = 0;
+	}
+	rendez_init(&zero_pool_rv);
+	/* Start poked, so the ktask fills the pools right away */
+	atomic_init(&zero_pool_poked, 1);
+	register_shrinker(&zero_pool_shrinker);
+	ktask("zero_pool", zero_pool_ktask, NULL);
+	zero_pool_ready = TRUE;
+}
@@ -0,0 +1,184 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * TCP connection accept rate benchmark, with N acceptor threads.
+ *
+ * accept_rate [-a ACCEPTORS] [-c CONNECTORS] [-p PORT] [-t SECS] [-r]
+ *
+ * Connectors connect to localhost and close, as fast as they can.  By default,
+ * all acceptors share one listening socket.  With -r, each acceptor has its own
+ * SO_REUSEPORT listener on the same port, so the kernel spreads the incoming
+ * connections across their accept queues. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <parlib/parlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_THREADS		64
+
+struct acceptor {
+	pthread_t					thread;
+	int							sock;
+	unsigned long				nr_accepts;
+};
+
+static struct acceptor acceptors[MAX_THREADS];
+static pthread_t connectors[MAX_THREADS];
+static int nr_acceptors = 4;
+static int nr_connectors = 4;
+static int port = 5000;
+static int duration = 10;
+static bool reuseport;
+static volatile int done;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-a ACCEPTORS] [-c CONNECTORS] [-p PORT] "
+	        "[-t SECS] [-r]\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int listen_socket(void)
+{
+	struct sockaddr_in sa = {0};
+	int sock, one = 1;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		exit(-1);
+	}
+	if (reuseport &&
+	    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+		perror("setsockopt SO_REUSEPORT");
+		exit(-1);
+	}
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr*)&sa, sizeof(sa))) {
+		perror("bind");
+		exit(-1);
+	}
+	if (listen(sock, SOMAXCONN)) {
+		perror("listen");
+		exit(-1);
+	}
+	return sock;
+}
+
+static void *acceptor_loop(void *arg)
+{
+	struct acceptor *a = arg;
+	int fd;
+
+	while (!done) {
+		fd = accept(a->sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		close(fd);
+		a->nr_accepts++;
+	}
+	return NULL;
+}
+
+static void *connector_loop(void *arg)
+{
+	struct sockaddr_in sa = {0};
+	int sock;
+
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port);
+	while (!done) {
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock < 0) {
+			perror("socket");
+			break;
+		}
+		if (connect(sock, (struct sockaddr*)&sa, sizeof(sa)) && !done)
+			perror("connect");
+		close(sock);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total = 0;
+	double start, elapsed;
+	int opt, shared_sock = -1;
+
+	while ((opt = getopt(argc, argv, "a:c:p:t:r")) != -1) {
+		switch (opt) {
+		case 'a':
+			nr_acceptors = atoi(optarg);
+			break;
+		case 'c':
+			nr_connectors = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'r':
+			reuseport = TRUE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_acceptors < 1 || nr_acceptors > MAX_THREADS ||
+	    nr_connectors < 1 || nr_connectors > MAX_THREADS) {
+		fprintf(stderr, "thread counts must be between 1 and %d\n",
+		        MAX_THREADS);
+		exit(-1);
+	}
+	if (!reuseport)
+		shared_sock = listen_socket();
+	for (int i = 0; i < nr_acceptors; i++) {
+		acceptors[i].sock = reuseport ? listen_socket() : shared_sock;
+		pthread_create(&acceptors[i].thread, NULL, acceptor_loop,
+		               &acceptors[i]);
+	}
+	start = now_secs();
+	for (int i = 0; i < nr_connectors; i++)
+		pthread_create(&connectors[i], NULL, connector_loop, NULL);
+	sleep(duration);
+	done = TRUE;
+	elapsed = now_secs() - start;
+	for (int i = 0; i < nr_connectors; i++)
+		pthread_join(connectors[i], NULL);
+	/* Acceptors might be blocked in accept; don't wait for them. */
+	for (int i = 0; i < nr_acceptors; i++) {
+		printf("acceptor %2d: %lu accepts\n", i, acceptors[i].nr_accepts);
+		total += acceptors[i].nr_accepts;
+	}
+	printf("%s: %lu accepts in %.2f sec, %.0f per sec\n",
+	       reuseport ? "reuseport listeners" : "shared listener", total,
+	       elapsed, total / elapsed);
+	return 0;
+}
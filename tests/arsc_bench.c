@@ -0,0 +1,134 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Syscall throughput: trapping vs. asynchronous remote syscalls (arsc).
+ *
+ * Usage: arsc_bench [-n CALLS] [-b BATCH] [-u USEC]
+ *
+ * Runs CALLS SYS_nulls with normal traps, then through the arsc ring, keeping
+ * up to BATCH in flight and submitting them BATCH at a time, and prints ns per
+ * call for both.  With -u, the arsc run uses SYS_block for USEC instead, which
+ * shows whether blocked syscalls hold up the ring.
+ *
+ * Needs a kernel with CONFIG_ARSC_SERVER. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <parlib/parlib.h>
+#include <parlib/arc.h>
+
+static unsigned long nr_calls = 1000000;
+static unsigned int batch = 32;
+static unsigned long block_usec;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-n CALLS] [-b BATCH] [-u USEC]\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run_trap(void)
+{
+	double start = now_secs();
+
+	for (unsigned long i = 0; i < nr_calls; i++)
+		sys_null();
+	return now_secs() - start;
+}
+
+static void prep_sysc(struct syscall *sysc)
+{
+	sysc->num = block_usec ? SYS_block : SYS_null;
+	sysc->arg0 = block_usec;
+}
+
+static double run_arsc(void)
+{
+	struct syscall *syscs = calloc(batch, sizeof(struct syscall));
+	struct syscall **free_syscs = calloc(batch, sizeof(struct syscall*));
+	struct syscall **done = calloc(batch, sizeof(struct syscall*));
+	unsigned long submitted = 0, reaped = 0, nr_errs = 0;
+	unsigned int nr_free = batch, nr_done, nr_sub, todo;
+	double start;
+
+	if (!syscs || !free_syscs || !done) {
+		perror("calloc");
+		exit(-1);
+	}
+	for (int i = 0; i < batch; i++)
+		free_syscs[i] = &syscs[i];
+	start = now_secs();
+	while (reaped < nr_calls) {
+		todo = MIN(nr_free, nr_calls - submitted);
+		if (todo) {
+			for (int i = 0; i < todo; i++)
+				prep_sysc(free_syscs[nr_free - todo + i]);
+			nr_sub = arsc_submit(SYS_CHANNEL,
+			                     &free_syscs[nr_free - todo], todo);
+			/* Whatever didn't fit stays at the front of free_syscs */
+			for (int i = 0; i < todo - nr_sub; i++)
+				free_syscs[nr_free - todo + i] =
+					free_syscs[nr_free - todo + nr_sub + i];
+			nr_free -= nr_sub;
+			submitted += nr_sub;
+		}
+		nr_done = arsc_reap_wait(SYS_CHANNEL, done, batch);
+		for (int i = 0; i < nr_done; i++) {
+			if (done[i]->retval < 0)
+				nr_errs++;
+			free_syscs[nr_free++] = done[i];
+		}
+		reaped += nr_done;
+	}
+	if (nr_errs)
+		printf("%lu arsc syscalls failed\n", nr_errs);
+	free(syscs);
+	free(free_syscs);
+	free(done);
+	return now_secs() - start;
+}
+
+int main(int argc, char **argv)
+{
+	double trap_secs, arsc_secs;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:u:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_calls = strtoul(optarg, 0, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, 0, 0);
+			break;
+		case 'u':
+			block_usec = strtoul(optarg, 0, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_calls || !batch)
+		usage(argv[0]);
+	if (arsc_channel_init(SYS_CHANNEL)) {
+		perror("arsc_channel_init");
+		exit(-1);
+	}
+	trap_secs = run_trap();
+	arsc_secs = run_arsc();
+	printf("%lu calls, batch %u%s\n", nr_calls, batch,
+	       block_usec ? " (arsc: SYS_block)" : "");
+	printf("trap: %8.1f ns/call\n", trap_secs * 1e9 / nr_calls);
+	printf("arsc: %8.1f ns/call\n", arsc_secs * 1e9 / nr_calls);
+	return 0;
+}
@@ -0,0 +1,133 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Parallel first-touch benchmark, for concurrent page faults.
+ *
+ * Usage: first_touch [-t THREADS] [-m MB] [-n LOOPS] [-s USEC]
+ *
+ * Runs as an MCP with one vcore per thread.  Each loop, it mmaps a fresh
+ * anonymous region of MB megabytes, and every thread writes one word to each
+ * page of its slice of the region, so every write is a page fault.  Prints the
+ * faults per second across all threads.  Run it with -t 1 for the baseline.
+ *
+ * With -s, it sleeps USEC between loops, outside the timed section, which gives
+ * the kernel's zero pool time to refill.  Use an MB no bigger than the pool
+ * (CONFIG_ZERO_POOL_PGS per node) to see faults served from it, and compare
+ * with the zero_pool_nr_* counters in #vars. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <parlib/parlib.h>
+
+static int nr_threads = 4;
+static size_t nr_mb = 256;
+static int nr_loops = 10;
+static unsigned long pause_usec;
+
+static pthread_barrier_t barrier;
+static char *region;
+static size_t slice_pgs;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-t THREADS] [-m MB] [-n LOOPS] [-s USEC]\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *touch_thread(void *arg)
+{
+	long id = (long)arg;
+	char *slice;
+
+	for (int l = 0; l < nr_loops; l++) {
+		/* Main mmaps the region, then we all go */
+		pthread_barrier_wait(&barrier);
+		slice = region + id * slice_pgs * PGSIZE;
+		for (size_t i = 0; i < slice_pgs; i++)
+			slice[i * PGSIZE] = 1;
+		pthread_barrier_wait(&barrier);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *threads;
+	size_t len;
+	double start, elapsed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:m:n:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'm':
+			nr_mb = atol(optarg);
+			break;
+		case 'n':
+			nr_loops = atoi(optarg);
+			break;
+		case 's':
+			pause_usec = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_threads < 1 || nr_threads > (int)max_vcores() || !nr_mb ||
+	    nr_loops < 1)
+		usage(argv[0]);
+	slice_pgs = (nr_mb << 20) / PGSIZE / nr_threads;
+	len = slice_pgs * nr_threads * PGSIZE;
+	threads = malloc(sizeof(pthread_t) * nr_threads);
+	if (!threads) {
+		perror("malloc");
+		exit(-1);
+	}
+
+	parlib_never_yield = TRUE;
+	pthread_mcp_init();
+	vcore_request_total(nr_threads);
+	parlib_never_vc_request = TRUE;
+
+	/* Main and the threads sync twice per loop */
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (long i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, touch_thread, (void*)i);
+	for (int l = 0; l < nr_loops; l++) {
+		region = mmap(0, len, PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) {
+			perror("mmap");
+			exit(-1);
+		}
+		start = now_secs();
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		elapsed += now_secs() - start;
+		munmap(region, len);
+		if (pause_usec)
+			usleep(pause_usec);
+	}
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&barrier);
+
+	printf("%d threads, %lu faults in %.3f sec, %.0f faults/sec\n", nr_threads,
+	       slice_pgs * nr_threads * nr_loops, elapsed,
+	       slice_pgs * nr_threads * nr_loops / elapsed);
+	return 0;
+}
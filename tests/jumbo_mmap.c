@@ -0,0 +1,179 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Random access latency benchmark for large shared file mappings, for jumbo
+ * pages in the page cache.
+ *
+ * Usage: jumbo_mmap [-s MB] [-n STEPS] FILE
+ *
+ * Sizes FILE to MB megabytes (default 4096), maps it MAP_SHARED twice and
+ * chases pointers through a random cycle of all of its pages, STEPS times.
+ * Each step is a dependent load from a random page, so the time per step is
+ * dominated by TLB and cache misses.
+ *
+ * The first mapping lets the kernel pick the address, which lines up with the
+ * file's jumbo pages.  The second is MAP_FIXED at an address 4K off a jumbo
+ * boundary, so the same pages can only be mapped with 4K PTEs.  FILE should be
+ * on #tmpfs, and MB should be at least CONFIG_TMPFS_JUMBO_THRESH. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <parlib/parlib.h>
+
+#define PGSIZE			4096UL
+#define JUMBO_PGSIZE	(2UL * 1024 * 1024)
+
+static size_t nr_mb = 4096;
+static unsigned long nr_steps = 10000000;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-s MB] [-n STEPS] FILE\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/* Each page's link lives at a different offset, so the chase doesn't hammer a
+ * single cache set. */
+static uint64_t *page_link(char *base, size_t pg)
+{
+	return (uint64_t*)(base + pg * PGSIZE + (pg * 64) % PGSIZE);
+}
+
+/* Writes a single random cycle through all of the pages (Sattolo's shuffle),
+ * which also faults in the whole file. */
+static void build_cycle(char *base, size_t nr_pgs)
+{
+	uint32_t *perm = malloc(nr_pgs * sizeof(uint32_t));
+	uint64_t seed = 0x9e3779b97f4a7c15;
+	size_t j;
+
+	if (!perm) {
+		perror("malloc");
+		exit(-1);
+	}
+	for (size_t i = 0; i < nr_pgs; i++)
+		perm[i] = i;
+	for (size_t i = nr_pgs - 1; i > 0; i--) {
+		j = xorshift(&seed) % i;
+		uint32_t tmp = perm[i];
+
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for (size_t i = 0; i < nr_pgs; i++)
+		*page_link(base, perm[i]) = perm[(i + 1) % nr_pgs];
+	free(perm);
+}
+
+static double chase(char *base, unsigned long steps)
+{
+	volatile uint64_t pg = 0;
+	double start = now_secs();
+
+	for (unsigned long i = 0; i < steps; i++)
+		pg = *page_link(base, pg);
+	return now_secs() - start;
+}
+
+static void run(const char *name, char *base, size_t nr_pgs)
+{
+	double first, elapsed;
+
+	/* The first pass faults in whatever the previous run didn't need */
+	first = chase(base, nr_pgs);
+	elapsed = chase(base, nr_steps);
+	printf("%-6s first pass %.3f sec, %.1f ns per random access\n", name,
+	       first, elapsed * 1e9 / nr_steps);
+}
+
+int main(int argc, char **argv)
+{
+	size_t len, nr_pgs;
+	char *jumbo, *small, *resv;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			nr_mb = atol(optarg);
+			break;
+		case 'n':
+			nr_steps = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (!nr_mb || !nr_steps)
+		usage(argv[0]);
+	len = nr_mb << 20;
+	nr_pgs = len / PGSIZE;
+
+	fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(argv[optind]);
+		exit(-1);
+	}
+	if (ftruncate(fd, len)) {
+		perror("ftruncate");
+		exit(-1);
+	}
+	jumbo = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (jumbo == MAP_FAILED) {
+		perror("mmap");
+		exit(-1);
+	}
+	build_cycle(jumbo, nr_pgs);
+	run("jumbo", jumbo, nr_pgs);
+
+	/* Reserve some space, then put the second mapping 4K past a jumbo
+	 * boundary inside it. */
+	resv = mmap(0, len + 2 * JUMBO_PGSIZE, PROT_NONE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (resv == MAP_FAILED) {
+		perror("mmap reserve");
+		exit(-1);
+	}
+	small = (char*)(((uintptr_t)resv + JUMBO_PGSIZE - 1) & ~(JUMBO_PGSIZE - 1))
+	        + PGSIZE;
+	small = mmap(small, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	             fd, 0);
+	if (small == MAP_FAILED) {
+		perror("mmap fixed");
+		exit(-1);
+	}
+	run("4k", small, nr_pgs);
+
+	munmap(jumbo, len);
+	munmap(resv, len + 2 * JUMBO_PGSIZE);
+	close(fd);
+	unlink(argv[optind]);
+	return 0;
+}
@@ -0,0 +1,211 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Multi-flow UDP receive benchmark, for measuring receive packet steering.
+ *
+ * Server: multiflow -s [-n NR_FLOWS] [-p BASE_PORT] [-t SECS]
+ * Client: multiflow -c HOST [-n NR_FLOWS] [-p BASE_PORT] [-t SECS] [-l LEN]
+ *
+ * Each flow is a UDP socket on its own port, serviced by its own thread.  The
+ * server counts what arrives on each flow and prints the per-flow and total
+ * throughput.  Run the server once with RPS off and once with it on, e.g.:
+ *
+ * 		echo rps 1 2 3 4 > /net/ipifc/0/ctl
+ * 		echo rfs on > /net/ipifc/0/ctl
+ *
+ * and compare.  /net/ipifc/stats shows how many packets each core got. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <parlib/parlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#define MAX_FLOWS		64
+#define MAX_PKT			9000
+
+struct flow {
+	pthread_t					thread;
+	int							sock;
+	int							port;
+	unsigned long				nr_pkts;
+	unsigned long				nr_bytes;
+};
+
+static struct flow flows[MAX_FLOWS];
+static int nr_flows = 4;
+static int base_port = 5000;
+static int duration = 10;
+static int pkt_len = 1400;
+static struct sockaddr_in server_addr;
+static volatile int done;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s -s|-c HOST [-n FLOWS] [-p PORT] [-t SECS] "
+	        "[-l LEN]\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *server_flow(void *arg)
+{
+	struct flow *fl = arg;
+	char buf[MAX_PKT];
+	ssize_t ret;
+
+	while (!done) {
+		ret = recv(fl->sock, buf, sizeof(buf), 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recv");
+			break;
+		}
+		fl->nr_pkts++;
+		fl->nr_bytes += ret;
+	}
+	return NULL;
+}
+
+static void *client_flow(void *arg)
+{
+	struct flow *fl = arg;
+	char buf[MAX_PKT];
+
+	memset(buf, 0xa5, pkt_len);
+	while (!done) {
+		if (send(fl->sock, buf, pkt_len, 0) < 0) {
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			perror("send");
+			break;
+		}
+		fl->nr_pkts++;
+		fl->nr_bytes += pkt_len;
+	}
+	return NULL;
+}
+
+static int flow_socket(struct flow *fl, bool server)
+{
+	struct sockaddr_in sa = {0};
+
+	fl->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fl->sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (server) {
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(INADDR_ANY);
+		sa.sin_port = htons(fl->port);
+		if (bind(fl->sock, (struct sockaddr*)&sa, sizeof(sa))) {
+			perror("bind");
+			return -1;
+		}
+	} else {
+		sa = server_addr;
+		sa.sin_port = htons(fl->port);
+		if (connect(fl->sock, (struct sockaddr*)&sa, sizeof(sa))) {
+			perror("connect");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bool server = FALSE;
+	char *host = NULL;
+	struct hostent *he;
+	unsigned long tot_pkts = 0, tot_bytes = 0;
+	double start, elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sc:n:p:t:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			server = TRUE;
+			break;
+		case 'c':
+			host = optarg;
+			break;
+		case 'n':
+			nr_flows = atoi(optarg);
+			break;
+		case 'p':
+			base_port = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			pkt_len = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (server == !!host)
+		usage(argv[0]);
+	if (nr_flows < 1 || nr_flows > MAX_FLOWS) {
+		fprintf(stderr, "flows must be between 1 and %d\n", MAX_FLOWS);
+		exit(-1);
+	}
+	if (pkt_len < 1 || pkt_len > MAX_PKT) {
+		fprintf(stderr, "len must be between 1 and %d\n", MAX_PKT);
+		exit(-1);
+	}
+	if (host) {
+		he = gethostbyname(host);
+		if (!he) {
+			fprintf(stderr, "can't resolve %s\n", host);
+			exit(-1);
+		}
+		server_addr.sin_family = AF_INET;
+		memcpy(&server_addr.sin_addr, he->h_addr, sizeof(struct in_addr));
+	}
+	for (int i = 0; i < nr_flows; i++) {
+		flows[i].port = base_port + i;
+		if (flow_socket(&flows[i], server))
+			exit(-1);
+	}
+	start = now_secs();
+	for (int i = 0; i < nr_flows; i++)
+		pthread_create(&flows[i].thread, NULL,
+		               server ? server_flow : client_flow, &flows[i]);
+	sleep(duration);
+	done = TRUE;
+	elapsed = now_secs() - start;
+	/* Server threads may be blocked in recv; don't wait for them. */
+	if (!server) {
+		for (int i = 0; i < nr_flows; i++)
+			pthread_join(flows[i].thread, NULL);
+	}
+	for (int i = 0; i < nr_flows; i++) {
+		printf("flow %2d (port %d): %lu pkts, %.2f Mbps\n", i, flows[i].port,
+		       flows[i].nr_pkts, flows[i].nr_bytes * 8 / elapsed / 1e6);
+		tot_pkts += flows[i].nr_pkts;
+		tot_bytes += flows[i].nr_bytes;
+	}
+	printf("total: %lu pkts in %.2f sec, %.0f pps, %.2f Mbps\n", tot_pkts,
+	       elapsed, tot_pkts / elapsed, tot_bytes * 8 / elapsed / 1e6);
+	return 0;
+}
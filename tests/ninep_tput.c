@@ -0,0 +1,457 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * 9p throughput benchmark, for devmnt's pipelined reads and writes.
+ *
+ * Usage: ninep_tput [-b BLKSZ] [-s MB] [-d USEC] [-n PASSES] [-w] [MNTPT]
+ *
+ * Serves a synthetic file "data" of MB megabytes from a 9p server on a pipe,
+ * mounts it on MNTPT (default /mnt), and reads (or with -w, writes) the file in
+ * BLKSZ chunks, PASSES times.  The server handles each request in its own
+ * thread, sleeping USEC microseconds first to emulate a round trip.
+ *
+ * With a delay, throughput is bounded by how many RPCs devmnt keeps in flight,
+ * i.e. CONFIG_MNT_MAX_INFLIGHT, and their size, the negotiated msize.  Reads
+ * bypass the page cache, since this is a mount of a plain 9p server. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcall.h>
+#include <ndblib/fcallfmt.h>
+#include <parlib/parlib.h>
+#include <ros/syscall.h>
+
+#define DMDIR			0x80000000	/* mode bit for directories */
+#define QTDIR			0x80
+#define QTFILE			0x00
+
+#define SRV_MSIZE		(1024 * 1024)
+#define MAX_BLKSZ		(64 * 1024 * 1024)
+
+enum {
+	Qdir,
+	Qdata,
+};
+
+struct fid {
+	struct fid *next;
+	uint32_t fid;
+	int qpath;
+};
+
+struct job {
+	struct fcall req;
+	struct fcall rep;
+	uint8_t *buf;
+};
+
+static size_t blksz = 1024 * 1024;
+static size_t file_mb = 256;
+static unsigned long delay_usec;
+static int nr_passes = 3;
+static bool do_write;
+
+static int srv_fd;
+static pthread_mutex_t srv_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fid *fids;
+static uint64_t nr_rpcs;
+
+static void usage(char *prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-b BLKSZ] [-s MB] [-d USEC] [-n PASSES] [-w] [MNTPT]\n",
+	        prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t file_len(void)
+{
+	return file_mb << 20;
+}
+
+/* Returns the qid path of fid, or -1.  Hold srv_lock. */
+static int fid_lookup(uint32_t fid)
+{
+	for (struct fid *f = fids; f; f = f->next) {
+		if (f->fid == fid)
+			return f->qpath;
+	}
+	return -1;
+}
+
+/* Hold srv_lock. */
+static void fid_set(uint32_t fid, int qpath)
+{
+	struct fid *f;
+
+	for (f = fids; f; f = f->next) {
+		if (f->fid == fid) {
+			f->qpath = qpath;
+			return;
+		}
+	}
+	f = malloc(sizeof(struct fid));
+	if (!f) {
+		perror("malloc");
+		exit(-1);
+	}
+	f->fid = fid;
+	f->qpath = qpath;
+	f->next = fids;
+	fids = f;
+}
+
+/* Hold srv_lock. */
+static void fid_clunk(uint32_t fid)
+{
+	for (struct fid **pp = &fids; *pp; pp = &(*pp)->next) {
+		if ((*pp)->fid == fid) {
+			struct fid *f = *pp;
+
+			*pp = f->next;
+			free(f);
+			return;
+		}
+	}
+}
+
+static struct qid mkqid(int qpath)
+{
+	struct qid q = {0};
+
+	q.path = qpath;
+	q.type = qpath == Qdir ? QTDIR : QTFILE;
+	return q;
+}
+
+static unsigned int mkstat(int qpath, uint8_t *buf, unsigned int len)
+{
+	struct dir d;
+
+	memset(&d, 0, sizeof(d));
+	d.name = qpath == Qdir ? "." : "data";
+	d.qid = mkqid(qpath);
+	d.mode = qpath == Qdir ? DMDIR | 0555 : 0666;
+	d.length = qpath == Qdir ? 0 : file_len();
+	d.uid = d.gid = d.muid = "bench";
+	return convD2M(&d, buf, len);
+}
+
+static void send_reply(struct job *job, char *err)
+{
+	unsigned int n;
+
+	if (err) {
+		job->rep.type = Rerror;
+		job->rep.ename = err;
+	} else {
+		job->rep.type = job->req.type + 1;
+	}
+	job->rep.tag = job->req.tag;
+	n = convS2M(&job->rep, job->buf, SRV_MSIZE);
+	if (!n) {
+		fprintf(stderr, "convS2M failed for type %d\n", job->rep.type);
+		exit(-1);
+	}
+	pthread_mutex_lock(&srv_lock);
+	if (write(srv_fd, job->buf, n) != n) {
+		perror("server write");
+		exit(-1);
+	}
+	pthread_mutex_unlock(&srv_lock);
+}
+
+static void srv_read(struct job *job, int qpath)
+{
+	uint64_t off = job->req.offset;
+	uint32_t cnt = job->req.count;
+	uint8_t *data;
+
+	/* The reply is built in job->buf, so the data needs its own buffer. */
+	data = malloc(cnt + 1);
+	if (!data) {
+		perror("malloc");
+		exit(-1);
+	}
+	if (qpath == Qdir) {
+		cnt = off ? 0 : mkstat(Qdata, data, cnt);
+	} else {
+		cnt = off >= file_len() ? 0 : MIN(cnt, file_len() - off);
+		for (uint32_t i = 0; i < cnt; i++)
+			data[i] = off + i;
+	}
+	job->rep.data = (char*)data;
+	job->rep.count = cnt;
+	send_reply(job, NULL);
+	free(data);
+}
+
+static void *srv_job(void *arg)
+{
+	struct job *job = arg;
+	uint8_t stat[256];
+	int qpath;
+
+	if (delay_usec)
+		usleep(delay_usec);
+	pthread_mutex_lock(&srv_lock);
+	nr_rpcs++;
+	qpath = fid_lookup(job->req.fid);
+	switch (job->req.type) {
+	case Tattach:
+		fid_set(job->req.fid, Qdir);
+		qpath = Qdir;
+		break;
+	case Twalk:
+		if (qpath < 0)
+			break;
+		if (job->req.nwname == 0) {
+			fid_set(job->req.newfid, qpath);
+		} else if (job->req.nwname == 1 && qpath == Qdir &&
+		           !strcmp(job->req.wname[0], "data")) {
+			fid_set(job->req.newfid, Qdata);
+			qpath = Qdata;
+		} else {
+			qpath = -2;
+		}
+		break;
+	case Tclunk:
+	case Tremove:
+		fid_clunk(job->req.fid);
+		break;
+	}
+	pthread_mutex_unlock(&srv_lock);
+
+	switch (job->req.type) {
+	case Tversion:
+		job->rep.msize = MIN(job->req.msize, SRV_MSIZE);
+		job->rep.version = "9P2000";
+		send_reply(job, NULL);
+		break;
+	case Tflush:
+		send_reply(job, NULL);
+		break;
+	case Tattach:
+		job->rep.qid = mkqid(Qdir);
+		send_reply(job, NULL);
+		break;
+	case Twalk:
+		if (qpath == -1) {
+			send_reply(job, "unknown fid");
+			break;
+		}
+		if (qpath == -2) {
+			send_reply(job, "file does not exist");
+			break;
+		}
+		job->rep.nwqid = job->req.nwname;
+		if (job->rep.nwqid)
+			job->rep.wqid[0] = mkqid(qpath);
+		send_reply(job, NULL);
+		break;
+	case Topen:
+		if (qpath < 0) {
+			send_reply(job, "unknown fid");
+			break;
+		}
+		job->rep.qid = mkqid(qpath);
+		job->rep.iounit = 0;
+		send_reply(job, NULL);
+		break;
+	case Tread:
+		if (qpath < 0) {
+			send_reply(job, "unknown fid");
+			break;
+		}
+		srv_read(job, qpath);
+		break;
+	case Twrite:
+		if (qpath != Qdata) {
+			send_reply(job, "permission denied");
+			break;
+		}
+		job->rep.count = job->req.count;
+		send_reply(job, NULL);
+		break;
+	case Tstat:
+		if (qpath < 0) {
+			send_reply(job, "unknown fid");
+			break;
+		}
+		job->rep.nstat = mkstat(qpath, stat, sizeof(stat));
+		job->rep.stat = stat;
+		send_reply(job, NULL);
+		break;
+	case Tclunk:
+		send_reply(job, NULL);
+		break;
+	case Twstat:
+		/* O_TRUNC and friends.  The file's contents are synthetic. */
+		send_reply(job, NULL);
+		break;
+	default:
+		send_reply(job, "not supported");
+		break;
+	}
+	free(job->buf);
+	free(job);
+	return NULL;
+}
+
+static void *srv_loop(void *arg)
+{
+	uint8_t *mdata = malloc(SRV_MSIZE);
+	struct job *job;
+	pthread_t thr;
+	int n;
+
+	if (!mdata) {
+		perror("malloc");
+		exit(-1);
+	}
+	for (;;) {
+		n = read9pmsg(srv_fd, mdata, SRV_MSIZE);
+		if (n <= 0)
+			break;
+		job = calloc(1, sizeof(struct job));
+		if (!job) {
+			perror("calloc");
+			exit(-1);
+		}
+		job->buf = malloc(SRV_MSIZE);
+		if (!job->buf) {
+			perror("malloc");
+			exit(-1);
+		}
+		/* The request's strings and data point into buf. */
+		memcpy(job->buf, mdata, n);
+		if (convM2S(job->buf, n, &job->req) != n) {
+			fprintf(stderr, "bad 9p message\n");
+			exit(-1);
+		}
+		/* Twrite's data points into buf, which the reply reuses.  We don't
+		 * look at the data, so that's OK. */
+		if (pthread_create(&thr, NULL, srv_job, job)) {
+			perror("pthread_create");
+			exit(-1);
+		}
+		pthread_detach(thr);
+	}
+	free(mdata);
+	return NULL;
+}
+
+static void run_pass(const char *path, char *buf, int pass)
+{
+	size_t total = 0, left = file_len();
+	uint64_t rpcs_before = nr_rpcs;
+	ssize_t ret;
+	double start, elapsed;
+	int fd;
+
+	fd = open(path, do_write ? O_WRONLY : O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(-1);
+	}
+	start = now_secs();
+	while (left) {
+		if (do_write)
+			ret = write(fd, buf, MIN(left, blksz));
+		else
+			ret = read(fd, buf, MIN(left, blksz));
+		if (ret < 0) {
+			perror(do_write ? "write" : "read");
+			exit(-1);
+		}
+		if (!ret)
+			break;
+		total += ret;
+		left -= ret;
+	}
+	elapsed = now_secs() - start;
+	close(fd);
+	printf("pass %d: %s %lu bytes in %.3f sec, %.2f MB/s, %lu rpcs\n", pass,
+	       do_write ? "wrote" : "read", total, elapsed,
+	       total / elapsed / (1 << 20), nr_rpcs - rpcs_before);
+}
+
+int main(int argc, char **argv)
+{
+	char *mntpt = "/mnt";
+	char path[256];
+	pthread_t srv;
+	int p[2];
+	char *buf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:s:d:n:w")) != -1) {
+		switch (opt) {
+		case 'b':
+			blksz = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			file_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			delay_usec = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_passes = atoi(optarg);
+			break;
+		case 'w':
+			do_write = TRUE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1)
+		usage(argv[0]);
+	if (optind == argc - 1)
+		mntpt = argv[optind];
+	if (!blksz || blksz > MAX_BLKSZ) {
+		fprintf(stderr, "blksz must be between 1 and %d\n", MAX_BLKSZ);
+		exit(-1);
+	}
+	buf = malloc(blksz);
+	if (!buf) {
+		perror("malloc");
+		exit(-1);
+	}
+	memset(buf, 0xab, blksz);
+	if (pipe(p)) {
+		perror("pipe");
+		exit(-1);
+	}
+	srv_fd = p[0];
+	/* The server needs to be running for the mount's version and attach. */
+	if (pthread_create(&srv, NULL, srv_loop, NULL)) {
+		perror("pthread_create");
+		exit(-1);
+	}
+	if (syscall(SYS_nmount, p[1], mntpt, strlen(mntpt), 0) < 0) {
+		perror("mount");
+		exit(-1);
+	}
+	snprintf(path, sizeof(path), "%s/data", mntpt);
+	for (int i = 0; i < nr_passes; i++)
+		run_pass(path, buf, i);
+	syscall(SYS_nunmount, NULL, 0, mntpt, strlen(mntpt));
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,141 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Sequential read throughput benchmark, for page cache readahead over #gtfs.
+ *
+ * Usage: seqread [-b BLKSZ] [-n PASSES] [-c MB] FILE
+ *
+ * Reads FILE from start to end in BLKSZ reads, PASSES times, and prints the
+ * throughput of each pass.  With -c, it first writes an MB megabyte file (and
+ * syncs it, which exercises writeback).
+ *
+ * The first pass only reads from the 9p server if FILE isn't already in the
+ * page cache.  For a cold read, mount the server (mount -C), create the file,
+ * then unmount, remount, and run without -c.  Later passes measure the page
+ * cache itself. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <parlib/parlib.h>
+
+#define MAX_BLKSZ		(16 * 1024 * 1024)
+
+static size_t blksz = 128 * 1024;
+static int nr_passes = 2;
+static size_t create_mb;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-b BLKSZ] [-n PASSES] [-c MB] FILE\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void create_file(const char *path, char *buf)
+{
+	size_t left = create_mb << 20;
+	ssize_t ret;
+	double start, elapsed;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror("open for create");
+		exit(-1);
+	}
+	for (size_t i = 0; i < blksz; i++)
+		buf[i] = i;
+	start = now_secs();
+	while (left) {
+		ret = write(fd, buf, MIN(left, blksz));
+		if (ret <= 0) {
+			perror("write");
+			exit(-1);
+		}
+		left -= ret;
+	}
+	if (fsync(fd)) {
+		perror("fsync");
+		exit(-1);
+	}
+	elapsed = now_secs() - start;
+	close(fd);
+	printf("create: %lu MB in %.3f sec, %.2f MB/s\n", create_mb, elapsed,
+	       create_mb / elapsed);
+}
+
+static void read_pass(const char *path, char *buf, int pass)
+{
+	size_t total = 0;
+	ssize_t ret;
+	double start, elapsed;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(-1);
+	}
+	start = now_secs();
+	while ((ret = read(fd, buf, blksz)) > 0)
+		total += ret;
+	elapsed = now_secs() - start;
+	if (ret < 0) {
+		perror("read");
+		exit(-1);
+	}
+	close(fd);
+	printf("pass %d: %lu bytes in %.3f sec, %.2f MB/s\n", pass, total, elapsed,
+	       total / elapsed / (1 << 20));
+}
+
+int main(int argc, char **argv)
+{
+	char *buf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:c:")) != -1) {
+		switch (opt) {
+		case 'b':
+			blksz = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_passes = atoi(optarg);
+			break;
+		case 'c':
+			create_mb = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (!blksz || blksz > MAX_BLKSZ) {
+		fprintf(stderr, "blksz must be between 1 and %d\n", MAX_BLKSZ);
+		exit(-1);
+	}
+	buf = malloc(blksz);
+	if (!buf) {
+		perror("malloc");
+		exit(-1);
+	}
+	if (create_mb)
+		create_file(argv[optind], buf);
+	for (int i = 0; i < nr_passes; i++)
+		read_pass(argv[optind], buf, i);
+	free(buf);
+	return 0;
+}
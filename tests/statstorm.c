@@ -0,0 +1,168 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * Stat storm benchmark, for the namec path cache.
+ *
+ * Usage: statstorm [-d DEPTH] [-f FILES] [-n LOOPS] [-u EVERY] DIR
+ *
+ * Builds a chain of DEPTH directories under DIR with FILES files in the deepest
+ * one, then stats every file LOOPS times, like a build system checking its
+ * dependencies, and prints the stats per second.  With -u, it also unlinks and
+ * recreates a file every EVERY stats, which invalidates the path cache entries
+ * that went through the deepest directory.
+ *
+ * DIR should be on a tree_file device, e.g. /tmp on #tmpfs.  The tree is
+ * removed on the way out. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <parlib/parlib.h>
+
+#define MAX_DEPTH		64
+#define MAX_PATH		4096
+
+static int depth = 8;
+static int nr_files = 64;
+static int nr_loops = 1000;
+static int unlink_every;
+
+static void usage(char *prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-d DEPTH] [-f FILES] [-n LOOPS] [-u EVERY] DIR\n",
+	        prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fills buf with DIR/d0/d1/.../d{lvl - 1} */
+static void dir_path(char *buf, const char *top, int lvl)
+{
+	int len = snprintf(buf, MAX_PATH, "%s", top);
+
+	for (int i = 0; i < lvl; i++)
+		len += snprintf(buf + len, MAX_PATH - len, "/d%d", i);
+}
+
+static void file_path(char *buf, const char *top, int i)
+{
+	int len;
+
+	dir_path(buf, top, depth);
+	len = strlen(buf);
+	snprintf(buf + len, MAX_PATH - len, "/f%d", i);
+}
+
+static void make_file(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if (fd < 0) {
+		perror(path);
+		exit(-1);
+	}
+	close(fd);
+}
+
+static void build_tree(const char *top)
+{
+	char path[MAX_PATH];
+
+	for (int i = 1; i <= depth; i++) {
+		dir_path(path, top, i);
+		if (mkdir(path, 0755) && errno != EEXIST) {
+			perror(path);
+			exit(-1);
+		}
+	}
+	for (int i = 0; i < nr_files; i++) {
+		file_path(path, top, i);
+		make_file(path);
+	}
+}
+
+static void remove_tree(const char *top)
+{
+	char path[MAX_PATH];
+
+	for (int i = 0; i < nr_files; i++) {
+		file_path(path, top, i);
+		unlink(path);
+	}
+	for (int i = depth; i > 0; i--) {
+		dir_path(path, top, i);
+		rmdir(path);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char path[MAX_PATH], churn[MAX_PATH];
+	struct stat st;
+	unsigned long nr_stats = 0;
+	double start, elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:f:n:u:")) != -1) {
+		switch (opt) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'f':
+			nr_files = atoi(optarg);
+			break;
+		case 'n':
+			nr_loops = atoi(optarg);
+			break;
+		case 'u':
+			unlink_every = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (depth < 1 || depth > MAX_DEPTH || nr_files < 1) {
+		fprintf(stderr, "depth must be 1 to %d, and need at least 1 file\n",
+		        MAX_DEPTH);
+		exit(-1);
+	}
+	build_tree(argv[optind]);
+	file_path(churn, argv[optind], nr_files);
+
+	start = now_secs();
+	for (int l = 0; l < nr_loops; l++) {
+		for (int i = 0; i < nr_files; i++) {
+			file_path(path, argv[optind], i);
+			if (stat(path, &st)) {
+				perror(path);
+				exit(-1);
+			}
+			nr_stats++;
+			if (unlink_every && !(nr_stats % unlink_every)) {
+				make_file(churn);
+				unlink(churn);
+			}
+		}
+	}
+	elapsed = now_secs() - start;
+	printf("%lu stats of depth %d in %.3f sec, %.0f stats/sec\n", nr_stats,
+	       depth + 1, elapsed, nr_stats / elapsed);
+
+	remove_tree(argv[optind]);
+	return 0;
+}
@@ -0,0 +1,199 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * UDP packets-per-second benchmark, for comparing per-datagram syscalls with
+ * batched recvmmsg/sendmmsg.
+ *
+ * Server: udp_pps -s [-b BATCH] [-p PORT] [-t SECS]
+ * Client: udp_pps -c HOST [-b BATCH] [-p PORT] [-t SECS] [-l LEN]
+ *
+ * A batch of 1 uses plain recvfrom/sendto.  Anything larger uses recvmmsg or
+ * sendmmsg with that many messages per call. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <parlib/parlib.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#define MAX_BATCH		1024
+#define MAX_PKT			2048
+
+static int batch = 32;
+static int port = 5000;
+static int duration = 10;
+static int pkt_len = 64;
+
+static struct mmsghdr msgs[MAX_BATCH];
+static struct iovec iovs[MAX_BATCH];
+static struct sockaddr_in addrs[MAX_BATCH];
+static char bufs[MAX_BATCH][MAX_PKT];
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s -s|-c HOST [-b BATCH] [-p PORT] [-t SECS] "
+	        "[-l LEN]\n", prog);
+	exit(-1);
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void setup_msgs(struct sockaddr_in *to, size_t len)
+{
+	for (int i = 0; i < batch; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = len;
+		memset(&msgs[i], 0, sizeof(struct mmsghdr));
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (to) {
+			msgs[i].msg_hdr.msg_name = to;
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		} else {
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+	}
+}
+
+/* Returns the number of packets moved in one call, -1 on error. */
+static int do_recv(int sock)
+{
+	socklen_t alen = sizeof(struct sockaddr_in);
+	int ret;
+
+	if (batch == 1) {
+		ret = recvfrom(sock, bufs[0], MAX_PKT, 0, (struct sockaddr*)&addrs[0],
+		               &alen);
+		return ret < 0 ? -1 : 1;
+	}
+	for (int i = 0; i < batch; i++)
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	return recvmmsg(sock, msgs, batch, 0, NULL);
+}
+
+static int do_send(int sock, struct sockaddr_in *to)
+{
+	int ret;
+
+	if (batch == 1) {
+		ret = sendto(sock, bufs[0], pkt_len, 0, (struct sockaddr*)to,
+		             sizeof(struct sockaddr_in));
+		return ret < 0 ? -1 : 1;
+	}
+	return sendmmsg(sock, msgs, batch, 0);
+}
+
+int main(int argc, char **argv)
+{
+	bool server = FALSE;
+	char *host = NULL;
+	struct hostent *he;
+	struct sockaddr_in sa = {0};
+	unsigned long nr_pkts = 0, nr_calls = 0;
+	double start, end, elapsed;
+	int sock, opt, ret;
+
+	while ((opt = getopt(argc, argv, "sc:b:p:t:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			server = TRUE;
+			break;
+		case 'c':
+			host = optarg;
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			pkt_len = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (server == !!host)
+		usage(argv[0]);
+	if (batch < 1 || batch > MAX_BATCH) {
+		fprintf(stderr, "batch must be between 1 and %d\n", MAX_BATCH);
+		exit(-1);
+	}
+	if (pkt_len < 1 || pkt_len > MAX_PKT) {
+		fprintf(stderr, "len must be between 1 and %d\n", MAX_PKT);
+		exit(-1);
+	}
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		exit(-1);
+	}
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (server) {
+		sa.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(sock, (struct sockaddr*)&sa, sizeof(sa))) {
+			perror("bind");
+			exit(-1);
+		}
+		setup_msgs(NULL, MAX_PKT);
+	} else {
+		he = gethostbyname(host);
+		if (!he) {
+			fprintf(stderr, "can't resolve %s\n", host);
+			exit(-1);
+		}
+		memcpy(&sa.sin_addr, he->h_addr, sizeof(struct in_addr));
+		setup_msgs(&sa, pkt_len);
+	}
+	printf("%s with batches of %d for %d sec\n", server ? "Receiving" :
+	       "Sending", batch, duration);
+	start = now_secs();
+	end = start + duration;
+	/* The server's clock starts at the first packet. */
+	if (server) {
+		ret = do_recv(sock);
+		if (ret < 0) {
+			perror("recv");
+			exit(-1);
+		}
+		start = now_secs();
+		end = start + duration;
+	}
+	while (now_secs() < end) {
+		ret = server ? do_recv(sock) : do_send(sock, &sa);
+		if (ret < 0) {
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			perror(server ? "recv" : "send");
+			break;
+		}
+		nr_pkts += ret;
+		nr_calls++;
+	}
+	elapsed = now_secs() - start;
+	printf("%lu pkts in %lu calls (%.1f per call), %.0f pps\n", nr_pkts,
+	       nr_calls, nr_calls ? (double)nr_pkts / nr_calls : 0,
+	       nr_pkts / elapsed);
+	return 0;
+}
@@ -202,6 +202,10 @@ Rock *_sock_newrock(int fd)
 	r->other = -1;
 	r->has_listen_fd = FALSE;
 	r->listen_fd = -1;
+	r->has_mdata_fd = FALSE;
+	r->mdata_fd = -1;
+	r->has_mdata_nb_fd = FALSE;
+	r->mdata_nb_fd = -1;
 	return r;
 }
 
@@ -218,6 +222,14 @@ void _sock_fd_closed(int fd)
 		/* This shouldn't matter - the rock is being closed anyways. */
 		r->has_listen_fd = FALSE;
 	}
+	if (r->has_mdata_fd) {
+		close(r->mdata_fd);
+		r->has_mdata_fd = FALSE;
+	}
+	if (r->has_mdata_nb_fd) {
+		close(r->mdata_nb_fd);
+		r->has_mdata_nb_fd = FALSE;
+	}
 }
 
 /* For a ctlfd and a few other settings, it opens and returns the corresponding
@@ -374,6 +386,48 @@ void _sock_mirror_fcntl(int sock_fd, int cmd, long arg)
 		syscall(SYS_fcntl, r->ctl_fd, cmd, arg);
 	if (r->has_listen_fd)
 		syscall(SYS_fcntl, r->listen_fd, cmd, arg);
+	if (r->has_mdata_fd)
+		syscall(SYS_fcntl, r->mdata_fd, cmd, arg);
+}
+
+/* Returns the FD for the conversation's "mdata" file, used for batched datagram
+ * I/O (recvmmsg/sendmmsg), opening it on first use.  It is closed along with
+ * the Rock.  Returns -1 on error.  Racy, like the listen FD.
+ *
+ * The normal mdata FD follows the socket's O_NONBLOCK.  With nonblock, you get
+ * a second FD that is always O_NONBLOCK, for MSG_DONTWAIT.  fcntl doesn't touch
+ * that one, and we don't toggle the shared FD, which would race with other
+ * threads. */
+int _sock_get_mdata_fd(Rock *r, int sock_fd, bool nonblock)
+{
+	char mdata_file[Ctlsize];
+	int ret, open_flags;
+
+	if (!nonblock && r->has_mdata_fd)
+		return r->mdata_fd;
+	if (nonblock && r->has_mdata_nb_fd)
+		return r->mdata_nb_fd;
+	_sock_get_conv_filename(r, "mdata", mdata_file);
+	open_flags = O_RDWR;
+	open_flags |= (r->sopts & SOCK_CLOEXEC ? O_CLOEXEC : 0);
+	if (nonblock) {
+		open_flags |= O_NONBLOCK;
+	} else {
+		/* Pick up O_NONBLOCK from the data FD, which might have been set
+		 * with fcntl before we existed. */
+		open_flags |= (syscall(SYS_fcntl, sock_fd, F_GETFL, 0) & O_NONBLOCK);
+	}
+	ret = open(mdata_file, open_flags);
+	if (ret < 0)
+		return -1;
+	if (nonblock) {
+		r->mdata_nb_fd = ret;
+		r->has_mdata_nb_fd = TRUE;
+	} else {
+		r->mdata_fd = ret;
+		r->has_mdata_fd = TRUE;
+	}
+	return ret;
 }
 
 /* Given an FD, opens the FD with the name 'sibling' in the same directory.
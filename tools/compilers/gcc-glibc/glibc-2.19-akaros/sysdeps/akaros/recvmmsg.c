@@ -0,0 +1,171 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * recvmmsg(), on top of the conv's mdata file.
+ *
+ * For UDP, one read of mdata returns a batch of datagrams, each with its Plan 9
+ * UDP headers, so we get up to vlen packets for one syscall.  Other sockets,
+ * and flags other than MSG_DONTWAIT and MSG_WAITFORONE (e.g. MSG_PEEK), just
+ * loop on recvmsg. */
+
+/* Flags the UDP batch path handles */
+#define RECVMMSG_UDP_FLAGS (MSG_DONTWAIT | MSG_WAITFORONE)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/plan9_helpers.h>
+
+static uint32_t get_le32(uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t iov_len(const struct iovec *iov, size_t iovcnt)
+{
+	size_t ret = 0;
+
+	for (size_t i = 0; i < iovcnt; i++)
+		ret += iov[i].iov_len;
+	return ret;
+}
+
+/* Copies len bytes from buf into the msg's iov, returning the amount copied. */
+static size_t copy_to_iov(struct msghdr *msg, uint8_t *buf, size_t len)
+{
+	size_t amt, sofar = 0;
+
+	for (size_t i = 0; i < msg->msg_iovlen && sofar < len; i++) {
+		amt = MIN(msg->msg_iov[i].iov_len, len - sofar);
+		memcpy(msg->msg_iov[i].iov_base, buf + sofar, amt);
+		sofar += amt;
+	}
+	return sofar;
+}
+
+/* Fills in one mmsghdr from a datagram (Plan 9 headers and payload). */
+static void fill_mmsghdr(struct mmsghdr *mmsg, uint8_t *dgram, size_t len)
+{
+	struct msghdr *msg = &mmsg->msg_hdr;
+	struct sockaddr_in *remote = msg->msg_name;
+	size_t payload = len - P9_UDP_HDR_SZ;
+
+	if (remote && msg->msg_namelen >= sizeof(struct sockaddr_in)) {
+		remote->sin_family = AF_INET;
+		remote->sin_addr.s_addr = plan9addr_to_naddr(dgram);
+		/* raddr, laddr, ifcaddr, then rport, in network order */
+		remote->sin_port = *(uint16_t*)(dgram + 16 * 3);
+		msg->msg_namelen = sizeof(struct sockaddr_in);
+	}
+	mmsg->msg_len = copy_to_iov(msg, dgram + P9_UDP_HDR_SZ, payload);
+	msg->msg_controllen = 0;
+	msg->msg_flags = mmsg->msg_len < payload ? MSG_TRUNC : 0;
+}
+
+/* Reads one batch of up to vlen datagrams from mfd.  Returns the number read,
+ * or -1 with errno set. */
+static int __recvmmsg_udp_batch(int mfd, struct mmsghdr *vmessages,
+                                unsigned int vlen)
+{
+	int nr_msgs = 0;
+	size_t buf_sz = 0;
+	ssize_t ret;
+	uint8_t *buf, *p, *ep;
+	uint32_t len;
+
+	for (unsigned int i = 0; i < vlen; i++)
+		buf_sz += P9_MDATA_HDR_SZ + P9_UDP_HDR_SZ +
+		          iov_len(vmessages[i].msg_hdr.msg_iov,
+		                  vmessages[i].msg_hdr.msg_iovlen);
+	buf = malloc(buf_sz);
+	if (!buf)
+		return -1;
+	/* The offset is the max number of datagrams we want. */
+	ret = pread(mfd, buf, buf_sz, vlen);
+	if (ret < 0) {
+		free(buf);
+		return -1;
+	}
+	p = buf;
+	ep = buf + ret;
+	while ((ep - p >= P9_MDATA_HDR_SZ) && (nr_msgs < vlen)) {
+		len = get_le32(p);
+		p += P9_MDATA_HDR_SZ;
+		if ((len > ep - p) || (len < P9_UDP_HDR_SZ))
+			break;
+		fill_mmsghdr(&vmessages[nr_msgs++], p, len);
+		p += len;
+	}
+	free(buf);
+	return nr_msgs;
+}
+
+/* Like Linux, without MSG_WAITFORONE or MSG_DONTWAIT we block until we have all
+ * vlen datagrams.  MSG_DONTWAIT reads from the nonblocking mdata FD. */
+static int __recvmmsg_udp(Rock *r, int fd, struct mmsghdr *vmessages,
+                          unsigned int vlen, int flags)
+{
+	int mfd, ret, nr_msgs = 0;
+
+	mfd = _sock_get_mdata_fd(r, fd, flags & MSG_DONTWAIT);
+	if (mfd < 0)
+		return -1;
+	do {
+		ret = __recvmmsg_udp_batch(mfd, vmessages + nr_msgs, vlen - nr_msgs);
+		if (ret < 0)
+			return nr_msgs ? nr_msgs : -1;
+		nr_msgs += ret;
+	} while (nr_msgs < vlen && ret &&
+	         !(flags & (MSG_WAITFORONE | MSG_DONTWAIT)));
+	return nr_msgs;
+}
+
+/* Generic version: loops on recvmsg.  Like Linux, MSG_WAITFORONE makes
+ * everything after the first message nonblocking. */
+static int __recvmmsg_loop(int fd, struct mmsghdr *vmessages,
+                           unsigned int vlen, int flags)
+{
+	ssize_t ret;
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+		ret = recvmsg(fd, &vmessages[i].msg_hdr, flags);
+		if (ret < 0)
+			break;
+		vmessages[i].msg_len = ret;
+		if (flags & MSG_WAITFORONE)
+			flags |= MSG_DONTWAIT;
+	}
+	if (!i)
+		return -1;
+	return i;
+}
+
+/* Receive up to VLEN messages as described by VMESSAGES from socket FD.
+ * Returns the number of messages received or -1 for errors.
+ *
+ * The timeout is ignored. */
+int __recvmmsg(int fd, struct mmsghdr *vmessages, unsigned int vlen, int flags,
+               const struct timespec *tmo)
+{
+	Rock *r;
+
+	if (flags & MSG_OOB) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (!vlen)
+		return 0;
+	r = udp_sock_get_rock(fd);
+	if (r && !(flags & ~RECVMMSG_UDP_FLAGS))
+		return __recvmmsg_udp(r, fd, vmessages, vlen, flags);
+	return __recvmmsg_loop(fd, vmessages, vlen, flags);
+}
+weak_alias(__recvmmsg, recvmmsg)
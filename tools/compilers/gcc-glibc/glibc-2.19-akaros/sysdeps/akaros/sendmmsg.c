@@ -0,0 +1,127 @@
+/* Copyright (c) 2026 Google Inc
+ * See LICENSE for details.
+ *
+ * sendmmsg(), on top of the conv's mdata file.
+ *
+ * For UDP, we build a batch of datagrams, each with its Plan 9 UDP headers, and
+ * send them all with one write to mdata.  Other sockets, and flags other than
+ * MSG_DONTWAIT and MSG_NOSIGNAL, just loop on sendmsg. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/plan9_helpers.h>
+
+/* Flags the UDP batch path handles.  UDP never raises SIGPIPE. */
+#define SENDMMSG_UDP_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+
+static void put_le32(uint8_t *p, uint32_t x)
+{
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+/* Writes the Plan 9 UDP headers for msg into p.  See sendto.c. */
+static void build_udp_hdrs(Rock *r, struct msghdr *msg, uint8_t *p)
+{
+	struct sockaddr_in *to = msg->msg_name;
+
+	/* Might not have a 'to', if they connected */
+	if (!to)
+		to = (struct sockaddr_in*)&r->raddr;
+	memset(p, 0, P9_UDP_HDR_SZ);
+	naddr_to_plan9addr(to->sin_addr.s_addr, p);
+	/* skip laddr and ifc; the kernel picks them.  rport is in network order */
+	*(uint16_t*)(p + 16 * 3) = to->sin_port;
+}
+
+static int __sendmmsg_udp(Rock *r, int fd, struct mmsghdr *vmessages,
+                          unsigned int vlen, int flags)
+{
+	struct msghdr *msg;
+	int mfd, nr_msgs = 0;
+	size_t buf_sz = 0, dgram_sz;
+	ssize_t ret;
+	uint8_t *buf, *p;
+
+	mfd = _sock_get_mdata_fd(r, fd, flags & MSG_DONTWAIT);
+	if (mfd < 0)
+		return -1;
+	for (unsigned int i = 0; i < vlen; i++) {
+		msg = &vmessages[i].msg_hdr;
+		for (size_t j = 0; j < msg->msg_iovlen; j++)
+			buf_sz += msg->msg_iov[j].iov_len;
+		buf_sz += P9_MDATA_HDR_SZ + P9_UDP_HDR_SZ;
+	}
+	buf = malloc(buf_sz);
+	if (!buf)
+		return -1;
+	p = buf;
+	for (unsigned int i = 0; i < vlen; i++) {
+		msg = &vmessages[i].msg_hdr;
+		build_udp_hdrs(r, msg, p + P9_MDATA_HDR_SZ);
+		dgram_sz = P9_UDP_HDR_SZ;
+		for (size_t j = 0; j < msg->msg_iovlen; j++) {
+			memcpy(p + P9_MDATA_HDR_SZ + dgram_sz, msg->msg_iov[j].iov_base,
+			       msg->msg_iov[j].iov_len);
+			dgram_sz += msg->msg_iov[j].iov_len;
+		}
+		put_le32(p, dgram_sz);
+		vmessages[i].msg_len = dgram_sz - P9_UDP_HDR_SZ;
+		p += P9_MDATA_HDR_SZ + dgram_sz;
+	}
+	ret = write(mfd, buf, p - buf);
+	if (ret < 0) {
+		free(buf);
+		return -1;
+	}
+	/* Partial writes always end on a datagram boundary; count the ones that
+	 * made it. */
+	for (p = buf; (p - buf < ret) && (nr_msgs < vlen); nr_msgs++)
+		p += P9_MDATA_HDR_SZ + vmessages[nr_msgs].msg_len + P9_UDP_HDR_SZ;
+	free(buf);
+	return nr_msgs;
+}
+
+static int __sendmmsg_loop(int fd, struct mmsghdr *vmessages,
+                           unsigned int vlen, int flags)
+{
+	ssize_t ret;
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+		ret = sendmsg(fd, &vmessages[i].msg_hdr, flags);
+		if (ret < 0)
+			break;
+		vmessages[i].msg_len = ret;
+	}
+	if (!i)
+		return -1;
+	return i;
+}
+
+/* Send up to VLEN messages described by VMESSAGES on socket FD.  Returns the
+ * number of messages sent or -1 for errors. */
+int __sendmmsg(int fd, struct mmsghdr *vmessages, unsigned int vlen, int flags)
+{
+	Rock *r;
+
+	if (flags & MSG_OOB) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (!vlen)
+		return 0;
+	r = udp_sock_get_rock(fd);
+	if (r && !(flags & ~SENDMMSG_UDP_FLAGS))
+		return __sendmmsg_udp(r, fd, vmessages, vlen, flags);
+	return __sendmmsg_loop(fd, vmessages, vlen, flags);
+}
+weak_alias(__sendmmsg, sendmmsg)
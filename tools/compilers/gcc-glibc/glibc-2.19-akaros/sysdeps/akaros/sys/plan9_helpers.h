@@ -62,6 +62,10 @@ struct Rock {
 	int other;					/* fd of the remote end for Unix domain */
 	bool has_listen_fd;			/* has set up a listen file, O_PATH */
 	int listen_fd;				/* fd of the listen file, if any */
+	bool has_mdata_fd;			/* has opened the batched data file */
+	int mdata_fd;				/* fd of the mdata file, if any */
+	bool has_mdata_nb_fd;		/* has opened mdata for MSG_DONTWAIT */
+	int mdata_nb_fd;			/* fd of mdata, always O_NONBLOCK */
 };
 
 extern Rock *_sock_findrock(int, struct stat *);
@@ -79,6 +83,7 @@ extern int _sock_get_opts(int type);
 extern void _sock_lookup_rock_fds(int sock_fd, bool can_open_listen_fd,
                                   int *listen_fd_r, int *ctl_fd_r);
 extern void _sock_mirror_fcntl(int sock_fd, int cmd, long arg);
+extern int _sock_get_mdata_fd(Rock *r, int sock_fd, bool nonblock);
 
 int get_sibling_fd(int fd, const char *sibling);
 int write_hex_to_fd(int fd, uint64_t num);
@@ -101,6 +106,11 @@ extern void _syserrno(void);
 
 #define P9_UDP_HDR_SZ 52
 
+/* The conv's mdata file moves batches of datagrams.  Each one is preceded by
+ * count[4] (little endian), and is in the same format as the data file.  Reads
+ * at offset N return at most N datagrams. */
+#define P9_MDATA_HDR_SZ 4
+
 /* Takes network-byte ordered IPv4 addr and writes it into buf, in the plan 9 IP
  * addr format */
 void naddr_to_plan9addr(uint32_t sin_addr, uint8_t * buf);
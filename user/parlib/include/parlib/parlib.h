@@ -51,6 +51,7 @@ int         sys_send_event(struct event_queue *ev_q, struct event_msg *ev_msg,
                            uint32_t vcoreid);
 int         sys_halt_core(unsigned long usec);
 void*		sys_init_arsc();
+int         sys_arsc_kick(void);
 int         sys_block(unsigned long usec);
 int         sys_change_vcore(uint32_t vcoreid, bool enable_my_notif);
 int         sys_change_to_m(void);
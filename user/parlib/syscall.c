@@ -101,6 +101,11 @@ void* sys_init_arsc()
 	return (void*)ros_syscall(SYS_init_arsc, 0, 0, 0, 0, 0, 0);
 }
 
+int sys_arsc_kick(void)
+{
+	return ros_syscall(SYS_arsc_kick, 0, 0, 0, 0, 0, 0);
+}
+
 int sys_block(unsigned long usec)
 {
 	return ros_syscall(SYS_block, usec, 0, 0, 0, 0, 0);